@@ -1,53 +1,52 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
 
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+
 using namespace std;
 using namespace cv;
 
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
 uchar quantize(uchar value, unsigned binCount){
 	return (unsigned)((double)value / 256. * binCount);
 }
 
-vector<int> calcHistogram(Mat img, unsigned binCount){
+// fills histogramValues, its memory is reused
+void calcHistogram(Mat img, unsigned binCount, vector<int> &histogramValues){
+	PROFILE_SCOPE_PIXELS("calcHistogram", img.total());
 	assert(img.channels() == 1);
 	//assert(binCount <= (1<<img.depth()));
 
-	vector<int> histogramValues(binCount, 0);
+	histogramValues.assign(binCount, 0);
 
 	for (int y = 0; y < img.rows; y++){
 		uchar* row = img.ptr<uchar>(y);
@@ -57,26 +56,37 @@ vector<int> calcHistogram(Mat img, unsigned binCount){
 			histogramValues[bin]++;
 		}
 	}
+}
+
+vector<int> calcHistogram(Mat img, unsigned binCount){
+	vector<int> histogramValues;
+	calcHistogram(img, binCount, histogramValues);
 	return histogramValues;
 }
 
-// normalizes using a fixed value
-Mat createHistogramImage(vector<int> histogramValues, int normalizeValue) {
+// normalizes using a fixed value, dst is only reallocated if its size does not fit
+void createHistogramImage(const vector<int> &histogramValues, int normalizeValue, Mat &dst) {
 	int binCount = (int)histogramValues.size();
 	int width = 256*3 / binCount*binCount;
 	int height = 500;
 	int binWidth = width / binCount;
 
-	Mat histogram(height, width, CV_8UC1, Scalar(255));
+	dst.create(height, width, CV_8UC1);
+	dst.setTo(Scalar(255));
 
 	double magnitude;
 	for (int b = 0; b < binCount; b++) {
 		magnitude = min(1., (double)histogramValues[b] / (double)normalizeValue);
 		// draws #bin_width lines next to each over
 		for (int j = 0; j < binWidth; j++) {
-			line(histogram, Point((b*binWidth) + j, height - 1), Point((b*binWidth) + j, height - (int)(magnitude*height)), Scalar(0));
+			line(dst, Point((b*binWidth) + j, height - 1), Point((b*binWidth) + j, height - (int)(magnitude*height)), Scalar(0));
 		}
 	}
+}
+
+Mat createHistogramImage(vector<int> histogramValues, int normalizeValue) {
+	Mat histogram;
+	createHistogramImage(histogramValues, normalizeValue, histogram);
 	return histogram;
 }
 
@@ -97,10 +107,19 @@ Mat createHistogramImage(vector<int> histogramValues) {
 	return createHistogramImage(histogramValues, max);
 }
 
-Mat enhanceContrast(Mat img, double cutOff){
+// dst is only reallocated if its size does not fit, it may be img
+void enhanceContrast(Mat img, Mat &dst, double cutOff){
+	PROFILE_SCOPE_PIXELS("enhanceContrast", img.total());
 	assert(img.channels() == 1);
 
-	vector<int> histogramValues = calcHistogram(img, 256);
+	// 256 bins on the stack instead of a new vector per image
+	int histogramValues[256] = {};
+	for (int y = 0; y < img.rows; y++){
+		uchar* row = img.ptr<uchar>(y);
+		for (int x = 0; x < img.cols; x++){
+			histogramValues[row[x]]++;
+		}
+	}
 
 	int totalCount = 0;
 	for (int value : histogramValues){
@@ -120,16 +139,20 @@ Mat enhanceContrast(Mat img, double cutOff){
 		}
 	}
 
-	Mat enhancedImg(img.rows, img.cols, CV_8UC1, Scalar(0));
+	dst.create(img.rows, img.cols, CV_8UC1);
 
 	for (int y = 0; y < img.rows; y++){
 		for (int x = 0; x < img.cols; x++){
 			uchar value = img.at<uchar>(y, x);
 			uchar newValue = min(255, max(0, (int)((double)(value - lowBound) / (double)(highBound - lowBound) * 255)));
-			enhancedImg.at<uchar>(y, x) = newValue;
+			dst.at<uchar>(y, x) = newValue;
 		}
 	}
+}
 
+Mat enhanceContrast(Mat img, double cutOff){
+	Mat enhancedImg;
+	enhanceContrast(img, enhancedImg, cutOff);
 	return enhancedImg;
 }
 
@@ -183,5 +206,8 @@ int main(){
 	saveImg("results", "enhancedUnderflow.jpg", enhancedUnderflow);
 	saveImg("results", "enhancedUnderflowHistogram.jpg", enhancedUnderflowHistogramImage);
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
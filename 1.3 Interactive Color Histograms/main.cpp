@@ -1,65 +1,67 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
 
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+
 using namespace std;
 using namespace cv;
 
 
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
-vector<Mat> splitChannels(Mat img) {
+// channels is resized to 3, channels that already fit are reused
+void splitChannels(Mat img, vector<Mat> &channels) {
 	assert(img.channels() == 3);
 
-	vector<Mat> channels;
-
 	//split(img, channels);
 
+	channels.resize(3);
 	for (int i = 0; i < 3; i++) {
-		channels.push_back(Mat(img.rows, img.cols, CV_8UC1));
+		channels[i].create(img.rows, img.cols, CV_8UC1);
 	}
 
 	for (int y = 0; y < img.rows; y++) {
 		Vec3b* row = img.ptr<Vec3b>(y);
+		uchar* channelRows[3] = { channels[0].ptr<uchar>(y), channels[1].ptr<uchar>(y), channels[2].ptr<uchar>(y) };
 		for (int x = 0; x < img.cols; x++) {
 			for (int c = 0; c < 3; c++) {
-				channels[c].at<uchar>(Point(x, y)) = row[x][c];
+				channelRows[c][x] = row[x][c];
 			}
 		}
 	}
+}
 
+vector<Mat> splitChannels(Mat img) {
+	vector<Mat> channels;
+	splitChannels(img, channels);
 	return channels;
 }
 
@@ -68,6 +70,7 @@ uchar quantize(uchar value, unsigned binCount){
 }
 
 vector<int> calcHistogram(Mat img, unsigned binCount){
+	PROFILE_SCOPE_PIXELS("calcHistogram", img.total());
 	assert(img.channels() == 1);
 	//assert(binCount < (1 << img.depth()));
 
@@ -198,5 +201,8 @@ int main(){
 	// Aufgabe a) + b)
 	waitForMouseDrag(img);
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
@@ -1,65 +1,75 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
 
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+
 using namespace std;
 using namespace cv;
 
 
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
-Mat simulateLowRes(Mat img, int n){
+// dst is (rows - rows%n) x (cols - cols%n) and only reallocated if its size does not fit
+void simulateLowRes(Mat img, Mat &dst, int n){
 	assert(n > 0);
 	assert(img.channels() == 1);
-
-	//use float Mat to save values properly
-	Mat lowResImg(img.rows - (img.rows%n), img.cols - (img.cols%n), CV_32FC1, Scalar(0.));
-
-	for (int y = 0; y < lowResImg.rows; y++){
-		uchar* row = img.ptr<uchar>(y);
-		for (int x = 0; x < lowResImg.cols; x++){
-			uchar value = row[x];
-			for (int yOff = 0; yOff < n; yOff++){
-				for (int xOff = 0; xOff < n; xOff++){
-					lowResImg.at<float>((y / n)*n + yOff, (x / n)*n + xOff) += ((float)value) / (n*n);
+	assert(dst.data != img.data);
+
+	dst.create(img.rows - (img.rows%n), img.cols - (img.cols%n), CV_8UC1);
+
+	//mean of every n x n block, accumulated per block instead of in a float Mat
+	//(same float sums in the same order and the same rounding as before, so the results are unchanged)
+	for (int yBlock = 0; yBlock < dst.rows; yBlock += n){
+		for (int xBlock = 0; xBlock < dst.cols; xBlock += n){
+			float sum = 0.f;
+			for (int y = yBlock; y < yBlock + n; y++){
+				uchar* row = img.ptr<uchar>(y);
+				for (int x = xBlock; x < xBlock + n; x++){
+					sum += ((float)row[x]) / (n*n);
+				}
+			}
+			uchar mean = saturate_cast<uchar>(sum);
+			for (int y = yBlock; y < yBlock + n; y++){
+				uchar* row = dst.ptr<uchar>(y);
+				for (int x = xBlock; x < xBlock + n; x++){
+					row[x] = mean;
 				}
 			}
 		}
 	}
-	//Convert back to unsigned char Mat
-	lowResImg.convertTo(lowResImg, CV_8UC1);
+}
+
+Mat simulateLowRes(Mat img, int n){
+	Mat lowResImg;
+	simulateLowRes(img, lowResImg, n);
 
 	saveImg("results", "lowResImg_" + to_string(n) + ".jpg", lowResImg);
 
@@ -70,18 +80,24 @@ Mat simulateLowRes(Mat img, int n){
 	return lowResImg;
 }
 
-Mat quantizeImg(Mat img, int q){
+// dst is only reallocated if its size does not fit, it may be img
+void quantizeImg(Mat img, Mat &dst, int q){
 	assert(img.channels() == 1);
 
-	Mat quantizedImg(img.rows, img.cols, CV_8UC1);
+	dst.create(img.rows, img.cols, CV_8UC1);
 
 	for (int y = 0; y < img.rows; y++){
 		for (int x = 0; x < img.cols; x++){
 			uchar value = img.at<uchar>(y, x);
 			uchar newValue = ((value >> (8 - q)) << (8 - q)) + 256 / (1 << q + 1);
-			quantizedImg.at<uchar>(y, x) = newValue;
+			dst.at<uchar>(y, x) = newValue;
 		}
 	}
+}
+
+Mat quantizeImg(Mat img, int q){
+	Mat quantizedImg;
+	quantizeImg(img, quantizedImg, q);
 
 	saveImg("results", "quantizedImg_" + to_string(q) + ".jpg", quantizedImg);
 
@@ -114,6 +130,7 @@ int main(int argc, char* argv[]) {
 
 	if (n > min(img.rows, img.cols)){
 		cout << "n exceeds the width or height of the image!" << endl;
+		resultWriter().close();
 		return -2;
 	}
 
@@ -121,6 +138,7 @@ int main(int argc, char* argv[]) {
 
 	if (q < 1 || q > 8){
 		cout << "q needs to be in range [1, 8]!" << endl;
+		resultWriter().close();
 		return -3;
 	}
 
@@ -131,5 +149,8 @@ int main(int argc, char* argv[]) {
 	//	quantizeImg(img, i);
 	//}
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
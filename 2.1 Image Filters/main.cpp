@@ -1,46 +1,47 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
 
+#include "..\Common\threadPool.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+
 #define PI	3.14159265
 #define E	2.71828182
 #include <math.h>
 
+// pixels per task of the loops that split an image into bands of rows on the shared pool
+#define BAND_PIXELS		(1 << 16)
+
 using namespace std;
 using namespace cv;
 
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -63,11 +64,13 @@ void _filter(uchar* pixel, const Mat &values, const Mat &kernel, double normValu
 	*pixel = (uchar) max(0., value / normValue);
 }
 
-Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+// dst is only reallocated if its size or type does not fit, it must not share data with img
+void filter(const Mat &img, Mat &dst, const Mat &kernel, bool normalize){
+	PROFILE_SCOPE_PIXELS("filter", img.total());
 	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
 	assert(kernel.type() == CV_64FC1);
 
-	Mat filteredImg(img.rows, img.cols, CV_8UC1, Scalar(0));
+	dst.create(img.rows, img.cols, CV_8UC1);
 
 	double normValue = 0.;
 	for (int y = 0; y < kernel.rows; y++){
@@ -80,34 +83,48 @@ Mat filter(const Mat &img, const Mat &kernel, bool normalize){
 	int yOffset = (kernel.rows - 1) / 2;
 	int xOffset = (kernel.cols - 1) / 2;
 
-	for (int y = 0; y < img.rows; y++){
-		//copy border from original Image
-		if (y < yOffset || y >= img.rows - yOffset){
-			img.row(y).copyTo(filteredImg.row(y));
-			continue;
-		}
-
-		uchar *row = filteredImg.ptr<uchar>(y);
-		for (int x = 0; x < img.cols; x++){
+	//bands of rows on the shared pool, every row is written by one task only
+	parallelFor(sharedThreadPool(), 0, img.rows, max(1, BAND_PIXELS / max(1, img.cols)), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
 			//copy border from original Image
-			if (x < xOffset || x >= img.cols - xOffset){
-				row[x] = img.at<uchar>(y, x);
+			if (y < yOffset || y >= img.rows - yOffset){
+				img.row(y).copyTo(dst.row(y));
 				continue;
 			}
 
-			const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
-			if (normalize)
-				_filter(&row[x], tmp, kernel, normValue);
-			else
-				_filter(&row[x], tmp, kernel, 1.);
+			uchar *row = dst.ptr<uchar>(y);
+			for (int x = 0; x < img.cols; x++){
+				//copy border from original Image
+				if (x < xOffset || x >= img.cols - xOffset){
+					row[x] = img.at<uchar>(y, x);
+					continue;
+				}
+
+				const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
+				if (normalize)
+					_filter(&row[x], tmp, kernel, normValue);
+				else
+					_filter(&row[x], tmp, kernel, 1.);
+			}
 		}
-	}
+	});
+}
+
+Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+	Mat filteredImg;
+	filter(img, filteredImg, kernel, normalize);
 	return filteredImg;
 }
 
-Mat box(const Mat &img, int kernelHeight, int kernelWidth){
+void box(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth){
 	Mat kernel(kernelHeight, kernelWidth, CV_64FC1, Scalar(1.));
-	return filter(img, kernel, true);
+	filter(img, dst, kernel, true);
+}
+
+Mat box(const Mat &img, int kernelHeight, int kernelWidth){
+	Mat filteredImg;
+	box(img, filteredImg, kernelHeight, kernelWidth);
+	return filteredImg;
 }
 
 Mat createGaussianKernel(int kernelHeight, int kernelWidth, double sigma){
@@ -127,9 +144,15 @@ Mat createGaussianKernel(int kernelHeight, int kernelWidth, double sigma){
 	return kernel;
 }
 
-Mat gaussian(const Mat &img, int kernelHeight, int kernelWidth, double sigma){
+void gaussian(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth, double sigma){
 	Mat kernel = createGaussianKernel(kernelHeight, kernelWidth, sigma);
-	return filter(img, kernel, true);
+	filter(img, dst, kernel, true);
+}
+
+Mat gaussian(const Mat &img, int kernelHeight, int kernelWidth, double sigma){
+	Mat filteredImg;
+	gaussian(img, filteredImg, kernelHeight, kernelWidth, sigma);
+	return filteredImg;
 }
 
 // median value of the neighbourhood of a single pixel
@@ -151,33 +174,43 @@ void _median(uchar* pixel, const Mat &values, int kernelHeight, int kernelWidth)
 	*pixel = median;
 }
 
-Mat median(const Mat &img, int kernelHeight, int kernelWidth){
+// dst is only reallocated if its size or type does not fit, it must not share data with img
+void median(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth){
+	PROFILE_SCOPE_PIXELS("median", img.total());
 	assert(kernelHeight % 2 == 1 && kernelWidth % 2 == 1);
-	Mat medianImg(img.rows, img.cols, CV_8UC1, Scalar(0));
+	dst.create(img.rows, img.cols, CV_8UC1);
 
 	int yOffset = (kernelHeight - 1) / 2;
 	int xOffset = (kernelWidth - 1) / 2;
 
-	for (int y = 0; y < img.rows; y++){
-		//copy border from original Image
-		if (y < yOffset || y >= img.rows - yOffset){
-			img.row(y).copyTo(medianImg.row(y));
-			continue;
-		}
-
-		uchar *row = medianImg.ptr<uchar>(y);
-		for (int x = 0; x < img.cols; x++){
+	//bands of rows on the shared pool, smaller ones for bigger windows
+	const int grain = max(1, BAND_PIXELS / max(1, img.cols) / (kernelHeight*kernelWidth));
+	parallelFor(sharedThreadPool(), 0, img.rows, grain, [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
 			//copy border from original Image
-			if (x < xOffset || x >= img.cols - xOffset){
-				row[x] = img.at<uchar>(y, x);
+			if (y < yOffset || y >= img.rows - yOffset){
+				img.row(y).copyTo(dst.row(y));
 				continue;
 			}
 
-			Mat tmp = img(Rect(x - xOffset, y - yOffset, kernelWidth, kernelHeight));
-			_median(&row[x], tmp, kernelHeight, kernelWidth);
+			uchar *row = dst.ptr<uchar>(y);
+			for (int x = 0; x < img.cols; x++){
+				//copy border from original Image
+				if (x < xOffset || x >= img.cols - xOffset){
+					row[x] = img.at<uchar>(y, x);
+					continue;
+				}
+
+				Mat tmp = img(Rect(x - xOffset, y - yOffset, kernelWidth, kernelHeight));
+				_median(&row[x], tmp, kernelHeight, kernelWidth);
+			}
 		}
-	}
+	});
+}
 
+Mat median(const Mat &img, int kernelHeight, int kernelWidth){
+	Mat medianImg;
+	median(img, medianImg, kernelHeight, kernelWidth);
 	return medianImg;
 }
 
@@ -242,5 +275,8 @@ int main(){
 		destroyAllWindows();
 	}
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
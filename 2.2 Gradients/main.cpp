@@ -1,42 +1,43 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
 
+#include "..\Common\threadPool.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+
+// pixels per task of the loops that split an image into bands of rows on the shared pool
+#define BAND_PIXELS		(1 << 16)
+
 using namespace std;
 using namespace cv;
 
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
 
@@ -60,11 +61,15 @@ void _filter(short* pixel, const Mat &values, const Mat &kernel, double normValu
 	//cout << normValue << endl;
 }
 
-Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+// dst is only reallocated if its size or type does not fit, it must not share data with img
+void filter(const Mat &img, Mat &dst, const Mat &kernel, bool normalize){
+	PROFILE_SCOPE_PIXELS("filter", img.total());
 	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
 	assert(kernel.type() == CV_64FC1);
 
-	Mat filteredImg(img.rows, img.cols, CV_16SC1, Scalar(0));
+	dst.create(img.rows, img.cols, CV_16SC1);
+	// the border stays 0
+	dst.setTo(Scalar(0));
 
 	double normValue = 0.;
 	for (int y = 0; y < kernel.rows; y++){
@@ -77,41 +82,64 @@ Mat filter(const Mat &img, const Mat &kernel, bool normalize){
 	int yOffset = (kernel.rows - 1) / 2;
 	int xOffset = (kernel.cols - 1) / 2;
 
-	for (int y = yOffset; y < img.rows-yOffset; y++){
-		short *row = filteredImg.ptr<short>(y);
-		for (int x = xOffset; x < img.cols-xOffset; x++){
-			const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
-			if (normalize)
-				_filter(&row[x], tmp, kernel, normValue);
-			else
-				_filter(&row[x], tmp, kernel, 1.);
+	//bands of rows on the shared pool, every row is written by one task only
+	parallelFor(sharedThreadPool(), yOffset, img.rows-yOffset, max(1, BAND_PIXELS / max(1, img.cols)), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
+			short *row = dst.ptr<short>(y);
+			for (int x = xOffset; x < img.cols-xOffset; x++){
+				const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
+				if (normalize)
+					_filter(&row[x], tmp, kernel, normValue);
+				else
+					_filter(&row[x], tmp, kernel, 1.);
+			}
 		}
-	}
+	});
+}
+
+Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+	Mat filteredImg;
+	filter(img, filteredImg, kernel, normalize);
 	return filteredImg;
 }
 /////////////////////////////////////////////////////////////////////////////
 
-Mat sobelX(const Mat &img){
+void sobelX(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
 	Mat kernel((Mat_<double>(3, 3) << -1, 0, 1, -2, 0, 2, -1, 0, 1));
-	return filter(img, kernel, false);
+	filter(img, dst, kernel, false);
 }
 
-Mat sobelY(const Mat &img){
+Mat sobelX(const Mat &img){
+	Mat derivative;
+	sobelX(img, derivative);
+	return derivative;
+}
+
+void sobelY(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
 	Mat kernel((Mat_<double>(3, 3) << -1, -2, -1, 0, 0, 0, 1, 2, 1));
-	return filter(img, kernel, false);
+	filter(img, dst, kernel, false);
 }
 
-Mat calcMagnitude(const Mat &X, const Mat &Y){
+Mat sobelY(const Mat &img){
+	Mat derivative;
+	sobelY(img, derivative);
+	return derivative;
+}
+
+// dst is only reallocated if its size or type does not fit, it may be X or Y
+void calcMagnitude(const Mat &X, const Mat &Y, Mat &dst){
 	assert(X.size() == Y.size());
 	assert(X.type() == CV_16SC1 && Y.type() == CV_16SC1);
 
-	Mat mag(X.rows, X.cols, CV_16SC1);
+	dst.create(X.rows, X.cols, CV_16SC1);
 
-	for (int y = 0; y < mag.rows; y++){
-		short *row = mag.ptr<short>(y);
+	for (int y = 0; y < dst.rows; y++){
+		short *row = dst.ptr<short>(y);
 		const short *rowX = X.ptr<short>(y);
 		const short *rowY = Y.ptr<short>(y);
-		for (int x = 0; x < mag.cols; x++){
+		for (int x = 0; x < dst.cols; x++){
 			// magnitude calculation to match OpenCV, but for displayable Magnitude-Image: don't divide normValue by 4 to achieve same result as OpenCV
 			//int value = 0.5*min(255, abs(rowX[x])) + 0.5*min(255, abs(rowY[x]));
 			// magnitude calculation using Script
@@ -120,6 +148,11 @@ Mat calcMagnitude(const Mat &X, const Mat &Y){
 			row[x] = (short) min(32768, value);
 		}
 	}
+}
+
+Mat calcMagnitude(const Mat &X, const Mat &Y){
+	Mat mag;
+	calcMagnitude(X, Y, mag);
 	return mag;
 }
 
@@ -138,7 +171,7 @@ double getAbsMax(const Mat &img){
 	return normValue;
 }
 
-Mat convertToImg(const Mat &img){
+void convertToImg(const Mat &img, Mat &dst){
 	assert(img.type() == CV_16SC1);
 
 	double normValue = getAbsMax(img);
@@ -146,33 +179,43 @@ Mat convertToImg(const Mat &img){
 	// however OpenCV seems to be using a fourth of that value to normalize its own Sobel Image Representation
 	normValue /= 4;
 
-	Mat convertedImg(img.rows, img.cols, CV_8UC1);
+	dst.create(img.rows, img.cols, CV_8UC1);
 	for (int y = 0; y < img.rows; y++){
-		uchar *row = convertedImg.ptr<uchar>(y);
+		uchar *row = dst.ptr<uchar>(y);
 		const short *rowOrg = img.ptr<short>(y);
 		for (int x = 0; x < img.cols; x++){
 			row[x] = (uchar) min(255., abs(((double)rowOrg[x]/normValue)*255.));
 		}
 	}
+}
+
+Mat convertToImg(const Mat &img){
+	Mat convertedImg;
+	convertToImg(img, convertedImg);
 	return convertedImg;
 }
 
 // gradients orentation interval ]-pi, pi[
-Mat calcGradients(const Mat &X, const Mat &Y){
+void calcGradients(const Mat &X, const Mat &Y, Mat &dst){
 	assert(X.size() == Y.size());
 	assert(X.type() == CV_16SC1 && Y.type() == CV_16SC1);
 
-	Mat gradients(X.rows, X.cols, CV_64FC1);
+	dst.create(X.rows, X.cols, CV_64FC1);
 
-	for (int y = 0; y < gradients.rows; y++){
-		double *row = gradients.ptr<double>(y);
+	for (int y = 0; y < dst.rows; y++){
+		double *row = dst.ptr<double>(y);
 		const short *rowX = X.ptr<short>(y);
 		const short *rowY = Y.ptr<short>(y);
-		for (int x = 0; x < gradients.cols; x++){
+		for (int x = 0; x < dst.cols; x++){
 			double direction = atan2(rowY[x], rowX[x]);
 			row[x] = direction;
 		}
 	}
+}
+
+Mat calcGradients(const Mat &X, const Mat &Y){
+	Mat gradients;
+	calcGradients(X, Y, gradients);
 	return gradients;
 }
 
@@ -192,23 +235,29 @@ void _drawGradient(Mat &gradImg, int x, int y, double gradDir, short gradMag){
 	circle(gradImg, Point(x, y), 2, Scalar(0, 0, 255), -1);
 }
 
-Mat drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag){
+// dst is only reallocated if its size or type does not fit, it may be img
+void drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag, Mat &dst){
 	assert(img.channels() == 3);
 	assert(img.type() == CV_8UC3 && gradients.type() == CV_64FC1 && dervMag.type() == CV_16SC1);
 	assert(img.size() == gradients.size() && img.size() == dervMag.size());
 
 	short threshold = 150;
 
-	Mat gradImg = img.clone();
+	img.copyTo(dst);
 	for (int y = 0; y < img.rows; y+=5){
 		const double *rowGrad = gradients.ptr<double>(y);
 		const short *rowMag = dervMag.ptr<short>(y);
 		for (int x = 0; x < img.cols; x+=5){
 			if (rowMag[x] > threshold){
-				_drawGradient(gradImg, x, y, rowGrad[x], rowMag[x]);
+				_drawGradient(dst, x, y, rowGrad[x], rowMag[x]);
 			}
 		}
 	}
+}
+
+Mat drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag){
+	Mat gradImg;
+	drawGradients(img, gradients, dervMag, gradImg);
 	return gradImg;
 }
 
@@ -268,5 +317,8 @@ int main(){
 	waitKey();
 	destroyAllWindows();
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
@@ -1,44 +1,50 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
+#include <atomic>
 #include <time.h>
-#include <direct.h>
 
 #include <opencv2\core\core.hpp>
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgproc\imgproc.hpp>
+#include <opencv2\ml\ml.hpp>
+
+#include "..\Common\threadPool.h"
+#include "..\Common\directory.h"
+#include "..\Common\featureStore.h"
+#include "..\Common\linearTrainer.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
 
 using namespace std;
 using namespace cv;
 
 #define PI	3.14159265
 
+// pixels per task of the loops that split an image into bands of rows on the shared pool
+#define BAND_PIXELS		(1 << 16)
+
 Mat loadImg(string directory, string filename, int flags){
+	PROFILE_SCOPE("loadImg");
 	string fullFilename = string(directory + "\\" + filename);
 	Mat image;
-	image = imread(fullFilename, flags);
+	image = readImage(fullFilename, flags);
 
 	if (!image.data){
 		cout << "image file " << fullFilename << " could not be opened" << endl;
 		getchar();
+		resultWriter().close();
 		exit(-1);
 	}
 
 	return image;
 }
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
 // filter on a single pixel
@@ -61,11 +67,15 @@ void _filter(short* pixel, const Mat &values, const Mat &kernel, double normValu
 	//cout << normValue << endl;
 }
 
-Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+// dst is only reallocated if its size or type does not fit, it must not share data with img
+void filter(const Mat &img, Mat &dst, const Mat &kernel, bool normalize){
+	PROFILE_SCOPE_PIXELS("filter", img.total());
 	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
 	assert(kernel.type() == CV_64FC1);
 
-	Mat filteredImg(img.rows, img.cols, CV_16SC1, Scalar(0));
+	dst.create(img.rows, img.cols, CV_16SC1);
+	// the border stays 0
+	dst.setTo(Scalar(0));
 
 	double normValue = 0.;
 	for (int y = 0; y < kernel.rows; y++){
@@ -78,40 +88,63 @@ Mat filter(const Mat &img, const Mat &kernel, bool normalize){
 	int yOffset = (kernel.rows - 1) / 2;
 	int xOffset = (kernel.cols - 1) / 2;
 
-	for (int y = yOffset; y < img.rows - yOffset; y++){
-		short *row = filteredImg.ptr<short>(y);
-		for (int x = xOffset; x < img.cols - xOffset; x++){
-			const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
-			if (normalize)
-				_filter(&row[x], tmp, kernel, normValue);
-			else
-				_filter(&row[x], tmp, kernel, 1.);
+	//bands of rows on the shared pool, every row is written by one task only
+	parallelFor(sharedThreadPool(), yOffset, img.rows - yOffset, max(1, BAND_PIXELS / max(1, img.cols)), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
+			short *row = dst.ptr<short>(y);
+			for (int x = xOffset; x < img.cols - xOffset; x++){
+				const Mat tmp = img(Rect(x - xOffset, y - yOffset, kernel.cols, kernel.rows));
+				if (normalize)
+					_filter(&row[x], tmp, kernel, normValue);
+				else
+					_filter(&row[x], tmp, kernel, 1.);
+			}
 		}
-	}
+	});
+}
+
+Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+	Mat filteredImg;
+	filter(img, filteredImg, kernel, normalize);
 	return filteredImg;
 }
 
-Mat sobelX(const Mat &img){
+void sobelX(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
 	Mat kernel((Mat_<double>(3, 3) << -1, 0, 1, -2, 0, 2, -1, 0, 1));
-	return filter(img, kernel, false);
+	filter(img, dst, kernel, false);
 }
 
-Mat sobelY(const Mat &img){
+Mat sobelX(const Mat &img){
+	Mat derivative;
+	sobelX(img, derivative);
+	return derivative;
+}
+
+void sobelY(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
 	Mat kernel((Mat_<double>(3, 3) << -1, -2, -1, 0, 0, 0, 1, 2, 1));
-	return filter(img, kernel, false);
+	filter(img, dst, kernel, false);
 }
 
-Mat calcMagnitude(const Mat &X, const Mat &Y){
+Mat sobelY(const Mat &img){
+	Mat derivative;
+	sobelY(img, derivative);
+	return derivative;
+}
+
+// dst is only reallocated if its size or type does not fit, it may be X or Y
+void calcMagnitude(const Mat &X, const Mat &Y, Mat &dst){
 	assert(X.size() == Y.size());
 	assert(X.type() == CV_16SC1 && Y.type() == CV_16SC1);
 
-	Mat mag(X.rows, X.cols, CV_16SC1);
+	dst.create(X.rows, X.cols, CV_16SC1);
 
-	for (int y = 0; y < mag.rows; y++){
-		short *row = mag.ptr<short>(y);
+	for (int y = 0; y < dst.rows; y++){
+		short *row = dst.ptr<short>(y);
 		const short *rowX = X.ptr<short>(y);
 		const short *rowY = Y.ptr<short>(y);
-		for (int x = 0; x < mag.cols; x++){
+		for (int x = 0; x < dst.cols; x++){
 			// magnitude calculation to match OpenCV, but for displayable Magnitude-Image: don't divide normValue by 4 to achieve same result as OpenCV
 			//int value = 0.5*min(255, abs(rowX[x])) + 0.5*min(255, abs(rowY[x]));
 			// magnitude calculation using Script
@@ -120,25 +153,35 @@ Mat calcMagnitude(const Mat &X, const Mat &Y){
 			row[x] = (short)min(32768, value);
 		}
 	}
+}
+
+Mat calcMagnitude(const Mat &X, const Mat &Y){
+	Mat mag;
+	calcMagnitude(X, Y, mag);
 	return mag;
 }
 
 // gradients orentation interval ]0, pi[
-Mat calcGradients(const Mat &X, const Mat &Y){
+void calcGradients(const Mat &X, const Mat &Y, Mat &dst){
 	assert(X.size() == Y.size());
 	assert(X.type() == CV_16SC1 && Y.type() == CV_16SC1);
 
-	Mat gradients(X.rows, X.cols, CV_64FC1);
+	dst.create(X.rows, X.cols, CV_64FC1);
 
-	for (int y = 0; y < gradients.rows; y++){
-		double *row = gradients.ptr<double>(y);
+	for (int y = 0; y < dst.rows; y++){
+		double *row = dst.ptr<double>(y);
 		const short *rowX = X.ptr<short>(y);
 		const short *rowY = Y.ptr<short>(y);
-		for (int x = 0; x < gradients.cols; x++){
+		for (int x = 0; x < dst.cols; x++){
 			double direction = abs(atan2(rowY[x], rowX[x]));
 			row[x] = direction;
 		}
 	}
+}
+
+Mat calcGradients(const Mat &X, const Mat &Y){
+	Mat gradients;
+	calcGradients(X, Y, gradients);
 	return gradients;
 }
 
@@ -184,18 +227,30 @@ double toRadiant(double degree){
 
 // 0 --> each bin0 and bin8 get 0.5*magnitude
 
-double*** compute_HoG(const Mat &img, const int cellSize, const std::vector<int> &dims){
-	assert(img.type() == CV_8UC1);
-	assert(dims.size() == 3);
+// adds a single gradient orientation to the histogram of its cell (linear interpolation between the two nearest bins)
+void _binOrientation(double* cellHoG, double orientation, int binCount){
+	double degree = toDegree(orientation);
 
-	const Mat X = sobelX(img);
-	const Mat Y = sobelY(img);
+	double bin = (degree - 0.5*(180. / binCount)) / (180. / binCount);
+	if (bin < 0)
+		bin += binCount;
 
-	Mat gradients = calcGradients(X, Y);
-	Mat magnitude = calcMagnitude(X, Y);
+	int lowerBin = (int)bin;
+	int upperBin = (lowerBin == binCount - 1) ? 0 : lowerBin + 1;
+
+	double lowerBinValue = (1. - (bin - (int)bin));
+	double upperBinValue = 1. - lowerBinValue;
+
+	cellHoG[lowerBin] += lowerBinValue; // * magnitude;
+	cellHoG[upperBin] += upperBinValue; // * magnitude;
+}
 
+double*** compute_HoG(const Mat &gradients, const Mat &magnitude, const int cellSize, const std::vector<int> &dims){
+	PROFILE_SCOPE_PIXELS("compute_HoG", gradients.total());
+	assert(dims.size() == 3);
 	assert(gradients.type() == CV_64FC1);
 	assert(magnitude.type() == CV_16SC1);
+	assert(gradients.size() == magnitude.size());
 
 	const int cellRows = dims.at(0);
 	const int cellCols = dims.at(1);
@@ -218,36 +273,59 @@ double*** compute_HoG(const Mat &img, const int cellSize, const std::vector<int>
 		}
 	}
 
-	double orientation, degree;
-	for (int y = 0; y < img.rows - (img.rows%cellSize); y++){
-		const double* gradRow = gradients.ptr<double>(y);
-		const short* magRow = magnitude.ptr<short>(y);
-		int yCell = y / cellSize;
-		for (int x = 0; x < img.cols - (img.cols%cellSize); x++){
-			if (magRow[x] == 0)
-				continue;
+	//bands of cell rows on the shared pool, every cell is written by the task of its rows only
+	const int bandCells = max(1, BAND_PIXELS / max(1, gradients.cols*cellSize));
+	parallelFor(sharedThreadPool(), 0, gradients.rows / cellSize, bandCells, [&](int yCell0, int yCell1){
+		for (int y = yCell0*cellSize; y < yCell1*cellSize; y++){
+			const double* gradRow = gradients.ptr<double>(y);
+			const short* magRow = magnitude.ptr<short>(y);
+			int yCell = y / cellSize;
+			for (int x = 0; x < gradients.cols - (gradients.cols%cellSize); x++){
+				if (magRow[x] == 0)
+					continue;
 
-			int xCell = x / cellSize;
-			orientation = gradRow[x];
-			degree = toDegree(orientation);
+				int xCell = x / cellSize;
+				_binOrientation(HoG[yCell][xCell], gradRow[x], binCount);
+			}
+		}
+	});
+	return HoG;
+}
+
+double*** compute_HoG(const Mat &img, const int cellSize, const std::vector<int> &dims){
+	assert(img.type() == CV_8UC1);
+	assert(dims.size() == 3);
+
+	const Mat X = sobelX(img);
+	const Mat Y = sobelY(img);
+
+	Mat gradients = calcGradients(X, Y);
+	Mat magnitude = calcMagnitude(X, Y);
 
-			double bin = (degree - 0.5*(180. / binCount)) / (180. / binCount);
-			if (bin < 0)
-				bin += binCount;
+	return compute_HoG(gradients, magnitude, cellSize, dims);
+}
 
-			int lowerBin = (int)bin;
-			int upperBin = (lowerBin == binCount - 1) ? 0 : lowerBin + 1;
+void freeHoG(double*** HoG, const std::vector<int> &dims){
+	assert(dims.size() == 3);
 
-			double lowerBinValue = (1. - (bin - (int)bin));
-			double upperBinValue = 1. - lowerBinValue;
+	for (int yCell = 0; yCell < dims.at(0); yCell++){
+		for (int xCell = 0; xCell < dims.at(1); xCell++)
+			free(HoG[yCell][xCell]);
+		free(HoG[yCell]);
+	}
+	free(HoG);
+}
 
-			//cout << yCell << ", " << xCell << ", " << lowerBin << ", " << upperBin << ", " << endl;
+// feature vector of a HoG: [yCell][xCell][bin] concatenation of all cell histograms
+void flattenHoG(double*** HoG, const std::vector<int> &dims, float* descriptor){
+	assert(dims.size() == 3);
 
-			HoG[yCell][xCell][lowerBin] += lowerBinValue; // * magRow[x];
-			HoG[yCell][xCell][upperBin] += upperBinValue; // * magRow[x];
+	for (int yCell = 0; yCell < dims.at(0); yCell++){
+		for (int xCell = 0; xCell < dims.at(1); xCell++){
+			for (int b = 0; b < dims.at(2); b++)
+				*descriptor++ = (float)HoG[yCell][xCell][b];
 		}
 	}
-	return HoG;
 }
 
 Mat visualizeHoG(double*** HoG, const int cellSize, const std::vector<int> &dims){
@@ -314,13 +392,529 @@ Mat visualizeHoG(double*** HoG, const int cellSize, const std::vector<int> &dims
 
 /////////////////////////////////////////////////////////////////////////////
 
-int main(){
+// one scale of a HoG pyramid, its cells are stored in HoGPyramid::arena
+struct HoGLevel{
+	double scale;			// size of this level relative to the original image
+	int rows, cols;			// size of the downscaled image
+	int cellRows, cellCols;
+	size_t offset;			// index of the first value of this level inside the arena
+};
+
+struct HoGPyramid{
+	int cellSize;
+	int binCount;
+	vector<HoGLevel> levels;
+	// histograms of all levels in one allocation: [level][yCell][xCell][bin]
+	vector<double> arena;
+
+	double* cell(int level, int yCell, int xCell){
+		const HoGLevel &l = levels[level];
+		return &arena[l.offset + ((size_t)yCell*l.cellCols + xCell)*binCount];
+	}
+
+	const double* cell(int level, int yCell, int xCell) const{
+		const HoGLevel &l = levels[level];
+		return &arena[l.offset + ((size_t)yCell*l.cellCols + xCell)*binCount];
+	}
+};
+
+// gradients and cell histograms for the cell rows [yCell0, yCell1[ of one pyramid level
+// the result is identical to the corresponding rows of compute_HoG(img, ...)
+void _computeHoGBand(const Mat &img, int cellSize, int binCount, int cellCols, int yCell0, int yCell1, double* HoG){
+	int y0 = yCell0*cellSize;
+	int y1 = yCell1*cellSize;
+
+	// sobel needs one row above and below the band, the border rows of the image stay 0 as in filter()
+	int top = max(0, y0 - 1);
+	int bottom = min(img.rows, y1 + 1);
+	const Mat band = img(Rect(0, top, img.cols, bottom - top));
+
+	const Mat X = sobelX(band);
+	const Mat Y = sobelY(band);
+	Mat gradients = calcGradients(X, Y);
+	Mat magnitude = calcMagnitude(X, Y);
+
+	for (int y = y0; y < y1; y++){
+		const double* gradRow = gradients.ptr<double>(y - top);
+		const short* magRow = magnitude.ptr<short>(y - top);
+		double* cellRow = HoG + (size_t)(y / cellSize - yCell0)*cellCols*binCount;
+		for (int x = 0; x < cellCols*cellSize; x++){
+			if (magRow[x] == 0)
+				continue;
+
+			_binOrientation(cellRow + (x / cellSize)*binCount, gradRow[x], binCount);
+		}
+	}
+}
+
+// every level is scaleFactor times smaller than the previous one, until less than one cell fits
+// gradients are computed once per level; the levels are cut into bands of roughly equal pixel count,
+// so the big levels are spread over all threads instead of keeping a single one busy
+HoGPyramid computeHoGPyramid(const Mat &img, int cellSize, int binCount, double scaleFactor, ThreadPool &pool){
+	PROFILE_SCOPE_PIXELS("computeHoGPyramid", img.total());
+	assert(img.type() == CV_8UC1);
+	assert(cellSize > 0 && binCount > 0);
+	assert(scaleFactor > 1.);
+
+	HoGPyramid pyramid;
+	pyramid.cellSize = cellSize;
+	pyramid.binCount = binCount;
+
+	size_t arenaSize = 0;
+	size_t totalPixels = 0;
+	for (double scale = 1.;; scale /= scaleFactor){
+		HoGLevel level;
+		level.scale = scale;
+		level.rows = (int)(img.rows*scale + 0.5);
+		level.cols = (int)(img.cols*scale + 0.5);
+		level.cellRows = level.rows / cellSize;
+		level.cellCols = level.cols / cellSize;
+		level.offset = arenaSize;
+		if (level.cellRows < 1 || level.cellCols < 1)
+			break;
+
+		arenaSize += (size_t)level.cellRows*level.cellCols*binCount;
+		totalPixels += (size_t)level.rows*level.cols;
+		pyramid.levels.push_back(level);
+	}
+	pyramid.arena.assign(arenaSize, 0.);
+
+	// a group of its own, so the pyramid may be built inside a task of the same pool
+	TaskGroup group(pool);
+	vector<Mat> images(pyramid.levels.size());
+	for (size_t l = 0; l < pyramid.levels.size(); l++){
+		if (l == 0){
+			images[l] = img;
+			continue;
+		}
+		group.run([&images, &pyramid, &img, l](){
+			resize(img, images[l], Size(pyramid.levels[l].cols, pyramid.levels[l].rows), 0, 0, INTER_AREA);
+		});
+	}
+	group.wait();
+
+	// about 8 bands per thread over the whole pyramid, at least one cell row each
+	size_t bandPixels = max((size_t)1, totalPixels / (pool.size() * 8));
+
+	// largest level first, so the small tasks fill up the end
+	for (size_t l = 0; l < pyramid.levels.size(); l++){
+		const HoGLevel &level = pyramid.levels[l];
+		int bandCells = max(1, (int)(bandPixels / ((size_t)level.cols*cellSize)));
+
+		for (int yCell0 = 0; yCell0 < level.cellRows; yCell0 += bandCells){
+			int yCell1 = min(level.cellRows, yCell0 + bandCells);
+			double* HoG = pyramid.cell((int)l, yCell0, 0);
+			const Mat &levelImg = images[l];
+			int cellCols = level.cellCols;
+
+			group.run([&levelImg, cellSize, binCount, cellCols, yCell0, yCell1, HoG](){
+				_computeHoGBand(levelImg, cellSize, binCount, cellCols, yCell0, yCell1, HoG);
+			});
+		}
+	}
+	group.wait();
+
+	return pyramid;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// linear SVM as a plane: score = w.x + b, positive scores belong to the larger class label (e.g. +1 = object)
+struct LinearModel{
+	Mat w;		// 1 x varCount, CV_64FC1
+	double b;
+};
+
+// the decision function of CvSVM is protected, this reads the plane of a linear one from it
+class LinearSVMAccess : public CvSVM{
+public:
+	// f(x) = sum_i alpha_i * sv_i.x - rho is positive for class_labels[0]; false unless a two-class C_SVC
+	bool copyTo(LinearModel &model) const{
+		if (params.svm_type != CvSVM::C_SVC || class_labels == NULL || class_labels->cols != 2 || decision_func == NULL)
+			return false;
+
+		const CvSVMDecisionFunc &df = decision_func[0];
+		model.w = Mat::zeros(1, var_count, CV_64FC1);
+		double* w = model.w.ptr<double>(0);
+		for (int i = 0; i < df.sv_count; i++){
+			const float* sv_i = sv[df.sv_index ? df.sv_index[i] : i];
+			for (int d = 0; d < var_count; d++)
+				w[d] += df.alpha[i] * sv_i[d];
+		}
+		model.b = -df.rho;
+
+		// positive scores belong to the larger label
+		if (class_labels->data.i[0] < class_labels->data.i[1]){
+			model.w *= -1.;
+			model.b = -model.b;
+		}
+		return true;
+	}
+};
+
+// loads a linear CvSVM (as written by trainSVM in 4.1) and sums its support vectors into the plane
+// false with a message if the file cannot be read as CvSVM or its kernel is not linear
+bool loadLinearSVM(const char* filename, LinearModel &model){
+	LinearSVMAccess SVM;
+	try{
+		SVM.load(filename);
+	}
+	catch (const cv::Exception&){
+	}
+	if (SVM.get_var_count() <= 0 || SVM.get_support_vector_count() <= 0){
+		cout << "SVM file " << filename << " could not be loaded" << endl;
+		return false;
+	}
+	if (SVM.get_params().kernel_type != CvSVM::LINEAR){
+		cout << "SVM file " << filename << " has no linear kernel, the detector needs a plane" << endl;
+		return false;
+	}
+	if (!SVM.copyTo(model)){
+		cout << "SVM file " << filename << " is no two-class C_SVC model" << endl;
+		return false;
+	}
+	return true;
+}
+
+// linear model files: plain w, b (.lsvm, as written by train) or linear CvSVM files
+// false with a message if the file cannot be read
+bool loadLinearModel(const char* filename, LinearModel &model){
+	if (!isLinearWeightsFile(filename))
+		return loadLinearSVM(filename, model);
+
+	LinearWeights weights;
+	if (!loadLinearWeights(filename, weights) || weights.w.empty()){
+		cout << "linear model " << filename << " could not be read" << endl;
+		return false;
+	}
+
+	model.w.create(1, (int)weights.w.size(), CV_64FC1);
+	copy(weights.w.begin(), weights.w.end(), model.w.ptr<double>(0));
+	model.b = weights.b;
+	return true;
+}
+
+struct Detection{
+	Rect box;		// in coordinates of the original image
+	double score;
+	int level;
+};
+
+// scores every window of winCellsX x winCellsY cells (stride: one cell) on all pyramid levels
+// the window descriptor is the [yCell][xCell][bin] concatenation of its cells, as in compute_HoG
+// instead of a full dot product per window, each cell's contribution to every window offset it can take
+// is computed once as a single matrix product (cells x bins) * (bins x offsets); a window score is
+// then b plus one table lookup per offset
+vector<Detection> detectHoG(const HoGPyramid &pyramid, const LinearModel &model, int winCellsX, int winCellsY, double threshold, ThreadPool &pool){
+	const int binCount = pyramid.binCount;
+	const int offsets = winCellsX*winCellsY;
+	assert(model.w.type() == CV_64FC1);
+	assert(model.w.cols == offsets*binCount);
+
+	// one row of weights per window offset
+	const Mat weights = model.w.reshape(1, offsets);
+	const size_t bandCells = 4096;
+
+	TaskGroup group(pool);
+	vector<Mat> contributions(pyramid.levels.size());
+	for (size_t l = 0; l < pyramid.levels.size(); l++){
+		const HoGLevel &level = pyramid.levels[l];
+		if (level.cellRows < winCellsY || level.cellCols < winCellsX)
+			continue;
+
+		int cellCount = level.cellRows*level.cellCols;
+		contributions[l].create(cellCount, offsets, CV_64FC1);
+		Mat cells(cellCount, binCount, CV_64FC1, (void*)pyramid.cell((int)l, 0, 0));
+
+		for (int c0 = 0; c0 < cellCount; c0 += (int)bandCells){
+			int c1 = min(cellCount, c0 + (int)bandCells);
+			Mat cellBand = cells.rowRange(c0, c1);
+			Mat contributionBand = contributions[l].rowRange(c0, c1);
+			group.run([cellBand, contributionBand, &weights]() mutable{
+				gemm(cellBand, weights, 1., noArray(), 0., contributionBand, GEMM_2_T);
+			});
+		}
+	}
+	group.wait();
+
+	vector<Detection> detections;
+	mutex detectionsMutex;
+	for (size_t l = 0; l < pyramid.levels.size(); l++){
+		const HoGLevel &level = pyramid.levels[l];
+		if (contributions[l].empty())
+			continue;
+
+		int windowRows = level.cellRows - winCellsY + 1;
+		int windowCols = level.cellCols - winCellsX + 1;
+		int bandRows = max(1, (int)bandCells / windowCols);
+
+		for (int wy0 = 0; wy0 < windowRows; wy0 += bandRows){
+			int wy1 = min(windowRows, wy0 + bandRows);
+			const Mat &C = contributions[l];
+			int cellSize = pyramid.cellSize;
+			int levelIndex = (int)l;
+
+			group.run([&C, &level, &model, &detections, &detectionsMutex, wy0, wy1, windowCols, winCellsX, winCellsY, cellSize, levelIndex, threshold](){
+				vector<Detection> found;
+				for (int cy = wy0; cy < wy1; cy++){
+					for (int cx = 0; cx < windowCols; cx++){
+						double score = model.b;
+						for (int i = 0; i < winCellsY; i++){
+							for (int j = 0; j < winCellsX; j++){
+								score += C.ptr<double>((cy + i)*level.cellCols + cx + j)[i*winCellsX + j];
+							}
+						}
+						if (score <= threshold)
+							continue;
+
+						Detection detection;
+						detection.box = Rect((int)(cx*cellSize / level.scale), (int)(cy*cellSize / level.scale),
+							(int)(winCellsX*cellSize / level.scale), (int)(winCellsY*cellSize / level.scale));
+						detection.score = score;
+						detection.level = levelIndex;
+						found.push_back(detection);
+					}
+				}
+				unique_lock<mutex> lock(detectionsMutex);
+				detections.insert(detections.end(), found.begin(), found.end());
+			});
+		}
+	}
+	group.wait();
+
+	return detections;
+}
+
+// greedy: keeps the best scoring box and drops every box overlapping it by more than maxOverlap (intersection over union)
+vector<Detection> nonMaximumSuppression(vector<Detection> detections, double maxOverlap){
+	sort(detections.begin(), detections.end(), [](const Detection &a, const Detection &b){ return a.score > b.score; });
+
+	vector<Detection> kept;
+	for (const Detection &detection : detections){
+		bool suppressed = false;
+		for (const Detection &other : kept){
+			double intersection = (detection.box & other.box).area();
+			double unionArea = detection.box.area() + other.box.area() - intersection;
+			if (intersection > maxOverlap*unionArea){
+				suppressed = true;
+				break;
+			}
+		}
+		if (!suppressed)
+			kept.push_back(detection);
+	}
+	return kept;
+}
+
+vector<Detection> detect(const Mat &img, const LinearModel &model, int cellSize, int winCellsX, int winCellsY, double threshold, ThreadPool &pool){
+	HoGPyramid pyramid = computeHoGPyramid(img, cellSize, 9, 1.2, pool);
+	vector<Detection> detections = detectHoG(pyramid, model, winCellsX, winCellsY, threshold, pool);
+	return nonMaximumSuppression(detections, 0.3);
+}
+
+// <exe> detect <linear SVM .xml or .lsvm> <image> <window cells x> <window cells y> [cell size] [threshold]
+int runDetector(int argc, char* argv[]){
+	if (argc < 6){
+		cout << "usage: detect <model.xml|model.lsvm> <image> <window cells x> <window cells y> [cell size] [threshold]" << endl;
+		return -1;
+	}
+
+	// image paths with '\\' or '/', or a bare file name in the working directory
+	string fullFilename(argv[3]);
+	size_t slash = fullFilename.find_last_of("/\\");
+	string dir = slash == string::npos ? "." : fullFilename.substr(0, slash);
+	string filename = slash == string::npos ? fullFilename : fullFilename.substr(slash + 1);
+
+	LinearModel model;
+	if (!loadLinearModel(argv[2], model))
+		return -3;
+	Mat img = loadImg(dir, filename, IMREAD_GRAYSCALE);
+
+	int winCellsX = atoi(argv[4]);
+	int winCellsY = atoi(argv[5]);
+	int cellSize = argc > 6 ? atoi(argv[6]) : 10;
+	double threshold = argc > 7 ? atof(argv[7]) : 0.;
+
+	if (model.w.cols != winCellsX*winCellsY*9){
+		cout << "the model expects " << model.w.cols << " features, the window has " << winCellsX*winCellsY*9 << endl;
+		return -2;
+	}
+
+	ThreadPool &pool = sharedThreadPool();
+	vector<Detection> detections = detect(img, model, cellSize, winCellsX, winCellsY, threshold, pool);
+
+	const int runs = 10;
+	double start = (double)getTickCount();
+	for (int r = 0; r < runs; r++)
+		detect(img, model, cellSize, winCellsX, winCellsY, threshold, pool);
+	double seconds = ((double)getTickCount() - start) / getTickFrequency() / runs;
+
+	cout << detections.size() << " detections on " << img.cols << "x" << img.rows << ", "
+		<< seconds * 1000. << " ms per frame (" << 1. / seconds << " fps, " << pool.size() << " threads)" << endl;
+
+	Mat detectionImg;
+	cvtColor(img, detectionImg, CV_GRAY2BGR);
+	for (const Detection &detection : detections)
+		rectangle(detectionImg, detection.box, Scalar(0, 255, 0), 2);
+	saveImg("results", "detections.jpg", detectionImg);
+
+	return 0;
+}
+
+// <exe> extract <image dir> <store> <label> [window width] [window height] [cell size]
+// every image is scaled to the window size and its HoG is appended as one row to the store
+int runExtract(int argc, char* argv[]){
+	if (argc < 5){
+		cout << "usage: extract <image dir> <store.hogs> <label> [window width] [window height] [cell size]" << endl;
+		return -1;
+	}
+
+	string dir(argv[2]);
+	string storeFilename(argv[3]);
+	float label = (float)atof(argv[4]);
+	int width = argc > 5 ? atoi(argv[5]) : 64;
+	int height = argc > 6 ? atoi(argv[6]) : 128;
+	int cellSize = argc > 7 ? atoi(argv[7]) : 8;
+
+	const int binCount = 9;
+	const vector<int> dims = { height / cellSize, width / cellSize, binCount };
+	const int descriptorSize = dims[0] * dims[1] * dims[2];
+
+	FeatureStoreWriter store;
+	if (!store.open(storeFilename, createFeatureStoreHeader(descriptorSize, cellSize, binCount, dims[0], dims[1]))){
+		cout << "feature store " << storeFilename << " could not be opened or has a different layout" << endl;
+		return -2;
+	}
+
+	vector<string> filenames = listImages(dir);
+	uint64_t rowsBefore = store.rows();
+	int failed = 0;
+
+	// a wave of images at a time is extracted in parallel, its rows are appended in the order of the files, so the store
+	// is the same for every run; the messages come from this thread
+	ThreadPool &pool = sharedThreadPool();
+	const size_t wave = pool.size() * 4;
+	vector<vector<float>> descriptors(wave, vector<float>(descriptorSize));
+	vector<char> loaded(wave);
+
+	double start = (double)getTickCount();
+	for (size_t first = 0; first < filenames.size(); first += wave){
+		size_t count = min(wave, filenames.size() - first);
+		TaskGroup group(pool);
+		for (size_t k = 0; k < count; k++){
+			group.run([&, first, k](){
+				Mat img = readImage(dir + "\\" + filenames[first + k], IMREAD_GRAYSCALE);
+				loaded[k] = img.data != NULL;
+				if (!img.data)
+					return;
+				if (img.cols != width || img.rows != height)
+					resize(img, img, Size(width, height), 0, 0, INTER_AREA);
+
+				double*** HoG = compute_HoG(img, cellSize, dims);
+				flattenHoG(HoG, dims, &descriptors[k][0]);
+				freeHoG(HoG, dims);
+			});
+		}
+		group.wait();
+
+		for (size_t k = 0; k < count; k++){
+			if (!loaded[k]){
+				cout << "image file " << dir + "\\" + filenames[first + k] << " could not be opened" << endl;
+				failed++;
+			}
+			else if (!store.append(label, &descriptors[k][0])){
+				cout << "feature store " << storeFilename << " could not be written" << endl;
+				store.close();
+				return -3;
+			}
+		}
+	}
+	if (!store.close()){
+		cout << "feature store " << storeFilename << " could not be written" << endl;
+		return -3;
+	}
+	double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	cout << store.rows() - rowsBefore << " descriptors (" << descriptorSize << " floats) written to '" << storeFilename << "', "
+		<< failed << " failed, " << (store.rows() - rowsBefore) / seconds << " images/s" << endl;
+
+	return 0;
+}
+
+// <exe> train <store.hogs> <model.lsvm> [C] [epochs] [checkpoint interval]
+// linear SVM streamed from the memory mapped store, the store may be larger than the memory
+int runTrain(int argc, char* argv[]){
+	if (argc < 4){
+		cout << "usage: train <store.hogs> <model.lsvm> [C] [epochs] [checkpoint interval (batches)]" << endl;
+		return -1;
+	}
+
+	FeatureStore store;
+	if (!store.open(argv[2])){
+		cout << "feature store " << argv[2] << " could not be opened" << endl;
+		return -2;
+	}
+
+	string modelFilename(argv[3]);
+	LinearTrainerOptions options = createLinearTrainerOptions(argc > 4 ? atof(argv[4]) : 1., argc > 5 ? atoi(argv[5]) : 10);
+	options.checkpointInterval = argc > 6 ? atoi(argv[6]) : 1000;
+	options.checkpoint = modelFilename + ".checkpoint";
+
+	ThreadPool &pool = sharedThreadPool();
+	LinearTrainer trainer(store, options, pool);
+	LinearWeights model;
+
+	double start = (double)getTickCount();
+	bool trained = trainer.train(model, [](const LinearTrainerProgress &progress){
+		cout << "epoch " << progress.epoch << ": objective " << progress.objective << ", training error "
+			<< progress.errorRate * 100. << "%, learning rate " << progress.eta << endl;
+	});
+	double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	if (!trained){
+		cout << "feature store " << argv[2] << " does not contain exactly two classes" << endl;
+		return -3;
+	}
+	if (!saveLinearWeights(modelFilename, model)){
+		cout << "model could not be written to " << modelFilename << endl;
+		return -4;
+	}
+
+	cout << store.rows() << " x " << store.dims() << " features, " << options.epochs << " epochs in " << seconds << " s ("
+		<< store.rows() * options.epochs / seconds << " rows/s, " << pool.size() << " threads), positive label " << model.labels[1] << endl;
+
+	if (trainer.failedCheckpoints() > 0){
+		cout << trainer.failedCheckpoints() << " checkpoints could not be written to " << options.checkpoint << endl;
+		return -5;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]){
+	int (*command)(int, char**) = NULL;
+	if (argc > 1 && string(argv[1]) == "detect")
+		command = runDetector;
+	if (argc > 1 && string(argv[1]) == "extract")
+		command = runExtract;
+	if (argc > 1 && string(argv[1]) == "train")
+		command = runTrain;
+	if (command != NULL){
+		int result = command(argc, argv);
+		resultWriter().close();
+		return result;
+	}
+
 	//Mat img = loadImg("src", "Testimage_gradients.jpg", IMREAD_GRAYSCALE); //IMREAD_COLOR
 	//Mat img = loadImg("src", "lenna.jpg", IMREAD_GRAYSCALE);
 	Mat img = loadImg("src", "eye.png", IMREAD_GRAYSCALE);
 
 	// Aufgabe 3.1 a)
-	Mat gradients = calcGradients(img);
+	const Mat X = sobelX(img);
+	const Mat Y = sobelY(img);
+	Mat gradients = calcGradients(X, Y);
+	Mat magnitude = calcMagnitude(X, Y);
 
 	// Augabe 3.1 b) + 3.2 a) + b)
 	for (int cellSize : {10, 20, 30}){
@@ -331,7 +925,8 @@ int main(){
 		vector<int> dims = { cellRows, cellCols, binCount };
 
 		// Aufgabe 3.1 b)
-		double*** HoG = compute_HoG(img, cellSize, dims);
+		// gradients are shared by all cell sizes
+		double*** HoG = compute_HoG(gradients, magnitude, cellSize, dims);
 
 		// Aufgabe 3.2 a) + b) 
 		Mat HoGimage = visualizeHoG(HoG, cellSize, dims);
@@ -343,5 +938,17 @@ int main(){
 		destroyAllWindows();
 	}
 
+	// multi-scale HoG for detection
+	ThreadPool &pool = sharedThreadPool();
+	HoGPyramid pyramid = computeHoGPyramid(img, 10, 9, 1.2, pool);
+	for (size_t l = 0; l < pyramid.levels.size(); l++){
+		const HoGLevel &level = pyramid.levels[l];
+		cout << "pyramid level " << l << ": " << level.cols << "x" << level.rows << " pixels, "
+			<< level.cellCols << "x" << level.cellRows << " cells" << endl;
+	}
+
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
\ No newline at end of file
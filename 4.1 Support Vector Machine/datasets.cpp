@@ -0,0 +1,104 @@
+#include "datasets.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+
+#include "..\Common\featureStore.h"
+
+using namespace std;
+using namespace cv;
+
+void generateSetChunk(const SetParams &params, Xoshiro256 &rng, size_t count, float* labels, size_t labelStep,
+	float* data, size_t dataStep){
+	const int threshold = 256 * params.dims;
+	const int margin = params.margin;
+
+	for (size_t i = 0; i < count; i++){
+		float* x = data + i*dataStep;
+		int sum = 0;
+		float label;
+
+		if (params.linearSeparable){
+			for (int k = 0; k < params.dims; k++){
+				int value = (int)rng.below(512) - 2 * margin;
+				x[k] = (float)value;
+				sum += value;
+			}
+			if (sum > threshold - margin){
+				for (int k = 0; k < params.dims; k++)
+					x[k] += 2.f * margin;
+				sum += 2 * margin * params.dims;
+			}
+			label = sum < threshold ? 1.f : -1.f;
+		}
+		else{
+			for (int k = 0; k < params.dims; k++){
+				int value = (int)rng.below(512);
+				x[k] = (float)value;
+				sum += value;
+			}
+			label = sum < threshold ? 1.f : -1.f;
+			if (sum > threshold - margin && sum < threshold + margin)
+				label = rng.coin() ? 1.f : -1.f;
+		}
+
+		labels[i*labelStep] = label;
+	}
+}
+
+void generateSet(const SetParams &params, Mat &data, Mat &labels){
+	assert(data.type() == CV_32FC1 && data.cols == params.dims);
+	assert(labels.type() == CV_32FC1 && labels.rows == data.rows && labels.cols == 1);
+
+	Xoshiro256 rng(params.seed);
+	for (size_t first = 0; first < (size_t)data.rows; first += SET_CHUNK_SIZE){
+		Xoshiro256 chunkRng = rng;
+		size_t count = min(SET_CHUNK_SIZE, (size_t)data.rows - first);
+		generateSetChunk(params, chunkRng, count, labels.ptr<float>((int)first), labels.step1(),
+			data.ptr<float>((int)first), data.step1());
+		rng.jump();
+	}
+}
+
+bool writeSetStore(const string &filename, const SetParams &params, uint64_t count, ThreadPool &pool){
+	// a new store, FeatureStoreWriter would continue an existing one
+	remove(filename.c_str());
+
+	FeatureStoreHeader layout = createFeatureStoreHeader(params.dims);
+	FeatureStoreWriter store;
+	if (!store.open(filename, layout))
+		return false;
+
+	const size_t stride = layout.rowStride;
+	const uint64_t chunks = (count + SET_CHUNK_SIZE - 1) / SET_CHUNK_SIZE;
+	const size_t wave = pool.size() * 2;
+	vector<vector<float>> buffers(wave);
+	vector<size_t> rows(wave);
+
+	TaskGroup group(pool);
+	Xoshiro256 rng(params.seed);
+	for (uint64_t chunk0 = 0; chunk0 < chunks; chunk0 += wave){
+		size_t waveChunks = (size_t)min((uint64_t)wave, chunks - chunk0);
+		for (size_t k = 0; k < waveChunks; k++){
+			rows[k] = (size_t)min((uint64_t)SET_CHUNK_SIZE, count - (chunk0 + k) * SET_CHUNK_SIZE);
+			buffers[k].assign(rows[k] * stride, 0.f);
+
+			float* buffer = &buffers[k][0];
+			size_t chunkRows = rows[k];
+			Xoshiro256 chunkRng = rng;
+			rng.jump();
+			group.run([&params, buffer, chunkRows, chunkRng, stride]() mutable{
+				generateSetChunk(params, chunkRng, chunkRows, buffer, stride, buffer + 1, stride);
+			});
+		}
+		group.wait();
+
+		for (size_t k = 0; k < waveChunks; k++){
+			if (!store.appendRows(&buffers[k][0], rows[k]))
+				return false;
+		}
+	}
+
+	return store.close() && store.rows() == count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\random.h"
+#include "..\Common\threadPool.h"
+
+// the two sets of the exercise, generalized to dims dimensions:
+// the classes are separated by the hyperplane sum_k x_k = 256 dims (x + y = 512 in 2D), label 1 below, -1 above
+// linearSeparable: integer coordinates in [-2 margin, 512 - 2 margin[, samples with sum > 256 dims - margin are moved
+//   by 2 margin in every coordinate, which leaves an empty band along the hyperplane
+// otherwise: integer coordinates in [0, 512[, samples with |sum - 256 dims| < margin get a random label
+struct SetParams{
+	int dims;
+	int margin;
+	bool linearSeparable;
+	uint64_t seed;
+};
+
+// samples are generated in chunks; chunk k uses the generator of the seed jumped k times, so a sample only depends
+// on the seed and its index, not on the thread that generates it or on the size of the set
+const size_t SET_CHUNK_SIZE = 65536;
+
+// count samples of one chunk: label i goes to labels[i*labelStep], its coordinates to data + i*dataStep
+void generateSetChunk(const SetParams &params, Xoshiro256 &rng, size_t count, float* labels, size_t labelStep,
+	float* data, size_t dataStep);
+
+// data: n x dims, CV_32FC1, labels: n x 1, CV_32FC1
+void generateSet(const SetParams &params, cv::Mat &data, cv::Mat &labels);
+
+// streams count samples into a new feature store (.hogs) without holding the set in memory
+// chunks are generated in parallel and written in order, the file is the same for any number of threads
+bool writeSetStore(const std::string &filename, const SetParams &params, uint64_t count, ThreadPool &pool);
@@ -0,0 +1,222 @@
+#include "fourierFeatures.h"
+
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FOURIER_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+// all lengths are multiples of 4
+
+// y += a*x
+static void axpy(float* y, const float* x, float a, int n){
+#ifdef FOURIER_SSE
+	__m128 va = _mm_set1_ps(a);
+	for (int k = 0; k < n; k += 4)
+		_mm_storeu_ps(y + k, _mm_add_ps(_mm_loadu_ps(y + k), _mm_mul_ps(va, _mm_loadu_ps(x + k))));
+#else
+	for (int k = 0; k < n; k++)
+		y[k] += a * x[k];
+#endif
+}
+
+static double dot(const float* a, const float* b, int n){
+#ifdef FOURIER_SSE
+	__m128 sum = _mm_setzero_ps();
+	for (int k = 0; k < n; k += 4)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+	float lanes[4];
+	_mm_storeu_ps(lanes, sum);
+	return ((double)lanes[0] + lanes[1]) + ((double)lanes[2] + lanes[3]);
+#else
+	double sum = 0.;
+	for (int k = 0; k < n; k++)
+		sum += a[k] * b[k];
+	return sum;
+#endif
+}
+
+// (re + i im) *= (stepRe + i stepIm)
+static void rotate(float* re, float* im, const float* stepRe, const float* stepIm, int n){
+#ifdef FOURIER_SSE
+	for (int k = 0; k < n; k += 4){
+		__m128 a = _mm_loadu_ps(re + k);
+		__m128 b = _mm_loadu_ps(im + k);
+		__m128 c = _mm_loadu_ps(stepRe + k);
+		__m128 s = _mm_loadu_ps(stepIm + k);
+		_mm_storeu_ps(re + k, _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, s)));
+		_mm_storeu_ps(im + k, _mm_add_ps(_mm_mul_ps(a, s), _mm_mul_ps(b, c)));
+	}
+#else
+	for (int k = 0; k < n; k++){
+		float a = re[k];
+		re[k] = a * stepRe[k] - im[k] * stepIm[k];
+		im[k] = a * stepIm[k] + im[k] * stepRe[k];
+	}
+#endif
+}
+
+FourierModel approximateRBF(const SVMModel &model, int D, unsigned seed){
+	assert(model.kernelType == CvSVM::RBF);
+
+	D = (max(D, 4) + 3) / 4 * 4;
+	const int varCount = model.varCount();
+
+	FourierModel fourier;
+	fourier.rho = model.rho;
+	fourier.labels[0] = model.labels[0];
+	fourier.labels[1] = model.labels[1];
+	fourier.omega.create(varCount, D, CV_32FC1);
+	fourier.phase.create(1, D, CV_32FC1);
+	fourier.beta.create(1, D, CV_32FC1);
+
+	mt19937 rng(seed);
+	normal_distribution<double> normal(0., sqrt(2. * model.gamma));
+	uniform_real_distribution<double> uniform(0., 2. * CV_PI);
+	for (int k = 0; k < D; k++){
+		for (int j = 0; j < varCount; j++)
+			fourier.omega.at<float>(j, k) = (float)normal(rng);
+		fourier.phase.at<float>(k) = (float)uniform(rng);
+	}
+
+	const double* alpha = model.alpha.ptr<double>(0);
+	for (int k = 0; k < D; k++){
+		double sum = 0.;
+		for (int i = 0; i < model.supportVectors.rows; i++){
+			const float* sv = model.supportVectors.ptr<float>(i);
+			double projection = fourier.phase.at<float>(k);
+			for (int j = 0; j < varCount; j++)
+				projection += (double)fourier.omega.at<float>(j, k) * sv[j];
+			sum += alpha[i] * cos(projection);
+		}
+		fourier.beta.at<float>(k) = (float)(2. / D * sum);
+	}
+
+	return fourier;
+}
+
+// z is a buffer of D floats
+static double fourierValue(const FourierModel &model, const float* sample, float* z){
+	const int D = model.features();
+	const float* phase = model.phase.ptr<float>(0);
+
+	copy(phase, phase + D, z);
+	for (int j = 0; j < model.varCount(); j++)
+		axpy(z, model.omega.ptr<float>(j), sample[j], D);
+	for (int k = 0; k < D; k++)
+		z[k] = cos(z[k]);
+
+	return dot(model.beta.ptr<float>(0), z, D) - model.rho;
+}
+
+double fourierDecisionValue(const FourierModel &model, const float* sample){
+	vector<float> z(model.features());
+	return fourierValue(model, sample, &z[0]);
+}
+
+// rows per task: enough tasks to balance, few enough to keep the queue short
+static int bandRows(int rows, const ThreadPool &pool){
+	return max(1, rows / (int)(pool.size() * 8));
+}
+
+void predictBatchFourier(const FourierModel &model, const Mat &samples, Mat &responses, ThreadPool &pool){
+	assert(samples.type() == CV_32FC1);
+	assert(samples.cols == model.varCount());
+
+	responses.create(samples.rows, 1, CV_32FC1);
+	Mat &out = responses;
+
+	TaskGroup group(pool);
+	int band = bandRows(samples.rows, pool);
+	for (int y0 = 0; y0 < samples.rows; y0 += band){
+		int y1 = min(samples.rows, y0 + band);
+		group.run([&model, &samples, &out, y0, y1](){
+			vector<float> z(model.features());
+			for (int y = y0; y < y1; y++)
+				out.at<float>(y) = (float)fourierValue(model, samples.ptr<float>(y), &z[0]);
+		});
+	}
+	group.wait();
+}
+
+void predictGridFourier(const FourierModel &model, const SampleGrid &grid, Mat &responses, ThreadPool &pool){
+	assert(model.varCount() == 2);
+
+	responses.create(grid.rows, grid.cols, CV_32FC1);
+	Mat &out = responses;
+
+	// the rotation accumulates float rounding errors, the features are recomputed exactly every few samples
+	const int exactInterval = 64;
+
+	TaskGroup group(pool);
+	int band = bandRows(grid.rows, pool);
+	for (int r0 = 0; r0 < grid.rows; r0 += band){
+		int r1 = min(grid.rows, r0 + band);
+		group.run([&model, &grid, &out, r0, r1, exactInterval](){
+			const int D = model.features();
+			const float* omegaY = model.omega.ptr<float>(0);
+			const float* omegaX = model.omega.ptr<float>(1);
+			const float* phase = model.phase.ptr<float>(0);
+			const float* beta = model.beta.ptr<float>(0);
+
+			// one step along x turns feature k by omegaX[k] * dx
+			vector<float> re(D), im(D), stepRe(D), stepIm(D);
+			for (int k = 0; k < D; k++){
+				stepRe[k] = (float)cos(omegaX[k] * grid.dx);
+				stepIm[k] = (float)sin(omegaX[k] * grid.dx);
+			}
+
+			for (int r = r0; r < r1; r++){
+				float* row = out.ptr<float>(r);
+				double y = grid.y0 + r*grid.dy;
+				for (int c = 0; c < grid.cols; c++){
+					if (c % exactInterval == 0){
+						double x = grid.x0 + c*grid.dx;
+						for (int k = 0; k < D; k++){
+							double projection = phase[k] + omegaY[k] * y + omegaX[k] * x;
+							re[k] = (float)cos(projection);
+							im[k] = (float)sin(projection);
+						}
+					}
+					row[c] = (float)(dot(beta, &re[0], D) - model.rho);
+					rotate(&re[0], &im[0], &stepRe[0], &stepIm[0], D);
+				}
+			}
+		});
+	}
+	group.wait();
+}
+
+ApproximationError compareDecisionMaps(const Mat &exact, const Mat &approximate){
+	assert(exact.type() == CV_32FC1 && approximate.type() == CV_32FC1);
+	assert(exact.size() == approximate.size());
+
+	ApproximationError error = { 0., 0., 0., 0. };
+	size_t labelChanges = 0, bucketChanges = 0;
+	for (int y = 0; y < exact.rows; y++){
+		const float* f = exact.ptr<float>(y);
+		const float* g = approximate.ptr<float>(y);
+		for (int x = 0; x < exact.cols; x++){
+			double difference = abs((double)f[x] - g[x]);
+			error.maxError = max(error.maxError, difference);
+			error.meanError += difference;
+			if ((f[x] > 0.f) != (g[x] > 0.f))
+				labelChanges++;
+			if (responseBucket(f[x]) != responseBucket(g[x]))
+				bucketChanges++;
+		}
+	}
+
+	const double count = (double)exact.rows * exact.cols;
+	error.meanError /= count;
+	error.labelChanges = labelChanges / count;
+	error.bucketChanges = bucketChanges / count;
+	return error;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <opencv2\core\core.hpp>
+
+#include "svmModel.h"
+#include "..\Common\threadPool.h"
+
+// random Fourier features (Rahimi, Recht 2007) of an RBF model:
+// exp(-gamma |x - y|^2) = E[2 cos(w.x + b) cos(w.y + b)] for w ~ N(0, 2 gamma I), b ~ U[0, 2 pi[
+// with D samples (w_k, b_k) the decision function becomes f(x) ~ sum_k beta_k cos(w_k.x + b_k) - rho,
+// beta_k = 2/D sum_i alpha_i cos(w_k.sv_i + b_k), so a prediction costs O(D varCount) instead of O(svCount varCount)
+struct FourierModel{
+	cv::Mat omega;		// varCount x D, CV_32FC1 (transposed: the projections of all features are computed together)
+	cv::Mat phase;		// 1 x D, CV_32FC1
+	cv::Mat beta;		// 1 x D, CV_32FC1
+	double rho;
+	float labels[2];
+
+	int features() const{
+		return beta.cols;
+	}
+
+	int varCount() const{
+		return omega.rows;
+	}
+};
+
+// D is the accuracy / speed knob: the error of the kernel approximation falls with 1/sqrt(D)
+// D is rounded up to a multiple of 4 (one SSE register); the same seed gives the same features
+FourierModel approximateRBF(const SVMModel &model, int D, unsigned seed = 0);
+
+double fourierDecisionValue(const FourierModel &model, const float* sample);
+
+// as predictBatch / predictGrid in svmModel.h; the grid advances the features along a row by a rotation
+// instead of evaluating cos for every sample
+void predictBatchFourier(const FourierModel &model, const cv::Mat &samples, cv::Mat &responses, ThreadPool &pool);
+void predictGridFourier(const FourierModel &model, const SampleGrid &grid, cv::Mat &responses, ThreadPool &pool);
+
+// differences between an exact and an approximated decision map (both CV_32FC1, same size)
+struct ApproximationError{
+	double maxError;			// max |f - f~|
+	double meanError;			// mean |f - f~|
+	double labelChanges;		// fraction of samples classified differently
+	double bucketChanges;		// fraction of samples with another responseBucket(), i.e. another color in visualizeSVM
+};
+
+ApproximationError compareDecisionMaps(const cv::Mat &exact, const cv::Mat &approximate);
@@ -2,7 +2,6 @@
 #include <string>
 #include <vector>
 #include <sys/stat.h>
-#include <time.h>
 #include <direct.h>
 
 #include <opencv2\core\core.hpp>
@@ -10,20 +9,22 @@
 #include <opencv2\imgproc\imgproc.hpp>
 #include <opencv2\ml\ml.hpp>
 
+#include "svmModel.h"
+#include "modelSelection.h"
+#include "svmSolver.h"
+#include "fourierFeatures.h"
+#include "datasets.h"
+#include "..\Common\directory.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\profiler.h"
+
 using namespace std;
 using namespace cv;
 
-bool saveImg(string directory, string filename, Mat img){
-	string fullFilename = string(directory + "\\" + filename);
-	struct stat sb;
-
-	if (!(stat(directory.c_str(), &sb) == 0 && sb.st_mode == S_IFDIR)){
-		_mkdir(directory.c_str());
-	}
-
-	cout << "successfully written '" << fullFilename << "' to file!" << endl;
-
-	return imwrite(fullFilename, img);
+// queued to the result writer, encoded and written on its threads
+bool saveImg(string directory, string filename, Mat img, ImageWriteMode mode = WRITE_AS_NAMED){
+	PROFILE_SCOPE_PIXELS("saveImg", img.total());
+	return resultWriter().write(directory, filename, img.clone(), mode);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -54,44 +55,18 @@ Mat drawSets(const Mat &img, const Mat &data, const Mat &labels)
 	return newImg;
 }
 
-void createSets(Mat &data, Mat &labels, int margin, bool linearSperable)
+// seeded: the same seed always gives the same set (see datasets.h)
+void createSets(Mat &data, Mat &labels, int margin, bool linearSperable, uint64_t seed)
 {
 	assert(data.type() == CV_32FC1);
 	assert(labels.type() == CV_32FC1);
 	assert(labels.rows == data.rows);
-	assert(data.cols == 2 && labels.cols == 1);
+	assert(labels.cols == 1);
 
-	srand(time(NULL));
-	for (unsigned i = 0; i < data.rows; i++)
-	{
-		int x, y;
-		float label;
-		if (linearSperable){
-			x = rand() % 512 - (2 * margin);
-			y = rand() % 512 - (2 * margin);
-			if ((x + y) > 512-margin)
-			{
-				x += 2 * margin;
-				y += 2 * margin;
-			}
-			label = (x + y) < 512 ? 1. : -1.;
-		}
-		else
-		{
-			x = rand() % 512;
-			y = rand() % 512;
-			label = (x + y) < 512 ? 1. : -1.;
-			if ((x + y) > 512 - margin && (x + y) < 512 + margin)
-				label = ((rand() % 2) * 2) - 1;
-		}
-		labels.at<float>(i) = label;
-
-		data.at<float>(i, 0) = float(y);
-		data.at<float>(i, 1) = float(x);
-	}
+	SetParams params = { data.cols, margin, linearSperable, seed };
+	generateSet(params, data, labels);
 }
 
-
 void trainSVM(const char* filename, const Mat &data, const Mat &labels, int maxIter, bool linear)
 {
 	CvSVMParams params;
@@ -102,48 +77,429 @@ void trainSVM(const char* filename, const Mat &data, const Mat &labels, int maxI
 		params.kernel_type = CvSVM::RBF;
 	params.term_crit = cvTermCriteria(CV_TERMCRIT_ITER + CV_TERMCRIT_EPS, maxIter, 1e-6);
 
-	CvSVM SVM;
-	SVM.train_auto(data, labels, Mat(), Mat(), params);
+	// 10-fold cross validation over the C (and gamma) grid of train_auto, all folds in parallel, with 100 MB of kernel
+	// rows like the final training
+	ThreadPool &pool = sharedThreadPool();
+	GridSearchResult best = gridSearchSVM(data, labels, linear, 10, params.term_crit.epsilon, maxIter, 100., pool,
+		[](const FoldResult &fold){
+		if (fold.pairComplete)
+			cout << "C = " << fold.C << ", gamma = " << fold.gamma << ": " << fold.pairErrors << " cross-validation errors" << endl;
+	});
+	cout << "best: C = " << best.C << ", gamma = " << best.gamma << ", error = " << best.error
+		<< " (" << best.trainedFolds << " folds trained, " << best.prunedFolds << " pruned, " << best.pairwiseRows
+		<< " distance rows computed)" << endl;
+
+	params.C = best.C;
+	params.gamma = best.gamma;
+
+	// native solver, writes the same file as CvSVM::save
+	SVMModel model;
+	if (!trainSVMModel(data, labels, params, 100., true, model) || !saveSVMModel(filename, model, params))
+		cout << "SVM could not be trained or saved to " << filename << endl;
+}
+
+// colors per responseBucket(): green: response < 0 (label +1 in drawSets), red: response >= 0, darker outside of the margin
+const Vec3b bucketColors[4] = { Vec3b(0, 80, 0), Vec3b(0, 120, 0), Vec3b(0, 0, 120), Vec3b(0, 0, 80) };
 
-	SVM.save(filename);
+Mat colorDecisionMap(const Mat &responses)
+{
+	assert(responses.type() == CV_32FC1);
+
+	Mat map(responses.rows, responses.cols, CV_8UC3);
+	for (int y = 0; y < map.rows; y++)
+	{
+		Vec3b *row = map.ptr<Vec3b>(y);
+		const float *rowResponses = responses.ptr<float>(y);
+		for (int x = 0; x < map.cols; x++)
+			row[x] = bucketColors[responseBucket(rowResponses[x])];
+	}
+	return map;
 }
 
-Mat visualizeSVM(char* filename, const Mat& canvas, const Mat& data, const Mat& labels)
+Mat colorBuckets(const Mat &buckets)
 {
+	assert(buckets.type() == CV_8UC1);
+
+	Mat map(buckets.rows, buckets.cols, CV_8UC3);
+	for (int y = 0; y < map.rows; y++)
+	{
+		Vec3b *row = map.ptr<Vec3b>(y);
+		const uchar *rowBuckets = buckets.ptr<uchar>(y);
+		for (int x = 0; x < map.cols; x++)
+			row[x] = bucketColors[rowBuckets[x]];
+	}
+	return map;
+}
+
+SVMModel loadModel(const char* filename)
+{
+	SVMModel model;
+	if (!loadSVMModel(filename, model))
+	{
+		cout << "SVM file " << filename << " could not be loaded as two-class C_SVC" << endl;
+		getchar();
+		resultWriter().close();
+		exit(-1);
+	}
+	return model;
+}
+
+// fourierFeatures > 0 approximates RBF models with that many random Fourier features
+Mat visualizeSVM(char* filename, const Mat& canvas, const Mat& data, const Mat& labels, int fourierFeatures = 0)
+{
+	PROFILE_SCOPE_PIXELS("visualizeSVM", canvas.total());
 	assert(canvas.type() == CV_8UC3);
-	CvSVM SVM;
-	SVM.load(filename);
+	SVMModel model = loadModel(filename);
+
+	// one sample per pixel, (y, x) as in createSets
+	SampleGrid grid = { canvas.rows, canvas.cols, 0., 0., 1., 1. };
+
+	ThreadPool &pool = sharedThreadPool();
+	if (fourierFeatures > 0 && model.kernelType == CvSVM::RBF)
+	{
+		Mat responses;
+		predictGridFourier(approximateRBF(model, fourierFeatures), grid, responses, pool);
+		return colorDecisionMap(responses);
+	}
+
+	if (model.kernelType == CvSVM::LINEAR)
+	{
+		Mat responses;
+		predictGrid(model, grid, responses, pool);
+		return colorDecisionMap(responses);
+	}
+
+	// kernel models: only refine where the color can change
+	Mat buckets;
+	predictGridBuckets(model, grid, buckets, pool);
+	return colorBuckets(buckets);
+}
+
+// <exe> render <model.xml> <width> <height>
+// renders the 512 x 512 data domain of a model at any resolution, e.g. 3840 2160
+int renderSVM(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cout << "usage: render <model.xml> <width> <height>" << endl;
+		return -1;
+	}
+
+	SVMModel model = loadModel(argv[2]);
+	int width = atoi(argv[3]);
+	int height = atoi(argv[4]);
+
+	SampleGrid grid = { height, width, 0., 0., 512. / height, 512. / width };
+
+	ThreadPool &pool = sharedThreadPool();
+	Mat responses;
+	double start = (double)getTickCount();
+	predictGrid(model, grid, responses, pool);
+	double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	cout << width << "x" << height << " decision map of " << model.supportVectors.rows << " support vectors in "
+		<< seconds * 1000. << " ms (" << pool.size() << " threads)" << endl;
+
+	saveImg("results", "decisionMap_" + to_string(width) + "x" + to_string(height) + ".png", colorDecisionMap(responses));
+
+	return 0;
+}
+
+// <exe> adaptive <model.xml> <width> <height>
+// coarse-to-fine rendering compared against evaluating every pixel
+int renderSVMAdaptive(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cout << "usage: adaptive <model.xml> <width> <height>" << endl;
+		return -1;
+	}
+
+	SVMModel model = loadModel(argv[2]);
+	int width = atoi(argv[3]);
+	int height = atoi(argv[4]);
+
+	SampleGrid grid = { height, width, 0., 0., 512. / height, 512. / width };
+	ThreadPool &pool = sharedThreadPool();
+
+	Mat buckets;
+	double start = (double)getTickCount();
+	AdaptiveStats stats = predictGridBuckets(model, grid, buckets, pool);
+	double adaptiveSeconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	// brute force reference, kernel path for every model type
+	Mat responses(height, width, CV_32FC1);
+	start = (double)getTickCount();
+	for (int y = 0; y < height; y++)
+	{
+		float *row = responses.ptr<float>(y);
+		for (int x = 0; x < width; x++)
+		{
+			float sample[2] = { (float)(grid.y0 + y*grid.dy), (float)(grid.x0 + x*grid.dx) };
+			row[x] = (float)decisionValue(model, sample);
+		}
+	}
+	double bruteForceSeconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	int differentPixels = 0;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			if (buckets.at<uchar>(y, x) != responseBucket(responses.at<float>(y, x)))
+				differentPixels++;
+		}
+	}
+
+	// a bound costs a pass over the support vectors like an evaluation
+	const size_t passes = stats.evaluations + stats.bounds;
+	cout << "adaptive: " << stats.evaluations << " evaluations + " << stats.bounds << " bounds (" << 100. * passes / ((double)width*height)
+		<< "% of " << width*height << " evaluations), " << adaptiveSeconds * 1000. << " ms on " << pool.size() << " threads" << endl;
+	cout << "brute force: " << bruteForceSeconds * 1000. << " ms on 1 thread, " << differentPixels << " different pixels" << endl;
+
+	saveImg("results", "adaptiveDecisionMap_" + to_string(width) + "x" + to_string(height) + ".png", colorBuckets(buckets));
+
+	return differentPixels == 0 ? 0 : -2;
+}
+
+// <exe> fourier <rbf model.xml> [features] [width] [height]
+// exact decision map against random Fourier feature approximations, all feature counts from 16 to 4096 if none is given
+int compareFourier(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		cout << "usage: fourier <rbf model.xml> [features] [width] [height]" << endl;
+		return -1;
+	}
+
+	SVMModel model = loadModel(argv[2]);
+	if (model.kernelType != CvSVM::RBF)
+	{
+		cout << argv[2] << " is no RBF model" << endl;
+		return -2;
+	}
+
+	int features = argc > 3 ? atoi(argv[3]) : 0;
+	int width = argc > 4 ? atoi(argv[4]) : 512;
+	int height = argc > 5 ? atoi(argv[5]) : 512;
+	SampleGrid grid = { height, width, 0., 0., 512. / height, 512. / width };
+	ThreadPool &pool = sharedThreadPool();
+
+	Mat exact;
+	double start = (double)getTickCount();
+	predictGrid(model, grid, exact, pool);
+	double exactSeconds = ((double)getTickCount() - start) / getTickFrequency();
+	cout << "exact: " << model.supportVectors.rows << " support vectors, " << exactSeconds * 1000. << " ms" << endl;
+
+	cout << "features\ttime [ms]\tspeedup\tmax error\tmean error\tlabel changes\tcolor changes" << endl;
+	for (int D = features > 0 ? features : 16; D <= (features > 0 ? features : 4096); D *= 2)
+	{
+		FourierModel fourier = approximateRBF(model, D);
+
+		Mat approximate;
+		start = (double)getTickCount();
+		predictGridFourier(fourier, grid, approximate, pool);
+		double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+		ApproximationError error = compareDecisionMaps(exact, approximate);
+		cout << fourier.features() << "\t" << seconds * 1000. << "\t" << exactSeconds / seconds << "\t" << error.maxError << "\t"
+			<< error.meanError << "\t" << error.labelChanges * 100. << "%\t" << error.bucketChanges * 100. << "%" << endl;
+
+		if (features > 0)
+			saveImg("results", "fourierDecisionMap_" + to_string(fourier.features()) + ".png", colorDecisionMap(approximate));
+	}
+
+	return 0;
+}
+
+// <exe> generate <store.hogs> <count> [dims] [margin] [separable] [seed]
+// streams a set of any size to a feature store, e.g. for the trainers
+int generateStore(int argc, char* argv[])
+{
+	if (argc < 4)
+	{
+		cout << "usage: generate <store.hogs> <count> [dims] [margin] [separable (0/1)] [seed]" << endl;
+		return -1;
+	}
+
+	uint64_t count = strtoull(argv[3], NULL, 10);
+	SetParams params;
+	params.dims = argc > 4 ? atoi(argv[4]) : 2;
+	params.margin = argc > 5 ? atoi(argv[5]) : 50;
+	params.linearSeparable = argc > 6 && atoi(argv[6]) != 0;
+	params.seed = argc > 7 ? strtoull(argv[7], NULL, 10) : 0;
+
+	ThreadPool &pool = sharedThreadPool();
+	double start = (double)getTickCount();
+	if (!writeSetStore(argv[2], params, count, pool))
+	{
+		cout << "set could not be written to " << argv[2] << endl;
+		return -2;
+	}
+	double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+	cout << count << " samples (" << params.dims << " dims) written to '" << argv[2] << "' in " << seconds << " s, "
+		<< count / seconds << " samples/s on " << pool.size() << " threads" << endl;
+
+	return 0;
+}
+
+string binaryModelFilename(const string &filename)
+{
+	return filename.substr(0, filename.rfind('.')) + ".svmb";
+}
+
+// <exe> convert [model.xml ...]
+// writes a binary model (.svmb) next to every CvSVM file, all results\*.xml if none is given
+int convertModels(int argc, char* argv[])
+{
+	vector<string> filenames(argv + 2, argv + argc);
+	if (filenames.empty())
+	{
+		for (const string &filename : listFiles("results", [](const string &name){ return fileExtension(name) == ".xml"; }))
+			filenames.push_back("results\\" + filename);
+	}
+
+	int failed = 0;
+	for (const string &filename : filenames)
+	{
+		SVMModel model;
+		string binaryFilename = binaryModelFilename(filename);
+		if (!loadSVMModel(filename.c_str(), model) || !saveSVMModelBinary(binaryFilename.c_str(), model))
+		{
+			cout << filename << " could not be converted" << endl;
+			failed++;
+			continue;
+		}
+		cout << filename << " -> " << binaryFilename << " (" << model.supportVectors.rows << " support vectors)" << endl;
+	}
+
+	return failed == 0 ? 0 : -2;
+}
+
+// <exe> loadbench <model.xml> [runs]
+// cold start: loading the XML file through CvSVM against mapping the binary file, each followed by one prediction
+int benchmarkModelLoading(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		cout << "usage: loadbench <model.xml> [runs]" << endl;
+		return -1;
+	}
+
+	string filename(argv[2]);
+	string binaryFilename = binaryModelFilename(filename);
+	int runs = argc > 3 ? atoi(argv[3]) : 20;
 
-	Mat newCanvas(canvas.rows, canvas.cols, canvas.type());
-	for (int y = 0; y < newCanvas.rows; y++)
+	SVMModel model = loadModel(filename.c_str());
+	if (!saveSVMModelBinary(binaryFilename.c_str(), model))
 	{
-		Vec3b *row = newCanvas.ptr<Vec3b>(y);
-		for (int x = 0; x < newCanvas.cols; x++)
+		cout << binaryFilename << " could not be written" << endl;
+		return -2;
+	}
+
+	// the prediction touches every support vector, so the mapped pages are really read
+	vector<float> sample(model.varCount(), 256.f);
+	double results[2];
+	double seconds[2];
+	const string files[2] = { filename, binaryFilename };
+	for (int format = 0; format < 2; format++)
+	{
+		double start = (double)getTickCount();
+		for (int r = 0; r < runs; r++)
 		{
-			Mat sampleMat = (Mat_<float>(1, 2) << y, x);
-			float response = SVM.predict(sampleMat, true);
-
-			if (response < 0.)
-			{
-				if (response < -1.)
-					row[x] = Vec3b(0, 80, 0);
-				else
-					row[x] = Vec3b(0, 120, 0);
-			}
-			else if (response >= 0)
-			{
-				if (response > 1.)
-					row[x] = Vec3b(0, 0, 80);
-				else
-					row[x] = Vec3b(0, 0, 120);
-			}
+			SVMModel loaded = loadModel(files[format].c_str());
+			results[format] = decisionValue(loaded, &sample[0]);
 		}
+		seconds[format] = ((double)getTickCount() - start) / getTickFrequency() / runs;
 	}
 
-	return newCanvas;
+	cout << model.supportVectors.rows << " support vectors, " << model.varCount() << " dims" << endl;
+	cout << "XML:    " << seconds[0] * 1000. << " ms per load + prediction" << endl;
+	cout << "binary: " << seconds[1] * 1000. << " ms per load + prediction (" << seconds[0] / seconds[1] << "x faster)" << endl;
+	if (results[0] != results[1])
+		cout << "the decision values differ: " << results[0] << " / " << results[1] << endl;
+
+	return results[0] == results[1] ? 0 : -3;
 }
 
-int main(){
+// <exe> benchmark [max count] [cache MB]
+// trains CvSVM and the native solver on noisy sets of doubling size with the same parameters
+int benchmarkSVM(int argc, char* argv[])
+{
+	int maxCount = argc > 2 ? atoi(argv[2]) : 64000;
+	double cacheSize = argc > 3 ? atof(argv[3]) : 100.;
+
+	CvSVMParams params;
+	params.svm_type = CvSVM::C_SVC;
+	params.kernel_type = CvSVM::RBF;
+	params.C = 2.5;
+	params.gamma = 1e-4;
+	params.term_crit = cvTermCriteria(CV_TERMCRIT_ITER + CV_TERMCRIT_EPS, 100000, 1e-3);
+
+	cout << "count\tCvSVM [s]\tnative [s]\tCvSVM SVs\tnative SVs\tsame labels" << endl;
+	for (int count = 1000; count <= maxCount; count *= 2)
+	{
+		Mat data(count, 2, CV_32FC1), labels(count, 1, CV_32FC1);
+		createSets(data, labels, 50, false, count);
+
+		double start = (double)getTickCount();
+		CvSVM SVM;
+		SVM.train(data, labels, Mat(), Mat(), params);
+		double cvSeconds = ((double)getTickCount() - start) / getTickFrequency();
+
+		start = (double)getTickCount();
+		SVMModel model;
+		trainSVMModel(data, labels, params, cacheSize, true, model);
+		double nativeSeconds = ((double)getTickCount() - start) / getTickFrequency();
+
+		int sameLabels = 0;
+		for (int i = 0; i < count; i++)
+		{
+			float label = decisionValue(model, data.ptr<float>(i)) > 0. ? model.labels[0] : model.labels[1];
+			if (label == SVM.predict(data.row(i)))
+				sameLabels++;
+		}
+
+		cout << count << "\t" << cvSeconds << "\t" << nativeSeconds << "\t" << SVM.get_support_vector_count() << "\t"
+			<< model.supportVectors.rows << "\t" << 100. * sameLabels / count << "%" << endl;
+
+		if (count * 2 > maxCount)
+		{
+			// the largest model goes through the file format and visualizeSVM
+			char* filename = "results\\benchmarkSVM.xml";
+			_mkdir("results");
+			saveSVMModel(filename, model, params);
+			Mat canvas = visualizeSVM(filename, Mat(512, 512, CV_8UC3, Scalar(0, 0, 0)), data, labels);
+			saveImg("results", "benchmarkSVM.jpg", canvas);
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+	int (*command)(int, char**) = NULL;
+	if (argc > 1 && string(argv[1]) == "render")
+		command = renderSVM;
+	if (argc > 1 && string(argv[1]) == "adaptive")
+		command = renderSVMAdaptive;
+	if (argc > 1 && string(argv[1]) == "fourier")
+		command = compareFourier;
+	if (argc > 1 && string(argv[1]) == "generate")
+		command = generateStore;
+	if (argc > 1 && string(argv[1]) == "convert")
+		command = convertModels;
+	if (argc > 1 && string(argv[1]) == "loadbench")
+		command = benchmarkModelLoading;
+	if (argc > 1 && string(argv[1]) == "benchmark")
+		command = benchmarkSVM;
+	if (command != NULL){
+		int result = command(argc, argv);
+		resultWriter().close();
+		return result;
+	}
+
 	// create "results" folder if not already existing
 	struct stat sb;
 	if (!(stat("results", &sb) == 0 && sb.st_mode == S_IFDIR)){
@@ -155,7 +511,7 @@ int main(){
 
 	// Aufgabe 4.1a)
 	Mat dataHard(count, 2, CV_32FC1), labelsHard(count, 1, CV_32FC1);
-	createSets(dataHard, labelsHard, 20, true);
+	createSets(dataHard, labelsHard, 20, true, 1);
 	//Mat &setCanvas = drawSets(black_canvas, data, labels);
 
 	// Aufgabe 4.1b)
@@ -174,7 +530,7 @@ int main(){
 
 	// Aufgabe 4.2a)
 	Mat dataSoft(count, 2, CV_32FC1), labelsSoft(count, 1, CV_32FC1);
-	createSets(dataSoft, labelsSoft, 50, false);
+	createSets(dataSoft, labelsSoft, 50, false, 2);
 	Mat &setCanvasSoft = drawSets(black_canvas, dataSoft, labelsSoft);
 
 	// Aufgabe 4.2b)
@@ -202,5 +558,8 @@ int main(){
 	waitKey();
 	destroyAllWindows();
 
+	resultWriter().close();
+	PROFILE_REPORT("trace.json");
+
 	return 0;
 }
@@ -0,0 +1,279 @@
+#include "modelSelection.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+#include <opencv2\ml\ml.hpp>
+
+#include "svmSolver.h"
+
+using namespace std;
+using namespace cv;
+
+// dot product (linear) or squared distance (RBF) of two samples, summed in double and rounded to float
+static float pairBase(const float* a, const float* b, int varCount, bool linear){
+	double value = 0.;
+	for (int d = 0; d < varCount; d++)
+		value += linear ? (double)a[d] * b[d] : ((double)a[d] - b[d])*((double)a[d] - b[d]);
+	return (float)value;
+}
+
+static double kernelValue(float base, bool linear, double gamma){
+	return linear ? base : exp(-gamma*base);
+}
+
+// rows of pairBase of one sample to all samples, shared by every (C, gamma, fold) job: the least recently used rows are
+// dropped beyond cacheSize MB (at least one row); rows are spread over shards by sample index, each with its own lock,
+// and computed outside of it, two jobs missing the same row at once may both compute it
+class PairwiseRows{
+public:
+	PairwiseRows(const Mat &data, bool linear, double cacheSize, int shardCount)
+		: data(data), linear(linear), shards(fittingShards(data.rows, cacheSize, shardCount)), held(0), peak(0), missCount(0){
+		shardBudget = max((size_t)data.rows * sizeof(float), (size_t)(cacheSize * (1 << 20)) / shards.size());
+	}
+
+	// pairBase(i, j) for all j, valid as long as the pointer is held, even if the cache drops the row
+	shared_ptr<const vector<float>> row(int i){
+		Shard &shard = shards[i % shards.size()];
+		{
+			lock_guard<mutex> lock(shard.mutex);
+			unordered_map<int, Entry>::iterator found = shard.rows.find(i);
+			if (found != shard.rows.end()){
+				shard.lru.splice(shard.lru.end(), shard.lru, found->second.position);
+				return found->second.values;
+			}
+		}
+
+		shared_ptr<vector<float>> values = make_shared<vector<float>>(data.rows);
+		const float* a = data.ptr<float>(i);
+		for (int j = 0; j < data.rows; j++)
+			(*values)[j] = pairBase(a, data.ptr<float>(j), data.cols, linear);
+		const size_t bytes = values->size() * sizeof(float);
+
+		lock_guard<mutex> lock(shard.mutex);
+		unordered_map<int, Entry>::iterator found = shard.rows.find(i);
+		if (found != shard.rows.end())
+			return found->second.values;
+		missCount++;
+
+		while (!shard.lru.empty() && shard.bytes + bytes > shardBudget){
+			shard.rows.erase(shard.lru.front());
+			shard.lru.pop_front();
+			shard.bytes -= bytes;
+			held -= bytes;
+		}
+		Entry entry = { values, shard.lru.insert(shard.lru.end(), i) };
+		shard.rows[i] = entry;
+		shard.bytes += bytes;
+
+		size_t now = held += bytes;
+		size_t before = peak.load();
+		while (now > before && !peak.compare_exchange_weak(before, now)){}
+		return values;
+	}
+
+	// rows computed
+	size_t misses() const{
+		return missCount;
+	}
+
+	// bytes of the rows held at once at most
+	size_t peakBytes() const{
+		return peak;
+	}
+
+private:
+	PairwiseRows(const PairwiseRows&);
+	PairwiseRows& operator=(const PairwiseRows&);
+
+	// no more shards than rows fit, so the cache stays within cacheSize unless that is less than one row
+	static size_t fittingShards(int n, double cacheSize, int shardCount){
+		const size_t fitting = (size_t)(cacheSize * (1 << 20)) / ((size_t)n * sizeof(float));
+		return max((size_t)1, min((size_t)max(1, shardCount), fitting));
+	}
+
+	struct Entry{
+		shared_ptr<const vector<float>> values;
+		list<int>::iterator position;	// in lru
+	};
+
+	struct Shard{
+		Shard() : bytes(0){}
+
+		std::mutex mutex;
+		unordered_map<int, Entry> rows;
+		list<int> lru;					// least recently used first
+		size_t bytes;
+	};
+
+	const Mat &data;
+	bool linear;
+	vector<Shard> shards;
+	size_t shardBudget;
+	atomic<size_t> held, peak, missCount;
+};
+
+// kernel of the training subset of one fold in rows of at most cacheSize MB, computed from the shared rows
+class FoldKernel : public CachedKernel{
+public:
+	FoldKernel(const Mat &data, PairwiseRows &pairwise, const vector<int> &indices, bool linear, double gamma, double cacheSize)
+		: CachedKernel((int)indices.size(), cacheSize), data(data), pairwise(pairwise), indices(indices), linear(linear),
+		gamma(gamma){}
+
+protected:
+	// only the diagonal, from the samples
+	double evaluate(int a, int b) const{
+		return kernelValue(pairBase(data.ptr<float>(indices[a]), data.ptr<float>(indices[b]), data.cols, linear), linear, gamma);
+	}
+
+	void evaluateRow(int a, const int* b, int count, float* values) const{
+		shared_ptr<const vector<float>> base = pairwise.row(indices[a]);
+		for (int t = 0; t < count; t++)
+			values[t] = (float)kernelValue((*base)[indices[b[t]]], linear, gamma);
+	}
+
+private:
+	const Mat &data;
+	PairwiseRows &pairwise;
+	const vector<int> &indices;
+	bool linear;
+	double gamma;
+};
+
+// values from grid.min_val up to (excluding) grid.max_val, the same as CvSVM::train_auto
+static vector<double> gridValues(const CvParamGrid &grid){
+	vector<double> values;
+	for (double v = grid.min_val; v < grid.max_val; v *= grid.step)
+		values.push_back(v);
+	return values;
+}
+
+GridSearchResult gridSearchSVM(const Mat &data, const Mat &labels, bool linear, int kFold, double eps, int maxIter,
+	double cacheSize, ThreadPool &pool, function<void(const FoldResult&)> onFold){
+	assert(data.type() == CV_32FC1);
+	assert(labels.type() == CV_32FC1);
+	assert(labels.rows == data.rows);
+	assert(kFold >= 2 && kFold <= data.rows);
+
+	const int n = data.rows;
+
+	// +1 for the smaller label, as in the decision function of CvSVM
+	float smallerLabel = labels.at<float>(0);
+	for (int i = 1; i < n; i++)
+		smallerLabel = min(smallerLabel, labels.at<float>(i));
+	vector<signed char> y(n);
+	for (int i = 0; i < n; i++)
+		y[i] = labels.at<float>(i) == smallerLabel ? +1 : -1;
+
+	// deterministic shuffle, sample order[k] goes to fold k % kFold
+	vector<int> order(n);
+	iota(order.begin(), order.end(), 0);
+	shuffle(order.begin(), order.end(), mt19937(0));
+	vector<vector<int>> trainIndices(kFold), testIndices(kFold);
+	for (int k = 0; k < n; k++){
+		for (int fold = 0; fold < kFold; fold++)
+			(k % kFold == fold ? testIndices : trainIndices)[fold].push_back(order[k]);
+	}
+
+	vector<double> Cs = gridValues(CvSVM::get_default_grid(CvSVM::C));
+	vector<double> gammas = linear ? vector<double>(1, 1.) : gridValues(CvSVM::get_default_grid(CvSVM::GAMMA));
+	const int pairCount = (int)(Cs.size()*gammas.size());
+	// half of the cache for the rows all jobs share, the other half for the kernel rows of the folds, of which every
+	// worker trains one at a time
+	PairwiseRows pairwise(data, linear, cacheSize / 2, (int)pool.size() * 4);
+	const double foldCacheSize = cacheSize / 2 / pool.size();
+
+	struct PairState{
+		int errors, folds;
+		bool pruned;
+	};
+	vector<PairState> pairs(pairCount);
+	for (PairState &pair : pairs){
+		pair.errors = 0;
+		pair.folds = 0;
+		pair.pruned = false;
+	}
+
+	mutex stateMutex;
+	double bestError = numeric_limits<double>::infinity();
+	int trainedFolds = 0, prunedFolds = 0;
+
+	TaskGroup group(pool);
+	for (int p = 0; p < pairCount; p++){
+		for (int fold = 0; fold < kFold; fold++){
+			group.run([&, p, fold](){
+				{
+					lock_guard<mutex> lock(stateMutex);
+					if (pairs[p].pruned){
+						prunedFolds++;
+						return;
+					}
+				}
+
+				const double C = Cs[p / gammas.size()];
+				const double gamma = gammas[p % gammas.size()];
+				const vector<int> &train = trainIndices[fold];
+				const vector<int> &test = testIndices[fold];
+
+				vector<signed char> yTrain(train.size());
+				for (size_t i = 0; i < train.size(); i++)
+					yTrain[i] = y[train[i]];
+
+				FoldKernel K(data, pairwise, train, linear, gamma, foldCacheSize);
+				SolverResult solution = solveCSVC(K, yTrain, C, eps, maxIter);
+
+				int errors = 0;
+				for (int v : test){
+					shared_ptr<const vector<float>> base = pairwise.row(v);
+					double value = -solution.rho;
+					for (size_t i = 0; i < train.size(); i++){
+						if (solution.alpha[i] > 0.)
+							value += solution.alpha[i] * yTrain[i] * kernelValue((*base)[train[i]], linear, gamma);
+					}
+					if ((value > 0. ? +1 : -1) != y[v])
+						errors++;
+				}
+
+				lock_guard<mutex> lock(stateMutex);
+				PairState &pair = pairs[p];
+				pair.errors += errors;
+				pair.folds++;
+				trainedFolds++;
+
+				FoldResult result = { C, gamma, fold, errors, (int)test.size(), pair.errors, pair.folds, pair.folds == kFold };
+				if (result.pairComplete)
+					bestError = min(bestError, (double)pair.errors / n);
+				if (onFold)
+					onFold(result);
+
+				// errors only grow, a pair that is already worse than a finished one cannot become the best
+				for (PairState &other : pairs){
+					if (other.folds < kFold && (double)other.errors / n > bestError)
+						other.pruned = true;
+				}
+			});
+		}
+	}
+	group.wait();
+
+	// the first pair with the smallest error, pruned pairs are always worse than the best finished one
+	GridSearchResult best = { Cs[0], gammas[0], numeric_limits<double>::infinity(), trainedFolds, prunedFolds,
+		pairwise.misses(), (double)pairwise.peakBytes() / (1 << 20) };
+	for (int p = 0; p < pairCount; p++){
+		if (pairs[p].folds == kFold && (double)pairs[p].errors / n < best.error){
+			best.C = Cs[p / gammas.size()];
+			best.gamma = gammas[p % gammas.size()];
+			best.error = (double)pairs[p].errors / n;
+		}
+	}
+	return best;
+}
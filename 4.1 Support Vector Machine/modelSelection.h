@@ -0,0 +1,35 @@
+#pragma once
+
+#include <functional>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\threadPool.h"
+
+struct GridSearchResult{
+	double C, gamma;
+	double error;				// cross-validation error rate
+	int trainedFolds;
+	int prunedFolds;
+	size_t pairwiseRows;		// rows of distances or dot products computed for the shared cache
+	double peakPairwiseSize;	// MB the shared cache held at most
+};
+
+// reported for every finished fold
+struct FoldResult{
+	double C, gamma;
+	int fold;
+	int errors, samples;		// of this fold
+	int pairErrors, pairFolds;	// of all folds of this (C, gamma) pair finished so far
+	bool pairComplete;
+};
+
+// k-fold cross-validated grid search over C (and gamma for RBF) on the default CvSVM grids, replaces CvSVM::train_auto
+// every (C, gamma, fold) is one job on the pool; the squared distances (RBF) or dot products (linear) of a sample to all
+// others are computed once into rows shared by all jobs, which apply the kernel of their gamma to them: half of cacheSize
+// MB holds the least recently used of these rows, the other half the kernel rows of the folds trained at the same time,
+// however many samples there are (a matrix of all sample pairs would need n^2 floats)
+// onFold is called (serialized, from the worker threads) as soon as a fold is finished
+// a pair whose errors so far already exceed the error of the best finished pair cannot win, its remaining folds are skipped
+GridSearchResult gridSearchSVM(const cv::Mat &data, const cv::Mat &labels, bool linear, int kFold, double eps, int maxIter,
+	double cacheSize, ThreadPool &pool, std::function<void(const FoldResult&)> onFold);
@@ -0,0 +1,529 @@
+#include "svmModel.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <fstream>
+
+#include "..\Common\linearModel.h"
+#include "..\Common\mappedFile.h"
+
+using namespace std;
+using namespace cv;
+
+// w = sum_i alpha_i * sv_i of linear models
+static void computeLinearWeights(SVMModel &model){
+	model.w = Mat::zeros(1, model.varCount(), CV_64FC1);
+	double* w = model.w.ptr<double>(0);
+	for (int i = 0; i < model.supportVectors.rows; i++){
+		const float* sv_i = model.supportVectors.ptr<float>(i);
+		for (int d = 0; d < model.varCount(); d++)
+			w[d] += model.alpha.at<double>(i) * sv_i[d];
+	}
+}
+
+// the decision function of CvSVM is protected, this gives read access to it
+class CvSVMAccess : public CvSVM{
+public:
+	bool copyTo(SVMModel &model) const{
+		if (params.svm_type != CvSVM::C_SVC || class_labels == NULL || class_labels->cols != 2 || decision_func == NULL)
+			return false;
+
+		const CvSVMDecisionFunc &df = decision_func[0];
+
+		model.kernelType = params.kernel_type;
+		model.gamma = params.gamma;
+		model.coef0 = params.coef0;
+		model.degree = params.degree;
+		model.rho = df.rho;
+		model.labels[0] = (float)class_labels->data.i[0];
+		model.labels[1] = (float)class_labels->data.i[1];
+
+		model.supportVectors.create(df.sv_count, var_count, CV_32FC1);
+		model.alpha.create(df.sv_count, 1, CV_64FC1);
+		for (int i = 0; i < df.sv_count; i++){
+			const float* sv_i = sv[df.sv_index ? df.sv_index[i] : i];
+			copy(sv_i, sv_i + var_count, model.supportVectors.ptr<float>(i));
+			model.alpha.at<double>(i) = df.alpha[i];
+		}
+
+		model.w.release();
+		if (model.kernelType == CvSVM::LINEAR)
+			computeLinearWeights(model);
+		return true;
+	}
+};
+
+// plain w, b: score > 0 is the larger label, so f = -score
+static bool loadLinearWeightsModel(const char* filename, SVMModel &model){
+	LinearWeights weights;
+	if (!loadLinearWeights(filename, weights))
+		return false;
+
+	const int varCount = (int)weights.w.size();
+	model.kernelType = CvSVM::LINEAR;
+	model.gamma = model.coef0 = model.degree = 0.;
+	model.rho = weights.b;
+	model.labels[0] = weights.labels[0];
+	model.labels[1] = weights.labels[1];
+
+	model.w.create(1, varCount, CV_64FC1);
+	model.supportVectors.create(1, varCount, CV_32FC1);
+	for (int d = 0; d < varCount; d++){
+		model.w.at<double>(d) = -weights.w[d];
+		model.supportVectors.at<float>(d) = (float)-weights.w[d];
+	}
+	model.alpha = Mat::ones(1, 1, CV_64FC1);
+	return true;
+}
+
+const uint32_t SVM_BINARY_VERSION = 1;
+
+bool saveSVMModelBinary(const char* filename, const SVMModel &model){
+	ofstream file(filename, ios::binary | ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	SVMBinaryHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "SVMB", 4);
+	header.version = SVM_BINARY_VERSION;
+	header.kernelType = model.kernelType;
+	header.varCount = model.varCount();
+	header.svCount = model.supportVectors.rows;
+	header.svStride = (model.varCount() + 3) / 4 * 4;
+	header.labels[0] = model.labels[0];
+	header.labels[1] = model.labels[1];
+	header.gamma = model.gamma;
+	header.coef0 = model.coef0;
+	header.degree = model.degree;
+	header.rho = model.rho;
+	file.write((const char*)&header, sizeof(header));
+
+	vector<float> row(header.svStride, 0.f);
+	for (int i = 0; i < header.svCount; i++){
+		const float* sv_i = model.supportVectors.ptr<float>(i);
+		copy(sv_i, sv_i + header.varCount, row.begin());
+		file.write((const char*)&row[0], row.size() * sizeof(float));
+	}
+	for (int i = 0; i < header.svCount; i++){
+		double alpha_i = model.alpha.at<double>(i);
+		file.write((const char*)&alpha_i, sizeof(alpha_i));
+	}
+	return (bool)file;
+}
+
+static bool loadSVMModelBinary(const char* filename, SVMModel &model){
+	shared_ptr<MappedFile> mapping(new MappedFile());
+	if (!mapping->open(filename) || mapping->size() < sizeof(SVMBinaryHeader))
+		return false;
+
+	const SVMBinaryHeader &header = *(const SVMBinaryHeader*)mapping->data();
+	if (memcmp(header.magic, "SVMB", 4) != 0 || header.version != SVM_BINARY_VERSION || header.varCount <= 0
+		|| header.svCount < 0 || header.svStride < header.varCount || header.svStride % 4 != 0)
+		return false;
+
+	const size_t svBytes = (size_t)header.svCount * header.svStride * sizeof(float);
+	if (mapping->size() < sizeof(SVMBinaryHeader) + svBytes + header.svCount * sizeof(double))
+		return false;
+
+	model.kernelType = header.kernelType;
+	model.gamma = header.gamma;
+	model.coef0 = header.coef0;
+	model.degree = header.degree;
+	model.rho = header.rho;
+	model.labels[0] = header.labels[0];
+	model.labels[1] = header.labels[1];
+
+	// Mat headers on the mapped data, no copy
+	uchar* data = (uchar*)mapping->data() + sizeof(SVMBinaryHeader);
+	model.supportVectors = Mat(header.svCount, header.varCount, CV_32FC1, data, header.svStride * sizeof(float));
+	model.alpha = Mat(header.svCount, 1, CV_64FC1, data + svBytes);
+	model.mapping = mapping;
+
+	model.w.release();
+	if (model.kernelType == CvSVM::LINEAR)
+		computeLinearWeights(model);
+	return true;
+}
+
+static string fileMagic(const char* filename){
+	char magic[4] = { 0, 0, 0, 0 };
+	ifstream file(filename, ios::binary);
+	file.read(magic, 4);
+	return string(magic, 4);
+}
+
+bool loadSVMModel(const char* filename, SVMModel &model){
+	// Mats on a previous mapping must not be reused
+	model.supportVectors.release();
+	model.alpha.release();
+	model.mapping.reset();
+
+	string magic = fileMagic(filename);
+	if (magic == "SVMB")
+		return loadSVMModelBinary(filename, model);
+	if (magic == "LSVM")
+		return loadLinearWeightsModel(filename, model);
+
+	CvSVMAccess SVM;
+	SVM.load(filename);
+	return SVM.copyTo(model);
+}
+
+static const char* kernelName(int kernelType){
+	switch (kernelType){
+	case CvSVM::POLY:
+		return "POLY";
+	case CvSVM::RBF:
+		return "RBF";
+	case CvSVM::SIGMOID:
+		return "SIGMOID";
+	default:
+		return "LINEAR";
+	}
+}
+
+// same nodes as CvSVM::write
+bool saveSVMModel(const char* filename, const SVMModel &model, const CvSVMParams &params){
+	FileStorage fs(filename, FileStorage::WRITE);
+	if (!fs.isOpened())
+		return false;
+
+	CvFileStorage* storage = *fs;
+	const int svCount = model.supportVectors.rows;
+
+	cvStartWriteStruct(storage, "my_svm", CV_NODE_MAP, CV_TYPE_NAME_ML_SVM);
+	cvWriteString(storage, "svm_type", "C_SVC");
+
+	cvStartWriteStruct(storage, "kernel", CV_NODE_MAP + CV_NODE_FLOW);
+	cvWriteString(storage, "type", kernelName(model.kernelType));
+	if (model.kernelType == CvSVM::POLY)
+		cvWriteReal(storage, "degree", model.degree);
+	if (model.kernelType != CvSVM::LINEAR)
+		cvWriteReal(storage, "gamma", model.gamma);
+	if (model.kernelType == CvSVM::POLY || model.kernelType == CvSVM::SIGMOID)
+		cvWriteReal(storage, "coef0", model.coef0);
+	cvEndWriteStruct(storage);
+
+	cvWriteReal(storage, "C", params.C);
+
+	cvStartWriteStruct(storage, "term_criteria", CV_NODE_MAP + CV_NODE_FLOW);
+	if (params.term_crit.type & CV_TERMCRIT_EPS)
+		cvWriteReal(storage, "epsilon", params.term_crit.epsilon);
+	if (params.term_crit.type & CV_TERMCRIT_ITER)
+		cvWriteInt(storage, "iterations", params.term_crit.max_iter);
+	cvEndWriteStruct(storage);
+
+	cvWriteInt(storage, "var_all", model.varCount());
+	cvWriteInt(storage, "var_count", model.varCount());
+	cvWriteInt(storage, "class_count", 2);
+
+	int labels[2] = { cvRound(model.labels[0]), cvRound(model.labels[1]) };
+	CvMat classLabels = cvMat(1, 2, CV_32SC1, labels);
+	cvWrite(storage, "class_labels", &classLabels);
+
+	cvWriteInt(storage, "sv_total", svCount);
+	cvStartWriteStruct(storage, "support_vectors", CV_NODE_SEQ);
+	for (int i = 0; i < svCount; i++){
+		cvStartWriteStruct(storage, 0, CV_NODE_SEQ + CV_NODE_FLOW);
+		cvWriteRawData(storage, model.supportVectors.ptr<float>(i), model.varCount(), "f");
+		cvEndWriteStruct(storage);
+	}
+	cvEndWriteStruct(storage);
+
+	vector<int> index(svCount);
+	for (int i = 0; i < svCount; i++)
+		index[i] = i;
+
+	cvStartWriteStruct(storage, "decision_functions", CV_NODE_SEQ);
+	cvStartWriteStruct(storage, 0, CV_NODE_MAP);
+	cvWriteInt(storage, "sv_count", svCount);
+	cvWriteReal(storage, "rho", model.rho);
+	cvStartWriteStruct(storage, "alpha", CV_NODE_SEQ + CV_NODE_FLOW);
+	cvWriteRawData(storage, model.alpha.ptr<double>(0), svCount, "d");
+	cvEndWriteStruct(storage);
+	cvStartWriteStruct(storage, "index", CV_NODE_SEQ + CV_NODE_FLOW);
+	cvWriteRawData(storage, index.data(), svCount, "i");
+	cvEndWriteStruct(storage);
+	cvEndWriteStruct(storage);
+	cvEndWriteStruct(storage);
+
+	cvEndWriteStruct(storage);
+	return true;
+}
+
+double kernel(int kernelType, double gamma, double coef0, double degree, const float* a, const float* b, int varCount){
+	if (kernelType == CvSVM::RBF){
+		double dist = 0.;
+		for (int d = 0; d < varCount; d++){
+			double diff = a[d] - b[d];
+			dist += diff*diff;
+		}
+		return exp(-gamma*dist);
+	}
+
+	double dot = 0.;
+	for (int d = 0; d < varCount; d++)
+		dot += (double)a[d] * b[d];
+
+	switch (kernelType){
+	case CvSVM::POLY:
+		return pow(gamma*dot + coef0, degree);
+	case CvSVM::SIGMOID:
+		return tanh(gamma*dot + coef0);
+	default:
+		return dot;
+	}
+}
+
+double kernel(const SVMModel &model, const float* a, const float* b){
+	return kernel(model.kernelType, model.gamma, model.coef0, model.degree, a, b, model.varCount());
+}
+
+double decisionValue(const SVMModel &model, const float* sample){
+	if (model.kernelType == CvSVM::LINEAR){
+		const double* w = model.w.ptr<double>(0);
+		double value = -model.rho;
+		for (int d = 0; d < model.varCount(); d++)
+			value += w[d] * sample[d];
+		return value;
+	}
+
+	const double* alpha = model.alpha.ptr<double>(0);
+	double value = -model.rho;
+	for (int i = 0; i < model.supportVectors.rows; i++)
+		value += alpha[i] * kernel(model, model.supportVectors.ptr<float>(i), sample);
+	return value;
+}
+
+// rows per task: enough tasks to balance, few enough to keep the queue short
+static int bandRows(int rows, const ThreadPool &pool){
+	return max(1, rows / (int)(pool.size() * 8));
+}
+
+void predictBatch(const SVMModel &model, const Mat &samples, Mat &responses, ThreadPool &pool){
+	assert(samples.type() == CV_32FC1);
+	assert(samples.cols == model.varCount());
+
+	responses.create(samples.rows, 1, CV_32FC1);
+	Mat &out = responses;
+
+	TaskGroup group(pool);
+	int band = bandRows(samples.rows, pool);
+	for (int y0 = 0; y0 < samples.rows; y0 += band){
+		int y1 = min(samples.rows, y0 + band);
+		group.run([&model, &samples, &out, y0, y1](){
+			for (int y = y0; y < y1; y++)
+				out.at<float>(y) = (float)decisionValue(model, samples.ptr<float>(y));
+		});
+	}
+	group.wait();
+}
+
+void predictGrid(const SVMModel &model, const SampleGrid &grid, Mat &responses, ThreadPool &pool){
+	assert(model.varCount() == 2);
+
+	responses.create(grid.rows, grid.cols, CV_32FC1);
+	Mat &out = responses;
+
+	TaskGroup group(pool);
+	int band = bandRows(grid.rows, pool);
+	for (int r0 = 0; r0 < grid.rows; r0 += band){
+		int r1 = min(grid.rows, r0 + band);
+
+		if (model.kernelType == CvSVM::LINEAR){
+			// f(y, x) is a plane: one add per sample along a row
+			group.run([&model, &grid, &out, r0, r1](){
+				const double* w = model.w.ptr<double>(0);
+				const double step = w[1] * grid.dx;
+				for (int r = r0; r < r1; r++){
+					float* row = out.ptr<float>(r);
+					double value = w[0] * (grid.y0 + r*grid.dy) + w[1] * grid.x0 - model.rho;
+					for (int c = 0; c < grid.cols; c++){
+						row[c] = (float)value;
+						value += step;
+					}
+				}
+			});
+		}
+		else{
+			group.run([&model, &grid, &out, r0, r1](){
+				float sample[2];
+				for (int r = r0; r < r1; r++){
+					float* row = out.ptr<float>(r);
+					sample[0] = (float)(grid.y0 + r*grid.dy);
+					for (int c = 0; c < grid.cols; c++){
+						sample[1] = (float)(grid.x0 + c*grid.dx);
+						row[c] = (float)decisionValue(model, sample);
+					}
+				}
+			});
+		}
+	}
+	group.wait();
+}
+
+int responseBucket(float response){
+	if (response < 0.f)
+		return response < -1.f ? 0 : 1;
+	return response > 1.f ? 3 : 2;
+}
+
+// distance of a response to the nearest bucket boundary (-1, 0, 1)
+static double bucketMargin(float response){
+	return min(min(abs(response + 1.), abs((double)response)), abs(response - 1.));
+}
+
+double lipschitzBound(const SVMModel &model, const float* center, double radius){
+	if (model.kernelType == CvSVM::LINEAR)
+		return norm(model.w);
+
+	if (model.kernelType == CvSVM::RBF){
+		// |grad exp(-gamma r^2)| = g(r) = 2 gamma r exp(-gamma r^2), rising up to r = 1/sqrt(2 gamma) and falling after that
+		// a support vector at distance d from the center is between d - radius and d + radius away from any point of the ball
+		const double peak = 1. / sqrt(2.*model.gamma);
+		const double* alpha = model.alpha.ptr<double>(0);
+
+		double bound = 0.;
+		for (int i = 0; i < model.supportVectors.rows; i++){
+			const float* sv_i = model.supportVectors.ptr<float>(i);
+			double d = 0.;
+			for (int k = 0; k < model.varCount(); k++)
+				d += ((double)sv_i[k] - center[k])*((double)sv_i[k] - center[k]);
+			d = sqrt(d);
+
+			double r = min(max(peak, d - radius), d + radius);
+			bound += abs(alpha[i]) * 2.*model.gamma*r*exp(-model.gamma*r*r);
+		}
+		return bound;
+	}
+
+	return numeric_limits<double>::infinity();
+}
+
+// one coarse block [r0, r1] x [c0, c1] (corners included) of predictGridBuckets
+// values are cached per block, so neighbouring tasks never write the same memory;
+// the block owns the pixels [r0, r1[ x [c0, c1[ plus the last row / column of the grid
+class AdaptiveBlock{
+public:
+	AdaptiveBlock(const SVMModel &model, const SampleGrid &grid, Mat &buckets, int r0, int r1, int c0, int c1)
+		: model(model), grid(grid), buckets(buckets), r0(r0), r1(r1), c0(c0), c1(c1){
+		stats.evaluations = 0;
+		stats.bounds = 0;
+		values.assign((size_t)(r1 - r0 + 1)*(c1 - c0 + 1), numeric_limits<float>::quiet_NaN());
+		ownR1 = (r1 == grid.rows - 1) ? r1 : r1 - 1;
+		ownC1 = (c1 == grid.cols - 1) ? c1 : c1 - 1;
+	}
+
+	AdaptiveStats render(){
+		refine(r0, r1, c0, c1);
+		return stats;
+	}
+
+private:
+	float value(int r, int c){
+		float &v = values[(size_t)(r - r0)*(c1 - c0 + 1) + (c - c0)];
+		if (v != v){
+			float sample[2] = { (float)(grid.y0 + r*grid.dy), (float)(grid.x0 + c*grid.dx) };
+			v = (float)decisionValue(model, sample);
+			stats.evaluations++;
+		}
+		return v;
+	}
+
+	void fill(int top, int bottom, int left, int right, uchar bucket){
+		for (int r = max(top, r0); r <= min(bottom, ownR1); r++){
+			uchar* row = buckets.ptr<uchar>(r);
+			for (int c = max(left, c0); c <= min(right, ownC1); c++)
+				row[c] = bucket;
+		}
+	}
+
+	void refine(int top, int bottom, int left, int right){
+		const int corners[4][2] = { { top, left }, { top, right }, { bottom, left }, { bottom, right } };
+
+		float v = value(top, left);
+		int bucket = responseBucket(v);
+		double margin = bucketMargin(v) - 1e-6*(1. + abs(v));
+		bool uniform = true;
+		for (int k = 1; k < 4; k++){
+			float corner = value(corners[k][0], corners[k][1]);
+			uniform = uniform && responseBucket(corner) == bucket;
+			margin = min(margin, bucketMargin(corner) - 1e-6*(1. + abs(corner)));
+		}
+
+		double height = (bottom - top)*abs(grid.dy);
+		double width = (right - left)*abs(grid.dx);
+		double halfDiagonal = 0.5*sqrt(height*height + width*width);
+		float center[2] = { (float)(grid.y0 + 0.5*(top + bottom)*grid.dy), (float)(grid.x0 + 0.5*(left + right)*grid.dx) };
+
+		// every pixel of the block is at most halfDiagonal away from one of its corners
+		if (uniform){
+			stats.bounds++;
+			if (margin > lipschitzBound(model, center, halfDiagonal)*halfDiagonal){
+				fill(top, bottom, left, right, (uchar)bucket);
+				return;
+			}
+		}
+
+		if (bottom - top <= 1 && right - left <= 1){
+			for (int k = 0; k < 4; k++)
+				fill(corners[k][0], corners[k][0], corners[k][1], corners[k][1], (uchar)responseBucket(value(corners[k][0], corners[k][1])));
+			return;
+		}
+
+		int midRow = (top + bottom) / 2;
+		int midCol = (left + right) / 2;
+		if (bottom - top <= 1){
+			refine(top, bottom, left, midCol);
+			refine(top, bottom, midCol, right);
+		}
+		else if (right - left <= 1){
+			refine(top, midRow, left, right);
+			refine(midRow, bottom, left, right);
+		}
+		else{
+			refine(top, midRow, left, midCol);
+			refine(top, midRow, midCol, right);
+			refine(midRow, bottom, left, midCol);
+			refine(midRow, bottom, midCol, right);
+		}
+	}
+
+	const SVMModel &model;
+	const SampleGrid &grid;
+	Mat &buckets;
+	int r0, r1, c0, c1;
+	int ownR1, ownC1;
+	vector<float> values;
+	AdaptiveStats stats;
+};
+
+AdaptiveStats predictGridBuckets(const SVMModel &model, const SampleGrid &grid, Mat &buckets, ThreadPool &pool, int coarseStep){
+	assert(model.varCount() == 2);
+	assert(coarseStep >= 1);
+
+	buckets.create(grid.rows, grid.cols, CV_8UC1);
+	Mat &out = buckets;
+	atomic<size_t> evaluations(0), bounds(0);
+	TaskGroup group(pool);
+	for (int r0 = 0; r0 < max(1, grid.rows - 1); r0 += coarseStep){
+		int r1 = min(grid.rows - 1, r0 + coarseStep);
+		for (int c0 = 0; c0 < max(1, grid.cols - 1); c0 += coarseStep){
+			int c1 = min(grid.cols - 1, c0 + coarseStep);
+			group.run([&model, &grid, &out, &evaluations, &bounds, r0, r1, c0, c1](){
+				AdaptiveBlock block(model, grid, out, r0, r1, c0, c1);
+				AdaptiveStats stats = block.render();
+				evaluations += stats.evaluations;
+				bounds += stats.bounds;
+			});
+		}
+	}
+	group.wait();
+
+	AdaptiveStats stats = { evaluations, bounds };
+	return stats;
+}
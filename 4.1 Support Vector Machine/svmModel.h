@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\ml\ml.hpp>
+
+#include "..\Common\threadPool.h"
+
+class MappedFile;
+
+// plain copy of a trained two-class CvSVM: f(x) = sum_i alpha_i * K(sv_i, x) - rho
+// f(x) is the value CvSVM::predict(x, true) returns, f(x) > 0 is classified as labels[0], otherwise labels[1]
+struct SVMModel{
+	int kernelType;				// CvSVM::LINEAR, POLY, RBF or SIGMOID
+	double gamma, coef0, degree;
+	double rho;
+	cv::Mat supportVectors;		// svCount x varCount, CV_32FC1
+	cv::Mat alpha;				// svCount x 1, CV_64FC1
+	float labels[2];
+
+	// only for LINEAR: sum_i alpha_i * sv_i, so f(x) = w.x - rho
+	cv::Mat w;					// 1 x varCount, CV_64FC1
+
+	// binary models: supportVectors and alpha point into this read-only mapping, they must not be written
+	std::shared_ptr<MappedFile> mapping;
+
+	int varCount() const{
+		return supportVectors.cols;
+	}
+};
+
+// a regular 2D grid of samples, sample (row, col) = (y0 + row*dy, x0 + col*dx)
+// the feature order (y, x) is the one createSets and visualizeSVM use
+struct SampleGrid{
+	int rows, cols;
+	double y0, x0;
+	double dy, dx;
+};
+
+// binary model file (.svmb), loaded by memory mapping it, without any parsing:
+//   SVMBinaryHeader (64 bytes)
+//   support vectors: svCount rows of svStride floats (a multiple of 4, so every row is 16 byte aligned), zero padded
+//   alpha: svCount doubles
+struct SVMBinaryHeader{
+	char magic[4];			// "SVMB"
+	uint32_t version;
+	int32_t kernelType;
+	int32_t varCount;
+	int32_t svCount;
+	int32_t svStride;		// floats per support vector
+	float labels[2];
+	double gamma, coef0, degree;
+	double rho;
+};
+
+static_assert(sizeof(SVMBinaryHeader) == 64, "binary SVM header must be 64 bytes");
+
+bool saveSVMModelBinary(const char* filename, const SVMModel &model);
+
+// CvSVM files, binary models (.svmb) or plain linear models (.lsvm) of the streaming trainer, told apart by their content
+bool loadSVMModel(const char* filename, SVMModel &model);
+
+// writes the model in the format of CvSVM::save, so CvSVM::load and loadSVMModel read it back
+// C and the termination criteria only go into the file, as CvSVM stores them
+bool saveSVMModel(const char* filename, const SVMModel &model, const CvSVMParams &params);
+
+// kernel of the given CvSVM kernel type between two vectors of length varCount
+double kernel(int kernelType, double gamma, double coef0, double degree, const float* a, const float* b, int varCount);
+
+// kernel between two vectors of length varCount
+double kernel(const SVMModel &model, const float* a, const float* b);
+
+// decision value of a single sample (varCount floats)
+double decisionValue(const SVMModel &model, const float* sample);
+
+// decision values of all rows of samples (n x varCount, CV_32FC1) into responses (n x 1, CV_32FC1)
+// rows are split over the pool, nothing is allocated per sample
+void predictBatch(const SVMModel &model, const cv::Mat &samples, cv::Mat &responses, ThreadPool &pool);
+
+// decision values of a 2D grid into responses (grid.rows x grid.cols, CV_32FC1)
+// linear models evaluate the plane incrementally (one add per sample), kernel models split the rows over the pool
+void predictGrid(const SVMModel &model, const SampleGrid &grid, cv::Mat &responses, ThreadPool &pool);
+
+// color classes of visualizeSVM: 0: f < -1, 1: -1 <= f < 0, 2: 0 <= f <= 1, 3: f > 1
+int responseBucket(float response);
+
+// upper bound of |grad f| inside the ball of the given radius around center, infinite if there is none for the kernel type
+double lipschitzBound(const SVMModel &model, const float* center, double radius);
+
+// responseBucket() of every grid sample (grid.rows x grid.cols, CV_8UC1), identical to bucketing decisionValue() of every sample
+// the decision function is evaluated on a coarse lattice; a block is only refined if the bound on the change of f
+// inside of it (lipschitzBound * half diagonal) allows a pixel to have another bucket than its corners
+// the work done: for kernel models a bound is a pass over the support vectors like an evaluation, so evaluations + bounds
+// compares with the rows * cols evaluations of predictGrid
+struct AdaptiveStats{
+	size_t evaluations;		// of the decision function
+	size_t bounds;			// lipschitzBound calls
+};
+AdaptiveStats predictGridBuckets(const SVMModel &model, const SampleGrid &grid, cv::Mat &buckets, ThreadPool &pool, int coarseStep = 32);
@@ -0,0 +1,503 @@
+#include "svmSolver.h"
+
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+CachedKernel::CachedKernel(int size, double cacheSize)
+	: n(size), order(size), rows(size), rowMisses(0), rowRequests(0){
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+	budget = max((size_t)(cacheSize * (1 << 20) / sizeof(float)), 2 * (size_t)n);
+}
+
+int CachedKernel::size() const{
+	return n;
+}
+
+const float* CachedKernel::row(int i, int length){
+	rowRequests++;
+
+	Row &r = rows[i];
+	int valid = (int)r.data.size();
+	if (valid > 0)
+		lru.erase(r.position);
+
+	if (valid < length){
+		rowMisses++;
+		size_t more = length - valid;
+		while (budget < more)
+			release(lru.front());
+		budget -= more;
+
+		r.data.resize(length);
+		evaluateRow(order[i], &order[valid], length - valid, &r.data[valid]);
+	}
+
+	r.position = lru.insert(lru.end(), i);
+	return r.data.data();
+}
+
+void CachedKernel::evaluateRow(int a, const int* b, int count, float* values) const{
+	for (int t = 0; t < count; t++)
+		values[t] = (float)evaluate(a, b[t]);
+}
+
+double CachedKernel::diagonal(int i){
+	return evaluate(order[i], order[i]);
+}
+
+void CachedKernel::release(int i){
+	Row &r = rows[i];
+	budget += r.data.size();
+	lru.erase(r.position);
+	vector<float>().swap(r.data);
+}
+
+// exchanges the variables i and j: their rows and columns i, j of every cached row
+// rows that contain i but not j cannot be fixed and are dropped
+void CachedKernel::swapIndex(int i, int j){
+	if (i == j)
+		return;
+
+	swap(order[i], order[j]);
+	swap(rows[i].data, rows[j].data);
+	swap(rows[i].position, rows[j].position);
+	if (!rows[i].data.empty())
+		*rows[i].position = i;
+	if (!rows[j].data.empty())
+		*rows[j].position = j;
+
+	if (i > j)
+		swap(i, j);
+	for (list<int>::iterator it = lru.begin(); it != lru.end();){
+		int index = *it++;
+		vector<float> &data = rows[index].data;
+		if ((int)data.size() > i){
+			if ((int)data.size() > j)
+				swap(data[i], data[j]);
+			else
+				release(index);
+		}
+	}
+}
+
+SampleKernel::SampleKernel(const Mat &data, const CvSVMParams &params, double cacheSize)
+	: CachedKernel(data.rows, cacheSize), data(data), params(params){
+	assert(data.type() == CV_32FC1);
+}
+
+double SampleKernel::evaluate(int a, int b) const{
+	return kernel(params.kernel_type, params.gamma, params.coef0, params.degree, data.ptr<float>(a), data.ptr<float>(b), data.cols);
+}
+
+static const double TAU = 1e-12;
+
+// LIBSVM's Solver restricted to C-SVC (p_i = -1, C_i = C)
+// variables that are shrunk are moved behind activeSize; G is only kept up to date for the active ones, Gbar
+// (the gradient part of the variables at the upper bound) allows to reconstruct the others
+class CSVCSolver{
+public:
+	CSVCSolver(KernelSource &K, const vector<signed char> &y, double C, bool shrinking)
+		: K(K), y(y), C(C), n(K.size()), alpha(n, 0.), G(n, -1.), Gbar(n, 0.), QD(n), activeSet(n), activeSize(n),
+		shrinking(shrinking), unshrink(false){
+		for (int i = 0; i < n; i++){
+			QD[i] = K.diagonal(i);
+			activeSet[i] = i;
+		}
+	}
+
+	SolverResult solve(double eps, int maxIter){
+		SolverResult result;
+		result.iterations = 0;
+
+		int counter = min(n, 1000) + 1;
+		while (result.iterations < maxIter){
+			if (--counter == 0){
+				counter = min(n, 1000);
+				if (shrinking)
+					shrink(eps);
+			}
+
+			int i, j;
+			if (!selectWorkingSet(eps, i, j)){
+				// optimal on the active set, check all variables
+				reconstructGradient();
+				activeSize = n;
+				if (!selectWorkingSet(eps, i, j))
+					break;
+				counter = 1;
+			}
+
+			update(i, j);
+			result.iterations++;
+		}
+
+		if (activeSize < n){
+			reconstructGradient();
+			activeSize = n;
+		}
+
+		result.rho = calculateRho();
+		result.alpha.resize(n);
+		for (int t = 0; t < n; t++)
+			result.alpha[activeSet[t]] = alpha[t];
+		return result;
+	}
+
+private:
+	bool isUpperBound(int t) const{ return alpha[t] >= C; }
+	bool isLowerBound(int t) const{ return alpha[t] <= 0.; }
+	bool isFree(int t) const{ return !isUpperBound(t) && !isLowerBound(t); }
+
+	// i maximizes -y_i G_i over I_up, j is the partner with the largest decrease of the second order approximation
+	bool selectWorkingSet(double eps, int &outI, int &outJ){
+		double Gmax = -numeric_limits<double>::infinity();
+		double Gmax2 = -numeric_limits<double>::infinity();
+		int GmaxIdx = -1;
+		int GminIdx = -1;
+		double objDiffMin = numeric_limits<double>::infinity();
+
+		for (int t = 0; t < activeSize; t++){
+			if (y[t] == +1){
+				if (!isUpperBound(t) && -G[t] >= Gmax){
+					Gmax = -G[t];
+					GmaxIdx = t;
+				}
+			}
+			else{
+				if (!isLowerBound(t) && G[t] >= Gmax){
+					Gmax = G[t];
+					GmaxIdx = t;
+				}
+			}
+		}
+		if (GmaxIdx == -1)
+			return false;
+
+		int i = GmaxIdx;
+		const float* Ki = K.row(i, activeSize);
+
+		for (int t = 0; t < activeSize; t++){
+			double gradDiff;
+			if (y[t] == +1){
+				if (isLowerBound(t))
+					continue;
+				gradDiff = Gmax + G[t];
+				Gmax2 = max(Gmax2, G[t]);
+			}
+			else{
+				if (isUpperBound(t))
+					continue;
+				gradDiff = Gmax - G[t];
+				Gmax2 = max(Gmax2, -G[t]);
+			}
+
+			if (gradDiff > 0.){
+				double quadCoef = QD[i] + QD[t] - 2.*Ki[t];
+				double objDiff = -(gradDiff*gradDiff) / (quadCoef > 0. ? quadCoef : TAU);
+				if (objDiff <= objDiffMin){
+					GminIdx = t;
+					objDiffMin = objDiff;
+				}
+			}
+		}
+
+		if (Gmax + Gmax2 < eps || GminIdx == -1)
+			return false;
+
+		outI = i;
+		outJ = GminIdx;
+		return true;
+	}
+
+	void update(int i, int j){
+		const float* Ki = K.row(i, activeSize);
+		const float* Kj = K.row(j, activeSize);
+
+		double oldAlphaI = alpha[i];
+		double oldAlphaJ = alpha[j];
+		bool wasUpperI = isUpperBound(i);
+		bool wasUpperJ = isUpperBound(j);
+
+		double quadCoef = QD[i] + QD[j] - 2.*Ki[j];
+		if (quadCoef <= 0.)
+			quadCoef = TAU;
+
+		if (y[i] != y[j]){
+			double delta = (-G[i] - G[j]) / quadCoef;
+			double diff = alpha[i] - alpha[j];
+			alpha[i] += delta;
+			alpha[j] += delta;
+
+			if (diff > 0.){
+				if (alpha[j] < 0.){ alpha[j] = 0.; alpha[i] = diff; }
+			}
+			else{
+				if (alpha[i] < 0.){ alpha[i] = 0.; alpha[j] = -diff; }
+			}
+			if (diff > 0.){
+				if (alpha[i] > C){ alpha[i] = C; alpha[j] = C - diff; }
+			}
+			else{
+				if (alpha[j] > C){ alpha[j] = C; alpha[i] = C + diff; }
+			}
+		}
+		else{
+			double delta = (G[i] - G[j]) / quadCoef;
+			double sum = alpha[i] + alpha[j];
+			alpha[i] -= delta;
+			alpha[j] += delta;
+
+			if (sum > C){
+				if (alpha[i] > C){ alpha[i] = C; alpha[j] = sum - C; }
+				if (alpha[j] > C){ alpha[j] = C; alpha[i] = sum - C; }
+			}
+			else{
+				if (alpha[j] < 0.){ alpha[j] = 0.; alpha[i] = sum; }
+				if (alpha[i] < 0.){ alpha[i] = 0.; alpha[j] = sum; }
+			}
+		}
+
+		// G_t += Q_ti * dAlpha_i + Q_tj * dAlpha_j, Q_ti = y_t y_i K_ti
+		double deltaI = (alpha[i] - oldAlphaI) * y[i];
+		double deltaJ = (alpha[j] - oldAlphaJ) * y[j];
+		for (int t = 0; t < activeSize; t++)
+			G[t] += y[t] * (Ki[t] * deltaI + Kj[t] * deltaJ);
+
+		// Gbar needs the full rows, only if a variable reaches or leaves the upper bound
+		if (wasUpperI != isUpperBound(i))
+			updateGbar(i, wasUpperI ? -C : C);
+		if (wasUpperJ != isUpperBound(j))
+			updateGbar(j, wasUpperJ ? -C : C);
+	}
+
+	void updateGbar(int i, double dAlpha){
+		const float* Ki = K.row(i, n);
+		for (int t = 0; t < n; t++)
+			Gbar[t] += dAlpha * y[i] * y[t] * Ki[t];
+	}
+
+	// G of the inactive variables from Gbar and the free variables
+	void reconstructGradient(){
+		if (activeSize == n)
+			return;
+
+		for (int t = activeSize; t < n; t++)
+			G[t] = Gbar[t] - 1.;
+
+		int freeCount = 0;
+		for (int t = 0; t < activeSize; t++){
+			if (isFree(t))
+				freeCount++;
+		}
+
+		// whichever needs fewer kernel values: inactive rows over the active part, or full rows of the free variables
+		if ((double)freeCount*n > 2.*activeSize*(n - activeSize)){
+			for (int i = activeSize; i < n; i++){
+				const float* Ki = K.row(i, activeSize);
+				for (int t = 0; t < activeSize; t++){
+					if (isFree(t))
+						G[i] += alpha[t] * y[t] * y[i] * Ki[t];
+				}
+			}
+		}
+		else{
+			for (int i = 0; i < activeSize; i++){
+				if (!isFree(i))
+					continue;
+				const float* Ki = K.row(i, n);
+				for (int t = activeSize; t < n; t++)
+					G[t] += alpha[i] * y[i] * y[t] * Ki[t];
+			}
+		}
+	}
+
+	// a variable at a bound whose gradient points out of the feasible region by more than the current violation
+	bool canShrink(int t, double Gmax1, double Gmax2) const{
+		if (isUpperBound(t))
+			return y[t] == +1 ? -G[t] > Gmax1 : -G[t] > Gmax2;
+		if (isLowerBound(t))
+			return y[t] == +1 ? G[t] > Gmax2 : G[t] > Gmax1;
+		return false;
+	}
+
+	void shrink(double eps){
+		double Gmax1 = -numeric_limits<double>::infinity();		// max { -y_i G_i | i in I_up }
+		double Gmax2 = -numeric_limits<double>::infinity();		// max { y_i G_i | i in I_low }
+
+		for (int t = 0; t < activeSize; t++){
+			if (y[t] == +1){
+				if (!isUpperBound(t))
+					Gmax1 = max(Gmax1, -G[t]);
+				if (!isLowerBound(t))
+					Gmax2 = max(Gmax2, G[t]);
+			}
+			else{
+				if (!isUpperBound(t))
+					Gmax2 = max(Gmax2, -G[t]);
+				if (!isLowerBound(t))
+					Gmax1 = max(Gmax1, G[t]);
+			}
+		}
+
+		// close to the solution: bring everything back once, the shrinking so far may have been wrong
+		if (!unshrink && Gmax1 + Gmax2 <= eps * 10){
+			unshrink = true;
+			reconstructGradient();
+			activeSize = n;
+		}
+
+		for (int t = 0; t < activeSize; t++){
+			if (!canShrink(t, Gmax1, Gmax2))
+				continue;
+			activeSize--;
+			while (activeSize > t){
+				if (!canShrink(activeSize, Gmax1, Gmax2)){
+					swapIndex(t, activeSize);
+					break;
+				}
+				activeSize--;
+			}
+		}
+	}
+
+	void swapIndex(int i, int j){
+		K.swapIndex(i, j);
+		swap(y[i], y[j]);
+		swap(alpha[i], alpha[j]);
+		swap(G[i], G[j]);
+		swap(Gbar[i], Gbar[j]);
+		swap(QD[i], QD[j]);
+		swap(activeSet[i], activeSet[j]);
+	}
+
+	// average of y_i G_i over the free variables, the middle of the feasible interval if there are none
+	double calculateRho() const{
+		int freeCount = 0;
+		double ub = numeric_limits<double>::infinity();
+		double lb = -numeric_limits<double>::infinity();
+		double sumFree = 0.;
+
+		for (int t = 0; t < activeSize; t++){
+			double yG = y[t] * G[t];
+			if (isUpperBound(t)){
+				if (y[t] == -1) ub = min(ub, yG);
+				else lb = max(lb, yG);
+			}
+			else if (isLowerBound(t)){
+				if (y[t] == +1) ub = min(ub, yG);
+				else lb = max(lb, yG);
+			}
+			else{
+				freeCount++;
+				sumFree += yG;
+			}
+		}
+		return freeCount > 0 ? sumFree / freeCount : (ub + lb) / 2.;
+	}
+
+	KernelSource &K;
+	vector<signed char> y;
+	double C;
+	int n;
+	vector<double> alpha;
+	vector<double> G;		// gradient of the dual objective: Q alpha - e
+	vector<double> Gbar;	// C * sum of Q_ti over the variables at the upper bound
+	vector<double> QD;
+	vector<int> activeSet;	// original index of every variable
+	int activeSize;
+	bool shrinking;
+	bool unshrink;
+};
+
+SolverResult solveCSVC(KernelSource &K, const vector<signed char> &y, double C, double eps, int maxIter, bool shrinking){
+	CSVCSolver solver(K, y, C, shrinking);
+	return solver.solve(eps, maxIter);
+}
+
+bool trainSVMModel(const Mat &data, const Mat &labels, const CvSVMParams &params, double cacheSize, bool shrinking,
+	SVMModel &model){
+	assert(data.type() == CV_32FC1);
+	assert(labels.type() == CV_32FC1);
+	assert(labels.rows == data.rows);
+
+	if (params.svm_type != CvSVM::C_SVC || data.rows < 2)
+		return false;
+
+	const int n = data.rows;
+	float smallerLabel = labels.at<float>(0), largerLabel = labels.at<float>(0);
+	for (int i = 1; i < n; i++){
+		smallerLabel = min(smallerLabel, labels.at<float>(i));
+		largerLabel = max(largerLabel, labels.at<float>(i));
+	}
+	if (smallerLabel == largerLabel)
+		return false;
+
+	// +1 for the smaller label, as in the decision function of CvSVM
+	vector<signed char> y(n);
+	for (int i = 0; i < n; i++){
+		float label = labels.at<float>(i);
+		if (label != smallerLabel && label != largerLabel)
+			return false;
+		y[i] = label == smallerLabel ? +1 : -1;
+	}
+
+	// the termination criteria as CvSVM interprets them
+	double eps = (params.term_crit.type & CV_TERMCRIT_EPS) ? max(params.term_crit.epsilon, DBL_EPSILON) : DBL_EPSILON;
+	int maxIter = (params.term_crit.type & CV_TERMCRIT_ITER) ? max(params.term_crit.max_iter, 1) : INT_MAX;
+
+	SampleKernel K(data, params, cacheSize);
+	SolverResult solution = solveCSVC(K, y, params.C, eps, maxIter, shrinking);
+
+	model.supportVectors.release();
+	model.alpha.release();
+	model.mapping.reset();
+	model.kernelType = params.kernel_type;
+	model.gamma = params.gamma;
+	model.coef0 = params.coef0;
+	model.degree = params.degree;
+	model.rho = solution.rho;
+	model.labels[0] = smallerLabel;
+	model.labels[1] = largerLabel;
+
+	int svCount = 0;
+	for (int i = 0; i < n; i++){
+		if (solution.alpha[i] > 0.)
+			svCount++;
+	}
+
+	model.supportVectors.create(svCount, data.cols, CV_32FC1);
+	model.alpha.create(svCount, 1, CV_64FC1);
+	for (int i = 0, k = 0; i < n; i++){
+		if (solution.alpha[i] <= 0.)
+			continue;
+		const float* sample = data.ptr<float>(i);
+		copy(sample, sample + data.cols, model.supportVectors.ptr<float>(k));
+		model.alpha.at<double>(k) = solution.alpha[i] * y[i];
+		k++;
+	}
+
+	model.w.release();
+	if (model.kernelType == CvSVM::LINEAR){
+		model.w = Mat::zeros(1, data.cols, CV_64FC1);
+		double* w = model.w.ptr<double>(0);
+		for (int k = 0; k < svCount; k++){
+			const float* sv = model.supportVectors.ptr<float>(k);
+			for (int d = 0; d < data.cols; d++)
+				w[d] += model.alpha.at<double>(k) * sv[d];
+		}
+
+		// a single support vector w with alpha 1, the form CvSVM stores linear models in
+		model.supportVectors.create(1, data.cols, CV_32FC1);
+		for (int d = 0; d < data.cols; d++)
+			model.supportVectors.at<float>(0, d) = (float)w[d];
+		model.alpha = Mat::ones(1, 1, CV_64FC1);
+	}
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <list>
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\ml\ml.hpp>
+
+#include "svmModel.h"
+
+// kernel rows for the solver in its current variable order (the solver reorders variables with swapIndex while shrinking)
+// row(i, length) returns K(i, 0..length-1), the two most recently requested rows have to stay valid
+class KernelSource{
+public:
+	virtual ~KernelSource(){}
+	virtual int size() const = 0;
+	virtual const float* row(int i, int length) = 0;
+	virtual double diagonal(int i) = 0;
+	virtual void swapIndex(int i, int j) = 0;
+};
+
+// least recently used cache of (partial) kernel rows, limited to cacheSize MB (at least two full rows)
+// derived classes compute single values, or whole row segments where that is cheaper; indices given to evaluate() and
+// evaluateRow() are the original sample indices
+class CachedKernel : public KernelSource{
+public:
+	CachedKernel(int size, double cacheSize);
+
+	int size() const;
+	const float* row(int i, int length);
+	double diagonal(int i);
+	void swapIndex(int i, int j);
+
+	// rows computed / requested since construction
+	size_t misses() const{ return rowMisses; }
+	size_t requests() const{ return rowRequests; }
+
+protected:
+	virtual double evaluate(int a, int b) const = 0;
+	// K(a, b[t]) for t < count, evaluate() for every value unless overridden
+	virtual void evaluateRow(int a, const int* b, int count, float* values) const;
+
+private:
+	struct Row{
+		std::vector<float> data;				// data.size() values of the row are valid
+		std::list<int>::iterator position;		// in lru, only if data is not empty
+	};
+
+	void release(int i);
+
+	int n;
+	std::vector<int> order;						// original index of every variable
+	std::vector<Row> rows;
+	std::list<int> lru;							// least recently used first
+	size_t budget;								// floats left
+	size_t rowMisses, rowRequests;
+};
+
+// kernel of the rows of data (n x varCount, CV_32FC1) with the parameters of CvSVM
+class SampleKernel : public CachedKernel{
+public:
+	SampleKernel(const cv::Mat &data, const CvSVMParams &params, double cacheSize);
+
+protected:
+	double evaluate(int a, int b) const;
+
+private:
+	const cv::Mat &data;
+	CvSVMParams params;
+};
+
+struct SolverResult{
+	std::vector<double> alpha;		// 0 <= alpha_i <= C
+	double rho;
+	int iterations;
+};
+
+// dual C-SVC with SMO: min 1/2 a'Qa - e'a, 0 <= a_i <= C, y'a = 0, Q_ij = y_i y_j K_ij
+// working set selection uses second order information (Fan, Chen, Lin 2005), shrinking of variables at
+// their bounds and gradient reconstruction are the ones of LIBSVM
+// y_i is +1 or -1; the decision function is f(x) = sum_i alpha_i y_i K(x_i, x) - rho
+SolverResult solveCSVC(KernelSource &K, const std::vector<signed char> &y, double C, double eps, int maxIter, bool shrinking = true);
+
+// trains a two-class C_SVC on data (n x varCount, CV_32FC1) and labels (n x 1, CV_32FC1) like CvSVM::train,
+// but holds at most cacheSize MB of the kernel matrix; the model has the semantics of loadSVMModel()
+// (f(x) > 0 is labels[0], the smaller label) and linear models are reduced to w, as CvSVM does it
+bool trainSVMModel(const cv::Mat &data, const cv::Mat &labels, const CvSVMParams &params, double cacheSize, bool shrinking,
+	SVMModel &model);
@@ -0,0 +1,128 @@
+#include "convolution.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "..\Common\profiler.h"
+#include "..\Common\threadPool.h"
+
+using namespace std;
+using namespace cv;
+
+// pixels per task of the bands of rows, like those of the filters in stages.cpp
+#define CONVOLUTION_BAND_PIXELS	(1 << 16)
+// pixels summed at once on the stack
+#define CONVOLUTION_CHUNK		256
+
+template<typename Src, typename Dst>
+static Dst borderPixel(Src value, ConvolutionBorder border){
+	return border == CONVOLUTION_BORDER_COPY ? saturate_cast<Dst>(value) : Dst(0);
+}
+
+template<typename Src, typename Acc, typename Dst>
+void convolve(const Mat &img, Mat &dst, const Mat &kernel, bool normalize, ConvolutionBorder border){
+	PROFILE_SCOPE_PIXELS("convolve", img.total());
+	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
+	assert(kernel.type() == CV_64FC1);
+	assert(img.type() == DataType<Src>::type);
+	assert(dst.data != img.data);
+
+	dst.create(img.rows, img.cols, DataType<Dst>::type);
+
+	vector<Acc> taps(kernel.total());
+	double kernelSum = 0.;
+	for (int ky = 0; ky < kernel.rows; ky++){
+		for (int kx = 0; kx < kernel.cols; kx++){
+			taps[ky * kernel.cols + kx] = (Acc)kernel.at<double>(ky, kx);
+			kernelSum += kernel.at<double>(ky, kx);
+		}
+	}
+	const Acc normValue = normalize ? (Acc)kernelSum : (Acc)1;
+	assert(normValue != 0);
+
+	const int yOffset = (kernel.rows - 1) / 2;
+	const int xOffset = (kernel.cols - 1) / 2;
+
+	const int grain = max(1, CONVOLUTION_BAND_PIXELS / max(1, img.cols));
+	parallelFor(sharedThreadPool(), 0, img.rows, grain, [&](int y0, int y1){
+		Acc values[CONVOLUTION_CHUNK];
+		for (int y = y0; y < y1; y++){
+			Dst* row = dst.ptr<Dst>(y);
+			const Src* rowOrg = img.ptr<Src>(y);
+			if (y < yOffset || y >= img.rows - yOffset){
+				for (int x = 0; x < img.cols; x++)
+					row[x] = borderPixel<Src, Dst>(rowOrg[x], border);
+				continue;
+			}
+			for (int x = 0; x < min(xOffset, img.cols); x++){
+				row[x] = borderPixel<Src, Dst>(rowOrg[x], border);
+				row[img.cols - 1 - x] = borderPixel<Src, Dst>(rowOrg[img.cols - 1 - x], border);
+			}
+
+			// a tap at a time over a chunk of pixels, which the compiler vectorizes; every pixel still sums ky outer,
+			// kx inner
+			for (int x0 = xOffset; x0 < img.cols - xOffset; x0 += CONVOLUTION_CHUNK){
+				const int count = min(CONVOLUTION_CHUNK, img.cols - xOffset - x0);
+				fill(values, values + count, (Acc)0);
+				for (int ky = 0; ky < kernel.rows; ky++){
+					const Src* src = img.ptr<Src>(y - yOffset + ky) + x0 - xOffset;
+					for (int kx = 0; kx < kernel.cols; kx++){
+						const Acc tap = taps[ky * kernel.cols + kx];
+						for (int x = 0; x < count; x++)
+							values[x] += tap * (Acc)src[x + kx];
+					}
+				}
+				for (int x = 0; x < count; x++)
+					row[x0 + x] = saturate_cast<Dst>(values[x] / normValue);
+			}
+		}
+	});
+}
+
+template void convolve<uchar, double, uchar>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<uchar, double, short>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<uchar, float, float>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<ushort, double, ushort>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<ushort, double, short>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<ushort, float, float>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<short, double, short>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<short, float, float>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<float, float, float>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<float, float, short>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+template void convolve<float, float, uchar>(const Mat&, Mat&, const Mat&, bool, ConvolutionBorder);
+
+bool convolveTyped(const Mat &img, Mat &dst, int dstDepth, const Mat &kernel, bool normalize, ConvolutionBorder border){
+	if (img.channels() != 1)
+		return false;
+
+	switch (img.depth()){
+	case CV_8U:
+		switch (dstDepth){
+		case CV_8U:		convolve<uchar, double, uchar>(img, dst, kernel, normalize, border); return true;
+		case CV_16S:	convolve<uchar, double, short>(img, dst, kernel, normalize, border); return true;
+		case CV_32F:	convolve<uchar, float, float>(img, dst, kernel, normalize, border); return true;
+		}
+		break;
+	case CV_16U:
+		switch (dstDepth){
+		case CV_16U:	convolve<ushort, double, ushort>(img, dst, kernel, normalize, border); return true;
+		case CV_16S:	convolve<ushort, double, short>(img, dst, kernel, normalize, border); return true;
+		case CV_32F:	convolve<ushort, float, float>(img, dst, kernel, normalize, border); return true;
+		}
+		break;
+	case CV_16S:
+		switch (dstDepth){
+		case CV_16S:	convolve<short, double, short>(img, dst, kernel, normalize, border); return true;
+		case CV_32F:	convolve<short, float, float>(img, dst, kernel, normalize, border); return true;
+		}
+		break;
+	case CV_32F:
+		switch (dstDepth){
+		case CV_32F:	convolve<float, float, float>(img, dst, kernel, normalize, border); return true;
+		case CV_16S:	convolve<float, float, short>(img, dst, kernel, normalize, border); return true;
+		case CV_8U:		convolve<float, float, uchar>(img, dst, kernel, normalize, border); return true;
+		}
+		break;
+	}
+	return false;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <opencv2\core\core.hpp>
+
+// the pixels within half the kernel size of the edge, where the kernel does not fit
+enum ConvolutionBorder{
+	CONVOLUTION_BORDER_COPY,	// the input pixel, saturated to the output type
+	CONVOLUTION_BORDER_ZERO
+};
+
+// one convolution for every combination of pixel types, so steps chain in their native types without convertTo
+// passes between them: the pixels of img (Src) are read as Acc, multiplied by the CV_64FC1 kernel converted to Acc,
+// summed in Acc, divided by the kernel sum if normalize, and stored to dst (Dst) with saturate_cast, i.e. rounded to
+// the nearest value and clamped for integer types
+// instantiated in convolution.cpp for the combinations of convolveTyped(); the 8 bit filters of stages.h keep their
+// vectorized kernels (ImageKernels) and truncation
+template<typename Src, typename Acc, typename Dst>
+void convolve(const cv::Mat &img, cv::Mat &dst, const cv::Mat &kernel, bool normalize, ConvolutionBorder border);
+
+// convolve() for the depths of img and dstDepth, one channel each:
+//   CV_8U  -> CV_8U, CV_16S (double sums), CV_32F (float sums)
+//   CV_16U -> CV_16U, CV_16S (double), CV_32F (float)
+//   CV_16S -> CV_16S (double), CV_32F (float)
+//   CV_32F -> CV_32F, CV_16S, CV_8U (float)
+// false for any other combination
+bool convolveTyped(const cv::Mat &img, cv::Mat &dst, int dstDepth, const cv::Mat &kernel, bool normalize, ConvolutionBorder border);
@@ -0,0 +1,81 @@
+#include "frameSource.h"
+
+#include <iostream>
+#include <sys/stat.h>
+
+#include "..\Common\directory.h"
+#include "..\Common\rawImage.h"
+
+using namespace std;
+using namespace cv;
+
+VideoFileSource::VideoFileSource(const string &filename) : capture(filename){}
+
+bool VideoFileSource::isOpened() const{
+	return capture.isOpened();
+}
+
+bool VideoFileSource::read(Mat &frame){
+	return capture.read(frame) && frame.data;
+}
+
+bool VideoFileSource::skip(){
+	return capture.grab();
+}
+
+double VideoFileSource::fps() const{
+	return max(0., capture.get(CV_CAP_PROP_FPS));
+}
+
+int VideoFileSource::frameCount() const{
+	return max(0, (int)capture.get(CV_CAP_PROP_FRAME_COUNT));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+ImageSequenceSource::ImageSequenceSource(const string &directory, double fps)
+	: directory(directory), filenames(listImages(directory)), next(0), frameRate(fps){}
+
+bool ImageSequenceSource::read(Mat &frame){
+	// unreadable files are left out, like gaps in a recording
+	while (next < filenames.size()){
+		string filename = directory + "\\" + filenames[next++];
+		frame = readImage(filename, IMREAD_COLOR);
+		if (frame.data)
+			return true;
+		cout << "image file " << filename << " could not be opened" << endl;
+	}
+	return false;
+}
+
+bool ImageSequenceSource::skip(){
+	if (next >= filenames.size())
+		return false;
+	next++;
+	return true;
+}
+
+double ImageSequenceSource::fps() const{
+	return frameRate;
+}
+
+int ImageSequenceSource::frameCount() const{
+	return (int)filenames.size();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+unique_ptr<FrameSource> openFrameSource(const string &path, double sequenceFps){
+	struct stat sb;
+	if (stat(path.c_str(), &sb) == 0 && (sb.st_mode & S_IFDIR)){
+		unique_ptr<FrameSource> sequence(new ImageSequenceSource(path, sequenceFps));
+		if (sequence->frameCount() == 0)
+			return unique_ptr<FrameSource>();
+		return sequence;
+	}
+
+	unique_ptr<VideoFileSource> video(new VideoFileSource(path));
+	if (!video->isOpened())
+		return unique_ptr<FrameSource>();
+	return unique_ptr<FrameSource>(video.release());
+}
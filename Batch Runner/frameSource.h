@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\highgui\highgui.hpp>
+
+// the frames of a recording in order, decoded as 8 bit BGR
+class FrameSource{
+public:
+	virtual ~FrameSource(){}
+
+	// the next frame, the buffer of frame is reused if the size fits; false at the end
+	virtual bool read(cv::Mat &frame) = 0;
+
+	// passes over the next frame without decoding it where the backend allows that; false at the end
+	virtual bool skip() = 0;
+
+	// frame rate of the recording, 0 if it is not known
+	virtual double fps() const = 0;
+
+	// number of frames, 0 if it is not known
+	virtual int frameCount() const = 0;
+};
+
+// a video file decoded by VideoCapture
+class VideoFileSource : public FrameSource{
+public:
+	explicit VideoFileSource(const std::string &filename);
+
+	bool isOpened() const;
+	bool read(cv::Mat &frame);
+	bool skip();
+	double fps() const;
+	int frameCount() const;
+
+private:
+	mutable cv::VideoCapture capture;	// get() is not const in OpenCV 2.4
+};
+
+// the images of a directory in file name order, a stand-in for a video with the given frame rate
+class ImageSequenceSource : public FrameSource{
+public:
+	ImageSequenceSource(const std::string &directory, double fps);
+
+	bool read(cv::Mat &frame);
+	bool skip();
+	double fps() const;
+	int frameCount() const;
+
+private:
+	std::string directory;
+	std::vector<std::string> filenames;
+	size_t next;
+	double frameRate;
+};
+
+// a directory opens as image sequence, everything else as video file; NULL if there is nothing to read
+std::unique_ptr<FrameSource> openFrameSource(const std::string &path, double sequenceFps = 25.);
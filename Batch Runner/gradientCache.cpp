@@ -0,0 +1,128 @@
+#include "gradientCache.h"
+
+#include <cstring>
+#include <atomic>
+
+using namespace std;
+using namespace cv;
+
+// fields of gradientCache(), a few images are enough for the steps and cell sizes of one image
+#define GRADIENT_CACHE_ENTRIES	4
+// bytes of idle buffers the cache keeps for the fields of new images, beyond those of the fields it holds
+#define GRADIENT_CACHE_IDLE_BYTES	((size_t)64 << 20)
+
+// 64 bit hash of the size, type and pixels, eight bytes at a time
+static uint64_t contentHash(const Mat &img){
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = (hash ^ ((uint64_t)img.rows << 32 | (uint32_t)img.cols)) * 0x9e3779b97f4a7c15ull;
+	hash = (hash ^ (uint64_t)img.type()) * 0x9e3779b97f4a7c15ull;
+
+	const size_t rowBytes = img.cols * img.elemSize();
+	for (int y = 0; y < img.rows; y++){
+		const uchar* row = img.ptr<uchar>(y);
+		size_t i = 0;
+		for (; i + 8 <= rowBytes; i += 8){
+			uint64_t word;
+			memcpy(&word, row + i, 8);
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 29;
+		}
+		for (; i < rowBytes; i++)
+			hash = (hash ^ row[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool samePixels(const Mat &a, const Mat &b){
+	if (a.size() != b.size() || a.type() != b.type())
+		return false;
+	const size_t rowBytes = a.cols * a.elemSize();
+	for (int y = 0; y < a.rows; y++){
+		if (memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), rowBytes) != 0)
+			return false;
+	}
+	return true;
+}
+
+GradientCache::GradientCache(size_t capacity) : capacity(max((size_t)1, capacity)), useCount(0), hitCount(0), missCount(0),
+	buffers(GRADIENT_CACHE_IDLE_BYTES){}
+
+shared_ptr<const GradientField> GradientCache::get(const Mat &img){
+	assert(img.type() == CV_8UC1);
+	const uint64_t hash = contentHash(img);
+
+	// candidates with the hash, compared without the lock; an entry dropped meanwhile is still held here
+	vector<Entry> candidates;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (const Entry &entry : entries){
+			if (entry.hash == hash)
+				candidates.push_back(entry);
+		}
+	}
+	for (const Entry &candidate : candidates){
+		if (samePixels(candidate.img, img)){
+			std::unique_lock<std::mutex> lock(mutex);
+			hitCount++;
+			for (Entry &entry : entries){
+				if (entry.field == candidate.field)
+					entry.lastUse = ++useCount;
+			}
+			return candidate.field;
+		}
+	}
+
+	// the fields are built in pool buffers, so a warm cache does not allocate
+	shared_ptr<GradientField> field = make_shared<GradientField>();
+	field->X = buffers.acquire(img.size(), CV_16SC1);
+	field->Y = buffers.acquire(img.size(), CV_16SC1);
+	field->magnitude = buffers.acquire(img.size(), CV_16SC1);
+	field->orientation = buffers.acquire(img.size(), CV_32FC1);
+	computeGradientField(img, *field);
+
+	Entry created;
+	created.hash = hash;
+	created.img = buffers.acquire(img.size(), CV_8UC1);
+	img.copyTo(created.img);
+	created.field = field;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	missCount++;
+	created.lastUse = ++useCount;
+	if (entries.size() < capacity){
+		entries.push_back(created);
+	}
+	else{
+		size_t oldest = 0;
+		for (size_t i = 1; i < entries.size(); i++){
+			if (entries[i].lastUse < entries[oldest].lastUse)
+				oldest = i;
+		}
+		entries[oldest] = created;
+	}
+	return field;
+}
+
+uint64_t GradientCache::hits() const{
+	std::unique_lock<std::mutex> lock(mutex);
+	return hitCount;
+}
+
+uint64_t GradientCache::misses() const{
+	std::unique_lock<std::mutex> lock(mutex);
+	return missCount;
+}
+
+// created by the first call and never destroyed, like filterPlanner()
+GradientCache& gradientCache(){
+	static std::atomic<GradientCache*> instance;
+	GradientCache* cache = instance.load(std::memory_order_acquire);
+	if (cache == NULL){
+		GradientCache* created = new GradientCache(GRADIENT_CACHE_ENTRIES);
+		if (instance.compare_exchange_strong(cache, created))
+			cache = created;
+		else
+			delete created;
+	}
+	return *cache;
+}
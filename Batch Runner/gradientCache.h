@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\bufferPool.h"
+#include "stages.h"
+
+// the GradientFields of the last images, found by their content: a caller that needs the gradients of an image another
+// one has already computed (the gradients and hog steps, several HoG cell sizes of one image) gets them without a second
+// Sobel pass; the key is a hash of the pixels, a hit is confirmed by comparing them with a copy of the image
+class GradientCache{
+public:
+	// capacity: fields kept, the least recently used one is dropped for a new one
+	explicit GradientCache(size_t capacity);
+
+	// img: CV_8UC1; the field of img, computed on a miss (without the lock, other images go on meanwhile)
+	// the field stays valid as long as the pointer is held, even if the cache drops it
+	std::shared_ptr<const GradientField> get(const cv::Mat &img);
+
+	uint64_t hits() const;
+	uint64_t misses() const;
+
+private:
+	GradientCache(const GradientCache&);
+	GradientCache& operator=(const GradientCache&);
+
+	struct Entry{
+		uint64_t hash;
+		cv::Mat img;	// copy of the image, pixels compared on a hash match
+		std::shared_ptr<const GradientField> field;
+		uint64_t lastUse;
+	};
+
+	size_t capacity;
+	mutable std::mutex mutex;
+	std::vector<Entry> entries;
+	uint64_t useCount;
+	uint64_t hitCount, missCount;
+	// the Mats of the fields and image copies, reused once a dropped field is no longer held
+	BufferPool buffers;
+};
+
+// the cache of the steps in stages.cpp, created by the first call
+GradientCache& gradientCache();
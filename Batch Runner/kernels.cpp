@@ -0,0 +1,358 @@
+#include "kernels.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar: the loops of the operations as they were, for every machine and the pixels the vector loops leave over
+
+static void histogramScalar(const uchar* src, size_t step, int rows, int cols, int* counts){
+	for (int y = 0; y < rows; y++){
+		const uchar* row = src + y * step;
+		for (int x = 0; x < cols; x++)
+			counts[row[x]]++;
+	}
+}
+
+static void convolveScalar(const uchar* src, size_t step, const double* kernel, int kernelRows, int kernelCols, int count, double* dst){
+	for (int x = 0; x < count; x++){
+		double value = 0.;
+		for (int ky = 0; ky < kernelRows; ky++){
+			const double* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++)
+				value += taps[kx] * (double)values[kx];
+		}
+		dst[x] = value;
+	}
+}
+
+static void convolveFixedScalar(const uchar* src, size_t step, const short* kernel, int kernelRows, int kernelCols, int count, int* dst){
+	for (int x = 0; x < count; x++){
+		int value = 0;
+		for (int ky = 0; ky < kernelRows; ky++){
+			const short* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++)
+				value += taps[kx] * values[kx];
+		}
+		dst[x] = value;
+	}
+}
+
+static void magnitudeScalar(const short* X, const short* Y, int count, short* dst){
+	for (int x = 0; x < count; x++){
+		int value = abs(X[x]) + abs(Y[x]);
+		dst[x] = (short)min(32767, value);
+	}
+}
+
+static void lumaScalar(const uchar* src, int count, uchar* dst){
+	for (int x = 0; x < count; x++){
+		const uchar* pixel = src + 3 * x;
+		dst[x] = (uchar)(0.2126*pixel[2] + 0.7152*pixel[1] + 0.0722*pixel[0]);
+	}
+}
+
+static void lookupScalar(const uchar* src, int count, const uchar* table, uchar* dst){
+	for (int x = 0; x < count; x++)
+		dst[x] = table[src[x]];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// histograms gain nothing from vector registers (there is no scatter-add); what limits the plain loop are runs of
+// equal values, where every increment waits for the store of the previous one, so both vector tiers count 8 pixels at
+// a time into four tables and add them up at the end
+
+static void histogramTables(const uchar* src, size_t step, int rows, int cols, int* counts){
+	int tables[4][256];
+	memset(tables, 0, sizeof(tables));
+	for (int y = 0; y < rows; y++){
+		const uchar* row = src + y * step;
+		int x = 0;
+		for (; x + 8 <= cols; x += 8){
+			unsigned long long pixels;
+			memcpy(&pixels, row + x, 8);
+			tables[0][pixels & 0xFF]++;
+			tables[1][pixels >> 8 & 0xFF]++;
+			tables[2][pixels >> 16 & 0xFF]++;
+			tables[3][pixels >> 24 & 0xFF]++;
+			tables[0][pixels >> 32 & 0xFF]++;
+			tables[1][pixels >> 40 & 0xFF]++;
+			tables[2][pixels >> 48 & 0xFF]++;
+			tables[3][pixels >> 56]++;
+		}
+		for (; x < cols; x++)
+			tables[0][row[x]]++;
+	}
+	for (int v = 0; v < 256; v++)
+		counts[v] += tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+}
+
+#ifdef CPU_DISPATCH_X86
+
+/////////////////////////////////////////////////////////////////////////////
+// SSE4.2 tier: 128 bit registers, two doubles, four ints or eight shorts
+
+CPU_TARGET_SSE42 static void convolveSSE42(const uchar* src, size_t step, const double* kernel, int kernelRows, int kernelCols, int count, double* dst){
+	int x = 0;
+	for (; x + 4 <= count; x += 4){
+		__m128d sum0 = _mm_setzero_pd();
+		__m128d sum1 = _mm_setzero_pd();
+		for (int ky = 0; ky < kernelRows; ky++){
+			const double* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++){
+				int four;
+				memcpy(&four, values + kx, 4);
+				const __m128i pixels = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(four));
+				const __m128d tap = _mm_set1_pd(taps[kx]);
+				sum0 = _mm_add_pd(sum0, _mm_mul_pd(tap, _mm_cvtepi32_pd(pixels)));
+				sum1 = _mm_add_pd(sum1, _mm_mul_pd(tap, _mm_cvtepi32_pd(_mm_srli_si128(pixels, 8))));
+			}
+		}
+		_mm_storeu_pd(dst + x, sum0);
+		_mm_storeu_pd(dst + x + 2, sum1);
+	}
+	convolveScalar(src + x, step, kernel, kernelRows, kernelCols, count - x, dst + x);
+}
+
+// eight pixels per tap in 16 bit, the low and high halves of the 32 bit products interleaved to four sums each
+CPU_TARGET_SSE42 static void convolveFixedSSE42(const uchar* src, size_t step, const short* kernel, int kernelRows, int kernelCols, int count, int* dst){
+	int x = 0;
+	for (; x + 8 <= count; x += 8){
+		__m128i sum0 = _mm_setzero_si128();
+		__m128i sum1 = _mm_setzero_si128();
+		for (int ky = 0; ky < kernelRows; ky++){
+			const short* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++){
+				const __m128i pixels = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(values + kx)));
+				const __m128i tap = _mm_set1_epi16(taps[kx]);
+				const __m128i low = _mm_mullo_epi16(pixels, tap);
+				const __m128i high = _mm_mulhi_epi16(pixels, tap);
+				sum0 = _mm_add_epi32(sum0, _mm_unpacklo_epi16(low, high));
+				sum1 = _mm_add_epi32(sum1, _mm_unpackhi_epi16(low, high));
+			}
+		}
+		_mm_storeu_si128((__m128i*)(dst + x), sum0);
+		_mm_storeu_si128((__m128i*)(dst + x + 4), sum1);
+	}
+	convolveFixedScalar(src + x, step, kernel, kernelRows, kernelCols, count - x, dst + x);
+}
+
+CPU_TARGET_SSE42 static void magnitudeSSE42(const short* X, const short* Y, int count, short* dst){
+	// |-32768| does not fit a short, the absolute values are read as unsigned and added in 32 bit
+	const __m128i limit = _mm_set1_epi32(32767);
+	int x = 0;
+	for (; x + 8 <= count; x += 8){
+		const __m128i absX = _mm_abs_epi16(_mm_loadu_si128((const __m128i*)(X + x)));
+		const __m128i absY = _mm_abs_epi16(_mm_loadu_si128((const __m128i*)(Y + x)));
+		__m128i low = _mm_add_epi32(_mm_cvtepu16_epi32(absX), _mm_cvtepu16_epi32(absY));
+		__m128i high = _mm_add_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(absX, 8)), _mm_cvtepu16_epi32(_mm_srli_si128(absY, 8)));
+		low = _mm_min_epi32(low, limit);
+		high = _mm_min_epi32(high, limit);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packs_epi32(low, high));
+	}
+	magnitudeScalar(X + x, Y + x, count - x, dst + x);
+}
+
+// four BGR pixels (12 of 16 loaded bytes) as b0 - b3, g0 - g3, r0 - r3
+CPU_TARGET_SSE42 static inline __m128i separateChannels(const uchar* src){
+	const __m128i order = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), order);
+}
+
+CPU_TARGET_SSE42 static void lumaSSE42(const uchar* src, int count, uchar* dst){
+	const __m128d weightR = _mm_set1_pd(0.2126);
+	const __m128d weightG = _mm_set1_pd(0.7152);
+	const __m128d weightB = _mm_set1_pd(0.0722);
+	int x = 0;
+	// the 16 byte load of the last four pixels reads 4 bytes beyond them, which have to be in the row
+	for (; 3 * x + 16 <= 3 * count; x += 4){
+		const __m128i channels = separateChannels(src + 3 * x);
+		const __m128i b = _mm_cvtepu8_epi32(channels);
+		const __m128i g = _mm_cvtepu8_epi32(_mm_srli_si128(channels, 4));
+		const __m128i r = _mm_cvtepu8_epi32(_mm_srli_si128(channels, 8));
+		__m128i gray[2];
+		for (int half = 0; half < 2; half++){
+			const __m128d rd = _mm_cvtepi32_pd(half == 0 ? r : _mm_srli_si128(r, 8));
+			const __m128d gd = _mm_cvtepi32_pd(half == 0 ? g : _mm_srli_si128(g, 8));
+			const __m128d bd = _mm_cvtepi32_pd(half == 0 ? b : _mm_srli_si128(b, 8));
+			const __m128d value = _mm_add_pd(_mm_add_pd(_mm_mul_pd(weightR, rd), _mm_mul_pd(weightG, gd)), _mm_mul_pd(weightB, bd));
+			gray[half] = _mm_cvttpd_epi32(value);
+		}
+		const __m128i words = _mm_packus_epi32(_mm_unpacklo_epi64(gray[0], gray[1]), _mm_setzero_si128());
+		const int four = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy(dst + x, &four, 4);
+	}
+	lumaScalar(src + 3 * x, count - x, dst + x);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX2 tier: 256 bit registers, four doubles, eight ints or sixteen shorts
+
+CPU_TARGET_AVX2 static void convolveAVX2(const uchar* src, size_t step, const double* kernel, int kernelRows, int kernelCols, int count, double* dst){
+	int x = 0;
+	for (; x + 8 <= count; x += 8){
+		__m256d sum0 = _mm256_setzero_pd();
+		__m256d sum1 = _mm256_setzero_pd();
+		for (int ky = 0; ky < kernelRows; ky++){
+			const double* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++){
+				const __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(values + kx)));
+				const __m256d tap = _mm256_set1_pd(taps[kx]);
+				sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(tap, _mm256_cvtepi32_pd(_mm256_castsi256_si128(pixels))));
+				sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(tap, _mm256_cvtepi32_pd(_mm256_extracti128_si256(pixels, 1))));
+			}
+		}
+		_mm256_storeu_pd(dst + x, sum0);
+		_mm256_storeu_pd(dst + x + 4, sum1);
+	}
+	convolveScalar(src + x, step, kernel, kernelRows, kernelCols, count - x, dst + x);
+}
+
+CPU_TARGET_AVX2 static void convolveFixedAVX2(const uchar* src, size_t step, const short* kernel, int kernelRows, int kernelCols, int count, int* dst){
+	int x = 0;
+	for (; x + 16 <= count; x += 16){
+		// the unpacks work within 128 bit lanes: sum0 holds pixels 0 - 3 and 8 - 11, sum1 4 - 7 and 12 - 15
+		__m256i sum0 = _mm256_setzero_si256();
+		__m256i sum1 = _mm256_setzero_si256();
+		for (int ky = 0; ky < kernelRows; ky++){
+			const short* taps = kernel + ky * kernelCols;
+			const uchar* values = src + ky * step + x;
+			for (int kx = 0; kx < kernelCols; kx++){
+				const __m256i pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(values + kx)));
+				const __m256i tap = _mm256_set1_epi16(taps[kx]);
+				const __m256i low = _mm256_mullo_epi16(pixels, tap);
+				const __m256i high = _mm256_mulhi_epi16(pixels, tap);
+				sum0 = _mm256_add_epi32(sum0, _mm256_unpacklo_epi16(low, high));
+				sum1 = _mm256_add_epi32(sum1, _mm256_unpackhi_epi16(low, high));
+			}
+		}
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_permute2x128_si256(sum0, sum1, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + x + 8), _mm256_permute2x128_si256(sum0, sum1, 0x31));
+	}
+	convolveFixedScalar(src + x, step, kernel, kernelRows, kernelCols, count - x, dst + x);
+}
+
+CPU_TARGET_AVX2 static void magnitudeAVX2(const short* X, const short* Y, int count, short* dst){
+	const __m256i limit = _mm256_set1_epi32(32767);
+	int x = 0;
+	for (; x + 16 <= count; x += 16){
+		const __m256i absX = _mm256_abs_epi16(_mm256_loadu_si256((const __m256i*)(X + x)));
+		const __m256i absY = _mm256_abs_epi16(_mm256_loadu_si256((const __m256i*)(Y + x)));
+		__m256i low = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(absX)),
+			_mm256_cvtepu16_epi32(_mm256_castsi256_si128(absY)));
+		__m256i high = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(absX, 1)),
+			_mm256_cvtepu16_epi32(_mm256_extracti128_si256(absY, 1)));
+		low = _mm256_min_epi32(low, limit);
+		high = _mm256_min_epi32(high, limit);
+		// the pack works within 128 bit lanes, the permutation restores the pixel order
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+		_mm256_storeu_si256((__m256i*)(dst + x), packed);
+	}
+	magnitudeScalar(X + x, Y + x, count - x, dst + x);
+}
+
+CPU_TARGET_AVX2 static void lumaAVX2(const uchar* src, int count, uchar* dst){
+	const __m256d weightR = _mm256_set1_pd(0.2126);
+	const __m256d weightG = _mm256_set1_pd(0.7152);
+	const __m256d weightB = _mm256_set1_pd(0.0722);
+	const __m128i order = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+	int x = 0;
+	for (; 3 * x + 16 <= 3 * count; x += 4){
+		const __m128i channels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3 * x)), order);
+		const __m256d b = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(channels));
+		const __m256d g = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 4)));
+		const __m256d r = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels, 8)));
+		const __m256d value = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(weightR, r), _mm256_mul_pd(weightG, g)), _mm256_mul_pd(weightB, b));
+		const __m128i gray = _mm256_cvttpd_epi32(value);
+		const __m128i words = _mm_packus_epi32(gray, gray);
+		const int four = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy(dst + x, &four, 4);
+	}
+	lumaScalar(src + 3 * x, count - x, dst + x);
+}
+
+// 16 shuffles of 16 table entries each by the low nibble, the high nibble selects one of them; with 128 bit registers
+// this is slower than the plain loads of the scalar loop, so the SSE4.2 tier keeps that
+CPU_TARGET_AVX2 static void lookupAVX2(const uchar* src, int count, const uchar* table, uchar* dst){
+	// the shuffle works within 128 bit lanes, so both lanes hold the same 16 table entries
+	__m256i parts[16];
+	for (int i = 0; i < 16; i++){
+		const __m128i part = _mm_loadu_si128((const __m128i*)(table + 16 * i));
+		parts[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(part), part, 1);
+	}
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	int x = 0;
+	for (; x + 32 <= count; x += 32){
+		const __m256i values = _mm256_loadu_si256((const __m256i*)(src + x));
+		const __m256i low = _mm256_and_si256(values, nibble);
+		const __m256i high = _mm256_and_si256(_mm256_srli_epi16(values, 4), nibble);
+		__m256i result = _mm256_setzero_si256();
+		for (int i = 0; i < 16; i++){
+			const __m256i selected = _mm256_cmpeq_epi8(high, _mm256_set1_epi8((char)i));
+			result = _mm256_or_si256(result, _mm256_and_si256(selected, _mm256_shuffle_epi8(parts[i], low)));
+		}
+		_mm256_storeu_si256((__m256i*)(dst + x), result);
+	}
+	lookupScalar(src + x, count - x, table, dst + x);
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+ImageKernels imageKernels(CpuTier tier){
+	ImageKernels kernels;
+	kernels.tier = CPU_TIER_SCALAR;
+	kernels.histogram = histogramScalar;
+	kernels.convolve = convolveScalar;
+	kernels.convolveFixed = convolveFixedScalar;
+	kernels.magnitude = magnitudeScalar;
+	kernels.luma = lumaScalar;
+	kernels.lookup = lookupScalar;
+#ifdef CPU_DISPATCH_X86
+	if (tier >= CPU_TIER_SSE42){
+		kernels.tier = CPU_TIER_SSE42;
+		kernels.histogram = histogramTables;
+		kernels.convolve = convolveSSE42;
+		kernels.convolveFixed = convolveFixedSSE42;
+		kernels.magnitude = magnitudeSSE42;
+		kernels.luma = lumaSSE42;
+	}
+	if (tier >= CPU_TIER_AVX2){
+		kernels.tier = tier;
+		kernels.convolve = convolveAVX2;
+		kernels.convolveFixed = convolveFixedAVX2;
+		kernels.magnitude = magnitudeAVX2;
+		kernels.luma = lumaAVX2;
+		kernels.lookup = lookupAVX2;
+	}
+#endif
+	return kernels;
+}
+
+// created by the first call and never destroyed, like profileRegistry()
+const ImageKernels& imageKernels(){
+	static std::atomic<ImageKernels*> instance;
+	ImageKernels* kernels = instance.load(std::memory_order_acquire);
+	if (kernels == NULL){
+		ImageKernels* created = new ImageKernels(imageKernels(activeCpuTier()));
+		if (instance.compare_exchange_strong(kernels, created))
+			kernels = created;
+		else
+			delete created;
+	}
+	return *kernels;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\cpuDispatch.h"
+
+// the inner loops of the image operations (stages.cpp), one variant per CpuTier
+// every variant gives the results of the scalar one bit for bit: the vector variants process several pixels at once,
+// but every pixel sees the same operations in the same order (no reassociation, no fused multiply-add)
+struct ImageKernels{
+	CpuTier tier;		// of the variants bound
+
+	// counts[v] += the number of pixels of value v in rows rows of cols pixels, step bytes apart
+	void (*histogram)(const uchar* src, size_t step, int rows, int cols, int* counts);
+
+	// dst[x] = sum of kernel[ky * kernelCols + kx] * src[ky * step + x + kx] for x in [0, count[, summed in double,
+	// ky outer, kx inner like the per pixel loop of filter
+	void (*convolve)(const uchar* src, size_t step, const double* kernel, int kernelRows, int kernelCols, int count, double* dst);
+
+	// the same with int16 coefficients summed in int32, for the fixed point filters; integer sums are exact, so any
+	// order gives the same result
+	void (*convolveFixed)(const uchar* src, size_t step, const short* kernel, int kernelRows, int kernelCols, int count, int* dst);
+
+	// dst[x] = min(32767, |X[x]| + |Y[x]|)
+	void (*magnitude)(const short* X, const short* Y, int count, short* dst);
+
+	// dst[x] = (uchar)(0.2126 * r + 0.7152 * g + 0.0722 * b) of the BGR pixel at src + 3 * x
+	void (*luma)(const uchar* src, int count, uchar* dst);
+
+	// dst[x] = table[src[x]], dst may be src
+	void (*lookup)(const uchar* src, int count, const uchar* table, uchar* dst);
+};
+
+// the variants of a tier; AVX-512 has no variants of its own (VS2013 cannot compile its intrinsics), it uses AVX2
+ImageKernels imageKernels(CpuTier tier);
+
+// the variants of activeCpuTier(), bound by the first call
+const ImageKernels& imageKernels();
@@ -0,0 +1,284 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sys/stat.h>
+#include <direct.h>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\directory.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+#include "..\Common\threadPool.h"
+#include "stages.h"
+#include "kernels.h"
+#include "planner.h"
+#include "gradientCache.h"
+#include "pipeline.h"
+#include "stream.h"
+#include "strips.h"
+
+using namespace std;
+using namespace cv;
+
+// the images of a directory, the lines of a list file, or a single image
+vector<string> listInputs(const string &input){
+	vector<string> inputs;
+	if (isImageFile(input)){
+		inputs.push_back(input);
+		return inputs;
+	}
+
+	struct stat sb;
+	if (stat(input.c_str(), &sb) == 0 && (sb.st_mode & S_IFDIR)){
+		for (const string &filename : listImages(input))
+			inputs.push_back(input + "\\" + filename);
+		return inputs;
+	}
+
+	ifstream list(input);
+	string line;
+	while (getline(list, line)){
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			inputs.push_back(line);
+	}
+	return inputs;
+}
+
+void printStats(const BatchStats &stats){
+	cout << fixed << setprecision(1) << "[" << setw(6) << stats.seconds << " s] " << stats.images << " images, "
+		<< stats.imagesPerSecond() << " images/s, " << stats.failed << " failed" << endl;
+	for (int s = 0; s < 3; s++){
+		const PipelineStageStats &stage = stats.stages[s];
+		cout << "  " << left << setw(8) << stage.name << right << stage.threads << " threads, " << stage.images << " images, "
+			<< setprecision(0) << stats.utilization(s) * 100. << "% busy, "
+			<< (s == 0 ? "inputs left " : "queue ") << stage.queueDepth << "/" << stage.queueCapacity
+			<< setprecision(1) << " (mean " << stage.meanQueueDepth << ", max " << stage.maxQueueDepth << ")" << endl;
+	}
+	cout << "  scheduler " << stats.schedulerTasks << " tasks, " << stats.schedulerSteals << " stolen, threads" << setprecision(0);
+	for (double utilization : stats.workerUtilization)
+		cout << " " << utilization * 100. << "%";
+	cout << endl;
+	cout << setprecision(1) << "  buffers " << stats.poolAllocations << " allocated for " << stats.poolRequests << " requests, "
+		<< stats.poolBytes / (1024. * 1024.) << " MB" << endl;
+}
+
+void printStreamStats(const StreamStats &stats){
+	cout << fixed << setprecision(1) << "[" << setw(6) << stats.seconds << " s] " << stats.processed << " frames, "
+		<< stats.fps() << " fps (source " << stats.sourceFps << "), " << stats.dropped << " dropped, " << stats.failed << " failed" << endl;
+	cout << setprecision(0) << "  decode " << (stats.seconds > 0. ? stats.decodeSeconds / stats.seconds * 100. : 0.) << "% busy, "
+		<< "process " << (stats.seconds > 0. ? stats.processSeconds / stats.seconds * 100. : 0.) << "% busy, "
+		<< stats.poolAllocations << " buffers allocated" << endl;
+}
+
+// video <video file|image dir> <steps> [output dir|-] [buffers] [realtime|fast] [image sequence fps]
+int runVideo(int argc, char* argv[]){
+	if (argc < 4){
+		cout << "usage: video <video file|image dir> <steps> [output dir|-] [buffers] [realtime|fast] [image sequence fps]" << endl;
+		cout << "steps, separated by '+':" << endl << stageUsage();
+		return -1;
+	}
+
+	vector<Stage> stages;
+	string error;
+	if (!parseStages(argv[3], stages, error)){
+		cout << error << endl << stageUsage();
+		return -1;
+	}
+
+	StreamOptions options = createStreamOptions();
+	if (argc > 4 && string(argv[4]) != "-")
+		options.outputDir = argv[4];
+	if (argc > 5)
+		options.buffers = atoi(argv[5]);
+	if (argc > 6)
+		options.realtime = string(argv[6]) == "realtime";
+	double sequenceFps = argc > 7 ? atof(argv[7]) : 25.;
+
+	unique_ptr<FrameSource> source = openFrameSource(argv[2], sequenceFps > 0. ? sequenceFps : 25.);
+	if (!source){
+		cout << "'" << argv[2] << "' could not be opened as video or image sequence" << endl;
+		return -2;
+	}
+
+	cout << source->frameCount() << " frames at " << source->fps() << " fps, steps '" << argv[3] << "', "
+		<< max(2u, options.buffers) << " buffers" << (options.realtime ? ", realtime" : "") << endl;
+	StreamStats stats = runStream(*source, stages, options, printStreamStats);
+
+	cout << "done:" << endl;
+	printStreamStats(stats);
+	PROFILE_REPORT("trace.json");
+
+	return stats.failed == 0 ? 0 : -3;
+}
+
+// strips <input .pgm|.ppm> <output .pgm|.ppm> <steps> [strip rows]
+int runStripMode(int argc, char* argv[]){
+	if (argc < 5){
+		cout << "usage: strips <input .pgm|.ppm> <output .pgm|.ppm> <steps> [strip rows]" << endl;
+		cout << "steps, separated by '+':" << endl << stageUsage();
+		return -1;
+	}
+
+	vector<Stage> stages;
+	string error;
+	if (!parseStages(argv[4], stages, error)){
+		cout << error << endl << stageUsage();
+		return -1;
+	}
+	int stripRows = argc > 5 ? atoi(argv[5]) : 256;
+
+	StripStats stats;
+	if (!runStrips(argv[2], argv[3], stages, stripRows, stats, error)){
+		cout << error << endl;
+		return -2;
+	}
+
+	const double megabyte = 1024. * 1024.;
+	cout << fixed << setprecision(1) << "[" << setw(6) << stats.seconds << " s] " << stats.cols << " x " << stats.rows
+		<< " to " << stats.outputCols << " x " << stats.outputRows << " in " << stats.strips << " strips of "
+		<< stats.stripRows << " rows, halo " << stats.halo << endl;
+	const double seconds = max(stats.seconds, 1e-9);
+	cout << setprecision(0) << "  read " << stats.readSeconds / seconds * 100. << "%, process "
+		<< stats.processSeconds / seconds * 100. << "%, write " << stats.writeSeconds / seconds * 100. << "%" << endl;
+	cout << setprecision(1) << "  buffers " << stats.poolBytes / megabyte << " MB for an image of "
+		<< (double)stats.rows * stats.cols / megabyte << " Mpixels" << endl;
+	PROFILE_REPORT("trace.json");
+
+	return 0;
+}
+
+// convert <image dir|list.txt|image> <output dir> [rawimg|png-fast|raw|output extension]
+int runConvert(int argc, char* argv[]){
+	if (argc < 4){
+		cout << "usage: convert <image dir|list.txt|image> <output dir> [rawimg|png-fast|raw|output extension]" << endl;
+		return -1;
+	}
+
+	vector<string> inputs = listInputs(argv[2]);
+	if (inputs.empty()){
+		cout << "no images found in '" << argv[2] << "'" << endl;
+		return -2;
+	}
+
+	string format = argc > 4 ? argv[4] : "rawimg";
+	ImageWriteMode mode = WRITE_AS_NAMED;
+	string extension;
+	if (format == "rawimg")
+		mode = WRITE_RAW_IMAGE;
+	else if (format == "png-fast")
+		mode = WRITE_PNG_FAST;
+	else if (format == "raw")
+		mode = WRITE_UNCOMPRESSED;
+	else
+		extension = format;
+
+	// images keep their type, e.g. 16 bit or CV_16SC1 intermediates; formats that cannot hold it fail to write
+	const int64 start = getTickCount();
+	ImageWriter writer(max(1u, thread::hardware_concurrency()));
+	writer.setVerbose(false);
+	uint64_t unreadable = 0;
+	for (const string &input : inputs){
+		Mat img = readImage(input, IMREAD_UNCHANGED);
+		if (!img.data){
+			cout << "image file " << input << " could not be opened" << endl;
+			unreadable++;
+			continue;
+		}
+		size_t slash = input.find_last_of("\\/");
+		string name = slash == string::npos ? input : input.substr(slash + 1);
+		if (!extension.empty())
+			name = name.substr(0, name.rfind('.')) + extension;
+		writer.write(argv[3], name, img, mode);
+	}
+	writer.close();
+
+	cout << fixed << setprecision(1) << "[" << setw(6) << (getTickCount() - start) / getTickFrequency() << " s] "
+		<< writer.written() << " images converted, " << unreadable + writer.failed() << " failed" << endl;
+	return unreadable + writer.failed() == 0 ? 0 : -3;
+}
+
+int main(int argc, char* argv[]){
+	if (argc > 1 && string(argv[1]) == "video")
+		return runVideo(argc, argv);
+	if (argc > 1 && string(argv[1]) == "strips")
+		return runStripMode(argc, argv);
+	if (argc > 1 && string(argv[1]) == "convert")
+		return runConvert(argc, argv);
+
+	if (argc < 4){
+		cout << "usage: <image dir|list.txt> <output dir> <steps> [decode threads] [process threads] [encode threads] "
+			"[queue capacity] [output extension|png-fast|raw|rawimg|-] [scheduler cpus, e.g. 0-7]" << endl;
+		cout << "       video <video file|image dir> <steps> [output dir|-] [buffers] [realtime|fast] [image sequence fps]" << endl;
+		cout << "       strips <input .pgm|.ppm> <output .pgm|.ppm> <steps> [strip rows]" << endl;
+		cout << "       convert <image dir|list.txt|image> <output dir> [rawimg|png-fast|raw|output extension]" << endl;
+		cout << "steps, separated by '+':" << endl << stageUsage();
+		return -1;
+	}
+
+	vector<Stage> stages;
+	string error;
+	if (!parseStages(argv[3], stages, error)){
+		cout << error << endl << stageUsage();
+		return -1;
+	}
+
+	vector<string> inputs = listInputs(argv[1]);
+	if (inputs.empty()){
+		cout << "no images found in '" << argv[1] << "'" << endl;
+		return -2;
+	}
+
+	BatchOptions options = createBatchOptions(argv[2]);
+	if (argc > 4)
+		options.decodeThreads = atoi(argv[4]);
+	if (argc > 5)
+		options.processThreads = atoi(argv[5]);
+	if (argc > 6)
+		options.encodeThreads = atoi(argv[6]);
+	if (argc > 7)
+		options.queueCapacity = atoi(argv[7]);
+	if (argc > 8 && string(argv[8]) != "-"){
+		string format(argv[8]);
+		if (format == "png-fast")
+			options.outputMode = WRITE_PNG_FAST;
+		else if (format == "raw")
+			options.outputMode = WRITE_UNCOMPRESSED;
+		else if (format == "rawimg")
+			options.outputMode = WRITE_RAW_IMAGE;
+		else
+			options.outputExtension = format;
+	}
+	if (argc > 9 && !parseCpuList(argv[9], options.cpus)){
+		cout << "'" << argv[9] << "' is no list of processors like 0-3,8" << endl;
+		return -1;
+	}
+
+	// the plans of the box and median filters are kept with the results unless FILTER_WISDOM names a file; the first
+	// plans are made before the writer has created the directory
+	_mkdir(options.outputDir.c_str());
+	setDefaultWisdomFile(options.outputDir + "\\filterWisdom.txt");
+
+	cout << inputs.size() << " images, steps '" << argv[3] << "', " << cpuTierName(imageKernels().tier) << " kernels" << endl;
+	for (const Stage &stage : stages){
+		if (stage.maxDeviation > 0)
+			cout << "  " << stage.name << " in fixed point, at most " << stage.maxDeviation << " gray levels from double" << endl;
+	}
+	BatchStats stats = runBatch(inputs, stages, options, printStats);
+
+	cout << "done:" << endl;
+	printStats(stats);
+	if (!filterPlanner().wisdomFile().empty())
+		cout << "  " << filterPlanner().plans() << " filter plans in " << filterPlanner().wisdomFile() << endl;
+	if (gradientCache().hits() + gradientCache().misses() > 0)
+		cout << "  gradient fields: " << gradientCache().misses() << " computed, " << gradientCache().hits() << " reused" << endl;
+	PROFILE_REPORT(options.outputDir + "\\trace.json");
+
+	return stats.failed == 0 ? 0 : -3;
+}
@@ -0,0 +1,212 @@
+#include "pipeline.h"
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2\highgui\highgui.hpp>
+
+#include "..\Common\boundedQueue.h"
+#include "..\Common\imageWriter.h"
+#include "..\Common\rawImage.h"
+#include "..\Common\profiler.h"
+#include "..\Common\threadPool.h"
+
+using namespace std;
+using namespace cv;
+
+BatchOptions createBatchOptions(const string &outputDir){
+	BatchOptions options;
+	options.decodeThreads = 2;
+	options.processThreads = max(1u, thread::hardware_concurrency());
+	options.encodeThreads = 2;
+	options.queueCapacity = 16;
+	options.outputDir = outputDir;
+	options.outputExtension = "";
+	options.outputMode = WRITE_AS_NAMED;
+	options.reportInterval = 1.;
+	options.bufferBudget = (size_t)256 << 20;
+	return options;
+}
+
+struct BatchItem{
+	size_t index;	// of the input
+	Mat img;
+};
+
+// file name inside the output directory
+static string outputFilename(const string &input, const BatchOptions &options){
+	size_t slash = input.find_last_of("\\/");
+	string name = slash == string::npos ? input : input.substr(slash + 1);
+	if (!options.outputExtension.empty())
+		name = name.substr(0, name.rfind('.')) + options.outputExtension;
+	return name;
+}
+
+static mutex messageMutex;
+
+static void reportFailure(const string &message){
+	unique_lock<mutex> lock(messageMutex);
+	cout << message << endl;
+}
+
+BatchStats runBatch(const vector<string> &inputs, const vector<Stage> &stages, const BatchOptions &options,
+	function<void(const BatchStats&)> onReport){
+	BoundedQueue<BatchItem> decoded(options.queueCapacity);
+	// results and temporaries of the steps, a result goes back to the pool once the writer has encoded it
+	BufferPool pool(options.bufferBudget);
+	// the encode stage
+	ImageWriter writer(max(1u, options.encodeThreads), options.queueCapacity);
+	writer.setVerbose(false);
+
+	// the scheduler keeps the settings of the first batch
+	createSharedThreadPool(max(1u, options.processThreads), options.cpus);
+	ThreadPool &scheduler = sharedThreadPool();
+	const vector<ThreadPool::WorkerStats> schedulerStart = scheduler.workerStats();
+
+	const unsigned threads[3] = { max(1u, options.decodeThreads), scheduler.size(), max(1u, options.encodeThreads) };
+	const int readFlags = stagesReadFlags(stages);
+	atomic<size_t> nextInput(0);
+	atomic<unsigned> running[3];
+	atomic<uint64_t> images[3];
+	atomic<int64_t> busyTicks[3];
+	atomic<uint64_t> failed(0);
+	for (int s = 0; s < 3; s++){
+		running[s] = threads[s];
+		images[s] = 0;
+		busyTicks[s] = 0;
+	}
+
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads[0]; t++){
+		workers.push_back(thread([&](){
+			for (size_t i = nextInput++; i < inputs.size(); i = nextInput++){
+				int64 start = getTickCount();
+				Mat img;
+				{
+					PROFILE_SCOPE("loadImg");
+					img = readImage(inputs[i], readFlags);
+				}
+				busyTicks[0] += getTickCount() - start;
+
+				if (!img.data){
+					reportFailure("image file " + inputs[i] + " could not be opened");
+					failed++;
+					continue;
+				}
+				images[0]++;
+				BatchItem item = { i, img };
+				if (!decoded.push(item))
+					break;
+			}
+			if (--running[0] == 0)
+				decoded.close();
+		}));
+	}
+	// one task per image on the scheduler, at most one image per thread in process, so the queue in front of the
+	// stage still bounds the memory
+	mutex slotMutex;
+	condition_variable slotFree;
+	unsigned inProcess = 0;
+	auto process = [&](BatchItem item){
+		int64 start = getTickCount();
+		try{
+			PROFILE_SCOPE_PIXELS("applyStages", item.img.total());
+			item.img = applyStages(stages, item.img, pool);
+			busyTicks[1] += getTickCount() - start;
+			images[1]++;
+			writer.write(options.outputDir, outputFilename(inputs[item.index], options), item.img, options.outputMode);
+		}
+		catch (const cv::Exception &e){
+			reportFailure(inputs[item.index] + ": " + e.what());
+			failed++;
+		}
+		{
+			unique_lock<mutex> lock(slotMutex);
+			inProcess--;
+		}
+		slotFree.notify_one();
+	};
+	workers.push_back(thread([&](){
+		TaskGroup group(scheduler);
+		BatchItem item;
+		while (decoded.pop(item)){
+			PROFILE_COUNT("decoded queue", decoded.size());
+			{
+				unique_lock<mutex> lock(slotMutex);
+				slotFree.wait(lock, [&]{ return inProcess < threads[1]; });
+				inProcess++;
+			}
+			group.run([&process, item](){ process(item); });
+		}
+		group.wait();
+		running[1] = 0;
+	}));
+
+	// the calling thread samples the queues until everything is written
+	const int64 begin = getTickCount();
+	const size_t sizes[3] = { inputs.size(), options.queueCapacity, options.queueCapacity };
+	double depthSum[3] = { 0., 0., 0. };
+	size_t maxDepth[3] = { 0, 0, 0 };
+	uint64_t samples = 0;
+	double nextReport = options.reportInterval;
+
+	BatchStats stats;
+	const char* names[3] = { "decode", "process", "encode" };
+	auto snapshot = [&](){
+		size_t depth[3] = { inputs.size() - min(inputs.size(), (size_t)nextInput), decoded.size(), writer.queueDepth() };
+		images[2] = writer.written();
+		busyTicks[2] = (int64_t)(writer.busySeconds() * getTickFrequency());
+		samples++;
+		stats.images = images[2];
+		stats.failed = failed + writer.failed();
+		stats.seconds = (getTickCount() - begin) / getTickFrequency();
+		stats.poolAllocations = pool.allocations();
+		stats.poolRequests = pool.requests();
+		stats.poolBytes = pool.bytes();
+		const vector<ThreadPool::WorkerStats> workerStats = scheduler.workerStats();
+		stats.workerUtilization.assign(workerStats.size(), 0.);
+		stats.schedulerTasks = 0;
+		stats.schedulerSteals = 0;
+		for (size_t w = 0; w < workerStats.size(); w++){
+			if (stats.seconds > 0.)
+				stats.workerUtilization[w] = (workerStats[w].busySeconds - schedulerStart[w].busySeconds) / stats.seconds;
+			stats.schedulerTasks += workerStats[w].tasks - schedulerStart[w].tasks;
+			stats.schedulerSteals += workerStats[w].steals - schedulerStart[w].steals;
+		}
+		for (int s = 0; s < 3; s++){
+			depthSum[s] += depth[s];
+			maxDepth[s] = max(maxDepth[s], depth[s]);
+
+			PipelineStageStats &stage = stats.stages[s];
+			stage.name = names[s];
+			stage.threads = threads[s];
+			stage.images = images[s];
+			stage.busySeconds = busyTicks[s] / getTickFrequency();
+			stage.queueDepth = depth[s];
+			stage.meanQueueDepth = depthSum[s] / samples;
+			stage.maxQueueDepth = maxDepth[s];
+			stage.queueCapacity = sizes[s];
+		}
+	};
+
+	while (running[1] > 0 || writer.inFlight() > 0){
+		this_thread::sleep_for(chrono::milliseconds(20));
+		snapshot();
+		if (options.reportInterval > 0. && stats.seconds >= nextReport && onReport){
+			onReport(stats);
+			nextReport += options.reportInterval;
+		}
+	}
+	for (thread &worker : workers)
+		worker.join();
+	writer.close();
+
+	snapshot();
+	stats.stages[1].maxQueueDepth = decoded.maxDepth();
+	stats.stages[2].maxQueueDepth = writer.maxQueueDepth();
+	return stats;
+}
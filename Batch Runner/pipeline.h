@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "..\Common\imageWriter.h"
+#include "stages.h"
+
+struct BatchOptions{
+	unsigned decodeThreads;
+	unsigned processThreads;		// threads of the shared scheduler (created by the first batch), images processed at once
+	unsigned encodeThreads;
+	size_t queueCapacity;			// images between two pipeline stages
+	std::string outputDir;
+	std::string outputExtension;	// e.g. ".png", empty keeps the extension of the input
+	ImageWriteMode outputMode;		// WRITE_PNG_FAST and WRITE_UNCOMPRESSED replace the extension
+	double reportInterval;			// seconds between progress reports, 0 for none
+	std::vector<int> cpus;			// logical processors of the scheduler threads, empty to leave it to the system
+	size_t bufferBudget;			// bytes of step buffers kept for reuse (see BufferPool), 0 for no limit
+};
+
+// 2 decode threads, 1 per hardware thread for processing, 2 encode threads, 16 images per queue, 256 MB of buffers
+BatchOptions createBatchOptions(const std::string &outputDir);
+
+// decode, process and encode, the encode stage is an ImageWriter
+struct PipelineStageStats{
+	const char* name;
+	unsigned threads;
+	uint64_t images;
+	double busySeconds;			// summed over the threads of the stage
+	size_t queueDepth;			// images waiting in front of the stage at the time of the report
+	double meanQueueDepth;		// sampled while running
+	size_t maxQueueDepth;
+	size_t queueCapacity;
+};
+
+struct BatchStats{
+	uint64_t images;			// written results
+	uint64_t failed;			// unreadable inputs and failed writes
+	double seconds;
+	PipelineStageStats stages[3];
+	uint64_t poolAllocations;	// buffers the steps allocated, stops growing after the first images of every size
+	uint64_t poolRequests;
+	size_t poolBytes;
+	std::vector<double> workerUtilization;	// of the scheduler threads during the batch, the steps parallelized inside included
+	uint64_t schedulerTasks;	// images and bands of rows run by the scheduler
+	uint64_t schedulerSteals;	// of those, taken from the deque of another thread
+
+	double imagesPerSecond() const{
+		return seconds > 0. ? images / seconds : 0.;
+	}
+
+	// share of the time the threads of a stage were working
+	double utilization(int stage) const{
+		return seconds > 0. ? stages[stage].busySeconds / (stages[stage].threads * seconds) : 0.;
+	}
+};
+
+// reads every input as 8 bit gray or color image (as the first step needs it), runs the steps and writes the result
+// under its file name to outputDir
+// the stages run concurrently and are connected by bounded queues, so at most about 2 queueCapacity + threads
+// images are in flight; the step buffers add the ones in use by the images in process and, with mixed image sizes,
+// idle buffers of earlier sizes up to bufferBudget bytes, so the memory stays bounded however many sizes the inputs
+// have; onReport is called from the calling thread every reportInterval seconds
+// the images are processed as tasks of sharedThreadPool(), where the steps also split their loops, so the idle
+// threads take bands of the images in process once fewer images than threads are left
+BatchStats runBatch(const std::vector<std::string> &inputs, const std::vector<Stage> &stages, const BatchOptions &options,
+	std::function<void(const BatchStats&)> onReport);
@@ -0,0 +1,206 @@
+#include "planner.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+
+#include "kernels.h"
+
+using namespace std;
+using namespace cv;
+
+// timed calls per candidate after an untimed one, the fastest counts
+#define PLANNER_REPETITIONS	3
+
+const char* filterStrategyName(FilterStrategy strategy){
+	switch (strategy){
+	case STRATEGY_RUNNING_SUM:	return "running-sum";
+	case STRATEGY_HISTOGRAM:	return "histogram";
+	default:					return "direct";
+	}
+}
+
+bool parseFilterStrategy(const string &name, FilterStrategy &strategy){
+	for (int s = 0; s < STRATEGY_COUNT; s++){
+		if (name == filterStrategyName((FilterStrategy)s)){
+			strategy = (FilterStrategy)s;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* filterOperationName(FilterOperation operation){
+	return operation == OPERATION_MEDIAN ? "median" : "filter";
+}
+
+FilterPlanKey filterPlanKey(FilterOperation operation, int kernelRows, int kernelCols, Size size){
+	FilterPlanKey key;
+	key.operation = operation;
+	key.kernelRows = kernelRows;
+	key.kernelCols = kernelCols;
+	key.sizeClass = 0;
+	for (size_t pixels = (size_t)size.area(); pixels > 1; pixels >>= 1)
+		key.sizeClass++;
+	key.tier = imageKernels().tier;
+	return key;
+}
+
+static bool isCandidate(FilterStrategy strategy, const FilterStrategy* candidates, int count){
+	return find(candidates, candidates + count, strategy) != candidates + count;
+}
+
+FilterPlanner::FilterPlanner(const string &wisdomFile, const string &forcedStrategy) : forced(-1){
+	FilterStrategy strategy;
+	if (parseFilterStrategy(forcedStrategy, strategy))
+		forced = strategy;
+	setWisdomFile(wisdomFile);
+}
+
+void FilterPlanner::setWisdomFile(const string &wisdomFile){
+	std::unique_lock<std::mutex> lock(mutex);
+	wisdom = wisdomFile;
+	if (wisdom.empty())
+		return;
+
+	// one plan per line: operation, kernel size, size class, CPU tier, strategy; later lines win
+	ifstream file(wisdom);
+	string line;
+	while (getline(file, line)){
+		istringstream fields(line);
+		string operation, tier, name;
+		FilterPlanKey key;
+		char times;
+		FilterStrategy strategy;
+		CpuTier cpuTier;
+		if (!(fields >> operation >> key.kernelRows >> times >> key.kernelCols >> key.sizeClass >> tier >> name) || times != 'x' ||
+			!parseFilterStrategy(name, strategy) || !parseCpuTier(tier, cpuTier))
+			continue;
+		key.operation = -1;
+		for (int o = 0; o < OPERATION_COUNT; o++){
+			if (operation == filterOperationName((FilterOperation)o))
+				key.operation = o;
+		}
+		key.tier = cpuTier;
+		if (key.operation >= 0)
+			planned[key] = strategy;
+	}
+}
+
+string FilterPlanner::wisdomFile() const{
+	std::unique_lock<std::mutex> lock(mutex);
+	return wisdom;
+}
+
+bool FilterPlanner::lookup(const FilterPlanKey &key, const FilterStrategy* candidates, int count, FilterStrategy &strategy) const{
+	assert(count > 0);
+	if (count == 1){
+		strategy = candidates[0];
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (forced >= 0 && isCandidate((FilterStrategy)forced, candidates, count)){
+		strategy = (FilterStrategy)forced;
+		return true;
+	}
+	unordered_map<FilterPlanKey, FilterStrategy, FilterPlanKeyHash>::const_iterator known = planned.find(key);
+	if (known == planned.end() || !isCandidate(known->second, candidates, count))
+		return false;
+	strategy = known->second;
+	return true;
+}
+
+FilterStrategy FilterPlanner::plan(const FilterPlanKey &key, const FilterStrategy* candidates, int count,
+	const function<void(FilterStrategy)> &run){
+	FilterStrategy best;
+	if (lookup(key, candidates, count, best))
+		return best;
+
+	// timed without the lock, other keys go on meanwhile; two threads timing the same key keep the first plan
+	best = candidates[0];
+	double bestSeconds = -1.;
+	for (int c = 0; c < count; c++){
+		run(candidates[c]);
+		double seconds = -1.;
+		for (int r = 0; r < PLANNER_REPETITIONS; r++){
+			int64 start = getTickCount();
+			run(candidates[c]);
+			double elapsed = (getTickCount() - start) / getTickFrequency();
+			if (seconds < 0. || elapsed < seconds)
+				seconds = elapsed;
+		}
+		if (bestSeconds < 0. || seconds < bestSeconds){
+			best = candidates[c];
+			bestSeconds = seconds;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	unordered_map<FilterPlanKey, FilterStrategy, FilterPlanKeyHash>::const_iterator known = planned.find(key);
+	if (known != planned.end())
+		return known->second;
+	planned[key] = best;
+	if (!wisdom.empty()){
+		ofstream file(wisdom, ios::app);
+		file << filterOperationName((FilterOperation)key.operation) << " " << key.kernelRows << "x" << key.kernelCols << " "
+			<< key.sizeClass << " " << cpuTierName((CpuTier)key.tier) << " " << filterStrategyName(best) << " "
+			<< bestSeconds * 1000. << " ms" << endl;
+	}
+	return best;
+}
+
+void FilterPlanner::force(int strategy){
+	std::unique_lock<std::mutex> lock(mutex);
+	forced = strategy >= 0 && strategy < STRATEGY_COUNT ? strategy : -1;
+}
+
+int FilterPlanner::forcedStrategy() const{
+	std::unique_lock<std::mutex> lock(mutex);
+	return forced;
+}
+
+size_t FilterPlanner::plans() const{
+	std::unique_lock<std::mutex> lock(mutex);
+	return planned.size();
+}
+
+// the value of an environment variable, empty if it is not set
+static string environment(const char* name){
+#ifdef _WIN32
+	char* value = NULL;
+	size_t length = 0;
+	string text;
+	if (_dupenv_s(&value, &length, name) == 0 && value != NULL)
+		text = value;
+	free(value);
+	return text;
+#else
+	const char* value = getenv(name);
+	return value != NULL ? value : "";
+#endif
+}
+
+// created by the first call and never destroyed, like imageKernels()
+FilterPlanner& filterPlanner(){
+	static std::atomic<FilterPlanner*> instance;
+	FilterPlanner* planner = instance.load(std::memory_order_acquire);
+	if (planner == NULL){
+		string wisdom = environment("FILTER_WISDOM");
+		if (wisdom == "-")
+			wisdom = "";
+		FilterPlanner* created = new FilterPlanner(wisdom, environment("FILTER_STRATEGY"));
+		if (instance.compare_exchange_strong(planner, created))
+			planner = created;
+		else
+			delete created;
+	}
+	return *planner;
+}
+
+void setDefaultWisdomFile(const string &wisdomFile){
+	if (environment("FILTER_WISDOM").empty())
+		filterPlanner().setWisdomFile(wisdomFile);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+
+#include <opencv2\core\core.hpp>
+
+// implementations of an operation that give the same results bit for bit, so the choice between them only changes
+// the time; approximations (separable or recursive gaussians, FFT, fixed point) are not candidates, a plan made on
+// one machine must not change the images of another
+enum FilterStrategy{
+	STRATEGY_DIRECT,		// filter: the kernel at every pixel; median: partial sort of every window
+	STRATEGY_RUNNING_SUM,	// filter with a kernel of one integer value (box): column and window sums updated per pixel
+	STRATEGY_HISTOGRAM,		// median: histogram of the window, one column out and one in per pixel
+	STRATEGY_COUNT
+};
+
+const char* filterStrategyName(FilterStrategy strategy);
+// false for unknown names
+bool parseFilterStrategy(const std::string &name, FilterStrategy &strategy);
+
+enum FilterOperation{
+	OPERATION_FILTER,
+	OPERATION_MEDIAN,
+	OPERATION_COUNT
+};
+
+const char* filterOperationName(FilterOperation operation);
+
+// what a plan is made for: operation, kernel size, image size class (a power of 2 of pixels) and CPU tier
+struct FilterPlanKey{
+	int operation;		// FilterOperation
+	int kernelRows, kernelCols;
+	int sizeClass;
+	int tier;			// CpuTier
+
+	bool operator==(const FilterPlanKey &other) const{
+		return operation == other.operation && kernelRows == other.kernelRows && kernelCols == other.kernelCols &&
+			sizeClass == other.sizeClass && tier == other.tier;
+	}
+};
+
+struct FilterPlanKeyHash{
+	size_t operator()(const FilterPlanKey &key) const{
+		size_t hash = key.operation;
+		hash = hash * 31 + key.kernelRows;
+		hash = hash * 31 + key.kernelCols;
+		hash = hash * 31 + key.sizeClass;
+		return hash * 31 + key.tier;
+	}
+};
+
+// the key of a request on an image of size with the bound kernels (imageKernels())
+FilterPlanKey filterPlanKey(FilterOperation operation, int kernelRows, int kernelCols, cv::Size size);
+
+// picks the fastest strategy per FilterPlanKey: the first request for a key times every candidate on its image, later
+// ones reuse the winner; with a wisdom file the plans are appended to it and read back by the next run, so the timing
+// happens once per machine
+// a forced strategy (for testing) wins wherever it is a candidate
+//
+//	FilterStrategy strategy;
+//	if (!filterPlanner().lookup(key, candidates, count, strategy))
+//		strategy = filterPlanner().plan(key, candidates, count, run);
+//	run(strategy);
+class FilterPlanner{
+public:
+	// wisdomFile empty: nothing is read or written
+	FilterPlanner(const std::string &wisdomFile, const std::string &forcedStrategy);
+
+	// the forced or planned strategy of key if it is one of the count candidates; no allocation, so every call of a
+	// filter can ask
+	bool lookup(const FilterPlanKey &key, const FilterStrategy* candidates, int count, FilterStrategy &strategy) const;
+
+	// times the candidates with run(strategy), which computes the result with a strategy, and keeps the fastest; the
+	// caller runs the strategy returned
+	FilterStrategy plan(const FilterPlanKey &key, const FilterStrategy* candidates, int count,
+		const std::function<void(FilterStrategy)> &run);
+
+	// reads the plans of wisdomFile, later plans are appended to it; empty for none
+	void setWisdomFile(const std::string &wisdomFile);
+	std::string wisdomFile() const;
+
+	// a FilterStrategy, -1 for none
+	void force(int strategy);
+	int forcedStrategy() const;
+
+	size_t plans() const;
+
+private:
+	FilterPlanner(const FilterPlanner&);
+	FilterPlanner& operator=(const FilterPlanner&);
+
+	std::string wisdom;
+	mutable std::mutex mutex;
+	std::unordered_map<FilterPlanKey, FilterStrategy, FilterPlanKeyHash> planned;
+	int forced;		// FilterStrategy, -1 for none
+};
+
+// the planner of the filters in stages.cpp, created by the first call: its wisdom file is the one FILTER_WISDOM names,
+// none without it ("-" for none as well), FILTER_STRATEGY forces a strategy (direct, running-sum, histogram)
+FilterPlanner& filterPlanner();
+
+// wisdomFile for filterPlanner() unless FILTER_WISDOM is set, for programs that keep the plans with their output
+void setDefaultWisdomFile(const std::string &wisdomFile);
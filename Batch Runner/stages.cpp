@@ -0,0 +1,1533 @@
+#include "stages.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+
+#include <opencv2\imgproc\imgproc.hpp>
+#include <opencv2\highgui\highgui.hpp>
+
+#include "..\Common\profiler.h"
+#include "..\Common\threadPool.h"
+#include "kernels.h"
+#include "convolution.h"
+#include "planner.h"
+#include "gradientCache.h"
+
+using namespace std;
+using namespace cv;
+
+#define PI	3.14159265
+#define E	2.71828182
+
+// pixels per call of a row kernel whose results go through a buffer on the stack
+#define KERNEL_CHUNK	256
+
+// pixels per task of the operations that split an image into bands of rows on the shared pool, enough work to
+// outweigh scheduling the task
+#define BAND_PIXELS		(1 << 16)
+
+static int bandRows(int cols){
+	return max(1, BAND_PIXELS / max(1, cols));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 1.1 Gray Scale Histograms
+
+static uchar quantize(uchar value, unsigned binCount){
+	return (unsigned)((double)value / 256. * binCount);
+}
+
+void calcHistogram(const Mat &img, unsigned binCount, vector<int> &histogramValues){
+	PROFILE_SCOPE_PIXELS("calcHistogram", img.total());
+	assert(img.channels() == 1);
+
+	// every pixel of a value goes to the same bin
+	int counts[256] = {};
+	if (img.rows > 0)
+		imageKernels().histogram(img.ptr<uchar>(0), img.step, img.rows, img.cols, counts);
+
+	histogramValues.assign(binCount, 0);
+	for (int v = 0; v < 256; v++)
+		histogramValues[quantize((uchar)v, binCount)] += counts[v];
+}
+
+vector<int> calcHistogram(const Mat &img, unsigned binCount){
+	vector<int> histogramValues;
+	calcHistogram(img, binCount, histogramValues);
+	return histogramValues;
+}
+
+// normalizes using the max value of the histogram
+void createHistogramImage(const vector<int> &histogramValues, Mat &dst){
+	int normalizeValue = max(1, *max_element(histogramValues.begin(), histogramValues.end()));
+
+	int binCount = (int)histogramValues.size();
+	int width = 256 * 3 / binCount*binCount;
+	int height = 500;
+	int binWidth = width / binCount;
+
+	dst.create(height, width, CV_8UC1);
+	dst.setTo(Scalar(255));
+
+	double magnitude;
+	for (int b = 0; b < binCount; b++){
+		magnitude = min(1., (double)histogramValues[b] / (double)normalizeValue);
+		// draws #bin_width lines next to each over
+		for (int j = 0; j < binWidth; j++){
+			line(dst, Point((b*binWidth) + j, height - 1), Point((b*binWidth) + j, height - (int)(magnitude*height)), Scalar(0));
+		}
+	}
+}
+
+Mat createHistogramImage(const vector<int> &histogramValues){
+	Mat histogram;
+	createHistogramImage(histogramValues, histogram);
+	return histogram;
+}
+
+void enhanceContrast(const Mat &img, Mat &dst, double cutOff){
+	PROFILE_SCOPE_PIXELS("enhanceContrast", img.total());
+	assert(img.type() == CV_8UC1);
+
+	const ImageKernels &kernels = imageKernels();
+
+	// 256 bins of width 1, counted on the stack
+	int histogramValues[256] = {};
+	if (img.rows > 0)
+		kernels.histogram(img.ptr<uchar>(0), img.step, img.rows, img.cols, histogramValues);
+
+	int totalCount = img.rows * img.cols;
+	int lowBound = 0;
+	int highBound = 0;
+	int currentCount = 0;
+	for (int b = 0; b < 256; b++){
+		currentCount += histogramValues[b];
+		if (lowBound == 0 && currentCount > cutOff*totalCount){
+			lowBound = b;
+		}
+		else if (currentCount > (1.0 - cutOff)*totalCount){
+			highBound = b;
+			break;
+		}
+	}
+	// flat images
+	if (highBound <= lowBound){
+		img.copyTo(dst);
+		return;
+	}
+
+	// every pixel of a value gets the same result
+	uchar lookup[256];
+	for (int v = 0; v < 256; v++)
+		lookup[v] = (uchar)min(255, max(0, (int)((double)(v - lowBound) / (double)(highBound - lowBound) * 255)));
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+	for (int y = 0; y < img.rows; y++)
+		kernels.lookup(img.ptr<uchar>(y), img.cols, lookup, dst.ptr<uchar>(y));
+}
+
+Mat enhanceContrast(const Mat &img, double cutOff){
+	Mat enhancedImg;
+	enhanceContrast(img, enhancedImg, cutOff);
+	return enhancedImg;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 1.2 Color Analysis
+
+void calc3DHistogram(const Mat &img, unsigned binCount, vector<int> &histogramValues){
+	PROFILE_SCOPE_PIXELS("calc3DHistogram", img.total());
+	assert(img.type() == CV_8UC3);
+	assert(binCount >= 1 && binCount <= 256);
+
+	histogramValues.assign(binCount * binCount * binCount, 0);
+	for (int y = 0; y < img.rows; y++){
+		const uchar* row = img.ptr<uchar>(y);
+		for (int x = 0; x < img.cols; x++){
+			// value * binCount / 256 is the bin of the exercise's quantize
+			unsigned b = row[3 * x] * binCount >> 8;
+			unsigned g = row[3 * x + 1] * binCount >> 8;
+			unsigned r = row[3 * x + 2] * binCount >> 8;
+			histogramValues[(b * binCount + g) * binCount + r]++;
+		}
+	}
+}
+
+static bool insideRange(uchar x, uchar min, uchar max){
+	return x >= min ? x <= max : false;
+}
+
+void highlightHue(const Mat &img, Mat &dst, uchar hue, uchar radius, Mat &hsvBuffer){
+	PROFILE_SCOPE_PIXELS("highlightHue", img.total());
+	assert(img.type() == CV_8UC3);
+	assert(hsvBuffer.data != img.data && hsvBuffer.data != dst.data);
+
+	cvtColor(img, hsvBuffer, COLOR_BGR2HSV);
+	dst.create(img.rows, img.cols, CV_8UC3);
+
+	const uchar minHue = (uchar)max(hue - radius, 0);
+	const uchar maxHue = (uchar)min(hue + radius, 179);
+	const ImageKernels &kernels = imageKernels();
+	uchar grey[KERNEL_CHUNK];
+
+	for (int y = 0; y < img.rows; y++){
+		const Vec3b* row = img.ptr<Vec3b>(y);
+		const Vec3b* rowHSV = hsvBuffer.ptr<Vec3b>(y);
+		Vec3b* rowHighlighted = dst.ptr<Vec3b>(y);
+		for (int x0 = 0; x0 < img.cols; x0 += KERNEL_CHUNK){
+			const int count = min(KERNEL_CHUNK, img.cols - x0);
+			kernels.luma(img.ptr<uchar>(y) + 3 * x0, count, grey);
+			for (int x = x0; x < x0 + count; x++){
+				const Vec3b &pixelHSV = rowHSV[x];
+				if (insideRange(pixelHSV[0], minHue, maxHue) && pixelHSV[1] >= 50 && pixelHSV[2] >= 50){
+					rowHighlighted[x] = row[x];
+				}
+				else{
+					uchar greyValue = grey[x - x0];
+					rowHighlighted[x] = Vec3b(greyValue, greyValue, greyValue);
+				}
+			}
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 1.4 Pixel Manipulation
+
+void simulateLowRes(const Mat &img, Mat &dst, int n){
+	assert(n > 0);
+	assert(img.type() == CV_8UC1);
+	assert(dst.data != img.data);
+
+	dst.create(img.rows - (img.rows%n), img.cols - (img.cols%n), CV_8UC1);
+	const int area = n*n;
+
+	// float sums of value / area in pixel order, rounded half to even, like the float Mat of the exercise
+	for (int yBlock = 0; yBlock < dst.rows; yBlock += n){
+		for (int xBlock = 0; xBlock < dst.cols; xBlock += n){
+			float sum = 0.f;
+			for (int y = yBlock; y < yBlock + n; y++){
+				const uchar* row = img.ptr<uchar>(y);
+				for (int x = xBlock; x < xBlock + n; x++)
+					sum += (float)row[x] / area;
+			}
+			uchar mean = saturate_cast<uchar>(sum);
+			for (int y = yBlock; y < yBlock + n; y++){
+				uchar* row = dst.ptr<uchar>(y);
+				for (int x = xBlock; x < xBlock + n; x++)
+					row[x] = mean;
+			}
+		}
+	}
+}
+
+void quantizeImg(const Mat &img, Mat &dst, int q){
+	assert(img.type() == CV_8UC1);
+	assert(q >= 1 && q <= 8);
+
+	uchar lookup[256];
+	for (int value = 0; value < 256; value++)
+		lookup[value] = ((value >> (8 - q)) << (8 - q)) + 256 / (1 << q + 1);
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+	const ImageKernels &kernels = imageKernels();
+	for (int y = 0; y < img.rows; y++)
+		kernels.lookup(img.ptr<uchar>(y), img.cols, lookup, dst.ptr<uchar>(y));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 2.1 Image Filters
+
+static double kernelSum(const Mat &kernel){
+	double normValue = 0.;
+	for (int y = 0; y < kernel.rows; y++){
+		const double *row = kernel.ptr<double>(y);
+		for (int x = 0; x < kernel.cols; x++){
+			normValue += row[x];
+		}
+	}
+	return normValue;
+}
+
+// the sums of the kernel over the pixels of row y in [x0, x0 + count[, the window of x0 starts at column x0 - xOffset
+static void convolveChunk(const ImageKernels &kernels, const Mat &img, const Mat &kernel, int y, int x0, int count, double* values){
+	const int yOffset = (kernel.rows - 1) / 2;
+	const int xOffset = (kernel.cols - 1) / 2;
+	kernels.convolve(img.ptr<uchar>(y - yOffset) + x0 - xOffset, img.step, kernel.ptr<double>(0), kernel.rows, kernel.cols, count, values);
+}
+
+// rows [y0, y1[ of filter, the kernel at every pixel
+static void filterDirectRows(const Mat &img, Mat &dst, const Mat &kernel, double normValue, int y0, int y1){
+	int yOffset = (kernel.rows - 1) / 2;
+	int xOffset = (kernel.cols - 1) / 2;
+
+	const ImageKernels &kernels = imageKernels();
+	double values[KERNEL_CHUNK];
+	for (int y = y0; y < y1; y++){
+		//copy border from original Image
+		if (y < yOffset || y >= img.rows - yOffset){
+			img.row(y).copyTo(dst.row(y));
+			continue;
+		}
+
+		uchar *row = dst.ptr<uchar>(y);
+		const uchar *rowOrg = img.ptr<uchar>(y);
+		//copy border from original Image
+		for (int x = 0; x < min(xOffset, img.cols); x++){
+			row[x] = rowOrg[x];
+			row[img.cols - 1 - x] = rowOrg[img.cols - 1 - x];
+		}
+
+		for (int x0 = xOffset; x0 < img.cols - xOffset; x0 += KERNEL_CHUNK){
+			const int count = min(KERNEL_CHUNK, img.cols - xOffset - x0);
+			convolveChunk(kernels, img, kernel, y, x0, count, values);
+			for (int x = 0; x < count; x++)
+				row[x0 + x] = (uchar)max(0., values[x] / normValue);
+		}
+	}
+}
+
+// every tap the same integer (box kernels): the products and their sums are exact in double, so value * (integer sum
+// of the window) is what the direct loop sums
+static bool isIntegralConstant(const Mat &kernel){
+	const double* taps = kernel.ptr<double>(0);
+	const double value = taps[0];
+	if (value != floor(value) || fabs(value) * 255. * kernel.total() > 2147483647.)
+		return false;
+	for (size_t i = 1; i < kernel.total(); i++){
+		if (taps[i] != value)
+			return false;
+	}
+	return true;
+}
+
+// rows [y0, y1[ of filter with an integral constant kernel: the sums of the kernel rows over every column are
+// carried from row to row, the window sum from pixel to pixel
+static void filterRunningSumRows(const Mat &img, Mat &dst, const Mat &kernel, double normValue, int y0, int y1){
+	int yOffset = (kernel.rows - 1) / 2;
+	int xOffset = (kernel.cols - 1) / 2;
+	const double value = kernel.at<double>(0, 0);
+
+	vector<int> columnSums(img.cols);
+	bool started = false;
+	for (int y = y0; y < y1; y++){
+		//copy border from original Image
+		if (y < yOffset || y >= img.rows - yOffset){
+			img.row(y).copyTo(dst.row(y));
+			continue;
+		}
+
+		if (!started){
+			fill(columnSums.begin(), columnSums.end(), 0);
+			for (int ky = -yOffset; ky <= yOffset; ky++){
+				const uchar* rowIn = img.ptr<uchar>(y + ky);
+				for (int x = 0; x < img.cols; x++)
+					columnSums[x] += rowIn[x];
+			}
+			started = true;
+		}
+		else{
+			const uchar* rowIn = img.ptr<uchar>(y + yOffset);
+			const uchar* rowOut = img.ptr<uchar>(y - yOffset - 1);
+			for (int x = 0; x < img.cols; x++)
+				columnSums[x] += rowIn[x] - rowOut[x];
+		}
+
+		uchar *row = dst.ptr<uchar>(y);
+		const uchar *rowOrg = img.ptr<uchar>(y);
+		//copy border from original Image
+		for (int x = 0; x < min(xOffset, img.cols); x++){
+			row[x] = rowOrg[x];
+			row[img.cols - 1 - x] = rowOrg[img.cols - 1 - x];
+		}
+		if (img.cols < kernel.cols)
+			continue;
+
+		int sum = 0;
+		for (int x = 0; x < kernel.cols; x++)
+			sum += columnSums[x];
+		for (int x = xOffset; x < img.cols - xOffset; x++){
+			if (x > xOffset)
+				sum += columnSums[x + xOffset] - columnSums[x - xOffset - 1];
+			row[x] = (uchar)max(0., value * sum / normValue);
+		}
+	}
+}
+
+void filter(const Mat &img, Mat &dst, const Mat &kernel, bool normalize){
+	PROFILE_SCOPE_PIXELS("filter", img.total());
+	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
+	assert(kernel.type() == CV_64FC1 && kernel.isContinuous());
+	assert(dst.data != img.data);
+	if (img.type() != CV_8UC1){
+		if (!convolveTyped(img, dst, img.depth(), kernel, normalize, CONVOLUTION_BORDER_COPY))
+			CV_Error(CV_StsUnsupportedFormat, "filter: no convolution for the type of the image");
+		return;
+	}
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+
+	double normValue = normalize ? kernelSum(kernel) : 1.;
+	assert(normValue != 0);
+
+	auto run = [&](FilterStrategy strategy){
+		parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+			if (strategy == STRATEGY_RUNNING_SUM)
+				filterRunningSumRows(img, dst, kernel, normValue, y0, y1);
+			else
+				filterDirectRows(img, dst, kernel, normValue, y0, y1);
+		});
+	};
+	// only box kernels have a second strategy, the others skip the planner
+	if (!isIntegralConstant(kernel)){
+		run(STRATEGY_DIRECT);
+		return;
+	}
+	const FilterStrategy candidates[] = { STRATEGY_DIRECT, STRATEGY_RUNNING_SUM };
+	const FilterPlanKey key = filterPlanKey(OPERATION_FILTER, kernel.rows, kernel.cols, img.size());
+	FilterStrategy strategy;
+	if (!filterPlanner().lookup(key, candidates, 2, strategy))
+		strategy = filterPlanner().plan(key, candidates, 2, run);
+	run(strategy);
+}
+
+Mat filter(const Mat &img, const Mat &kernel, bool normalize){
+	Mat filteredImg;
+	filter(img, filteredImg, kernel, normalize);
+	return filteredImg;
+}
+
+bool quantizeKernel(const Mat &kernel, bool normalize, FixedPointKernel &fixed){
+	assert(kernel.type() == CV_64FC1 && kernel.isContinuous());
+	double normValue = normalize ? kernelSum(kernel) : 1.;
+	assert(normValue != 0);
+
+	const double* taps = kernel.ptr<double>(0);
+	const int count = (int)kernel.total();
+	bool integral = true;
+	for (int i = 0; i < count; i++)
+		integral = integral && taps[i] / normValue == floor(taps[i] / normValue);
+
+	// the coefficients have to fit int16 and the sums of 8 bit pixels (plus the rounding) int32
+	for (int shift = integral ? 0 : 30; shift >= 0; shift--){
+		const double scale = ldexp(1., shift);
+		Mat coefficients(kernel.rows, kernel.cols, CV_16SC1);
+		short* rounded = coefficients.ptr<short>(0);
+		double absSum = 0., error = 0.;
+		bool fits = true;
+		for (int i = 0; i < count && fits; i++){
+			const double exact = taps[i] / normValue * scale;
+			const double value = floor(exact + 0.5);
+			fits = fabs(value) <= 32767.;
+			rounded[i] = (short)value;
+			absSum += fabs(value);
+			error += fabs(value - exact) / scale;
+		}
+		if (!fits || 255. * absSum + scale / 2 > 2147483647.)
+			continue;
+
+		fixed.coefficients = coefficients;
+		fixed.shift = shift;
+		fixed.maxError = 255. * error;
+		// the double arithmetic truncates where this rounds, which adds up to one gray level unless both are exact
+		fixed.maxDeviation = shift == 0 && error == 0. ? 0 : (int)floor(fixed.maxError + 1.5);
+		return true;
+	}
+	return false;
+}
+
+// the rounded sums of the fixed point kernel over the pixels of row y in [x0, x0 + count[, like convolveChunk
+static void convolveChunkFixed(const ImageKernels &kernels, const Mat &img, const FixedPointKernel &kernel, int y, int x0, int count, int* values){
+	const Mat &coefficients = kernel.coefficients;
+	const int yOffset = (coefficients.rows - 1) / 2;
+	const int xOffset = (coefficients.cols - 1) / 2;
+	kernels.convolveFixed(img.ptr<uchar>(y - yOffset) + x0 - xOffset, img.step, coefficients.ptr<short>(0),
+		coefficients.rows, coefficients.cols, count, values);
+	if (kernel.shift > 0){
+		// halves round up, the arithmetic shift floors negative sums too
+		const int half = 1 << (kernel.shift - 1);
+		for (int x = 0; x < count; x++)
+			values[x] = (values[x] + half) >> kernel.shift;
+	}
+}
+
+void filter(const Mat &img, Mat &dst, const FixedPointKernel &kernel){
+	PROFILE_SCOPE_PIXELS("filter", img.total());
+	const Mat &coefficients = kernel.coefficients;
+	assert(coefficients.rows % 2 == 1 && coefficients.cols % 2 == 1);
+	assert(coefficients.type() == CV_16SC1 && coefficients.isContinuous());
+	assert(img.type() == CV_8UC1);
+	assert(dst.data != img.data);
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+
+	int yOffset = (coefficients.rows - 1) / 2;
+	int xOffset = (coefficients.cols - 1) / 2;
+
+	const ImageKernels &kernels = imageKernels();
+
+	parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+		int values[KERNEL_CHUNK];
+		for (int y = y0; y < y1; y++){
+			//copy border from original Image
+			if (y < yOffset || y >= img.rows - yOffset){
+				img.row(y).copyTo(dst.row(y));
+				continue;
+			}
+
+			uchar *row = dst.ptr<uchar>(y);
+			const uchar *rowOrg = img.ptr<uchar>(y);
+			//copy border from original Image
+			for (int x = 0; x < min(xOffset, img.cols); x++){
+				row[x] = rowOrg[x];
+				row[img.cols - 1 - x] = rowOrg[img.cols - 1 - x];
+			}
+
+			for (int x0 = xOffset; x0 < img.cols - xOffset; x0 += KERNEL_CHUNK){
+				const int count = min(KERNEL_CHUNK, img.cols - xOffset - x0);
+				convolveChunkFixed(kernels, img, kernel, y, x0, count, values);
+				for (int x = 0; x < count; x++)
+					row[x0 + x] = saturate_cast<uchar>(values[x]);
+			}
+		}
+	});
+}
+
+void box(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth){
+	Mat kernel(kernelHeight, kernelWidth, CV_64FC1, Scalar(1.));
+	filter(img, dst, kernel, true);
+}
+
+Mat box(const Mat &img, int kernelHeight, int kernelWidth){
+	Mat filteredImg;
+	box(img, filteredImg, kernelHeight, kernelWidth);
+	return filteredImg;
+}
+
+Mat createGaussianKernel(int kernelHeight, int kernelWidth, double sigma){
+	assert(kernelHeight % 2 == 1 && kernelWidth % 2 == 1);
+
+	int yOffset = (kernelHeight - 1) / 2;
+	int xOffset = (kernelWidth - 1) / 2;
+
+	Mat kernel(kernelHeight, kernelWidth, CV_64FC1, Scalar(0.));
+
+	for (int y = -yOffset; y <= yOffset; y++){
+		double *row = kernel.ptr<double>(y + yOffset);
+		for (int x = -xOffset; x <= xOffset; x++){
+			row[x + xOffset] = (1. / (2.*PI*sigma*sigma))*pow(E, (-(x*x + y*y) / (2 * sigma*sigma)));
+		}
+	}
+	return kernel;
+}
+
+void gaussian(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth, double sigma){
+	Mat kernel = createGaussianKernel(kernelHeight, kernelWidth, sigma);
+	filter(img, dst, kernel, true);
+}
+
+Mat gaussian(const Mat &img, int kernelHeight, int kernelWidth, double sigma){
+	Mat filteredImg;
+	gaussian(img, filteredImg, kernelHeight, kernelWidth, sigma);
+	return filteredImg;
+}
+
+// windows up to this size are sorted on the stack
+#define MEDIAN_STACK_WINDOW	(31*31)
+
+// median value of the neighbourhood of a single pixel, window holds kernelHeight * kernelWidth values
+static void _median(uchar* pixel, const Mat &values, int kernelHeight, int kernelWidth, uchar* window){
+	assert(values.channels() == 1);
+
+	int count = 0;
+	for (int y = 0; y < kernelHeight; y++){
+		const uchar *rowValues = values.ptr<uchar>(y);
+		for (int x = 0; x < kernelWidth; x++){
+			window[count++] = rowValues[x];
+		}
+	}
+	assert(count % 2 == 1);
+
+	nth_element(window, window + (count - 1) / 2, window + count);
+	*pixel = window[(count - 1) / 2];
+}
+
+// rows [y0, y1[ of median, a partial sort of every window
+static void medianSortRows(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth, int y0, int y1){
+	int yOffset = (kernelHeight - 1) / 2;
+	int xOffset = (kernelWidth - 1) / 2;
+
+	uchar stackWindow[MEDIAN_STACK_WINDOW];
+	vector<uchar> heapWindow;
+	uchar* window = stackWindow;
+	if (kernelHeight*kernelWidth > MEDIAN_STACK_WINDOW){
+		heapWindow.resize(kernelHeight*kernelWidth);
+		window = heapWindow.data();
+	}
+
+	for (int y = y0; y < y1; y++){
+		//copy border from original Image
+		if (y < yOffset || y >= img.rows - yOffset){
+			img.row(y).copyTo(dst.row(y));
+			continue;
+		}
+
+		uchar *row = dst.ptr<uchar>(y);
+		for (int x = 0; x < img.cols; x++){
+			//copy border from original Image
+			if (x < xOffset || x >= img.cols - xOffset){
+				row[x] = img.at<uchar>(y, x);
+				continue;
+			}
+
+			Mat tmp = img(Rect(x - xOffset, y - yOffset, kernelWidth, kernelHeight));
+			_median(&row[x], tmp, kernelHeight, kernelWidth, window);
+		}
+	}
+}
+
+// rows [y0, y1[ of median from a histogram of the window: moving right removes a column and adds one, the median is
+// found through 16 coarse bins of 16 values each
+static void medianHistogramRows(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth, int y0, int y1){
+	int yOffset = (kernelHeight - 1) / 2;
+	int xOffset = (kernelWidth - 1) / 2;
+	const int rank = (kernelHeight*kernelWidth - 1) / 2;
+
+	for (int y = y0; y < y1; y++){
+		//copy border from original Image
+		if (y < yOffset || y >= img.rows - yOffset){
+			img.row(y).copyTo(dst.row(y));
+			continue;
+		}
+
+		uchar *row = dst.ptr<uchar>(y);
+		const uchar *rowOrg = img.ptr<uchar>(y);
+		//copy border from original Image
+		for (int x = 0; x < min(xOffset, img.cols); x++){
+			row[x] = rowOrg[x];
+			row[img.cols - 1 - x] = rowOrg[img.cols - 1 - x];
+		}
+		if (img.cols < kernelWidth)
+			continue;
+
+		int fine[256] = { 0 };
+		int coarse[16] = { 0 };
+		for (int ky = -yOffset; ky <= yOffset; ky++){
+			const uchar* rowIn = img.ptr<uchar>(y + ky);
+			for (int x = 0; x < kernelWidth; x++){
+				fine[rowIn[x]]++;
+				coarse[rowIn[x] >> 4]++;
+			}
+		}
+		for (int x = xOffset; x < img.cols - xOffset; x++){
+			if (x > xOffset){
+				for (int ky = -yOffset; ky <= yOffset; ky++){
+					const uchar* rowIn = img.ptr<uchar>(y + ky);
+					const uchar out = rowIn[x - xOffset - 1];
+					const uchar in = rowIn[x + xOffset];
+					fine[out]--;
+					coarse[out >> 4]--;
+					fine[in]++;
+					coarse[in >> 4]++;
+				}
+			}
+
+			int remaining = rank;
+			int bin = 0;
+			while (remaining >= coarse[bin])
+				remaining -= coarse[bin++];
+			int value = bin << 4;
+			while (remaining >= fine[value])
+				remaining -= fine[value++];
+			row[x] = (uchar)value;
+		}
+	}
+}
+
+void median(const Mat &img, Mat &dst, int kernelHeight, int kernelWidth){
+	PROFILE_SCOPE_PIXELS("median", img.total());
+	assert(kernelHeight % 2 == 1 && kernelWidth % 2 == 1);
+	assert(dst.data != img.data);
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+
+	// the window costs about as much as the kernel per pixel, bands get fewer pixels for large kernels
+	const int grain = max(1, bandRows(img.cols) / (kernelHeight*kernelWidth));
+	auto run = [&](FilterStrategy strategy){
+		parallelFor(sharedThreadPool(), 0, img.rows, grain, [&](int y0, int y1){
+			if (strategy == STRATEGY_HISTOGRAM)
+				medianHistogramRows(img, dst, kernelHeight, kernelWidth, y0, y1);
+			else
+				medianSortRows(img, dst, kernelHeight, kernelWidth, y0, y1);
+		});
+	};
+	const FilterStrategy candidates[] = { STRATEGY_DIRECT, STRATEGY_HISTOGRAM };
+	const FilterPlanKey key = filterPlanKey(OPERATION_MEDIAN, kernelHeight, kernelWidth, img.size());
+	FilterStrategy strategy;
+	if (!filterPlanner().lookup(key, candidates, 2, strategy))
+		strategy = filterPlanner().plan(key, candidates, 2, run);
+	run(strategy);
+}
+
+Mat median(const Mat &img, int kernelHeight, int kernelWidth){
+	Mat medianImg;
+	median(img, medianImg, kernelHeight, kernelWidth);
+	return medianImg;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 2.2 Gradients
+
+void filterSigned(const Mat &img, Mat &dst, const Mat &kernel, bool normalize){
+	assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
+	assert(kernel.type() == CV_64FC1 && kernel.isContinuous());
+	if (img.type() != CV_8UC1){
+		if (!convolveTyped(img, dst, img.depth() == CV_32F ? CV_32F : CV_16S, kernel, normalize, CONVOLUTION_BORDER_ZERO))
+			CV_Error(CV_StsUnsupportedFormat, "filterSigned: no convolution for the type of the image");
+		return;
+	}
+
+	dst.create(img.rows, img.cols, CV_16SC1);
+
+	double normValue = normalize ? kernelSum(kernel) : 1.;
+	assert(normValue != 0);
+
+	int yOffset = (kernel.rows - 1) / 2;
+	int xOffset = (kernel.cols - 1) / 2;
+
+	const ImageKernels &kernels = imageKernels();
+
+	parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+		double values[KERNEL_CHUNK];
+		for (int y = y0; y < y1; y++){
+			short *row = dst.ptr<short>(y);
+			// the border is 0, a reused dst still holds the last image
+			if (y < yOffset || y >= img.rows - yOffset){
+				fill(row, row + img.cols, (short)0);
+				continue;
+			}
+			for (int x = 0; x < min(xOffset, img.cols); x++){
+				row[x] = 0;
+				row[img.cols - 1 - x] = 0;
+			}
+			for (int x0 = xOffset; x0 < img.cols - xOffset; x0 += KERNEL_CHUNK){
+				const int count = min(KERNEL_CHUNK, img.cols - xOffset - x0);
+				convolveChunk(kernels, img, kernel, y, x0, count, values);
+				for (int x = 0; x < count; x++)
+					row[x0 + x] = (short)(values[x] / normValue);
+			}
+		}
+	});
+}
+
+Mat filterSigned(const Mat &img, const Mat &kernel, bool normalize){
+	Mat filteredImg;
+	filterSigned(img, filteredImg, kernel, normalize);
+	return filteredImg;
+}
+
+void filterSigned(const Mat &img, Mat &dst, const FixedPointKernel &kernel){
+	const Mat &coefficients = kernel.coefficients;
+	assert(coefficients.rows % 2 == 1 && coefficients.cols % 2 == 1);
+	assert(coefficients.type() == CV_16SC1 && coefficients.isContinuous());
+	assert(img.type() == CV_8UC1);
+
+	dst.create(img.rows, img.cols, CV_16SC1);
+
+	int yOffset = (coefficients.rows - 1) / 2;
+	int xOffset = (coefficients.cols - 1) / 2;
+
+	const ImageKernels &kernels = imageKernels();
+
+	parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+		int values[KERNEL_CHUNK];
+		for (int y = y0; y < y1; y++){
+			short *row = dst.ptr<short>(y);
+			// the border is 0, a reused dst still holds the last image
+			if (y < yOffset || y >= img.rows - yOffset){
+				fill(row, row + img.cols, (short)0);
+				continue;
+			}
+			for (int x = 0; x < min(xOffset, img.cols); x++){
+				row[x] = 0;
+				row[img.cols - 1 - x] = 0;
+			}
+			for (int x0 = xOffset; x0 < img.cols - xOffset; x0 += KERNEL_CHUNK){
+				const int count = min(KERNEL_CHUNK, img.cols - xOffset - x0);
+				convolveChunkFixed(kernels, img, kernel, y, x0, count, values);
+				for (int x = 0; x < count; x++)
+					row[x0 + x] = saturate_cast<short>(values[x]);
+			}
+		}
+	});
+}
+
+// the 8 bit images in fixed point, all others through filterSigned
+static void sobel(const Mat &img, Mat &dst, const short values[9]){
+	if (img.type() != CV_8UC1){
+		double taps[9];
+		copy(values, values + 9, taps);
+		filterSigned(img, dst, Mat(3, 3, CV_64FC1, taps), false);
+		return;
+	}
+	const FixedPointKernel kernel = { Mat(3, 3, CV_16SC1, (void*)values), 0, 0., 0 };
+	filterSigned(img, dst, kernel);
+}
+
+void sobelX(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
+	static const short values[9] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
+	sobel(img, dst, values);
+}
+
+Mat sobelX(const Mat &img){
+	Mat derivative;
+	sobelX(img, derivative);
+	return derivative;
+}
+
+void sobelY(const Mat &img, Mat &dst){
+	PROFILE_SCOPE_PIXELS("sobel", img.total());
+	static const short values[9] = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+	sobel(img, dst, values);
+}
+
+Mat sobelY(const Mat &img){
+	Mat derivative;
+	sobelY(img, derivative);
+	return derivative;
+}
+
+void calcMagnitude(const Mat &X, const Mat &Y, Mat &dst){
+	assert(X.size() == Y.size());
+	assert(X.type() == Y.type());
+
+	if (X.type() == CV_32FC1){
+		dst.create(X.rows, X.cols, CV_32FC1);
+		parallelFor(sharedThreadPool(), 0, dst.rows, bandRows(dst.cols), [&](int y0, int y1){
+			for (int y = y0; y < y1; y++){
+				const float *rowX = X.ptr<float>(y);
+				const float *rowY = Y.ptr<float>(y);
+				float *row = dst.ptr<float>(y);
+				for (int x = 0; x < dst.cols; x++)
+					row[x] = abs(rowX[x]) + abs(rowY[x]);
+			}
+		});
+		return;
+	}
+	assert(X.type() == CV_16SC1);
+
+	dst.create(X.rows, X.cols, CV_16SC1);
+
+	const ImageKernels &kernels = imageKernels();
+	parallelFor(sharedThreadPool(), 0, dst.rows, bandRows(dst.cols), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++)
+			kernels.magnitude(X.ptr<short>(y), Y.ptr<short>(y), dst.cols, dst.ptr<short>(y));
+	});
+}
+
+Mat calcMagnitude(const Mat &X, const Mat &Y){
+	Mat mag;
+	calcMagnitude(X, Y, mag);
+	return mag;
+}
+
+// the maximum of every band on its own, reduced afterwards
+template<typename T>
+static double getAbsMax(const Mat &img){
+	const int grain = bandRows(img.cols);
+	vector<double> bandMax((img.rows + grain - 1) / grain + 1, 1.);
+	parallelFor(sharedThreadPool(), 0, img.rows, grain, [&](int y0, int y1){
+		double value = 1.;
+		for (int y = y0; y < y1; y++){
+			const T *row = img.ptr<T>(y);
+			for (int x = 0; x < img.cols; x++)
+				value = max(value, (double)abs(row[x]));
+		}
+		bandMax[y0 / grain] = value;
+	});
+	return *max_element(bandMax.begin(), bandMax.end());
+}
+
+template<typename T>
+static void convertToImgTyped(const Mat &img, Mat &dst){
+	// a fourth of the absolute maximum, like the OpenCV Sobel representation
+	double normValue = getAbsMax<T>(img) / 4;
+
+	dst.create(img.rows, img.cols, CV_8UC1);
+	parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
+			uchar *row = dst.ptr<uchar>(y);
+			const T *rowOrg = img.ptr<T>(y);
+			for (int x = 0; x < img.cols; x++){
+				row[x] = (uchar)min(255., abs(((double)rowOrg[x] / normValue)*255.));
+			}
+		}
+	});
+}
+
+void convertToImg(const Mat &img, Mat &dst){
+	assert(img.type() == CV_16SC1 || img.type() == CV_32FC1);
+	if (img.type() == CV_32FC1)
+		convertToImgTyped<float>(img, dst);
+	else
+		convertToImgTyped<short>(img, dst);
+}
+
+Mat convertToImg(const Mat &img){
+	Mat convertedImg;
+	convertToImg(img, convertedImg);
+	return convertedImg;
+}
+
+void calcGradients(const Mat &X, const Mat &Y, Mat &dst){
+	PROFILE_SCOPE_PIXELS("calcGradients", X.total());
+	assert(X.size() == Y.size());
+	assert(X.type() == CV_16SC1 && Y.type() == CV_16SC1);
+
+	dst.create(X.rows, X.cols, CV_64FC1);
+
+	for (int y = 0; y < dst.rows; y++){
+		double *row = dst.ptr<double>(y);
+		const short *rowX = X.ptr<short>(y);
+		const short *rowY = Y.ptr<short>(y);
+		for (int x = 0; x < dst.cols; x++){
+			row[x] = atan2(rowY[x], rowX[x]);
+		}
+	}
+}
+
+Mat calcGradients(const Mat &X, const Mat &Y){
+	Mat gradients;
+	calcGradients(X, Y, gradients);
+	return gradients;
+}
+
+GradientField GradientField::rowRange(int top, int bottom) const{
+	GradientField rows;
+	rows.X = X.rowRange(top, bottom);
+	rows.Y = Y.rowRange(top, bottom);
+	rows.magnitude = magnitude.rowRange(top, bottom);
+	rows.orientation = orientation.rowRange(top, bottom);
+	return rows;
+}
+
+void computeGradientField(const Mat &img, GradientField &field){
+	PROFILE_SCOPE_PIXELS("computeGradientField", img.total());
+	assert(img.type() == CV_8UC1);
+
+	sobelX(img, field.X);
+	sobelY(img, field.Y);
+	field.magnitude.create(img.rows, img.cols, CV_16SC1);
+	field.orientation.create(img.rows, img.cols, CV_32FC1);
+
+	// magnitude and orientation in one pass over the derivatives
+	const ImageKernels &kernels = imageKernels();
+	parallelFor(sharedThreadPool(), 0, img.rows, bandRows(img.cols), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++){
+			const short *rowX = field.X.ptr<short>(y);
+			const short *rowY = field.Y.ptr<short>(y);
+			kernels.magnitude(rowX, rowY, img.cols, field.magnitude.ptr<short>(y));
+			float *row = field.orientation.ptr<float>(y);
+			for (int x = 0; x < img.cols; x++)
+				row[x] = (float)atan2(rowY[x], rowX[x]);
+		}
+	});
+}
+
+static void _drawGradient(Mat &gradImg, int x, int y, double gradDir, short gradMag){
+	double length = 0.06;
+	int xOffset = (int)(gradMag * cos(gradDir) * length) / 2;
+	int yOffset = (int)(gradMag * sin(gradDir) * length) / 2;
+
+	Point start = Point(x - xOffset, y - yOffset);
+	Point end = Point(x + xOffset, y + yOffset);
+
+	line(gradImg, start, end, Scalar(0, 255, 0));
+	if (gradDir < 0 && yOffset > 0)
+		circle(gradImg, start, 2, Scalar(0, 255, 0), -1);
+	else
+		circle(gradImg, end, 2, Scalar(0, 255, 0), -1);
+	circle(gradImg, Point(x, y), 2, Scalar(0, 0, 255), -1);
+}
+
+// an arrow at every fifth pixel of every fifth row whose magnitude is above the threshold
+template<typename T>
+static void _drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag, Mat &dst){
+	assert(img.type() == CV_8UC3 && gradients.type() == DataType<T>::type && dervMag.type() == CV_16SC1);
+	assert(img.size() == gradients.size() && img.size() == dervMag.size());
+
+	short threshold = 150;
+
+	img.copyTo(dst);
+	for (int y = 0; y < img.rows; y += 5){
+		const T *rowGrad = gradients.ptr<T>(y);
+		const short *rowMag = dervMag.ptr<short>(y);
+		for (int x = 0; x < img.cols; x += 5){
+			if (rowMag[x] > threshold){
+				_drawGradient(dst, x, y, rowGrad[x], rowMag[x]);
+			}
+		}
+	}
+}
+
+void drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag, Mat &dst){
+	_drawGradients<double>(img, gradients, dervMag, dst);
+}
+
+Mat drawGradients(const Mat &img, const Mat &gradients, const Mat &dervMag){
+	Mat gradImg;
+	drawGradients(img, gradients, dervMag, gradImg);
+	return gradImg;
+}
+
+void drawGradients(const Mat &img, const GradientField &field, Mat &dst){
+	_drawGradients<float>(img, field.orientation, field.magnitude, dst);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 3.1 Extracting HOG Features
+
+static double toDegree(double radiant){
+	return (radiant * 360.) / (2 * PI);
+}
+
+static double toRadiant(double degree){
+	return (degree * 2 * PI) / (360.);
+}
+
+// adds a single gradient orientation to the histogram of its cell (linear interpolation between the two nearest bins)
+static void _binOrientation(double* cellHoG, double orientation, int binCount){
+	double degree = toDegree(orientation);
+
+	double bin = (degree - 0.5*(180. / binCount)) / (180. / binCount);
+	if (bin < 0)
+		bin += binCount;
+
+	int lowerBin = (int)bin;
+	int upperBin = (lowerBin == binCount - 1) ? 0 : lowerBin + 1;
+
+	double lowerBinValue = (1. - (bin - (int)bin));
+	double upperBinValue = 1. - lowerBinValue;
+
+	cellHoG[lowerBin] += lowerBinValue;
+	cellHoG[upperBin] += upperBinValue;
+}
+
+// histogram of a cell, row yCell of HoG holds the cells of a row one after another
+static double* cellHistogram(Mat &HoG, int yCell, int xCell, int binCount){
+	return HoG.ptr<double>(yCell) + xCell*binCount;
+}
+
+static const double* cellHistogram(const Mat &HoG, int yCell, int xCell, int binCount){
+	return HoG.ptr<double>(yCell) + xCell*binCount;
+}
+
+// orientations of type T, folded into [0, pi] (the CV_64FC1 ones already are)
+template<typename T>
+static void _compute_HoG(const Mat &gradients, const Mat &magnitude, const int cellSize, const vector<int> &dims, Mat &HoG){
+	PROFILE_SCOPE_PIXELS("compute_HoG", gradients.total());
+	assert(dims.size() == 3);
+	assert(gradients.type() == DataType<T>::type);
+	assert(magnitude.type() == CV_16SC1);
+	assert(gradients.size() == magnitude.size());
+
+	const int cellRows = dims.at(0);
+	const int cellCols = dims.at(1);
+	const int binCount = dims.at(2);
+
+	HoG.create(cellRows, cellCols*binCount, CV_64FC1);
+	HoG.setTo(Scalar(0.));
+
+	// bands of whole cell rows, every band writes its own rows of HoG
+	const int rows = min(gradients.rows - (gradients.rows%cellSize), cellRows*cellSize);
+	const int cols = min(gradients.cols - (gradients.cols%cellSize), cellCols*cellSize);
+	const int bandCells = max(1, bandRows(gradients.cols) / cellSize);
+	parallelFor(sharedThreadPool(), 0, (rows + cellSize - 1) / cellSize, bandCells, [&](int yCell0, int yCell1){
+		for (int y = yCell0*cellSize; y < min(rows, yCell1*cellSize); y++){
+			const T* gradRow = gradients.ptr<T>(y);
+			const short* magRow = magnitude.ptr<short>(y);
+			int yCell = y / cellSize;
+			for (int x = 0; x < cols; x++){
+				if (magRow[x] == 0)
+					continue;
+
+				int xCell = x / cellSize;
+				_binOrientation(cellHistogram(HoG, yCell, xCell, binCount), fabs((double)gradRow[x]), binCount);
+			}
+		}
+	});
+}
+
+void compute_HoG(const Mat &gradients, const Mat &magnitude, const int cellSize, const vector<int> &dims, Mat &HoG){
+	_compute_HoG<double>(gradients, magnitude, cellSize, dims, HoG);
+}
+
+void compute_HoG(const GradientField &field, const int cellSize, const vector<int> &dims, Mat &HoG){
+	_compute_HoG<float>(field.orientation, field.magnitude, cellSize, dims, HoG);
+}
+
+double*** compute_HoG(const Mat &gradients, const Mat &magnitude, const int cellSize, const vector<int> &dims){
+	assert(dims.size() == 3);
+
+	const int cellRows = dims.at(0);
+	const int cellCols = dims.at(1);
+	const int binCount = dims.at(2);
+
+	Mat histograms;
+	compute_HoG(gradients, magnitude, cellSize, dims, histograms);
+
+	double*** HoG = (double***)malloc(sizeof(double**)* cellRows);
+	if (HoG == NULL)
+		exit(1);
+
+	for (int yCell = 0; yCell < cellRows; yCell++){
+		HoG[yCell] = (double**)malloc(sizeof(double*)* cellCols);
+		if (HoG[yCell] == NULL)
+			exit(1);
+		for (int xCell = 0; xCell < cellCols; xCell++){
+			HoG[yCell][xCell] = (double*)malloc(sizeof(double)* binCount);
+			if (HoG[yCell][xCell] == NULL)
+				exit(1);
+			const double* cellHoG = cellHistogram(histograms, yCell, xCell, binCount);
+			for (int b = 0; b < binCount; b++)
+				HoG[yCell][xCell][b] = cellHoG[b];
+		}
+	}
+	return HoG;
+}
+
+void freeHoG(double*** HoG, const vector<int> &dims){
+	assert(dims.size() == 3);
+
+	for (int yCell = 0; yCell < dims.at(0); yCell++){
+		for (int xCell = 0; xCell < dims.at(1); xCell++)
+			free(HoG[yCell][xCell]);
+		free(HoG[yCell]);
+	}
+	free(HoG);
+}
+
+void visualizeHoG(const Mat &HoG, const int cellSize, const vector<int> &dims, Mat &dst){
+	PROFILE_SCOPE("visualizeHoG");
+	assert(dims.size() == 3);
+	assert(HoG.type() == CV_64FC1);
+
+	const uchar tau = 30;
+
+	const int cellRows = dims.at(0);
+	const int cellCols = dims.at(1);
+	const int binCount = dims.at(2);
+
+	dst.create(cellRows*cellSize, cellCols*cellSize, CV_8UC1);
+	dst.setTo(Scalar(0));
+
+	for (int yCell = 0; yCell < cellRows; yCell++){
+		for (int xCell = 0; xCell < cellCols; xCell++){
+			const double* cellHoG = cellHistogram(HoG, yCell, xCell, binCount);
+
+			double max = -1, min = -1;
+			for (int b = 0; b < binCount; b++){
+				double value = cellHoG[b];
+				if (value == 0)
+					continue;
+				if (max == -1 || value > max)
+					max = value;
+				if (min == -1 || value < min)
+					min = value;
+			}
+			if (min == -1 || max == -1)
+				continue;
+
+			for (int b = 0; b < binCount; b++){
+				double HoGvalue = cellHoG[b];
+				if (HoGvalue == 0)
+					continue;
+
+				int degree = ((b * 180) / binCount) + (int)(0.5*(180. / binCount));
+				double gradDir = toRadiant(degree);
+
+				int centerX = xCell*cellSize + cellSize / 2;
+				int centerY = yCell*cellSize + cellSize / 2;
+
+				int xOffset = (int)((cos(gradDir) * cellSize) / 2);
+				int yOffset = (int)((sin(gradDir) * cellSize) / 2);
+
+				Point start(centerX + xOffset, centerY + yOffset);
+				Point end(centerX - xOffset, centerY - yOffset);
+
+				// a single orientation (max == min) is drawn at full strength
+				uchar strength = max > min ? tau + (uchar)((255 - tau) * ((HoGvalue - min) / (max - min))) : 255;
+
+				line(dst, start, end, Scalar(strength));
+			}
+		}
+	}
+}
+
+Mat visualizeHoG(double*** HoG, const int cellSize, const vector<int> &dims){
+	assert(dims.size() == 3);
+
+	const int cellRows = dims.at(0);
+	const int cellCols = dims.at(1);
+	const int binCount = dims.at(2);
+
+	Mat histograms(cellRows, cellCols*binCount, CV_64FC1);
+	for (int yCell = 0; yCell < cellRows; yCell++){
+		for (int xCell = 0; xCell < cellCols; xCell++){
+			double* cellHoG = cellHistogram(histograms, yCell, xCell, binCount);
+			for (int b = 0; b < binCount; b++)
+				cellHoG[b] = HoG[yCell][xCell][b];
+		}
+	}
+
+	Mat HoGimage;
+	visualizeHoG(histograms, cellSize, dims, HoGimage);
+	return HoGimage;
+}
+
+void visualizeHoG(const GradientField &field, const int cellSize, const vector<int> &dims, Mat &dst){
+	Mat HoG;
+	compute_HoG(field, cellSize, dims, HoG);
+	visualizeHoG(HoG, cellSize, dims, dst);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static vector<string> split(const string &text, char separator){
+	vector<string> parts;
+	stringstream stream(text);
+	string part;
+	while (getline(stream, part, separator))
+		parts.push_back(part);
+	return parts;
+}
+
+// parameter k of a step, fallback if it is not given; false for values that are not numbers
+static bool parameter(const vector<string> &parts, size_t k, double fallback, double &value){
+	if (parts.size() <= k || parts[k].empty()){
+		value = fallback;
+		return true;
+	}
+	char* end;
+	value = strtod(parts[k].c_str(), &end);
+	return *end == '\0';
+}
+
+static bool isKernelSize(double size){
+	return size >= 1 && size == (int)size && (int)size % 2 == 1;
+}
+
+// HoG visualization of the rows between haloTop and haloBottom of the image of field; a halo of at least one cell is a
+// cell row of context, whose lines reach into the first row, below it the halo only feeds the derivatives
+static Mat hogImage(const Mat &img, const GradientField &field, int cellSize, int haloTop, int haloBottom, BufferPool &pool){
+	const int contextRows = haloTop >= cellSize ? cellSize : 0;
+	const int top = haloTop - contextRows;
+	const int bottom = img.rows - haloBottom;
+	const int dimValues[3] = { (bottom - top) / cellSize, img.cols / cellSize, 9 };
+	const vector<int> dims(dimValues, dimValues + 3);
+	Mat HoG = pool.acquire(dims[0], dims[1] * dims[2], CV_64FC1);
+	compute_HoG(field.rowRange(top, bottom), cellSize, dims, HoG);
+
+	Mat HoGimage = pool.acquire(dims[0] * cellSize, dims[1] * cellSize, CV_8UC1);
+	visualizeHoG(HoG, cellSize, dims, HoGimage);
+	return HoGimage.rowRange(contextRows, HoGimage.rows);
+}
+
+string stageUsage(){
+	return
+		"  hue[:hue[:radius]]        keeps the colors of a hue (0 - 179), the rest gray (120, 10)\n"
+		"  histogram[:bins]          histogram image (256 bins)\n"
+		"  contrast[:cutOff]         contrast stretch (0.05)\n"
+		"  quantize[:bits]           keeps the upper bits of every pixel (3)\n"
+		"  lowres[:n]                mean of every n x n block (4)\n"
+		"  box[:size]                box filter (3)\n"
+		"  gaussian[:size[:sigma]]   gaussian filter (5, 2)\n"
+		"  median[:size]             median filter (3)\n"
+		"  sobelx, sobely            derivative images\n"
+		"  magnitude                 gradient magnitude image\n"
+		"  gradients                 gradient arrows on the image (color)\n"
+		"  hog[:cellSize]            HoG visualization, 9 bins (10)\n"
+		"  fixed                     box and gaussian filters after it in 16 bit fixed point\n";
+}
+
+// a normalized filter step in double or fixed point arithmetic; in double arithmetic the step also takes and returns
+// the unrounded CV_32FC1 images of a chain, the fixed point kernels are 8 bit only
+static bool filterStage(const Mat &kernel, bool fixedPoint, Stage &stage, string &error){
+	if (!fixedPoint){
+		stage.floatInput = true;
+		stage.apply = [kernel](const Mat &img, BufferPool &pool){
+			Mat filteredImg = pool.acquire(img.size(), CV_8UC1);
+			if (img.type() == CV_32FC1)
+				convolveTyped(img, filteredImg, CV_8U, kernel, true, CONVOLUTION_BORDER_COPY);
+			else
+				filter(img, filteredImg, kernel, true);
+			return filteredImg;
+		};
+		stage.applyFloat = [kernel](const Mat &img, BufferPool &pool){
+			Mat filteredImg = pool.acquire(img.size(), CV_32FC1);
+			convolveTyped(img, filteredImg, CV_32F, kernel, true, CONVOLUTION_BORDER_COPY);
+			return filteredImg;
+		};
+		return true;
+	}
+
+	FixedPointKernel fixed;
+	if (!quantizeKernel(kernel, true, fixed)){
+		error = "the kernel of '" + stage.name + "' does not fit fixed point";
+		return false;
+	}
+	stage.maxDeviation = fixed.maxDeviation;
+	stage.apply = [fixed](const Mat &img, BufferPool &pool){
+		Mat filteredImg = pool.acquire(img.size(), CV_8UC1);
+		filter(img, filteredImg, fixed);
+		return filteredImg;
+	};
+	return true;
+}
+
+// the derivatives of a step input: CV_32FC1 for the float images of a chain, CV_16SC1 for 8 bit images
+static int derivativeType(const Mat &img){
+	return img.type() == CV_32FC1 ? CV_32FC1 : CV_16SC1;
+}
+
+bool parseStages(const string &spec, vector<Stage> &stages, string &error){
+	stages.clear();
+	bool fixedPoint = false;
+
+	for (const string &step : split(spec, '+')){
+		vector<string> parts = split(step, ':');
+		if (parts.empty() || parts[0].empty()){
+			error = "empty step in '" + spec + "'";
+			return false;
+		}
+
+		const string &name = parts[0];
+		if (name == "fixed" && parts.size() == 1){
+			fixedPoint = true;
+			continue;
+		}
+		double a, b;
+		if (!parameter(parts, 1, 0., a) || !parameter(parts, 2, 0., b)){
+			error = "invalid parameter in '" + step + "'";
+			return false;
+		}
+
+		Stage stage;
+		stage.name = step;
+		stage.colorInput = false;
+		stage.floatInput = false;
+		stage.halo = 0;
+		stage.blockRows = 1;
+		stage.maxDeviation = 0;
+
+		if (name == "histogram"){
+			parameter(parts, 1, 256., a);
+			if (a < 1 || a > 256){
+				error = "histogram needs 1 to 256 bins";
+				return false;
+			}
+			unsigned bins = (unsigned)a;
+			stage.halo = -1;
+			stage.apply = [bins](const Mat &img, BufferPool &pool){
+				// 500 x (768 / bins * bins), see createHistogramImage
+				Mat histogram = pool.acquire(500, 256 * 3 / bins * bins, CV_8UC1);
+				vector<int> histogramValues;
+				calcHistogram(img, bins, histogramValues);
+				createHistogramImage(histogramValues, histogram);
+				return histogram;
+			};
+		}
+		else if (name == "hue"){
+			parameter(parts, 1, 120., a);
+			parameter(parts, 2, 10., b);
+			if (a < 0 || a > 179 || b < 0 || b > 179){
+				error = "hue needs a hue and a radius in [0, 179]";
+				return false;
+			}
+			uchar hue = (uchar)a;
+			uchar radius = (uchar)b;
+			stage.colorInput = true;
+			stage.apply = [hue, radius](const Mat &img, BufferPool &pool){
+				Mat hsvImg = pool.acquire(img.size(), CV_8UC3);
+				Mat highlightedImg = pool.acquire(img.size(), CV_8UC3);
+				highlightHue(img, highlightedImg, hue, radius, hsvImg);
+				return highlightedImg;
+			};
+		}
+		else if (name == "contrast"){
+			parameter(parts, 1, 0.05, a);
+			if (a < 0. || a >= 0.5){
+				error = "contrast needs a cut off in [0, 0.5[";
+				return false;
+			}
+			stage.halo = -1;
+			stage.apply = [a](const Mat &img, BufferPool &pool){
+				Mat enhancedImg = pool.acquire(img.size(), CV_8UC1);
+				enhanceContrast(img, enhancedImg, a);
+				return enhancedImg;
+			};
+		}
+		else if (name == "quantize"){
+			parameter(parts, 1, 3., a);
+			if (a < 1 || a > 8 || a != (int)a){
+				error = "quantize needs 1 to 8 bits";
+				return false;
+			}
+			int q = (int)a;
+			stage.apply = [q](const Mat &img, BufferPool &pool){
+				Mat quantizedImg = pool.acquire(img.size(), CV_8UC1);
+				quantizeImg(img, quantizedImg, q);
+				return quantizedImg;
+			};
+		}
+		else if (name == "lowres"){
+			parameter(parts, 1, 4., a);
+			if (a < 1 || a != (int)a){
+				error = "lowres needs a positive block size";
+				return false;
+			}
+			int n = (int)a;
+			stage.blockRows = n;
+			stage.apply = [n](const Mat &img, BufferPool &pool){
+				Mat lowResImg = pool.acquire(img.rows - img.rows % n, img.cols - img.cols % n, CV_8UC1);
+				simulateLowRes(img, lowResImg, n);
+				return lowResImg;
+			};
+		}
+		else if (name == "box" || name == "median"){
+			parameter(parts, 1, 3., a);
+			if (!isKernelSize(a)){
+				error = name + " needs an odd kernel size";
+				return false;
+			}
+			int size = (int)a;
+			stage.halo = size / 2;
+			if (name == "box"){
+				Mat kernel(size, size, CV_64FC1, Scalar(1.));
+				if (!filterStage(kernel, fixedPoint, stage, error))
+					return false;
+			}
+			else{
+				stage.apply = [size](const Mat &img, BufferPool &pool){
+					Mat medianImg = pool.acquire(img.size(), CV_8UC1);
+					median(img, medianImg, size, size);
+					return medianImg;
+				};
+			}
+		}
+		else if (name == "gaussian"){
+			parameter(parts, 1, 5., a);
+			parameter(parts, 2, 2., b);
+			if (!isKernelSize(a) || b <= 0.){
+				error = "gaussian needs an odd kernel size and sigma > 0";
+				return false;
+			}
+			int size = (int)a;
+			Mat kernel = createGaussianKernel(size, size, b);
+			stage.halo = size / 2;
+			if (!filterStage(kernel, fixedPoint, stage, error))
+				return false;
+		}
+		else if (name == "sobelx" || name == "sobely"){
+			bool xDirection = name == "sobelx";
+			stage.halo = -1;	// scaled by the maximum of the image
+			stage.floatInput = true;
+			stage.apply = [xDirection](const Mat &img, BufferPool &pool){
+				Mat derivative = pool.acquire(img.size(), derivativeType(img));
+				if (xDirection)
+					sobelX(img, derivative);
+				else
+					sobelY(img, derivative);
+				Mat derivativeImg = pool.acquire(img.size(), CV_8UC1);
+				convertToImg(derivative, derivativeImg);
+				return derivativeImg;
+			};
+		}
+		else if (name == "magnitude"){
+			stage.halo = -1;
+			stage.floatInput = true;
+			stage.apply = [](const Mat &img, BufferPool &pool){
+				Mat X = pool.acquire(img.size(), derivativeType(img));
+				Mat Y = pool.acquire(img.size(), derivativeType(img));
+				sobelX(img, X);
+				sobelY(img, Y);
+				calcMagnitude(X, Y, X);
+				Mat magnitudeImg = pool.acquire(img.size(), CV_8UC1);
+				convertToImg(X, magnitudeImg);
+				return magnitudeImg;
+			};
+		}
+		else if (name == "gradients"){
+			stage.halo = -1;	// arrows reach far beyond their pixel
+			stage.apply = [](const Mat &img, BufferPool &pool){
+				shared_ptr<const GradientField> field = gradientCache().get(img);
+
+				Mat colorImg = pool.acquire(img.size(), CV_8UC3);
+				cvtColor(img, colorImg, CV_GRAY2BGR);
+				drawGradients(colorImg, *field, colorImg);
+				return colorImg;
+			};
+		}
+		else if (name == "hog"){
+			parameter(parts, 1, 10., a);
+			if (a < 1 || a != (int)a){
+				error = "hog needs a positive cell size";
+				return false;
+			}
+			int cellSize = (int)a;
+			// a cell row above the strip for the lines reaching into it, a row more for the derivatives
+			stage.halo = cellSize + 1;
+			stage.blockRows = cellSize;
+			stage.applyStrip = [cellSize](const Mat &img, int haloTop, int haloBottom, BufferPool &pool){
+				shared_ptr<const GradientField> field = gradientCache().get(img);
+				return hogImage(img, *field, cellSize, haloTop, haloBottom, pool);
+			};
+			stage.apply = [cellSize](const Mat &img, BufferPool &pool){
+				shared_ptr<const GradientField> field = gradientCache().get(img);
+				return hogImage(img, *field, cellSize, 0, 0, pool);
+			};
+		}
+		else{
+			error = "unknown step '" + name + "'";
+			return false;
+		}
+
+		stages.push_back(stage);
+	}
+
+	if (stages.empty()){
+		error = "no steps given";
+		return false;
+	}
+	return true;
+}
+
+int stagesReadFlags(const vector<Stage> &stages){
+	return !stages.empty() && stages.front().colorInput ? IMREAD_COLOR : IMREAD_GRAYSCALE;
+}
+
+Mat stageInput(const Stage &stage, const Mat &img, BufferPool &pool){
+	if (stage.colorInput == (img.channels() == 3))
+		return img;
+	Mat converted = pool.acquire(img.size(), stage.colorInput ? CV_8UC3 : CV_8UC1);
+	cvtColor(img, converted, stage.colorInput ? COLOR_GRAY2BGR : COLOR_BGR2GRAY);
+	return converted;
+}
+
+Mat applyStage(const vector<Stage> &stages, size_t s, const Mat &img, BufferPool &pool){
+	const Stage &stage = stages[s];
+	if (stage.applyFloat && s + 1 < stages.size() && stages[s + 1].floatInput)
+		return stage.applyFloat(img, pool);
+	return stage.apply(img, pool);
+}
+
+Mat applyStages(const vector<Stage> &stages, const Mat &img, BufferPool &pool){
+	// the buffer of a step is free again as soon as the next step has replaced it
+	Mat result = img;
+	for (size_t s = 0; s < stages.size(); s++)
+		result = applyStage(stages, s, stageInput(stages[s], result, pool), pool);
+	return result;
+}
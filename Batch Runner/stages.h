@@ -0,0 +1,157 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\bufferPool.h"
+
+// the image operations of the exercises, without display and file output
+// every operation writes into dst, which is only reallocated if its size or type does not fit, so a caller that keeps
+// its destinations (or takes them from a BufferPool) does not allocate; dst must not share data with the input unless
+// noted; the variants returning a Mat allocate their result
+
+// 1.1 Gray Scale Histograms
+void calcHistogram(const cv::Mat &img, unsigned binCount, std::vector<int> &histogramValues);
+std::vector<int> calcHistogram(const cv::Mat &img, unsigned binCount);
+void createHistogramImage(const std::vector<int> &histogramValues, cv::Mat &dst);
+cv::Mat createHistogramImage(const std::vector<int> &histogramValues);
+// dst may be img
+void enhanceContrast(const cv::Mat &img, cv::Mat &dst, double cutOff);
+cv::Mat enhanceContrast(const cv::Mat &img, double cutOff);
+
+// 1.2 Color Analysis
+// img: CV_8UC3 BGR, every channel quantized to binCount levels, the count of (b, g, r) at (b * binCount + g) * binCount + r
+void calc3DHistogram(const cv::Mat &img, unsigned binCount, std::vector<int> &histogramValues);
+// img: CV_8UC3 BGR; pixels of the hue (OpenCV scale 0 - 179) +- radius with some saturation and value keep their
+// color, all others become gray; hsvBuffer is the HSV conversion of img, reallocated like dst
+void highlightHue(const cv::Mat &img, cv::Mat &dst, uchar hue, uchar radius, cv::Mat &hsvBuffer);
+
+// 1.4 Pixel Manipulation
+// dst is (rows - rows % n) x (cols - cols % n), every n x n block holds its mean
+void simulateLowRes(const cv::Mat &img, cv::Mat &dst, int n);
+// the upper q bits of every pixel, centered in their interval; dst may be img
+void quantizeImg(const cv::Mat &img, cv::Mat &dst, int q);
+
+// 2.1 Image Filters: CV_8UC1 results, the border is copied from the input
+// filter, box and gaussian also take CV_16UC1, CV_16SC1 and CV_32FC1 images and keep their type (convolution.h, rounded
+// and saturated instead of truncated), other types throw a cv::Exception; the steps pass CV_8UC1 and, within a chain,
+// CV_32FC1
+void filter(const cv::Mat &img, cv::Mat &dst, const cv::Mat &kernel, bool normalize);
+cv::Mat filter(const cv::Mat &img, const cv::Mat &kernel, bool normalize);
+void box(const cv::Mat &img, cv::Mat &dst, int kernelHeight, int kernelWidth);
+cv::Mat box(const cv::Mat &img, int kernelHeight, int kernelWidth);
+cv::Mat createGaussianKernel(int kernelHeight, int kernelWidth, double sigma);
+void gaussian(const cv::Mat &img, cv::Mat &dst, int kernelHeight, int kernelWidth, double sigma);
+cv::Mat gaussian(const cv::Mat &img, int kernelHeight, int kernelWidth, double sigma);
+void median(const cv::Mat &img, cv::Mat &dst, int kernelHeight, int kernelWidth);
+cv::Mat median(const cv::Mat &img, int kernelHeight, int kernelWidth);
+
+// fixed point arithmetic for 8 bit images: the kernel (divided by its sum if normalized) as int16 coefficients in
+// units of 2^-shift, summed in int32, rounded to the nearest value and saturated; kernels of integers keep shift 0
+// and give exactly the results of the double arithmetic, all others get the finest shift that cannot overflow
+struct FixedPointKernel{
+	cv::Mat coefficients;	// CV_16SC1, the size of the kernel
+	int shift;
+	double maxError;		// bound of |fixed point sum - exact sum| for any input, in gray levels, before the rounding
+	int maxDeviation;		// bound of |result - result of the double arithmetic|, 0 for exact kernels
+};
+// false if a coefficient does not fit int16 even at shift 0
+bool quantizeKernel(const cv::Mat &kernel, bool normalize, FixedPointKernel &fixed);
+void filter(const cv::Mat &img, cv::Mat &dst, const FixedPointKernel &kernel);
+
+// 2.2 Gradients: derivatives are CV_16SC1 with a border of 0, orientations CV_64FC1 in ]-pi, pi]
+// filterSigned and the Sobel filters also take CV_16UC1 and CV_16SC1 images (saturated CV_16SC1 derivatives) and CV_32FC1
+// images (CV_32FC1 derivatives), so a blurred image of those types needs no conversion before them; other types throw
+void filterSigned(const cv::Mat &img, cv::Mat &dst, const cv::Mat &kernel, bool normalize);
+cv::Mat filterSigned(const cv::Mat &img, const cv::Mat &kernel, bool normalize);
+void filterSigned(const cv::Mat &img, cv::Mat &dst, const FixedPointKernel &kernel);
+// 8 bit images in fixed point, which is exact for their kernels
+void sobelX(const cv::Mat &img, cv::Mat &dst);
+cv::Mat sobelX(const cv::Mat &img);
+void sobelY(const cv::Mat &img, cv::Mat &dst);
+cv::Mat sobelY(const cv::Mat &img);
+// X and Y both CV_16SC1 or both CV_32FC1, dst of their type; dst may be X or Y
+void calcMagnitude(const cv::Mat &X, const cv::Mat &Y, cv::Mat &dst);
+cv::Mat calcMagnitude(const cv::Mat &X, const cv::Mat &Y);
+// img: CV_16SC1 or CV_32FC1
+void convertToImg(const cv::Mat &img, cv::Mat &dst);
+cv::Mat convertToImg(const cv::Mat &img);
+void calcGradients(const cv::Mat &X, const cv::Mat &Y, cv::Mat &dst);
+cv::Mat calcGradients(const cv::Mat &X, const cv::Mat &Y);
+// everything the gradient steps derive from the derivatives of an image, computed in one pass: X and Y as sobelX and
+// sobelY, magnitude as calcMagnitude (CV_16SC1), orientation as calcGradients but in CV_32FC1
+struct GradientField{
+	cv::Mat X, Y, magnitude, orientation;
+
+	// headers on the rows [top, bottom[ of every Mat
+	GradientField rowRange(int top, int bottom) const;
+};
+// img: CV_8UC1
+void computeGradientField(const cv::Mat &img, GradientField &field);
+// img: CV_8UC3, dst may be img
+void drawGradients(const cv::Mat &img, const cv::Mat &gradients, const cv::Mat &dervMag, cv::Mat &dst);
+cv::Mat drawGradients(const cv::Mat &img, const cv::Mat &gradients, const cv::Mat &dervMag);
+void drawGradients(const cv::Mat &img, const GradientField &field, cv::Mat &dst);
+
+// 3.1 Extracting HOG Features: HoG[yCell][xCell][bin], orientations in [0, pi]
+double*** compute_HoG(const cv::Mat &gradients, const cv::Mat &magnitude, const int cellSize, const std::vector<int> &dims);
+void freeHoG(double*** HoG, const std::vector<int> &dims);
+cv::Mat visualizeHoG(double*** HoG, const int cellSize, const std::vector<int> &dims);
+// the same on a cellRows x (cellCols * binCount) CV_64FC1 Mat instead of the nested arrays
+void compute_HoG(const cv::Mat &gradients, const cv::Mat &magnitude, const int cellSize, const std::vector<int> &dims, cv::Mat &HoG);
+void visualizeHoG(const cv::Mat &HoG, const int cellSize, const std::vector<int> &dims, cv::Mat &dst);
+// the same from a GradientField, whose orientations are folded into [0, pi]; one field serves any number of cell sizes
+// the float orientations move the bin weights by about 1e-7, which changes a visualization pixel in millions by 1
+void compute_HoG(const GradientField &field, const int cellSize, const std::vector<int> &dims, cv::Mat &HoG);
+void visualizeHoG(const GradientField &field, const int cellSize, const std::vector<int> &dims, cv::Mat &dst);
+
+/////////////////////////////////////////////////////////////////////////////
+
+// one step of a batch configuration, takes CV_8UC1 or CV_8UC3 BGR images and returns either of both
+// apply() takes its result and all temporaries from the pool
+struct Stage{
+	std::string name;
+	std::function<cv::Mat(const cv::Mat&, BufferPool&)> apply;
+	bool colorInput;	// CV_8UC3 input, applyStages converts between gray and color where two steps differ
+	// also takes CV_32FC1 gray images (the double filters, sobelx, sobely, magnitude)
+	bool floatInput;
+	// for steps whose result needs more than 8 bit (the double filters), empty for all others: like apply, but the
+	// unrounded CV_32FC1 result, which is passed on if the next step has floatInput; the last step always returns
+	// 8 bit, so a chain is rounded only where it is written or shown
+	std::function<cv::Mat(const cv::Mat&, BufferPool&)> applyFloat;
+
+	// strip processing (strips.h): every result row depends on the input rows within halo above and below it,
+	// -1 for steps that need the whole image (histograms, normalization by the image maximum)
+	int halo;
+	// strips start at multiples of blockRows, for steps that work on blocks or cells of rows
+	int blockRows;
+	// for steps whose result rows are not the input rows (cells), empty for all others: like apply, on a strip with
+	// haloTop and haloBottom rows of context that are not part of the result
+	std::function<cv::Mat(const cv::Mat&, int haloTop, int haloBottom, BufferPool&)> applyStrip;
+	// bound of the difference to the double arithmetic in gray levels, for steps after "fixed"; 0 for all others
+	int maxDeviation;
+};
+
+// steps separated by '+', parameters by ':', e.g. "contrast:0.05+gaussian:5:2+magnitude"; the pseudo step "fixed"
+// switches the box and gaussian filters after it to fixed point arithmetic
+// false with a message in error for unknown steps or invalid parameters
+bool parseStages(const std::string &spec, std::vector<Stage> &stages, std::string &error);
+
+// one line per step with its parameters and defaults
+std::string stageUsage();
+
+// the input the first step needs, IMREAD_COLOR or IMREAD_GRAYSCALE
+int stagesReadFlags(const std::vector<Stage> &stages);
+
+// img converted to the gray or color input of the step, img itself if it fits
+cv::Mat stageInput(const Stage &stage, const cv::Mat &img, BufferPool &pool);
+
+// step s of stages on img (its stageInput()), through applyFloat where the next step takes the float result
+cv::Mat applyStage(const std::vector<Stage> &stages, size_t s, const cv::Mat &img, BufferPool &pool);
+
+// img: CV_8UC1 or CV_8UC3, the result is a pool buffer; every step takes the result of the one before, the gradient
+// steps look the field of that input up in gradientCache()
+cv::Mat applyStages(const std::vector<Stage> &stages, const cv::Mat &img, BufferPool &pool);
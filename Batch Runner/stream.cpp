@@ -0,0 +1,142 @@
+#include "stream.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "..\Common\boundedQueue.h"
+#include "..\Common\bufferPool.h"
+#include "..\Common\profiler.h"
+
+using namespace std;
+using namespace cv;
+
+StreamOptions createStreamOptions(){
+	StreamOptions options;
+	options.buffers = 3;
+	options.realtime = false;
+	options.outputDir = "";
+	options.outputMode = WRITE_PNG_FAST;
+	options.reportInterval = 1.;
+	return options;
+}
+
+struct StreamFrame{
+	uint64_t index;		// in the source, dropped frames leave gaps
+	Mat img;
+};
+
+static string frameFilename(uint64_t index){
+	ostringstream name;
+	name << "frame_" << setw(6) << setfill('0') << index << ".png";
+	return name.str();
+}
+
+StreamStats runStream(FrameSource &source, const vector<Stage> &stages, const StreamOptions &options,
+	function<void(const StreamStats&)> onReport){
+	// a buffer is either free, decoded and waiting, or being processed
+	const unsigned buffers = max(2u, options.buffers);
+	BoundedQueue<StreamFrame> decoded(buffers);
+	BoundedQueue<Mat> freeBuffers(buffers);
+	for (unsigned b = 0; b < buffers; b++)
+		freeBuffers.push(Mat());
+
+	BufferPool pool;
+	ImageWriter writer;
+	writer.setVerbose(false);
+
+	const double fps = source.fps() > 0. ? source.fps() : 25.;
+	const int64 begin = getTickCount();
+	atomic<uint64_t> decodedCount(0);
+	atomic<uint64_t> dropped(0);
+	atomic<int64_t> decodeTicks(0);
+
+	thread decoder([&](){
+		for (uint64_t index = 0;; index++){
+			Mat buffer;
+			if (options.realtime){
+				// frame index is due index / fps after the start, a frame that finds every buffer taken is lost
+				int64 due = begin + (int64)(index / fps * getTickFrequency());
+				int64 now = getTickCount();
+				if (due > now)
+					this_thread::sleep_for(chrono::microseconds((int64_t)((due - now) * 1e6 / getTickFrequency())));
+				if (!freeBuffers.tryPop(buffer)){
+					if (!source.skip())
+						break;
+					dropped++;
+					continue;
+				}
+			}
+			else if (!freeBuffers.pop(buffer))
+				break;
+
+			int64 start = getTickCount();
+			bool success;
+			{
+				PROFILE_SCOPE("decode");
+				success = source.read(buffer);
+			}
+			decodeTicks += getTickCount() - start;
+			if (!success)
+				break;
+
+			decodedCount++;
+			StreamFrame frame = { index, buffer };
+			if (!decoded.push(frame))
+				break;
+		}
+		decoded.close();
+	});
+
+	StreamStats stats;
+	uint64_t processed = 0;
+	uint64_t failed = 0;
+	int64 processTicks = 0;
+	auto snapshot = [&](){
+		stats.decoded = decodedCount;
+		stats.processed = processed;
+		stats.dropped = dropped;
+		stats.failed = failed + writer.failed();
+		stats.seconds = (getTickCount() - begin) / getTickFrequency();
+		stats.sourceFps = fps;
+		stats.decodeSeconds = decodeTicks / getTickFrequency();
+		stats.processSeconds = processTicks / getTickFrequency();
+		stats.poolAllocations = pool.allocations();
+	};
+
+	double nextReport = options.reportInterval;
+	StreamFrame frame;
+	while (decoded.pop(frame)){
+		int64 start = getTickCount();
+		try{
+			PROFILE_SCOPE_PIXELS("applyStages", frame.img.total());
+			Mat result = applyStages(stages, frame.img, pool);
+			if (!options.outputDir.empty())
+				writer.write(options.outputDir, frameFilename(frame.index), result, options.outputMode);
+			processed++;
+		}
+		catch (const cv::Exception &e){
+			cout << "frame " << frame.index << ": " << e.what() << endl;
+			failed++;
+		}
+		processTicks += getTickCount() - start;
+
+		// back to the decoder, which reads into it again
+		freeBuffers.push(frame.img);
+		frame.img.release();
+
+		snapshot();
+		if (options.reportInterval > 0. && stats.seconds >= nextReport && onReport){
+			onReport(stats);
+			nextReport += options.reportInterval;
+		}
+	}
+	decoder.join();
+	writer.close();
+
+	snapshot();
+	return stats;
+}
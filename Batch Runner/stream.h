@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "..\Common\imageWriter.h"
+#include "frameSource.h"
+#include "stages.h"
+
+struct StreamOptions{
+	unsigned buffers;			// decoded frames that can wait for processing, 2 double and 3 triple buffering
+	bool realtime;				// decode at the frame rate of the source like a camera, frames that find no free buffer
+								// are dropped; otherwise the decoder waits for the processing and nothing is dropped
+	std::string outputDir;		// results are written as frame_000000.png, empty for none
+	ImageWriteMode outputMode;
+	double reportInterval;		// seconds between progress reports, 0 for none
+};
+
+// triple buffering, as fast as possible, no output
+StreamOptions createStreamOptions();
+
+struct StreamStats{
+	uint64_t decoded;
+	uint64_t processed;
+	uint64_t dropped;			// skipped by the decoder in realtime mode
+	uint64_t failed;			// frames the steps failed on and failed writes
+	double seconds;
+	double sourceFps;
+	double decodeSeconds;		// time the decoder thread was working
+	double processSeconds;		// time the processing thread was working
+	uint64_t poolAllocations;
+
+	// sustained rate of processed frames
+	double fps() const{
+		return seconds > 0. ? processed / seconds : 0.;
+	}
+};
+
+// the decoder thread reads frame N+1 into a free buffer while the calling thread runs the steps on frame N,
+// the buffers go back to the decoder once processed; onReport is called between frames every reportInterval seconds
+StreamStats runStream(FrameSource &source, const std::vector<Stage> &stages, const StreamOptions &options,
+	std::function<void(const StreamStats&)> onReport);
@@ -0,0 +1,297 @@
+#include "strips.h"
+
+#include <iomanip>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+
+#include "..\Common\bufferPool.h"
+#include "..\Common\profiler.h"
+
+using namespace std;
+using namespace cv;
+
+StripReader::StripReader() : dataOffset(0), height(0), width(0), channelCount(0){}
+
+bool StripReader::open(const string &filename){
+	file.close();
+	file.clear();
+	height = width = channelCount = 0;
+	file.open(filename, ios::binary);
+	if (!file.is_open())
+		return false;
+
+	// magic number, width, height and maximum value separated by whitespace, comments run from '#' to the line end
+	string magic;
+	file >> magic;
+	int values[3];
+	for (int i = 0; i < 3; i++){
+		file >> ws;
+		while (file.peek() == '#'){
+			file.ignore(numeric_limits<streamsize>::max(), '\n');
+			file >> ws;
+		}
+		if (!(file >> values[i]))
+			return false;
+	}
+	if ((magic != "P5" && magic != "P6") || values[0] <= 0 || values[1] <= 0 || values[2] <= 0 || values[2] > 255)
+		return false;
+	// a single whitespace character ends the header
+	file.get();
+	dataOffset = file.tellg();
+	if (!file.good())
+		return false;
+
+	width = values[0];
+	height = values[1];
+	channelCount = magic == "P5" ? 1 : 3;
+	return true;
+}
+
+int StripReader::rows() const{
+	return height;
+}
+
+int StripReader::cols() const{
+	return width;
+}
+
+int StripReader::channels() const{
+	return channelCount;
+}
+
+bool StripReader::read(int top, int count, Mat &dst){
+	assert(top >= 0 && count > 0 && top + count <= height);
+
+	dst.create(count, width, channelCount == 1 ? CV_8UC1 : CV_8UC3);
+	const streamoff rowBytes = (streamoff)width * channelCount;
+	file.clear();
+	file.seekg(dataOffset + top * rowBytes);
+	for (int y = 0; y < count; y++){
+		uchar* row = dst.ptr<uchar>(y);
+		if (!file.read((char*)row, rowBytes))
+			return false;
+		// RGB to BGR
+		if (channelCount == 3){
+			for (int x = 0; x < width; x++)
+				swap(row[3 * x], row[3 * x + 2]);
+		}
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+StripWriter::StripWriter() : height(0), width(0), channelCount(0){}
+
+StripWriter::~StripWriter(){
+	close();
+}
+
+bool StripWriter::open(const string &filename){
+	close();
+	height = width = channelCount = 0;
+	file.clear();
+	file.open(filename, ios::binary | ios::trunc);
+	return file.is_open();
+}
+
+bool StripWriter::writeHeader(){
+	// fixed width fields, so that close() can write the final height over the first header
+	file.seekp(0);
+	file << (channelCount == 1 ? "P5" : "P6") << "\n" << setw(10) << width << " " << setw(10) << height << "\n255\n";
+	return file.good();
+}
+
+bool StripWriter::write(const Mat &img){
+	assert(img.type() == CV_8UC1 || img.type() == CV_8UC3);
+	if (!file.is_open())
+		return false;
+
+	if (channelCount == 0){
+		width = img.cols;
+		channelCount = img.channels();
+		if (!writeHeader())
+			return false;
+	}
+	if (img.cols != width || img.channels() != channelCount)
+		return false;
+
+	const size_t rowBytes = (size_t)width * channelCount;
+	rowBuffer.resize(rowBytes);
+	for (int y = 0; y < img.rows; y++){
+		const uchar* row = img.ptr<uchar>(y);
+		// BGR to RGB
+		if (channelCount == 3){
+			for (int x = 0; x < width; x++){
+				rowBuffer[3 * x] = row[3 * x + 2];
+				rowBuffer[3 * x + 1] = row[3 * x + 1];
+				rowBuffer[3 * x + 2] = row[3 * x];
+			}
+			row = rowBuffer.data();
+		}
+		file.write((const char*)row, rowBytes);
+	}
+	height += img.rows;
+	return file.good();
+}
+
+bool StripWriter::close(){
+	if (!file.is_open())
+		return true;
+	bool success = channelCount == 0 || writeHeader();
+	file.close();
+	return success && !file.fail();
+}
+
+int StripWriter::rows() const{
+	return height;
+}
+
+int StripWriter::cols() const{
+	return width;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int greatestCommonDivisor(int a, int b){
+	while (b != 0){
+		int r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+string checkStripStages(const vector<Stage> &stages){
+	int haloAfter = 0;
+	for (size_t s = stages.size(); s-- > 0;){
+		const Stage &stage = stages[s];
+		if (stage.halo < 0)
+			return "'" + stage.name + "' needs the whole image and cannot run in strips";
+		// the strip a step with blocks gets has to start at a block, the halo of later steps would shift it
+		if (stage.blockRows > 1 && haloAfter > 0)
+			return "'" + stage.name + "' cannot be followed by filters in strips";
+		haloAfter += stage.halo;
+	}
+	return "";
+}
+
+bool runStrips(const string &input, const string &output, const vector<Stage> &stages, int stripRows,
+	StripStats &stats, string &error){
+	error = checkStripStages(stages);
+	if (!error.empty())
+		return false;
+
+	StripReader reader;
+	if (!reader.open(input)){
+		error = "'" + input + "' could not be opened as 8 bit binary .pgm / .ppm";
+		return false;
+	}
+	StripWriter writer;
+	if (!writer.open(output)){
+		error = "'" + output + "' could not be opened";
+		return false;
+	}
+
+	// rows of context the steps from s on need around a strip
+	vector<int> haloFrom(stages.size() + 1, 0);
+	for (size_t s = stages.size(); s-- > 0;)
+		haloFrom[s] = haloFrom[s + 1] + stages[s].halo;
+	// strips start at a block of every step
+	int blockRows = 1;
+	for (const Stage &stage : stages)
+		blockRows = blockRows / greatestCommonDivisor(blockRows, stage.blockRows) * stage.blockRows;
+	stripRows = (max(stripRows, 1) + blockRows - 1) / blockRows * blockRows;
+
+	stats.rows = reader.rows();
+	stats.cols = reader.cols();
+	stats.strips = 0;
+	stats.stripRows = stripRows;
+	stats.halo = haloFrom[0];
+
+	BufferPool pool;
+	const int64 begin = getTickCount();
+	int64 readTicks = 0, processTicks = 0, writeTicks = 0;
+
+	for (int top = 0; top < reader.rows(); top += stripRows){
+		const int bottom = min(reader.rows(), top + stripRows);
+		// the image rows the strip covers, with the halo of the steps still to come
+		int stripTop = max(0, top - haloFrom[0]);
+		int stripBottom = min(reader.rows(), bottom + haloFrom[0]);
+
+		int64 start = getTickCount();
+		Mat strip = pool.acquire(stripBottom - stripTop, reader.cols(), reader.channels() == 1 ? CV_8UC1 : CV_8UC3);
+		{
+			PROFILE_SCOPE("readStrip");
+			if (!reader.read(stripTop, stripBottom - stripTop, strip)){
+				error = "'" + input + "' ends before row " + to_string(stripBottom);
+				return false;
+			}
+		}
+		readTicks += getTickCount() - start;
+
+		start = getTickCount();
+		{
+			PROFILE_SCOPE_PIXELS("applyStrip", strip.total());
+			for (size_t s = 0; s < stages.size(); s++){
+				const Stage &stage = stages[s];
+				// the step uses up its own halo
+				int nextTop = max(0, top - haloFrom[s + 1]);
+				int nextBottom = min(reader.rows(), bottom + haloFrom[s + 1]);
+				int haloTop = nextTop - stripTop;
+				int haloBottom = stripBottom - nextBottom;
+
+				// the rows at the end of the image that do not fill a block are left out, as for the whole image
+				if (strip.rows - haloTop - haloBottom < stage.blockRows){
+					strip.release();
+					break;
+				}
+
+				Mat stepInput = stageInput(stage, strip, pool);
+				if (stage.applyStrip)
+					strip = stage.applyStrip(stepInput, haloTop, haloBottom, pool);
+				else{
+					Mat result = applyStage(stages, s, stepInput, pool);
+					strip = result.rowRange(haloTop, result.rows - haloBottom);
+				}
+				stripTop = nextTop;
+				stripBottom = nextBottom;
+			}
+		}
+		processTicks += getTickCount() - start;
+
+		start = getTickCount();
+		if (strip.data){
+			PROFILE_SCOPE("writeStrip");
+			if (strip.type() != CV_8UC1 && strip.type() != CV_8UC3){
+				error = "the steps return no 8 bit image";
+				return false;
+			}
+			if (!writer.write(strip)){
+				error = "'" + output + "' could not be written";
+				return false;
+			}
+		}
+		writeTicks += getTickCount() - start;
+		stats.strips++;
+	}
+
+	stats.outputRows = writer.rows();
+	stats.outputCols = writer.cols();
+	if (!writer.close()){
+		error = "'" + output + "' could not be written";
+		return false;
+	}
+	if (stats.outputRows == 0){
+		error = "the image is smaller than a block of the steps";
+		return false;
+	}
+
+	stats.seconds = (getTickCount() - begin) / getTickFrequency();
+	stats.readSeconds = readTicks / getTickFrequency();
+	stats.processSeconds = processTicks / getTickFrequency();
+	stats.writeSeconds = writeTicks / getTickFrequency();
+	stats.poolBytes = pool.bytes();
+	return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <opencv2\core\core.hpp>
+
+#include "stages.h"
+
+// images too large for memory: the input is read in horizontal strips, every strip runs through the steps together
+// with the rows of context they need (Stage::halo) and its result rows are appended to the output file, so the
+// memory needed is bounded by (strip rows + 2 halo) x width however tall the image is
+//
+// strips are read from and written to binary .pgm / .ppm with 8 bit samples: OpenCV 2.4 decodes every other format
+// as a whole, and these are what the batch runner writes with the 'raw' output
+
+// a binary PGM (P5) or PPM (P6) image whose rows are read on demand
+class StripReader{
+public:
+	StripReader();
+
+	// false if the file cannot be opened or is no 8 bit binary PGM / PPM
+	bool open(const std::string &filename);
+
+	int rows() const;
+	int cols() const;
+	int channels() const;
+
+	// rows [top, top + count[ into dst, CV_8UC1 or CV_8UC3 BGR, which is only reallocated if its size does not fit
+	bool read(int top, int count, cv::Mat &dst);
+
+private:
+	std::ifstream file;
+	std::streamoff dataOffset;
+	int height, width, channelCount;
+};
+
+// a binary PGM / PPM written row by row, the header holds room for the height, which is filled in by close()
+class StripWriter{
+public:
+	StripWriter();
+	~StripWriter();
+
+	bool open(const std::string &filename);
+
+	// appends the rows of img, CV_8UC1 (PGM) or CV_8UC3 BGR (PPM); all rows need the width and channels of the first
+	bool write(const cv::Mat &img);
+
+	bool close();
+
+	int rows() const;
+	int cols() const;
+
+private:
+	StripWriter(const StripWriter&);
+	StripWriter& operator=(const StripWriter&);
+
+	bool writeHeader();
+
+	std::ofstream file;
+	int height, width, channelCount;
+	std::vector<uchar> rowBuffer;
+};
+
+struct StripStats{
+	int rows, cols;				// of the input
+	int outputRows, outputCols;
+	int strips;
+	int stripRows;				// result rows per strip, rounded to the block rows of the steps
+	int halo;					// rows read above and below every strip
+	double seconds;
+	double readSeconds;
+	double processSeconds;
+	double writeSeconds;
+	size_t poolBytes;			// all buffers the steps used, the peak memory of the image data
+};
+
+// empty if the steps can run in strips, otherwise the reason they cannot
+std::string checkStripStages(const std::vector<Stage> &stages);
+
+// reads input strip by strip, runs the steps and writes the result rows to output, the same as for the whole image
+// false with a message in error if the steps cannot run in strips or a file cannot be read or written
+bool runStrips(const std::string &input, const std::string &output, const std::vector<Stage> &stages, int stripRows,
+	StripStats &stats, std::string &error);
@@ -0,0 +1,257 @@
+#include "benchmark.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <opencv2\core\core.hpp>
+
+using namespace std;
+using namespace cv;
+
+BenchmarkOptions createBenchmarkOptions(){
+	BenchmarkOptions options;
+	options.warmup = 2;
+	options.repetitions = 11;
+	options.minSampleSeconds = 0.01;
+	options.cpu = 0;
+	options.filter = "";
+	return options;
+}
+
+double BenchmarkResult::megapixelsPerSecond() const{
+	return pixels > 0 && medianMs > 0. ? pixels / (medianMs * 1000.) : 0.;
+}
+
+Benchmark::Benchmark(const BenchmarkOptions &options) : settings(options){}
+
+const BenchmarkOptions& Benchmark::options() const{
+	return settings;
+}
+
+const vector<BenchmarkResult>& Benchmark::results() const{
+	return measured;
+}
+
+void Benchmark::run(const string &name, const string &input, int64_t pixels, function<void()> f){
+	if (!settings.filter.empty() && name.find(settings.filter) == string::npos)
+		return;
+
+	for (int i = 0; i < settings.warmup; i++)
+		f();
+
+	// calls per sample: raised from 1 until a sample takes minSampleSeconds
+	int calls = 1;
+	double seconds;
+	for (;;){
+		int64 start = getTickCount();
+		for (int i = 0; i < calls; i++)
+			f();
+		seconds = (getTickCount() - start) / getTickFrequency();
+		if (seconds >= settings.minSampleSeconds || calls >= (1 << 20))
+			break;
+		calls *= seconds > 0. ? min(16, max(2, (int)ceil(settings.minSampleSeconds / seconds))) : 16;
+	}
+
+	vector<double> samples(max(1, settings.repetitions));
+	for (double &sample : samples){
+		int64 start = getTickCount();
+		for (int i = 0; i < calls; i++)
+			f();
+		sample = (getTickCount() - start) / getTickFrequency() * 1000. / calls;
+	}
+
+	BenchmarkResult result;
+	result.name = name;
+	result.input = input;
+	result.pixels = pixels;
+	result.repetitions = (int)samples.size();
+	result.callsPerSample = calls;
+
+	double sum = 0.;
+	for (double sample : samples)
+		sum += sample;
+	result.meanMs = sum / samples.size();
+	double squares = 0.;
+	for (double sample : samples)
+		squares += (sample - result.meanMs) * (sample - result.meanMs);
+	result.stddevMs = samples.size() > 1 ? sqrt(squares / (samples.size() - 1)) : 0.;
+
+	sort(samples.begin(), samples.end());
+	result.minMs = samples.front();
+	size_t middle = samples.size() / 2;
+	result.medianMs = samples.size() % 2 == 1 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2.;
+	measured.push_back(result);
+
+	cout << left << setw(44) << name << setw(36) << input << right << fixed << setprecision(3) << setw(11)
+		<< result.medianMs << " ms  (min " << result.minMs << ", sd " << result.stddevMs << ")";
+	if (pixels > 0)
+		cout << setprecision(1) << "  " << result.megapixelsPerSecond() << " MP/s";
+	cout << endl;
+}
+
+static string escape(const string &text){
+	string escaped;
+	for (char c : text){
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+bool Benchmark::writeJson(const string &filename, unsigned threads, const string &cpuTier) const{
+	ofstream out(filename);
+	if (!out.is_open())
+		return false;
+
+#ifdef _DEBUG
+	const char* build = "debug";
+#else
+	const char* build = "release";
+#endif
+	out << "{\"build\": \"" << build << "\", \"threads\": " << threads << ", \"cpu\": " << settings.cpu
+		<< ", \"cpu_tier\": \"" << cpuTier << "\", \"warmup\": " << settings.warmup << ", \"repetitions\": " << settings.repetitions
+		<< ", \"min_sample_s\": " << settings.minSampleSeconds << ",\n\"results\": [\n";
+	out << setprecision(6);
+	for (size_t i = 0; i < measured.size(); i++){
+		const BenchmarkResult &result = measured[i];
+		out << "{\"name\": \"" << escape(result.name) << "\", \"input\": \"" << escape(result.input)
+			<< "\", \"pixels\": " << result.pixels << ", \"repetitions\": " << result.repetitions
+			<< ", \"calls_per_sample\": " << result.callsPerSample << ", \"min_ms\": " << result.minMs
+			<< ", \"median_ms\": " << result.medianMs << ", \"mean_ms\": " << result.meanMs
+			<< ", \"stddev_ms\": " << result.stddevMs << ", \"megapixels_per_s\": " << result.megapixelsPerSecond()
+			<< "}" << (i + 1 < measured.size() ? "," : "") << "\n";
+	}
+	out << "]}\n";
+	return out.good();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool pinCurrentThread(int cpu){
+	if (cpu < 0)
+		return true;
+#ifdef _WIN32
+	if (cpu >= (int)(sizeof(DWORD_PTR) * 8))
+		return false;
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#else
+	if (cpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+// the value of "key" in a line written by writeJson, strings without their quotes and escapes
+static bool jsonField(const string &line, const string &key, string &value){
+	size_t position = line.find("\"" + key + "\": ");
+	if (position == string::npos)
+		return false;
+	position += key.size() + 4;
+
+	value.clear();
+	if (position < line.size() && line[position] == '"'){
+		for (position++; position < line.size() && line[position] != '"'; position++){
+			if (line[position] == '\\' && position + 1 < line.size())
+				position++;
+			value += line[position];
+		}
+		return position < line.size();
+	}
+	size_t end = line.find_first_of(",}", position);
+	value = line.substr(position, end == string::npos ? string::npos : end - position);
+	return !value.empty();
+}
+
+vector<BenchmarkResult> readBenchmarkJson(const string &filename){
+	vector<BenchmarkResult> results;
+	ifstream in(filename);
+	string line;
+	while (getline(in, line)){
+		BenchmarkResult result;
+		string pixels, repetitions, calls, minMs, medianMs, meanMs, stddevMs;
+		if (!jsonField(line, "name", result.name) || !jsonField(line, "input", result.input)
+			|| !jsonField(line, "median_ms", medianMs))
+			continue;
+		jsonField(line, "pixels", pixels);
+		jsonField(line, "repetitions", repetitions);
+		jsonField(line, "calls_per_sample", calls);
+		jsonField(line, "min_ms", minMs);
+		jsonField(line, "mean_ms", meanMs);
+		jsonField(line, "stddev_ms", stddevMs);
+		result.pixels = atoll(pixels.c_str());
+		result.repetitions = atoi(repetitions.c_str());
+		result.callsPerSample = atoi(calls.c_str());
+		result.minMs = atof(minMs.c_str());
+		result.medianMs = atof(medianMs.c_str());
+		result.meanMs = atof(meanMs.c_str());
+		result.stddevMs = atof(stddevMs.c_str());
+		results.push_back(result);
+	}
+	return results;
+}
+
+bool readBenchmarkConditions(const string &filename, BenchmarkConditions &conditions){
+	ifstream in(filename);
+	string line;
+	if (!getline(in, line))
+		return false;
+	string threads, cpu;
+	if (!jsonField(line, "build", conditions.build) || !jsonField(line, "cpu_tier", conditions.cpuTier)
+		|| !jsonField(line, "threads", threads) || !jsonField(line, "cpu", cpu))
+		return false;
+	conditions.threads = (unsigned)atoi(threads.c_str());
+	conditions.cpu = atoi(cpu.c_str());
+	return true;
+}
+
+string conditionDifferences(const BenchmarkConditions &baseline, const BenchmarkConditions &current, string &warnings){
+	ostringstream differences, notes;
+	if (baseline.build != current.build)
+		differences << "build: " << baseline.build << " -> " << current.build << "\n";
+	if (baseline.cpuTier != current.cpuTier)
+		differences << "cpu_tier: " << baseline.cpuTier << " -> " << current.cpuTier << "\n";
+	if (baseline.threads != current.threads)
+		differences << "threads: " << baseline.threads << " -> " << current.threads << "\n";
+	if (baseline.cpu != current.cpu)
+		notes << "cpu: " << baseline.cpu << " -> " << current.cpu << "\n";
+	warnings = notes.str();
+	return differences.str();
+}
+
+double BenchmarkComparison::change() const{
+	return baselineMs > 0. ? currentMs / baselineMs - 1. : 0.;
+}
+
+vector<BenchmarkComparison> compareBenchmarks(const vector<BenchmarkResult> &baseline, const vector<BenchmarkResult> &current){
+	vector<BenchmarkComparison> comparisons;
+	for (const BenchmarkResult &result : current){
+		for (const BenchmarkResult &reference : baseline){
+			if (reference.name == result.name && reference.input == result.input){
+				BenchmarkComparison comparison = { result.name, result.input, reference.medianMs, result.medianMs };
+				comparisons.push_back(comparison);
+				break;
+			}
+		}
+	}
+	return comparisons;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+// timing of single operations (micro) and whole step chains (macro) with reproducible conditions:
+// every case runs untimed warmup calls first (caches, page faults of the destinations, lazily built tables), then
+// repetitions samples; a sample repeats the call until it takes at least minSampleSeconds, so fast cases are not
+// measured at the resolution of the timer; the median of the samples is the result, compared against a baseline
+
+struct BenchmarkOptions{
+	int warmup;					// untimed calls before the samples
+	int repetitions;			// timed samples
+	double minSampleSeconds;
+	int cpu;					// the measuring thread runs on this logical processor only and the pool workers on the
+								// others, -1 to leave them to the system
+	std::string filter;			// only cases whose name contains it, empty for all
+};
+
+// 2 warmup calls, 11 samples of at least 10 ms, on CPU 0
+BenchmarkOptions createBenchmarkOptions();
+
+struct BenchmarkResult{
+	std::string name;			// operation and parameters, e.g. "gaussian:5:2"
+	std::string input;			// image and size, e.g. "lenna.jpg 512x512"
+	int64_t pixels;				// per call, 0 where it does not apply
+	int repetitions;
+	int callsPerSample;
+	double minMs, medianMs, meanMs, stddevMs;	// per call
+
+	// of the median, 0 without pixels
+	double megapixelsPerSecond() const;
+};
+
+class Benchmark{
+public:
+	explicit Benchmark(const BenchmarkOptions &options);
+
+	// times f unless the filter excludes name, prints the result line
+	void run(const std::string &name, const std::string &input, int64_t pixels, std::function<void()> f);
+
+	const BenchmarkOptions& options() const;
+	const std::vector<BenchmarkResult>& results() const;
+
+	// the options and one result object per line, readBenchmarkJson reads it back
+	bool writeJson(const std::string &filename, unsigned threads, const std::string &cpuTier) const;
+
+private:
+	BenchmarkOptions settings;
+	std::vector<BenchmarkResult> measured;
+};
+
+// pins the calling thread to a logical processor and raises its priority; false if the system refused
+bool pinCurrentThread(int cpu);
+
+// the results of a file written by Benchmark::writeJson, empty if it cannot be read
+std::vector<BenchmarkResult> readBenchmarkJson(const std::string &filename);
+
+// the conditions of a run, from the first line of its file
+struct BenchmarkConditions{
+	std::string build;			// "release" or "debug"
+	std::string cpuTier;		// of the image kernels
+	unsigned threads;			// of the pool
+	int cpu;					// of the measuring thread, -1 unpinned
+};
+
+// false if the file cannot be read or has no conditions line
+bool readBenchmarkConditions(const std::string &filename, BenchmarkConditions &conditions);
+
+// the differences that make the timings of two runs incomparable (build, kernels, pool threads), one per line, empty
+// if there are none; a different cpu only goes to warnings
+std::string conditionDifferences(const BenchmarkConditions &baseline, const BenchmarkConditions &current,
+	std::string &warnings);
+
+struct BenchmarkComparison{
+	std::string name, input;
+	double baselineMs, currentMs;	// medians
+
+	// relative change of the time, 0.1 = 10 % slower
+	double change() const;
+};
+
+// the cases in both lists, in the order of current
+std::vector<BenchmarkComparison> compareBenchmarks(const std::vector<BenchmarkResult> &baseline,
+	const std::vector<BenchmarkResult> &current);
@@ -0,0 +1,344 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <thread>
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\imgproc\imgproc.hpp>
+
+#include "..\Common\rawImage.h"
+#include "..\Common\threadPool.h"
+#include "..\Common\bufferPool.h"
+#include "..\Common\random.h"
+#include "..\Batch Runner\stages.h"
+#include "..\Batch Runner\kernels.h"
+#include "..\Batch Runner\planner.h"
+#include "..\4.1 Support Vector Machine\svmModel.h"
+#include "benchmark.h"
+
+using namespace std;
+using namespace cv;
+
+// the images of the exercises, relative to the project directory (the working directory in Visual Studio)
+static const char* referenceImages[] = {
+	"..\\1.1 Gray Scale Histograms\\src\\lenna.jpg",
+	"..\\1.2 Color Analysis\\src\\DSC_0078.jpg",
+	"..\\1.3 Interactive Color Histograms\\src\\IMG_6211.JPG",
+	"..\\2.2 Gradients\\src\\Testimage_gradients.jpg",
+};
+
+struct SyntheticSize{
+	const char* name;
+	int cols, rows;
+};
+
+static const SyntheticSize syntheticSizes[] = {
+	{ "VGA", 640, 480 },
+	{ "HD", 1920, 1080 },
+	{ "4K", 3840, 2160 },
+	{ "8K", 7680, 4320 },
+};
+
+// the same pixels for every run: smooth ramps (a spread histogram), blocks with sharp edges (gradients, HoG cells)
+// and noise (median), all from a fixed seed
+static Mat syntheticImage(int rows, int cols){
+	Xoshiro256 random(rows * 100003ull + cols);
+	Mat img(rows, cols, CV_8UC3);
+	for (int y = 0; y < rows; y++){
+		uchar* row = img.ptr<uchar>(y);
+		for (int x = 0; x < cols; x++){
+			const int block = ((x / 64) ^ (y / 48)) & 1 ? 48 : -48;
+			const int ramps[3] = { 255 * x / cols, 255 * y / rows, 255 * (x + y) / (cols + rows) };
+			for (int c = 0; c < 3; c++)
+				row[3 * x + c] = saturate_cast<uchar>(ramps[c] + block + (int)random.below(33) - 16);
+		}
+	}
+	return img;
+}
+
+static string sizeText(const Mat &img){
+	return to_string(img.cols) + "x" + to_string(img.rows);
+}
+
+// the operations of the exercises on one image; destinations are kept over the calls, so the steady state without
+// allocations is measured
+static void benchmarkImage(Benchmark &benchmark, const string &input, const Mat &color){
+	Mat gray;
+	cvtColor(color, gray, COLOR_BGR2GRAY);
+	const int64_t pixels = (int64_t)gray.total();
+
+	vector<int> histogram;
+	benchmark.run("calcHistogram:256", input, pixels, [&](){ calcHistogram(gray, 256, histogram); });
+	benchmark.run("calc3DHistogram:16", input, pixels, [&](){ calc3DHistogram(color, 16, histogram); });
+
+	Mat dst;
+	benchmark.run("enhanceContrast:0.05", input, pixels, [&](){ enhanceContrast(gray, dst, 0.05); });
+	benchmark.run("simulateLowRes:4", input, pixels, [&](){ simulateLowRes(gray, dst, 4); });
+
+	Mat boxKernel(3, 3, CV_64FC1, Scalar(1.));
+	benchmark.run("filter:3x3", input, pixels, [&](){ filter(gray, dst, boxKernel, true); });
+	benchmark.run("box:5", input, pixels, [&](){ box(gray, dst, 5, 5); });
+	benchmark.run("gaussian:5:2", input, pixels, [&](){ gaussian(gray, dst, 5, 5, 2.); });
+	FixedPointKernel fixedGaussian;
+	if (quantizeKernel(createGaussianKernel(5, 5, 2.), true, fixedGaussian))
+		benchmark.run("gaussian:5:2 fixed", input, pixels, [&](){ filter(gray, dst, fixedGaussian); });
+	// the same in 16 bit and float, without conversions
+	Mat gray16, grayFloat, dst16, dstFloat;
+	gray.convertTo(gray16, CV_16U, 257.);
+	gray.convertTo(grayFloat, CV_32F);
+	benchmark.run("gaussian:5:2 u16", input, pixels, [&](){ gaussian(gray16, dst16, 5, 5, 2.); });
+	benchmark.run("gaussian:5:2 f32", input, pixels, [&](){ gaussian(grayFloat, dstFloat, 5, 5, 2.); });
+	benchmark.run("median:3", input, pixels, [&](){ median(gray, dst, 3, 3); });
+	benchmark.run("median:5", input, pixels, [&](){ median(gray, dst, 5, 5); });
+	// the strategies the planner chooses from, each on its own
+	const int planned = filterPlanner().forcedStrategy();
+	for (int s = 0; s < STRATEGY_COUNT; s++){
+		filterPlanner().force(s);
+		const string strategy = string(" ") + filterStrategyName((FilterStrategy)s);
+		if (s != STRATEGY_HISTOGRAM)
+			benchmark.run("box:5" + strategy, input, pixels, [&](){ box(gray, dst, 5, 5); });
+		if (s != STRATEGY_RUNNING_SUM)
+			benchmark.run("median:5" + strategy, input, pixels, [&](){ median(gray, dst, 5, 5); });
+	}
+	filterPlanner().force(planned);
+
+	Mat X, Y, magnitude, gradients;
+	benchmark.run("sobelX+sobelY", input, pixels, [&](){ sobelX(gray, X); sobelY(gray, Y); });
+	sobelX(gray, X);
+	sobelY(gray, Y);
+	benchmark.run("calcMagnitude", input, pixels, [&](){ calcMagnitude(X, Y, magnitude); });
+	benchmark.run("calcGradients", input, pixels, [&](){ calcGradients(X, Y, gradients); });
+	calcMagnitude(X, Y, magnitude);
+	calcGradients(X, Y, gradients);
+	gradients = abs(gradients);
+
+	const int cellSize = 8;
+	const int dimValues[3] = { gray.rows / cellSize, gray.cols / cellSize, 9 };
+	const vector<int> dims(dimValues, dimValues + 3);
+	Mat HoG;
+	benchmark.run("compute_HoG:8", input, pixels, [&](){ compute_HoG(gradients, magnitude, cellSize, dims, HoG); });
+
+	// three cell sizes of one image: a gradient pass each, against one GradientField shared by all
+	static const int cellSizes[] = { 8, 16, 32 };
+	benchmark.run("HoG:8+16+32 per size", input, pixels, [&](){
+		for (int size : cellSizes){
+			const int sizeDims[3] = { gray.rows / size, gray.cols / size, 9 };
+			sobelX(gray, X);
+			sobelY(gray, Y);
+			calcMagnitude(X, Y, magnitude);
+			calcGradients(X, Y, gradients);
+			gradients = abs(gradients);
+			compute_HoG(gradients, magnitude, size, vector<int>(sizeDims, sizeDims + 3), HoG);
+		}
+	});
+	GradientField field;
+	benchmark.run("HoG:8+16+32 shared field", input, pixels, [&](){
+		computeGradientField(gray, field);
+		for (int size : cellSizes){
+			const int sizeDims[3] = { gray.rows / size, gray.cols / size, 9 };
+			compute_HoG(field, size, vector<int>(sizeDims, sizeDims + 3), HoG);
+		}
+	});
+
+	// whole step chains of the batch runner, temporaries from a pool as there
+	static const char* chains[] = { "contrast:0.05+gaussian:5:2+magnitude", "median:3+hog:8" };
+	for (const char* chain : chains){
+		vector<Stage> stages;
+		string error;
+		if (!parseStages(chain, stages, error)){
+			cout << error << endl;
+			continue;
+		}
+		BufferPool pool;
+		const Mat &img = stagesReadFlags(stages) == IMREAD_COLOR ? color : gray;
+		benchmark.run(string("steps ") + chain, input, pixels, [&](){ applyStages(stages, img, pool); });
+	}
+}
+
+// a two feature model like the ones of the exercise, with random support vectors in the unit square
+static SVMModel syntheticModel(int kernelType, int svCount){
+	Xoshiro256 random(svCount * 7919ull + kernelType);
+	SVMModel model;
+	model.kernelType = kernelType;
+	model.gamma = 8.;
+	model.coef0 = 0.;
+	model.degree = 3.;
+	model.rho = 0.1;
+	model.labels[0] = 1.f;
+	model.labels[1] = -1.f;
+	model.supportVectors.create(svCount, 2, CV_32FC1);
+	model.alpha.create(svCount, 1, CV_64FC1);
+	for (int i = 0; i < svCount; i++){
+		model.supportVectors.at<float>(i, 0) = (float)random.uniform();
+		model.supportVectors.at<float>(i, 1) = (float)random.uniform();
+		model.alpha.at<double>(i) = random.coin() ? random.uniform() : -random.uniform();
+	}
+	if (kernelType == CvSVM::LINEAR){
+		model.w = Mat::zeros(1, 2, CV_64FC1);
+		for (int i = 0; i < svCount; i++){
+			for (int d = 0; d < 2; d++)
+				model.w.at<double>(d) += model.alpha.at<double>(i) * model.supportVectors.at<float>(i, d);
+		}
+	}
+	return model;
+}
+
+static void benchmarkSVM(Benchmark &benchmark, ThreadPool &pool){
+	const int sampleCount = 100000;
+	Xoshiro256 random(42);
+	Mat samples(sampleCount, 2, CV_32FC1);
+	for (int i = 0; i < sampleCount; i++){
+		samples.at<float>(i, 0) = (float)random.uniform();
+		samples.at<float>(i, 1) = (float)random.uniform();
+	}
+	const SampleGrid grid = { 512, 512, 0., 0., 1. / 512, 1. / 512 };
+
+	const struct { int type; const char* name; } kernelTypes[] = { { CvSVM::LINEAR, "linear" }, { CvSVM::RBF, "rbf" } };
+	for (const auto &kernelType : kernelTypes){
+		const int svCount = 200;
+		SVMModel model = syntheticModel(kernelType.type, svCount);
+		const string input = to_string(svCount) + " support vectors";
+		Mat responses, buckets;
+		benchmark.run(string("predictBatch:") + kernelType.name, to_string(sampleCount) + " samples, " + input, sampleCount,
+			[&](){ predictBatch(model, samples, responses, pool); });
+		benchmark.run(string("predictGrid:") + kernelType.name, "512x512 grid, " + input, (int64_t)grid.rows * grid.cols,
+			[&](){ predictGrid(model, grid, responses, pool); });
+		benchmark.run(string("predictGridBuckets:") + kernelType.name, "512x512 grid, " + input, (int64_t)grid.rows * grid.cols,
+			[&](){ predictGridBuckets(model, grid, buckets, pool); });
+	}
+}
+
+int runBenchmarks(int argc, char* argv[]){
+	string resultFile = argc > 2 ? argv[2] : "benchmark.json";
+	BenchmarkOptions options = createBenchmarkOptions();
+	if (argc > 3 && string(argv[3]) != "-")
+		options.filter = argv[3];
+	if (argc > 4)
+		options.repetitions = max(1, atoi(argv[4]));
+	string largest = argc > 5 ? argv[5] : "8K";
+	if (argc > 6)
+		options.cpu = atoi(argv[6]);
+
+	// the operations split their loops over the shared pool; with a CPU its workers are pinned one per other logical
+	// processor, since the measuring thread runs the last range of every loop itself
+	if (options.cpu >= 0){
+		vector<int> workerCpus;
+		const int processors = (int)max(1u, thread::hardware_concurrency());
+		for (int cpu = 0; cpu < processors; cpu++){
+			if (cpu != options.cpu)
+				workerCpus.push_back(cpu);
+		}
+		if (workerCpus.empty())
+			workerCpus.push_back(options.cpu);
+		if (!createSharedThreadPool((unsigned)workerCpus.size(), workerCpus))
+			cout << "the pool threads were started before and are not pinned, timings may vary more" << endl;
+	}
+	ThreadPool &pool = sharedThreadPool();
+	if (!pinCurrentThread(options.cpu))
+		cout << "the thread could not be pinned to CPU " << options.cpu << ", timings may vary more" << endl;
+#ifdef _DEBUG
+	cout << "debug build: the timings are not comparable to release builds" << endl;
+#endif
+	cout << options.warmup << " warmup calls, " << options.repetitions << " samples of at least "
+		<< options.minSampleSeconds * 1000. << " ms, CPU " << options.cpu << ", " << pool.size() << " pool threads, "
+		<< cpuTierName(imageKernels().tier) << " kernels (CPU_TIER lowers them)" << endl;
+
+	Benchmark benchmark(options);
+	for (const char* filename : referenceImages){
+		Mat img = readImage(filename, IMREAD_COLOR);
+		if (!img.data){
+			cout << "image file " << filename << " could not be opened, skipped" << endl;
+			continue;
+		}
+		string name(filename);
+		name = name.substr(name.find_last_of("\\/") + 1);
+		benchmarkImage(benchmark, name + " " + sizeText(img), img);
+	}
+	for (const SyntheticSize &size : syntheticSizes){
+		Mat img = syntheticImage(size.rows, size.cols);
+		benchmarkImage(benchmark, string("synthetic ") + size.name + " " + sizeText(img), img);
+		if (largest == size.name)
+			break;
+	}
+	benchmarkSVM(benchmark, pool);
+
+	if (!benchmark.writeJson(resultFile, pool.size(), cpuTierName(imageKernels().tier))){
+		cout << "'" << resultFile << "' could not be written" << endl;
+		return -2;
+	}
+	cout << benchmark.results().size() << " results written to " << resultFile << endl;
+	return 0;
+}
+
+int runCompare(int argc, char* argv[]){
+	if (argc < 4){
+		cout << "usage: compare <baseline.json> <results.json> [threshold %] [force]" << endl;
+		return -1;
+	}
+	const double threshold = (argc > 4 ? atof(argv[4]) : 10.) / 100.;
+	const bool force = argc > 5 && string(argv[5]) == "force";
+	vector<BenchmarkResult> baseline = readBenchmarkJson(argv[2]);
+	vector<BenchmarkResult> current = readBenchmarkJson(argv[3]);
+	if (baseline.empty() || current.empty()){
+		cout << "no results in '" << (baseline.empty() ? argv[2] : argv[3]) << "'" << endl;
+		return -2;
+	}
+
+	// timings of another build, kernel tier or pool size are not comparable: refused unless forced
+	BenchmarkConditions baselineConditions, currentConditions;
+	if (!readBenchmarkConditions(argv[2], baselineConditions) || !readBenchmarkConditions(argv[3], currentConditions)){
+		cout << "the conditions of the runs could not be read, they may differ" << endl;
+	}
+	else{
+		string warnings;
+		const string differences = conditionDifferences(baselineConditions, currentConditions, warnings);
+		if (!warnings.empty())
+			cout << "the runs differ in\n" << warnings;
+		if (!differences.empty()){
+			cout << "the runs are not comparable, they differ in\n" << differences;
+			if (!force){
+				cout << "add 'force' to compare them anyway" << endl;
+				return -4;
+			}
+		}
+	}
+
+	vector<BenchmarkComparison> comparisons = compareBenchmarks(baseline, current);
+	int regressions = 0, improvements = 0;
+	for (const BenchmarkComparison &comparison : comparisons){
+		const double change = comparison.change();
+		const char* verdict = "";
+		if (change > threshold){
+			verdict = "  REGRESSION";
+			regressions++;
+		}
+		else if (change < -threshold){
+			verdict = "  faster";
+			improvements++;
+		}
+		cout << left << setw(44) << comparison.name << setw(36) << comparison.input << right << fixed << setprecision(3)
+			<< setw(11) << comparison.baselineMs << " -> " << setw(11) << comparison.currentMs << " ms "
+			<< showpos << setprecision(1) << setw(7) << change * 100. << noshowpos << "%" << verdict << endl;
+	}
+	cout << comparisons.size() << " cases compared (" << baseline.size() - comparisons.size() << " only in the baseline, "
+		<< current.size() - comparisons.size() << " only in the results), " << regressions << " slower and "
+		<< improvements << " faster by more than " << threshold * 100. << "%" << endl;
+	return regressions == 0 ? 0 : -3;
+}
+
+int main(int argc, char* argv[]){
+	if (argc > 1 && string(argv[1]) == "compare")
+		return runCompare(argc, argv);
+	if (argc > 1 && string(argv[1]) == "run")
+		return runBenchmarks(argc, argv);
+
+	if (argc > 1){
+		cout << "usage: run [results.json] [name filter|-] [samples] [largest synthetic size: VGA|HD|4K|8K] [cpu|-1]" << endl;
+		cout << "       compare <baseline.json> <results.json> [threshold %] [force]" << endl;
+		cout << "without arguments: run, results to benchmark.json" << endl;
+		return -1;
+	}
+	return runBenchmarks(argc, argv);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// blocking FIFO with a fixed capacity: push() waits while the queue is full, so a fast producer is held back by a
+// slow consumer instead of buffering without limit
+// close() ends the stream: pending items can still be popped, afterwards pop() returns false and push() is refused
+template <typename T>
+class BoundedQueue{
+public:
+	explicit BoundedQueue(size_t capacity) : maxSize(capacity > 0 ? capacity : 1), closed(false), highWater(0){}
+
+	// false if the queue was closed, the item is dropped then
+	bool push(T item){
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this]{ return closed || items.size() < maxSize; });
+		if (closed)
+			return false;
+
+		items.push_back(std::move(item));
+		if (items.size() > highWater)
+			highWater = items.size();
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// false once the queue is closed and empty
+	bool pop(T &item){
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+		if (items.empty())
+			return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	// false without waiting if the queue is empty
+	bool tryPop(T &item){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (items.empty())
+			return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void close(){
+		std::unique_lock<std::mutex> lock(mutex);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+	size_t size() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return items.size();
+	}
+
+	size_t capacity() const{
+		return maxSize;
+	}
+
+	// largest size the queue has reached
+	size_t maxDepth() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return highWater;
+	}
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	mutable std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	const size_t maxSize;
+	bool closed;
+	size_t highWater;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <mutex>
+
+#include <opencv2\core\core.hpp>
+
+// Mats that are handed out again instead of being allocated anew for every image
+// acquire() returns a buffer of the size and type that nobody else references; there is no explicit return, a buffer is
+// free again as soon as every header on it is released (the pool's own header keeps its reference count at 1)
+// the contents of an acquired buffer are undefined
+// every size and type seen gets buffers of its own; with a byte budget, an allocation that takes the pool above it first
+// frees buffers not in use, the least recently acquired first, so images of ever new sizes do not pile up buffers: the
+// pool holds at most the budget or the buffers in use, whichever is more (plus the new one)
+class BufferPool{
+public:
+	// byteBudget 0: no limit, buffers are only freed by trim()
+	explicit BufferPool(size_t byteBudget = 0) : budget(byteBudget), allocationCount(0), requestCount(0), allocatedBytes(0){}
+
+	cv::Mat acquire(int rows, int cols, int type){
+		std::unique_lock<std::mutex> lock(mutex);
+		requestCount++;
+
+		std::vector<Buffer> &buffers = pool[Key(rows, cols, type)];
+		for (Buffer &buffer : buffers){
+			if (*buffer.mat.refcount == 1){
+				buffer.lastUse = requestCount;
+				return buffer.mat;
+			}
+		}
+
+		const size_t bytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+		if (budget > 0 && allocatedBytes + bytes > budget)
+			release(allocatedBytes + bytes - budget);
+
+		Buffer buffer;
+		buffer.mat.create(rows, cols, type);
+		buffer.lastUse = requestCount;
+		std::vector<Buffer> &fresh = pool[Key(rows, cols, type)];
+		fresh.push_back(buffer);
+		allocationCount++;
+		allocatedBytes += bytes;
+		return fresh.back().mat;
+	}
+
+	cv::Mat acquire(cv::Size size, int type){
+		return acquire(size.height, size.width, type);
+	}
+
+	// frees the buffers that are not in use
+	void trim(){
+		std::unique_lock<std::mutex> lock(mutex);
+		release(allocatedBytes);
+	}
+
+	// buffers allocated since the start, constant once the pool has warmed up
+	uint64_t allocations() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return allocationCount;
+	}
+
+	uint64_t requests() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return requestCount;
+	}
+
+	// memory held by the pool, in use or not
+	size_t bytes() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return allocatedBytes;
+	}
+
+	size_t byteBudget() const{
+		return budget;
+	}
+
+private:
+	BufferPool(const BufferPool&);
+	BufferPool& operator=(const BufferPool&);
+
+	struct Key{
+		int rows, cols, type;
+
+		Key(int rows, int cols, int type) : rows(rows), cols(cols), type(type){}
+
+		bool operator<(const Key &other) const{
+			if (rows != other.rows)
+				return rows < other.rows;
+			if (cols != other.cols)
+				return cols < other.cols;
+			return type < other.type;
+		}
+	};
+
+	struct Buffer{
+		cv::Mat mat;
+		uint64_t lastUse;	// requestCount of the last acquire
+	};
+
+	// frees buffers not in use, least recently acquired first, until at least bytes are freed or none is left;
+	// the mutex is held
+	void release(size_t bytes){
+		size_t freed = 0;
+		while (freed < bytes){
+			std::vector<Buffer>* oldestBuffers = NULL;
+			size_t oldest = 0;
+			for (auto &entry : pool){
+				std::vector<Buffer> &buffers = entry.second;
+				for (size_t i = 0; i < buffers.size(); i++){
+					if (*buffers[i].mat.refcount == 1 && (oldestBuffers == NULL || buffers[i].lastUse < (*oldestBuffers)[oldest].lastUse)){
+						oldestBuffers = &buffers;
+						oldest = i;
+					}
+				}
+			}
+			if (oldestBuffers == NULL)
+				break;
+			const cv::Mat &mat = (*oldestBuffers)[oldest].mat;
+			freed += mat.total() * mat.elemSize();
+			oldestBuffers->erase(oldestBuffers->begin() + oldest);
+		}
+		allocatedBytes -= freed;
+		for (auto entry = pool.begin(); entry != pool.end();){
+			if (entry->second.empty())
+				entry = pool.erase(entry);
+			else
+				++entry;
+		}
+	}
+
+	const size_t budget;
+	mutable std::mutex mutex;
+	std::map<Key, std::vector<Buffer>> pool;
+	uint64_t allocationCount;
+	uint64_t requestCount;
+	size_t allocatedBytes;
+};
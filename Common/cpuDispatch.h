@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <atomic>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_DISPATCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// instruction set tiers of the vectorized kernels, chosen at run time, so one build runs on every machine
+// the tier is detected once (cpuid, and xgetbv for the register state the operating system saves), the environment
+// variable CPU_TIER (scalar, sse4.2, avx2, avx512) lowers it for testing; a tier above the detected one is ignored
+enum CpuTier{
+	CPU_TIER_SCALAR,
+	CPU_TIER_SSE42,		// SSSE3, SSE4.1 and SSE4.2
+	CPU_TIER_AVX2,
+	CPU_TIER_AVX512		// F and BW
+};
+
+// functions with intrinsics of a higher tier than the build targets: Visual Studio compiles them anywhere, gcc and
+// clang only inside functions marked for the instruction set
+#if defined(__GNUC__) && defined(CPU_DISPATCH_X86)
+#define CPU_TARGET_SSE42	__attribute__((target("sse4.2")))
+#define CPU_TARGET_AVX2		__attribute__((target("avx2")))
+#else
+#define CPU_TARGET_SSE42
+#define CPU_TARGET_AVX2
+#endif
+
+inline const char* cpuTierName(CpuTier tier){
+	switch (tier){
+	case CPU_TIER_SSE42:	return "sse4.2";
+	case CPU_TIER_AVX2:		return "avx2";
+	case CPU_TIER_AVX512:	return "avx512";
+	default:				return "scalar";
+	}
+}
+
+// false for unknown names
+inline bool parseCpuTier(const std::string &name, CpuTier &tier){
+	for (int t = CPU_TIER_SCALAR; t <= CPU_TIER_AVX512; t++){
+		if (name == cpuTierName((CpuTier)t)){
+			tier = (CpuTier)t;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef CPU_DISPATCH_X86
+// registers of cpuid leaf, subleaf: eax, ebx, ecx, edx
+inline void cpuid(unsigned leaf, unsigned subleaf, unsigned registers[4]){
+#ifdef _MSC_VER
+	int values[4];
+	__cpuidex(values, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; i++)
+		registers[i] = (unsigned)values[i];
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// the register state the operating system saves on context switches (XCR0)
+inline unsigned long long savedRegisterState(){
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+// the highest tier the processor and the operating system support
+inline CpuTier detectCpuTier(){
+#ifdef CPU_DISPATCH_X86
+	unsigned registers[4];
+	cpuid(0, 0, registers);
+	const unsigned maxLeaf = registers[0];
+	if (maxLeaf < 1)
+		return CPU_TIER_SCALAR;
+
+	cpuid(1, 0, registers);
+	const unsigned ecx1 = registers[2];
+	const bool ssse3 = (ecx1 >> 9 & 1) != 0;
+	const bool sse41 = (ecx1 >> 19 & 1) != 0;
+	const bool sse42 = (ecx1 >> 20 & 1) != 0;
+	if (!ssse3 || !sse41 || !sse42)
+		return CPU_TIER_SCALAR;
+
+	// AVX registers are only usable if the operating system saves them (OSXSAVE, XCR0 bits 1 and 2)
+	const bool osxsave = (ecx1 >> 27 & 1) != 0;
+	const bool avx = (ecx1 >> 28 & 1) != 0;
+	if (!osxsave || !avx || maxLeaf < 7)
+		return CPU_TIER_SSE42;
+	const unsigned long long state = savedRegisterState();
+	if ((state & 0x6) != 0x6)
+		return CPU_TIER_SSE42;
+
+	cpuid(7, 0, registers);
+	const unsigned ebx7 = registers[1];
+	if ((ebx7 >> 5 & 1) == 0)
+		return CPU_TIER_SSE42;
+
+	// AVX-512 F and BW, with the opmask and upper ZMM state (XCR0 bits 5 - 7)
+	const bool avx512 = (ebx7 >> 16 & 1) != 0 && (ebx7 >> 30 & 1) != 0;
+	if (avx512 && (state & 0xE6) == 0xE6)
+		return CPU_TIER_AVX512;
+	return CPU_TIER_AVX2;
+#else
+	return CPU_TIER_SCALAR;
+#endif
+}
+
+// the value of CPU_TIER, empty if it is not set
+inline std::string cpuTierOverride(){
+#ifdef _WIN32
+	char* value = NULL;
+	size_t length = 0;
+	std::string name;
+	if (_dupenv_s(&value, &length, "CPU_TIER") == 0 && value != NULL)
+		name = value;
+	free(value);
+	return name;
+#else
+	const char* value = getenv("CPU_TIER");
+	return value != NULL ? value : "";
+#endif
+}
+
+// the tier the kernels are bound to: the detected one, lowered by CPU_TIER; determined by the first call
+inline CpuTier activeCpuTier(){
+	// tier + 1, 0 until the first call: zero initialized like the instance of profileRegistry(), a constructor would
+	// not run thread safe in VS2013; the detection is cheap enough to run twice if two threads race
+	static std::atomic<int> active;
+	int tier = active.load(std::memory_order_acquire) - 1;
+	if (tier < 0){
+		tier = detectCpuTier();
+		CpuTier forced;
+		if (parseCpuTier(cpuTierOverride(), forced) && forced < tier)
+			tier = forced;
+		active.store(tier + 1, std::memory_order_release);
+	}
+	return (CpuTier)tier;
+}
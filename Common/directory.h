@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+// lower case file extension including the dot, "" if there is none
+inline std::string fileExtension(const std::string &filename){
+	size_t dot = filename.rfind('.');
+	if (dot == std::string::npos)
+		return "";
+
+	std::string extension = filename.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension;
+}
+
+inline bool isImageFile(const std::string &filename){
+	std::string extension = fileExtension(filename);
+	return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp"
+		|| extension == ".tif" || extension == ".tiff" || extension == ".pgm" || extension == ".ppm" || extension == ".rawimg";
+}
+
+// sorted file names (without directory) of the files in a directory that accept(name) takes, not recursive
+template <typename Filter>
+inline std::vector<std::string> listFiles(const std::string &directory, Filter accept){
+	std::vector<std::string> filenames;
+
+#ifdef _WIN32
+	_finddata_t fileInfo;
+	intptr_t handle = _findfirst((directory + "\\*").c_str(), &fileInfo);
+	if (handle != -1){
+		do{
+			if (!(fileInfo.attrib & _A_SUBDIR) && accept(std::string(fileInfo.name)))
+				filenames.push_back(fileInfo.name);
+		} while (_findnext(handle, &fileInfo) == 0);
+		_findclose(handle);
+	}
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir != NULL){
+		while (dirent* entry = readdir(dir)){
+			if (entry->d_type != DT_DIR && accept(std::string(entry->d_name)))
+				filenames.push_back(entry->d_name);
+		}
+		closedir(dir);
+	}
+#endif
+
+	std::sort(filenames.begin(), filenames.end());
+	return filenames;
+}
+
+// sorted file names (without directory) of all images in a directory, not recursive
+inline std::vector<std::string> listImages(const std::string &directory){
+	return listFiles(directory, isImageFile);
+}
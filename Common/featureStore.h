@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+
+#include "mappedFile.h"
+
+// binary feature store (.hogs)
+//
+// header (64 bytes), followed by one row per sample:
+//   float label, float features[dims], padding up to rowStride floats
+// rowStride is a multiple of 4 floats, so with the 64 byte header every row starts 16 byte aligned.
+// cellSize, binCount, cellRows and cellCols describe the HoG window the rows were extracted from,
+// they are 0 for features that are no HoG descriptors.
+
+struct FeatureStoreHeader{
+	char magic[4];			// "HOGS"
+	uint32_t version;
+	int32_t cellSize;
+	int32_t binCount;
+	int32_t cellRows;
+	int32_t cellCols;
+	int32_t dims;
+	int32_t rowStride;		// floats per row
+	uint64_t rows;
+	uint8_t reserved[24];
+};
+
+static_assert(sizeof(FeatureStoreHeader) == 64, "feature store header must be 64 bytes");
+
+const uint32_t FEATURE_STORE_VERSION = 1;
+
+inline FeatureStoreHeader createFeatureStoreHeader(int dims, int cellSize = 0, int binCount = 0, int cellRows = 0, int cellCols = 0){
+	FeatureStoreHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "HOGS", 4);
+	header.version = FEATURE_STORE_VERSION;
+	header.cellSize = cellSize;
+	header.binCount = binCount;
+	header.cellRows = cellRows;
+	header.cellCols = cellCols;
+	header.dims = dims;
+	header.rowStride = (1 + dims + 3) / 4 * 4;
+	header.rows = 0;
+	return header;
+}
+
+inline bool isValidFeatureStoreHeader(const FeatureStoreHeader &header){
+	return memcmp(header.magic, "HOGS", 4) == 0 && header.version == FEATURE_STORE_VERSION
+		&& header.dims > 0 && header.rowStride >= header.dims + 1 && header.rowStride % 4 == 0;
+}
+
+// appends rows to a new or existing store, append() may be called from several threads
+// open() writes the header of a new store before any row; flush() and close() patch the row count into it, so a store
+// that is not closed holds the rows up to the last flush
+// once a write fails (disk full, ...) the row is not counted and every later call fails, close() leaves the row count
+// of the last successful flush in the file
+class FeatureStoreWriter{
+public:
+	FeatureStoreWriter(){}
+
+	~FeatureStoreWriter(){
+		close();
+	}
+
+	// an existing file is continued if its layout matches, otherwise open() fails
+	bool open(const std::string &filename, const FeatureStoreHeader &layout){
+		close();
+		header = layout;
+
+		file.open(filename.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+		if (file.is_open()){
+			FeatureStoreHeader existing;
+			file.read((char*)&existing, sizeof(existing));
+			if (!file || !isValidFeatureStoreHeader(existing) || existing.dims != layout.dims || existing.rowStride != layout.rowStride
+				|| existing.cellSize != layout.cellSize || existing.binCount != layout.binCount){
+				file.close();
+				return false;
+			}
+			header = existing;
+			file.seekp(sizeof(FeatureStoreHeader) + header.rows * header.rowStride * sizeof(float), std::ios::beg);
+		}
+		else{
+			file.clear();
+			file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+			header.rows = 0;
+			file.write((const char*)&header, sizeof(header));
+			file.flush();
+		}
+
+		row.assign(header.rowStride, 0.f);
+		return (bool)file;
+	}
+
+	bool append(float label, const float* features){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!file.is_open() || !file)
+			return false;
+		row[0] = label;
+		memcpy(&row[1], features, header.dims * sizeof(float));
+		if (!file.write((const char*)&row[0], row.size() * sizeof(float)))
+			return false;
+		header.rows++;
+		return true;
+	}
+
+	// count rows that are already laid out as in the store: rowStride floats each, label first
+	bool appendRows(const float* rows, size_t count){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!file.is_open() || !file)
+			return false;
+		if (!file.write((const char*)rows, count * header.rowStride * sizeof(float)))
+			return false;
+		header.rows += count;
+		return true;
+	}
+
+	bool flush(){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!file.is_open() || !file)
+			return false;
+
+		std::streampos end = file.tellp();
+		file.seekp(0, std::ios::beg);
+		file.write((const char*)&header, sizeof(header));
+		file.seekp(end);
+		file.flush();
+		return (bool)file;
+	}
+
+	// false if any write failed
+	bool close(){
+		if (!file.is_open())
+			return true;
+		bool written = flush();
+		file.close();
+		return written && !file.fail();
+	}
+
+	uint64_t rows() const{
+		return header.rows;
+	}
+
+private:
+	FeatureStoreWriter(const FeatureStoreWriter&);
+	FeatureStoreWriter& operator=(const FeatureStoreWriter&);
+
+	std::fstream file;
+	FeatureStoreHeader header;
+	std::vector<float> row;
+	std::mutex mutex;
+};
+
+// zero-copy read access to a store, rows point directly into the memory mapped file
+class FeatureStore{
+public:
+	bool open(const std::string &filename){
+		if (!file.open(filename))
+			return false;
+
+		if (file.size() < sizeof(FeatureStoreHeader)){
+			file.close();
+			return false;
+		}
+		const FeatureStoreHeader* header = (const FeatureStoreHeader*)file.data();
+		if (!isValidFeatureStoreHeader(*header)
+			|| file.size() < sizeof(FeatureStoreHeader) + header->rows * header->rowStride * sizeof(float)){
+			file.close();
+			return false;
+		}
+		return true;
+	}
+
+	void close(){
+		file.close();
+	}
+
+	const FeatureStoreHeader& header() const{
+		return *(const FeatureStoreHeader*)file.data();
+	}
+
+	size_t rows() const{
+		return (size_t)header().rows;
+	}
+
+	int dims() const{
+		return header().dims;
+	}
+
+	float label(size_t i) const{
+		return rowData(i)[0];
+	}
+
+	const float* features(size_t i) const{
+		return rowData(i) + 1;
+	}
+
+private:
+	const float* rowData(size_t i) const{
+		return (const float*)(file.data() + sizeof(FeatureStoreHeader)) + i * header().rowStride;
+	}
+
+	MappedFile file;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\highgui\highgui.hpp>
+
+#include "boundedQueue.h"
+#include "rawImage.h"
+#include "profiler.h"
+
+enum ImageWriteMode{
+	WRITE_AS_NAMED,			// format of the file extension with the OpenCV defaults (JPEG quality 95, ...)
+	WRITE_PNG_FAST,			// .png with the lowest compression level, lossless and a lot faster than JPEG
+	WRITE_UNCOMPRESSED,		// binary .pgm / .ppm, no encoding at all; 8 and 16 bit unsigned images only
+	WRITE_RAW_IMAGE			// .rawimg (rawImage.h), no encoding, any Mat type, loaded by mapping the file
+};
+
+// the file name with the extension of the mode
+inline std::string imageWriteFilename(const std::string &filename, int channels, ImageWriteMode mode){
+	if (mode == WRITE_AS_NAMED)
+		return filename;
+
+	std::string base = filename.substr(0, filename.rfind('.'));
+	if (mode == WRITE_PNG_FAST)
+		return base + ".png";
+	if (mode == WRITE_RAW_IMAGE)
+		return base + ".rawimg";
+	return base + (channels == 1 ? ".pgm" : ".ppm");
+}
+
+// writes images on its own encoder threads: write() only queues the image and returns, encoding and disk access
+// overlap with the computation of the caller; a full queue blocks write() until an encoder is free again
+// flush() waits for everything queued so far, close() and the destructor write everything queued and stop the threads
+class ImageWriter{
+public:
+	explicit ImageWriter(unsigned threadCount = 2, size_t queueCapacity = 16)
+		: queue(queueCapacity), pending(0), writtenCount(0), failedCount(0), busyTicks(0), verbose(true){
+		for (unsigned i = 0; i < std::max(1u, threadCount); i++)
+			workers.push_back(std::thread(&ImageWriter::run, this));
+	}
+
+	~ImageWriter(){
+		close();
+	}
+
+	// img is encoded later and must not be changed by the caller any more, pass a clone() otherwise
+	// false if the writer is closed
+	bool write(const std::string &directory, const std::string &filename, const cv::Mat &img, ImageWriteMode mode = WRITE_AS_NAMED){
+		createDirectory(directory);
+
+		Job job;
+		job.filename = directory + "\\" + imageWriteFilename(filename, img.channels(), mode);
+		job.img = img;
+		job.mode = mode;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			pending++;
+		}
+		PROFILE_COUNT("writer queue", queue.size());
+		if (!queue.push(job)){
+			finished();
+			return false;
+		}
+		return true;
+	}
+
+	// blocks until every image queued so far is written
+	void flush(){
+		std::unique_lock<std::mutex> lock(mutex);
+		allWritten.wait(lock, [this]{ return pending == 0; });
+	}
+
+	// flushes and stops the encoder threads, later writes are refused
+	void close(){
+		queue.close();
+		for (std::thread &worker : workers){
+			if (worker.joinable())
+				worker.join();
+		}
+	}
+
+	// prints a line for every written file, like saveImg always did
+	void setVerbose(bool on){
+		verbose = on;
+	}
+
+	unsigned threads() const{
+		return (unsigned)workers.size();
+	}
+
+	uint64_t written() const{
+		return writtenCount;
+	}
+
+	uint64_t failed() const{
+		return failedCount;
+	}
+
+	// images queued or being encoded
+	size_t inFlight() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return pending;
+	}
+
+	size_t queueDepth() const{
+		return queue.size();
+	}
+
+	size_t maxQueueDepth() const{
+		return queue.maxDepth();
+	}
+
+	size_t queueCapacity() const{
+		return queue.capacity();
+	}
+
+	// encoding time summed over the threads
+	double busySeconds() const{
+		return busyTicks / cv::getTickFrequency();
+	}
+
+private:
+	ImageWriter(const ImageWriter&);
+	ImageWriter& operator=(const ImageWriter&);
+
+	struct Job{
+		std::string filename;
+		cv::Mat img;
+		ImageWriteMode mode;
+	};
+
+	// every directory is checked and created once instead of once per image
+	void createDirectory(const std::string &directory){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (directories.count(directory))
+			return;
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0777);
+#endif
+		directories.insert(directory);
+	}
+
+	void run(){
+		Job job;
+		while (queue.pop(job)){
+			std::vector<int> params;
+			if (job.mode == WRITE_PNG_FAST){
+				params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+				params.push_back(1);
+			}
+
+			int64 start = cv::getTickCount();
+			bool success;
+			try{
+				PROFILE_SCOPE_PIXELS("imwrite", job.img.total());
+				success = writeImage(job.filename, job.img, params);
+			}
+			catch (const cv::Exception&){
+				success = false;
+			}
+			busyTicks += cv::getTickCount() - start;
+
+			if (success)
+				writtenCount++;
+			else
+				failedCount++;
+			if (verbose || !success){
+				std::unique_lock<std::mutex> lock(mutex);
+				if (success)
+					std::cout << "successfully written '" << job.filename << "' to file!" << std::endl;
+				else
+					std::cout << "'" << job.filename << "' could not be written" << std::endl;
+			}
+
+			job.img.release();
+			finished();
+		}
+	}
+
+	void finished(){
+		std::unique_lock<std::mutex> lock(mutex);
+		if (--pending == 0)
+			allWritten.notify_all();
+	}
+
+	BoundedQueue<Job> queue;
+	std::vector<std::thread> workers;
+	mutable std::mutex mutex;
+	std::condition_variable allWritten;
+	std::set<std::string> directories;
+	size_t pending;
+	std::atomic<uint64_t> writtenCount;
+	std::atomic<uint64_t> failedCount;
+	std::atomic<int64_t> busyTicks;
+	std::atomic<bool> verbose;
+};
+
+// the writer behind saveImg of the exercises, created by the first call and never destroyed: a static destructor
+// that joins the encoder threads after main can hang in VS2013, so every program calls resultWriter().close() itself
+// before it returns or exits, which writes what is queued; images still queued at an exit without it are lost
+inline ImageWriter& resultWriter(){
+	static std::atomic<ImageWriter*> instance;
+	ImageWriter* writer = instance.load(std::memory_order_acquire);
+	if (writer == NULL){
+		ImageWriter* created = new ImageWriter();
+		if (instance.compare_exchange_strong(writer, created))
+			writer = created;
+		else
+			delete created;
+	}
+	return *writer;
+}
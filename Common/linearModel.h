@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+
+// plain linear model: score = w.x + b, positive scores belong to labels[1] (the larger label)
+//
+// file (.lsvm): char magic[4] "LSVM", uint32 version, int32 dims, float labels[2], double b, double w[dims]
+
+struct LinearWeights{
+	std::vector<double> w;
+	double b;
+	float labels[2];
+};
+
+const uint32_t LINEAR_MODEL_VERSION = 1;
+
+inline bool saveLinearWeights(const std::string &filename, const LinearWeights &model){
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	int32_t dims = (int32_t)model.w.size();
+	file.write("LSVM", 4);
+	file.write((const char*)&LINEAR_MODEL_VERSION, sizeof(LINEAR_MODEL_VERSION));
+	file.write((const char*)&dims, sizeof(dims));
+	file.write((const char*)model.labels, sizeof(model.labels));
+	file.write((const char*)&model.b, sizeof(model.b));
+	file.write((const char*)model.w.data(), dims * sizeof(double));
+	return (bool)file;
+}
+
+inline bool isLinearWeightsFile(const std::string &filename){
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	char magic[4];
+	return file.read(magic, 4) && memcmp(magic, "LSVM", 4) == 0;
+}
+
+inline bool loadLinearWeights(const std::string &filename, LinearWeights &model){
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	char magic[4];
+	uint32_t version;
+	int32_t dims;
+	file.read(magic, 4);
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&dims, sizeof(dims));
+	if (!file || memcmp(magic, "LSVM", 4) != 0 || version != LINEAR_MODEL_VERSION || dims <= 0)
+		return false;
+
+	model.w.resize(dims);
+	file.read((char*)model.labels, sizeof(model.labels));
+	file.read((char*)&model.b, sizeof(model.b));
+	file.read((char*)model.w.data(), dims * sizeof(double));
+	return (bool)file;
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include "featureStore.h"
+#include "linearModel.h"
+#include "threadPool.h"
+
+// averaged stochastic gradient descent for a linear SVM on a feature store:
+//   min lambda/2 |w|^2 + 1/n sum_i max(0, 1 - y_i (w.x_i + b)),  lambda = 1 / (C n)
+// which is the objective of a C-SVM divided by C n. y_i is +1 for the larger of the two labels.
+//
+// the store is streamed: chunks of consecutive rows are visited in random order and the rows of a chunk are shuffled,
+// so only about one chunk has to be resident at a time. every mini-batch is split over the pool, each task sums the
+// gradient of its rows into its own buffer and the buffers are reduced once per batch.
+
+struct LinearTrainerOptions{
+	double C;
+	int epochs;
+	int batchSize;
+	int chunkRows;				// rows of one chunk
+	int checkpointInterval;		// batches between two checkpoints, 0 for none
+	std::string checkpoint;		// .lsvm file the current model is written to
+	unsigned seed;
+};
+
+inline LinearTrainerOptions createLinearTrainerOptions(double C = 1., int epochs = 10){
+	LinearTrainerOptions options;
+	options.C = C;
+	options.epochs = epochs;
+	options.batchSize = 1024;
+	options.chunkRows = 65536;
+	options.checkpointInterval = 0;
+	options.seed = 0;
+	return options;
+}
+
+// after every epoch; hinge loss and errors are measured on the fly, with the weights of the moment
+struct LinearTrainerProgress{
+	int epoch;
+	double objective;
+	double errorRate;
+	double eta;
+};
+
+class LinearTrainer{
+public:
+	LinearTrainer(const FeatureStore &store, const LinearTrainerOptions &options, ThreadPool &pool)
+		: store(store), options(options), pool(pool), dims(store.dims()), checkpointFailures(0){}
+
+	// false if the store does not contain exactly two different labels
+	bool train(LinearWeights &model, std::function<void(const LinearTrainerProgress&)> onEpoch = nullptr){
+		const size_t n = store.rows();
+		if (!findLabels(model.labels))
+			return false;
+		checkpointFailures = 0;
+		positiveLabel = model.labels[1];
+
+		lambda = 1. / (options.C * n);
+		eta0 = calibrate();
+
+		w.assign(dims, 0.);
+		b = 0.;
+		wAverage.assign(dims, 0.);
+		bAverage = 0.;
+		averaged = 0;
+		samples = 0;
+
+		const size_t chunkRows = (size_t)std::max(1, options.chunkRows);
+		std::vector<size_t> chunks((n + chunkRows - 1) / chunkRows);
+		std::iota(chunks.begin(), chunks.end(), (size_t)0);
+		std::mt19937 rng(options.seed);
+		std::vector<size_t> rows;
+		size_t batches = 0;
+
+		for (int epoch = 0; epoch < options.epochs; epoch++){
+			// the plain weights of the first epoch are too far from the optimum to be worth averaging
+			const bool averaging = epoch > 0 || options.epochs == 1;
+			double hingeSum = 0.;
+			size_t errors = 0;
+
+			std::shuffle(chunks.begin(), chunks.end(), rng);
+			for (size_t chunk : chunks){
+				size_t first = chunk * chunkRows;
+				rows.resize(std::min(n, first + chunkRows) - first);
+				std::iota(rows.begin(), rows.end(), first);
+				std::shuffle(rows.begin(), rows.end(), rng);
+
+				for (size_t start = 0; start < rows.size(); start += options.batchSize){
+					size_t count = std::min(rows.size() - start, (size_t)options.batchSize);
+					step(&rows[start], count, hingeSum, errors);
+					if (averaging)
+						average();
+
+					batches++;
+					if (options.checkpointInterval > 0 && batches % options.checkpointInterval == 0 && !saveCheckpoint(model))
+						checkpointFailures++;
+				}
+			}
+
+			if (onEpoch){
+				LinearTrainerProgress progress;
+				progress.epoch = epoch;
+				progress.objective = 0.5 * lambda * squaredNorm(w) + hingeSum / n;
+				progress.errorRate = (double)errors / n;
+				progress.eta = eta();
+				onEpoch(progress);
+			}
+		}
+
+		result(model);
+		if (options.checkpointInterval > 0 && !saveCheckpoint(model))
+			checkpointFailures++;
+		return true;
+	}
+
+	// checkpoints of the last train() that could not be written or could not replace the previous one
+	size_t failedCheckpoints() const{
+		return checkpointFailures;
+	}
+
+private:
+	LinearTrainer(const LinearTrainer&);
+	LinearTrainer& operator=(const LinearTrainer&);
+
+	// the two labels of the store, smaller one first; false for fewer or more than two
+	bool findLabels(float labels[2]) const{
+		if (store.rows() == 0)
+			return false;
+
+		labels[0] = labels[1] = store.label(0);
+		for (size_t i = 1; i < store.rows(); i++){
+			const float label = store.label(i);
+			if (label == labels[0] || label == labels[1])
+				continue;
+			if (labels[0] != labels[1])
+				return false;
+			labels[1] = std::max(labels[0], label);
+			labels[0] = std::min(labels[0], label);
+		}
+		return labels[0] != labels[1];
+	}
+
+	double eta() const{
+		return eta0 / std::pow(1. + lambda * eta0 * samples, 0.75);
+	}
+
+	static double squaredNorm(const std::vector<double> &v){
+		double sum = 0.;
+		for (double x : v)
+			sum += x * x;
+		return sum;
+	}
+
+	double score(const std::vector<double> &weights, double bias, const float* x) const{
+		double value = bias;
+		for (int d = 0; d < dims; d++)
+			value += weights[d] * x[d];
+		return value;
+	}
+
+	// one mini-batch, the gradient of the hinge loss is accumulated in parallel
+	void step(const size_t* rows, size_t count, double &hingeSum, size_t &errors){
+		const size_t tasks = std::min((size_t)pool.size(), std::max((size_t)1, count / 64));
+		if (gradients.size() < tasks)
+			gradients.resize(tasks);
+
+		std::vector<double> biasGradients(tasks, 0.), hinges(tasks, 0.);
+		std::vector<size_t> taskErrors(tasks, 0);
+
+		TaskGroup group(pool);
+		for (size_t k = 0; k < tasks; k++){
+			size_t r0 = count * k / tasks;
+			size_t r1 = count * (k + 1) / tasks;
+			group.run([this, rows, r0, r1, k, &biasGradients, &hinges, &taskErrors](){
+				std::vector<double> &gradient = gradients[k];
+				gradient.assign(dims, 0.);
+				for (size_t r = r0; r < r1; r++){
+					const float* x = store.features(rows[r]);
+					double y = store.label(rows[r]) == positiveLabel ? 1. : -1.;
+					double margin = y * score(w, b, x);
+					if (margin <= 0.)
+						taskErrors[k]++;
+					if (margin < 1.){
+						hinges[k] += 1. - margin;
+						for (int d = 0; d < dims; d++)
+							gradient[d] += y * x[d];
+						biasGradients[k] += y;
+					}
+				}
+			});
+		}
+		group.wait();
+
+		const double rate = eta();
+		const double shrink = std::max(0., 1. - rate * lambda);
+		const double scale = rate / count;
+		for (int d = 0; d < dims; d++){
+			double sum = 0.;
+			for (size_t k = 0; k < tasks; k++)
+				sum += gradients[k][d];
+			w[d] = shrink * w[d] + scale * sum;
+		}
+		for (size_t k = 0; k < tasks; k++){
+			b += scale * biasGradients[k];
+			hingeSum += hinges[k];
+			errors += taskErrors[k];
+		}
+		samples += count;
+	}
+
+	void average(){
+		averaged++;
+		for (int d = 0; d < dims; d++)
+			wAverage[d] += (w[d] - wAverage[d]) / averaged;
+		bAverage += (b - bAverage) / averaged;
+	}
+
+	// averaged weights once averaging has started
+	void result(LinearWeights &model) const{
+		model.w = averaged > 0 ? wAverage : w;
+		model.b = averaged > 0 ? bAverage : b;
+	}
+
+	// written to a temporary file first, which then replaces the checkpoint in one step (MoveFileEx on Windows, where
+	// rename() fails for an existing target; rename() on POSIX), so an interrupted run always leaves a complete checkpoint
+	// false if the temporary file could not be written or could not replace the checkpoint, which is then unchanged
+	bool saveCheckpoint(LinearWeights &model) const{
+		result(model);
+		std::string temporary = options.checkpoint + ".tmp";
+		if (!saveLinearWeights(temporary, model)){
+			std::remove(temporary.c_str());
+			return false;
+		}
+#ifdef _WIN32
+		bool replaced = MoveFileExA(temporary.c_str(), options.checkpoint.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		bool replaced = std::rename(temporary.c_str(), options.checkpoint.c_str()) == 0;
+#endif
+		if (!replaced)
+			std::remove(temporary.c_str());
+		return replaced;
+	}
+
+	// initial learning rate: the one of a few candidates with the smallest objective after one pass over a sample
+	// of rows spread over the whole store (stores are often written one class after the other)
+	double calibrate() const{
+		const size_t sampleRows = std::min(store.rows(), (size_t)1000);
+		std::vector<size_t> sample(sampleRows);
+		for (size_t i = 0; i < sampleRows; i++)
+			sample[i] = i * store.rows() / sampleRows;
+		std::shuffle(sample.begin(), sample.end(), std::mt19937(options.seed));
+
+		double bestEta = 1., bestObjective = std::numeric_limits<double>::infinity();
+		for (double candidate = 10.; candidate >= 1e-6; candidate /= 4.){
+			std::vector<double> weights(dims, 0.);
+			double bias = 0.;
+			for (size_t i = 0; i < sampleRows; i++){
+				double rate = candidate / std::pow(1. + lambda * candidate * i, 0.75);
+				const float* x = store.features(sample[i]);
+				double y = store.label(sample[i]) == positiveLabel ? 1. : -1.;
+				double margin = y * score(weights, bias, x);
+				for (int d = 0; d < dims; d++)
+					weights[d] *= std::max(0., 1. - rate * lambda);
+				if (margin < 1.){
+					for (int d = 0; d < dims; d++)
+						weights[d] += rate * y * x[d];
+					bias += rate * y;
+				}
+			}
+
+			double objective = 0.5 * lambda * squaredNorm(weights);
+			for (size_t i : sample){
+				double y = store.label(i) == positiveLabel ? 1. : -1.;
+				objective += std::max(0., 1. - y * score(weights, bias, store.features(i))) / sampleRows;
+			}
+			if (objective < bestObjective){
+				bestObjective = objective;
+				bestEta = candidate;
+			}
+		}
+		return bestEta;
+	}
+
+	const FeatureStore &store;
+	LinearTrainerOptions options;
+	ThreadPool &pool;
+	const int dims;
+
+	float positiveLabel;
+	double lambda, eta0;
+	std::vector<double> w, wAverage;
+	double b, bAverage;
+	size_t averaged;
+	size_t samples;
+	size_t checkpointFailures;
+	std::vector<std::vector<double>> gradients;		// one per task of a batch
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// read-only memory mapping of a whole file, the pages are only loaded when they are touched
+class MappedFile{
+public:
+	MappedFile() : mapped(NULL), length(0), writable(false){
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		file = -1;
+#endif
+	}
+
+	~MappedFile(){
+		close();
+	}
+
+	// copyOnWrite maps private pages that can be written as well, a written page is copied and the file stays unchanged
+	bool open(const std::string &filename, bool copyOnWrite = false){
+		close();
+
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0){
+			close();
+			return false;
+		}
+		length = (size_t)fileSize.QuadPart;
+
+		mapping = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL){
+			close();
+			return false;
+		}
+		mapped = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+#else
+		file = ::open(filename.c_str(), O_RDONLY);
+		if (file == -1)
+			return false;
+
+		struct stat sb;
+		if (fstat(file, &sb) != 0 || sb.st_size == 0){
+			close();
+			return false;
+		}
+		length = (size_t)sb.st_size;
+
+		mapped = copyOnWrite ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0)
+			: mmap(NULL, length, PROT_READ, MAP_SHARED, file, 0);
+		if (mapped == MAP_FAILED)
+			mapped = NULL;
+#endif
+
+		if (mapped == NULL){
+			close();
+			return false;
+		}
+		writable = copyOnWrite;
+		return true;
+	}
+
+	void close(){
+#ifdef _WIN32
+		if (mapped != NULL)
+			UnmapViewOfFile(mapped);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (mapped != NULL)
+			munmap(mapped, length);
+		if (file != -1)
+			::close(file);
+		file = -1;
+#endif
+		mapped = NULL;
+		length = 0;
+		writable = false;
+	}
+
+	bool isOpen() const{
+		return mapped != NULL;
+	}
+
+	const unsigned char* data() const{
+		return (const unsigned char*)mapped;
+	}
+
+	// NULL unless opened copy-on-write
+	unsigned char* writableData() const{
+		return writable ? (unsigned char*)mapped : NULL;
+	}
+
+	size_t size() const{
+		return length;
+	}
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void* mapped;
+	size_t length;
+	bool writable;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+// scoped timers and counters for the hot paths, off unless ENABLE_PROFILING is defined; without it every PROFILE_ macro
+// expands to nothing and neither the arguments nor this code are compiled. The property sheets openCV.props and
+// openCV_debug.props define it for every project when MSBuild runs with /p:EnableProfiling=true, e.g. on the solution
+//	msbuild <solution>.sln /p:Configuration=Release /p:Platform=x64 /p:EnableProfiling=true
+// a single project gets it from ENABLE_PROFILING in its C/C++ preprocessor definitions
+//
+//	PROFILE_SCOPE("filter");						time from here to the end of the block
+//	PROFILE_SCOPE_PIXELS("filter", img.total());	the same, the summary reports pixels per second
+//	PROFILE_COUNT("queue", writer.queueDepth());	a sampled value, a counter track in the trace
+//	PROFILE_REPORT("results\\trace.json");			Chrome trace (chrome://tracing, ui.perfetto.dev) and summary to cout
+//
+// every thread records into its own ring buffer without locking; once a buffer is full the oldest events are
+// overwritten, so the report covers the last PROFILE_BUFFER_EVENTS events of each thread
+// PROFILE_REPORT reads all buffers and has to be called while no other thread records: after the thread pools are idle
+// and the image writers are closed (resultWriter().close() in the exercises), whose encoder threads record "imwrite"
+
+#ifdef ENABLE_PROFILING
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include <opencv2\core\core.hpp>
+
+#ifdef _MSC_VER
+#define PROFILE_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILE_THREAD_LOCAL __thread
+#endif
+
+#define PROFILE_BUFFER_EVENTS	(1 << 16)
+
+struct ProfileEvent{
+	const char* name;	// string literal, events are grouped by its content
+	int64_t start;		// ticks of cv::getTickCount
+	int64_t duration;	// ticks, -1 for counters
+	int64_t value;		// pixels of a scope, value of a counter
+};
+
+// written by its thread only, head is published after the event
+struct ProfileBuffer{
+	unsigned thread;
+	std::atomic<uint64_t> head;
+	ProfileEvent events[PROFILE_BUFFER_EVENTS];
+
+	explicit ProfileBuffer(unsigned thread) : thread(thread), head(0){}
+};
+
+class ProfileRegistry{
+public:
+	ProfileRegistry(){}
+
+	// the calling thread's buffer, registered on its first event
+	ProfileBuffer& buffer(){
+		static PROFILE_THREAD_LOCAL ProfileBuffer* threadBuffer = NULL;
+		if (threadBuffer == NULL){
+			std::unique_lock<std::mutex> lock(mutex);
+			buffers.push_back(std::unique_ptr<ProfileBuffer>(new ProfileBuffer((unsigned)buffers.size() + 1)));
+			threadBuffer = buffers.back().get();
+		}
+		return *threadBuffer;
+	}
+
+	void record(const char* name, int64_t start, int64_t duration, int64_t value){
+		ProfileBuffer &b = buffer();
+		uint64_t head = b.head.load(std::memory_order_relaxed);
+		ProfileEvent &event = b.events[head % PROFILE_BUFFER_EVENTS];
+		event.name = name;
+		event.start = start;
+		event.duration = duration;
+		event.value = value;
+		b.head.store(head + 1, std::memory_order_release);
+	}
+
+	void writeTrace(std::ostream &out){
+		// timestamps start at the first event
+		int64_t epoch = INT64_MAX;
+		forEach([&](unsigned, const ProfileEvent &event){
+			epoch = std::min(epoch, event.start);
+		});
+
+		const double usPerTick = 1e6 / cv::getTickFrequency();
+		out << "{\"traceEvents\":[" << std::endl;
+		bool first = true;
+		forEach([&](unsigned thread, const ProfileEvent &event){
+			out << (first ? "" : ",\n") << "{\"name\":\"" << escape(event.name) << "\",\"pid\":1,\"tid\":" << thread
+				<< std::fixed << std::setprecision(3) << ",\"ts\":" << (event.start - epoch) * usPerTick;
+			if (event.duration < 0)
+				out << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+			else
+				out << ",\"ph\":\"X\",\"dur\":" << event.duration * usPerTick << ",\"args\":{\"pixels\":" << event.value << "}}";
+			first = false;
+		});
+		out << std::endl << "]}" << std::endl;
+	}
+
+	// calls, total, median and 99th percentile per scope, pixels per second where pixels were given
+	void writeSummary(std::ostream &out){
+		struct Scope{
+			std::vector<int64_t> durations;
+			int64_t total, pixels;
+			Scope() : total(0), pixels(0){}
+		};
+		struct Counter{
+			uint64_t samples;
+			int64_t last, max;
+			Counter() : samples(0), last(0), max(0){}
+		};
+		std::map<std::string, Scope> scopes;
+		std::map<std::string, Counter> counters;
+		uint64_t lost = 0;
+
+		forEach([&](unsigned, const ProfileEvent &event){
+			if (event.duration < 0){
+				Counter &counter = counters[event.name];
+				counter.max = counter.samples == 0 ? event.value : std::max(counter.max, event.value);
+				counter.last = event.value;
+				counter.samples++;
+				return;
+			}
+			Scope &scope = scopes[event.name];
+			scope.durations.push_back(event.duration);
+			scope.total += event.duration;
+			scope.pixels += event.value;
+		});
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (auto &b : buffers)
+				lost += b->head.load(std::memory_order_acquire) - recorded(*b);
+		}
+
+		const double msPerTick = 1e3 / cv::getTickFrequency();
+		auto percentile = [](std::vector<int64_t> &values, double p){
+			size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+			std::nth_element(values.begin(), values.begin() + k, values.end());
+			return values[k];
+		};
+
+		out << std::left << std::setw(24) << "scope" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+			<< std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(12) << "Mpixels/s" << std::endl;
+		out << std::fixed;
+		for (auto &entry : scopes){
+			Scope &scope = entry.second;
+			out << std::left << std::setw(24) << entry.first << std::right << std::setw(10) << scope.durations.size()
+				<< std::setprecision(2) << std::setw(12) << scope.total * msPerTick
+				<< std::setprecision(3) << std::setw(10) << percentile(scope.durations, 0.5) * msPerTick
+				<< std::setw(10) << percentile(scope.durations, 0.99) * msPerTick;
+			if (scope.pixels > 0 && scope.total > 0)
+				out << std::setprecision(1) << std::setw(12) << scope.pixels / (scope.total * msPerTick * 1e3);
+			out << std::endl;
+		}
+		for (auto &entry : counters){
+			out << std::left << std::setw(24) << entry.first << std::right << std::setw(10) << entry.second.samples
+				<< "  last " << entry.second.last << ", max " << entry.second.max << std::endl;
+		}
+		if (lost > 0)
+			out << lost << " older events were overwritten and are not included" << std::endl;
+	}
+
+private:
+	ProfileRegistry(const ProfileRegistry&);
+	ProfileRegistry& operator=(const ProfileRegistry&);
+
+	static uint64_t recorded(const ProfileBuffer &b){
+		return std::min<uint64_t>(b.head.load(std::memory_order_acquire), PROFILE_BUFFER_EVENTS);
+	}
+
+	// the events still in the buffers, oldest first per thread
+	template<typename F>
+	void forEach(F f){
+		std::unique_lock<std::mutex> lock(mutex);
+		for (auto &b : buffers){
+			uint64_t head = b->head.load(std::memory_order_acquire);
+			for (uint64_t i = head - recorded(*b); i < head; i++)
+				f(b->thread, b->events[i % PROFILE_BUFFER_EVENTS]);
+		}
+	}
+
+	static std::string escape(const char* name){
+		std::string escaped;
+		for (const char* c = name; *c; c++){
+			if (*c == '"' || *c == '\\')
+				escaped += '\\';
+			escaped += *c;
+		}
+		return escaped;
+	}
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+};
+
+// created by the first event of any thread and never destroyed, so events recorded during shutdown are safe
+// the pointer has no constructor to run, unlike a static registry object (not thread safe in VS2013)
+inline ProfileRegistry& profileRegistry(){
+	static std::atomic<ProfileRegistry*> instance;
+	ProfileRegistry* registry = instance.load(std::memory_order_acquire);
+	if (registry == NULL){
+		ProfileRegistry* created = new ProfileRegistry();
+		if (instance.compare_exchange_strong(registry, created))
+			registry = created;
+		else
+			delete created;
+	}
+	return *registry;
+}
+
+class ProfileScope{
+public:
+	explicit ProfileScope(const char* name, int64_t pixels = 0) : name(name), pixels(pixels), start(cv::getTickCount()){}
+
+	~ProfileScope(){
+		profileRegistry().record(name, start, cv::getTickCount() - start, pixels);
+	}
+
+private:
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+
+	const char* name;
+	int64_t pixels;
+	int64_t start;
+};
+
+inline void profileReport(const std::string &traceFile){
+	std::ofstream trace(traceFile);
+	if (trace.is_open())
+		profileRegistry().writeTrace(trace);
+	else
+		std::cout << "trace file " << traceFile << " could not be opened" << std::endl;
+	profileRegistry().writeSummary(std::cout);
+}
+
+#define PROFILE_CONCAT_(a, b)	a##b
+#define PROFILE_CONCAT(a, b)	PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(name)					ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_SCOPE_PIXELS(name, pixels)	ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, (int64_t)(pixels))
+#define PROFILE_COUNT(name, value)			profileRegistry().record(name, cv::getTickCount(), -1, (int64_t)(value))
+#define PROFILE_REPORT(traceFile)			profileReport(traceFile)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_PIXELS(name, pixels)
+#define PROFILE_COUNT(name, value)
+#define PROFILE_REPORT(traceFile)
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+// xoshiro256** (Blackman, Vigna 2018): 256 bit state, period 2^256 - 1, a few ns per number
+// jump() advances the state by 2^128 numbers, so consecutive jumps give non-overlapping streams for parallel generation
+class Xoshiro256{
+public:
+	// the state is filled from the seed with splitmix64, as recommended by the authors
+	explicit Xoshiro256(uint64_t seed = 0){
+		for (int i = 0; i < 4; i++){
+			seed += 0x9e3779b97f4a7c15ull;
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			state[i] = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t operator()(){
+		const uint64_t result = rotl(state[1] * 5, 7) * 9;
+		const uint64_t t = state[1] << 17;
+
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+
+		return result;
+	}
+
+	// uniform in [0, n[ without modulo bias (Lemire 2019)
+	uint32_t below(uint32_t n){
+		uint64_t m = (uint64_t)(uint32_t)((*this)() >> 32) * n;
+		uint32_t low = (uint32_t)m;
+		if (low < n){
+			const uint32_t threshold = (0u - n) % n;
+			while (low < threshold){
+				m = (uint64_t)(uint32_t)((*this)() >> 32) * n;
+				low = (uint32_t)m;
+			}
+		}
+		return (uint32_t)(m >> 32);
+	}
+
+	// uniform in [0, 1[ with 53 random bits
+	double uniform(){
+		return ((*this)() >> 11) * (1. / 9007199254740992.);
+	}
+
+	bool coin(){
+		return ((*this)() >> 63) != 0;
+	}
+
+	void jump(){
+		static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+
+		uint64_t s[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 4; i++){
+			for (int b = 0; b < 64; b++){
+				if (JUMP[i] & (1ull << b)){
+					for (int k = 0; k < 4; k++)
+						s[k] ^= state[k];
+				}
+				(*this)();
+			}
+		}
+		for (int k = 0; k < 4; k++)
+			state[k] = s[k];
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k){
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t state[4];
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+
+#include <opencv2\core\core.hpp>
+#include <opencv2\highgui\highgui.hpp>
+#include <opencv2\imgproc\imgproc.hpp>
+
+#include "directory.h"
+#include "mappedFile.h"
+
+// raw image container (.rawimg), loaded by mapping the file instead of decoding it
+//
+// header (64 bytes), followed by one row after the other:
+//   the pixels of the row as in a cv::Mat of the stored type, padding up to stride bytes
+// dataOffset and stride are multiples of RAW_IMAGE_ALIGNMENT, so in the page aligned mapping every row starts 64 byte
+// aligned. Any Mat type can be stored: 8 bit images, CV_16SC1 derivatives, CV_64FC1 orientations, ...
+// Samples are in the byte order of the machine that wrote them (little endian on x86).
+
+struct RawImageHeader{
+	char magic[4];			// "RIMG"
+	uint32_t version;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;			// cv::Mat type, e.g. CV_8UC3
+	uint32_t elemSize;		// bytes per pixel, CV_ELEM_SIZE(type)
+	uint64_t stride;		// bytes per row
+	uint64_t dataOffset;	// of the first row from the start of the file
+	uint8_t reserved[24];
+};
+
+static_assert(sizeof(RawImageHeader) == 64, "raw image header must be 64 bytes");
+
+const uint32_t RAW_IMAGE_VERSION = 1;
+const size_t RAW_IMAGE_ALIGNMENT = 64;
+
+inline RawImageHeader createRawImageHeader(int rows, int cols, int type){
+	RawImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RIMG", 4);
+	header.version = RAW_IMAGE_VERSION;
+	header.rows = rows;
+	header.cols = cols;
+	header.type = type;
+	header.elemSize = (uint32_t)CV_ELEM_SIZE(type);
+	header.stride = ((uint64_t)cols * header.elemSize + RAW_IMAGE_ALIGNMENT - 1) / RAW_IMAGE_ALIGNMENT * RAW_IMAGE_ALIGNMENT;
+	header.dataOffset = (sizeof(RawImageHeader) + RAW_IMAGE_ALIGNMENT - 1) / RAW_IMAGE_ALIGNMENT * RAW_IMAGE_ALIGNMENT;
+	return header;
+}
+
+// fileSize: the rows have to be within the file
+inline bool isValidRawImageHeader(const RawImageHeader &header, size_t fileSize){
+	if (memcmp(header.magic, "RIMG", 4) != 0 || header.version != RAW_IMAGE_VERSION || header.rows <= 0 || header.cols <= 0)
+		return false;
+	if (CV_MAT_DEPTH(header.type) > CV_64F || header.elemSize != (uint32_t)CV_ELEM_SIZE(header.type))
+		return false;
+	// a Mat step is a multiple of the sample size
+	if (header.stride < (uint64_t)header.cols * header.elemSize || header.stride % CV_ELEM_SIZE1(header.type) != 0
+		|| header.dataOffset < sizeof(RawImageHeader) || header.dataOffset % RAW_IMAGE_ALIGNMENT != 0)
+		return false;
+	return header.dataOffset <= fileSize && (fileSize - header.dataOffset) / header.stride >= (uint64_t)header.rows;
+}
+
+inline bool isRawImageFile(const std::string &filename){
+	return fileExtension(filename) == ".rawimg";
+}
+
+inline bool writeRawImage(const std::string &filename, const cv::Mat &img){
+	if (!img.data || img.dims != 2)
+		return false;
+
+	std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	RawImageHeader header = createRawImageHeader(img.rows, img.cols, img.type());
+	file.write((const char*)&header, sizeof(header));
+	std::vector<char> padding((size_t)std::max<uint64_t>(header.dataOffset - sizeof(header), header.stride), 0);
+	file.write(&padding[0], (std::streamsize)(header.dataOffset - sizeof(header)));
+
+	const size_t rowBytes = (size_t)img.cols * header.elemSize;
+	for (int y = 0; y < img.rows; y++){
+		file.write((const char*)img.ptr(y), rowBytes);
+		file.write(&padding[0], (std::streamsize)(header.stride - rowBytes));
+	}
+	return (bool)file;
+}
+
+// owner of the mappings behind loaded raw images: a Mat on a mapping carries this allocator, and its last release
+// unmaps the file; if such a Mat is used as dst of a different size, the allocator is asked for ordinary memory, which
+// it lays out like Mat::create does
+class RawImageAllocator : public cv::MatAllocator{
+public:
+	RawImageAllocator(){}
+
+	cv::Mat wrap(std::unique_ptr<MappedFile> file, const RawImageHeader &header){
+		int* refcount = new int(1);
+		cv::Mat img(header.rows, header.cols, header.type, file->writableData() + header.dataOffset, (size_t)header.stride);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			mappings[refcount] = file.release();
+		}
+		img.refcount = refcount;
+		img.allocator = this;
+		return img;
+	}
+
+	void allocate(int dims, const int* sizes, int type, int*& refcount, uchar*& datastart, uchar*& data, size_t* step){
+		// continuous, the reference count behind the data
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--){
+			step[i] = total;
+			total *= sizes[i];
+		}
+		total = cv::alignSize(total, (int)sizeof(*refcount));
+		data = datastart = (uchar*)cv::fastMalloc(total + sizeof(*refcount));
+		refcount = (int*)(data + total);
+		*refcount = 1;
+	}
+
+	void deallocate(int* refcount, uchar* datastart, uchar*){
+		MappedFile* file = NULL;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			std::map<int*, MappedFile*>::iterator mapping = mappings.find(refcount);
+			if (mapping != mappings.end()){
+				file = mapping->second;
+				mappings.erase(mapping);
+			}
+		}
+		if (file != NULL){
+			delete file;
+			delete refcount;
+		}
+		else
+			cv::fastFree(datastart);
+	}
+
+	// files mapped by images that are still referenced
+	size_t mappedFiles() const{
+		std::unique_lock<std::mutex> lock(mutex);
+		return mappings.size();
+	}
+
+private:
+	RawImageAllocator(const RawImageAllocator&);
+	RawImageAllocator& operator=(const RawImageAllocator&);
+
+	mutable std::mutex mutex;
+	std::map<int*, MappedFile*> mappings;
+};
+
+// never destroyed, images may be released during static destruction; created like profileRegistry()
+inline RawImageAllocator& rawImageAllocator(){
+	static std::atomic<RawImageAllocator*> instance;
+	RawImageAllocator* allocator = instance.load(std::memory_order_acquire);
+	if (allocator == NULL){
+		RawImageAllocator* created = new RawImageAllocator();
+		if (instance.compare_exchange_strong(allocator, created))
+			allocator = created;
+		else
+			delete created;
+	}
+	return *allocator;
+}
+
+// the image on a copy-on-write mapping of the file: nothing is read or copied before the pixels are touched, and
+// writing to the image changes neither the file nor other images loaded from it; empty if it is no raw image
+inline cv::Mat loadRawImage(const std::string &filename){
+	std::unique_ptr<MappedFile> file(new MappedFile());
+	if (!file->open(filename, true) || file->size() < sizeof(RawImageHeader))
+		return cv::Mat();
+
+	RawImageHeader header;
+	memcpy(&header, file->data(), sizeof(header));
+	if (!isValidRawImageHeader(header, file->size()))
+		return cv::Mat();
+	return rawImageAllocator().wrap(std::move(file), header);
+}
+
+// imread that loads .rawimg as well; for them flags only convert 8 bit images between gray and color like imread,
+// other depths keep their type (imread would reduce them to 8 bit)
+inline cv::Mat readImage(const std::string &filename, int flags = cv::IMREAD_COLOR){
+	if (!isRawImageFile(filename))
+		return cv::imread(filename, flags);
+
+	cv::Mat img = loadRawImage(filename);
+	if (!img.data || flags < 0 || img.depth() != CV_8U)
+		return img;
+
+	int code = -1;
+	if (flags == cv::IMREAD_GRAYSCALE && (img.channels() == 3 || img.channels() == 4))
+		code = img.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY;
+	else if (flags != cv::IMREAD_GRAYSCALE && (img.channels() == 1 || img.channels() == 4))
+		code = img.channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR;
+	if (code < 0)
+		return img;
+
+	cv::Mat converted;
+	cv::cvtColor(img, converted, code);
+	return converted;
+}
+
+// imwrite that writes .rawimg as well
+inline bool writeImage(const std::string &filename, const cv::Mat &img, const std::vector<int> &params = std::vector<int>()){
+	if (isRawImageFile(filename))
+		return writeRawImage(filename, img);
+	return cv::imwrite(filename, img, params);
+}
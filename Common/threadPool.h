@@ -0,0 +1,367 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// work-stealing thread pool, used through TaskGroup and parallelFor: there is no wait for every task of the pool,
+// which would also count the task a nested loop runs in, a group waits for its own tasks only and may be waited for
+// anywhere, so parallel loops nest inside parallel tasks
+// every worker has its own deque: tasks submitted from a worker go to its own deque and are taken
+// newest first (cache friendly), idle workers steal the oldest tasks of the others; tasks submitted from outside are
+// dealt round robin; the destructor runs the tasks still queued before it joins the workers
+class ThreadPool{
+public:
+	struct WorkerStats{
+		unsigned long long tasks;	// run by the worker, nested ones included
+		unsigned long long steals;	// of those, taken from the deque of another worker
+		double busySeconds;			// running tasks since the pool was created
+		double utilization;			// busySeconds per second since the pool was created
+	};
+
+	// threadCount == 0 uses one thread per hardware thread; with cpus, worker i runs on logical processor
+	// cpus[i % cpus.size()] only
+	explicit ThreadPool(unsigned threadCount = 0, const std::vector<int> &cpus = std::vector<int>())
+		: queued(0), nextQueue(0), stopping(false), created(std::chrono::steady_clock::now()){
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		for (unsigned i = 0; i < threadCount; i++)
+			queues.push_back(std::unique_ptr<Queue>(new Queue()));
+		for (unsigned i = 0; i < threadCount; i++){
+			workers.push_back(std::thread(&ThreadPool::run, this, i));
+			if (!cpus.empty())
+				pin(workers.back(), cpus[i % cpus.size()]);
+		}
+	}
+
+	~ThreadPool(){
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		taskAvailable.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+
+	unsigned size() const{
+		return (unsigned)workers.size();
+	}
+
+	// index of the calling worker thread, -1 for threads that do not belong to this pool
+	int currentWorker() const{
+		std::thread::id id = std::this_thread::get_id();
+		for (size_t i = 0; i < workers.size(); i++){
+			if (workers[i].get_id() == id)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	// one entry per worker
+	std::vector<WorkerStats> workerStats() const{
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+		std::vector<WorkerStats> stats(queues.size());
+		for (size_t i = 0; i < queues.size(); i++){
+			stats[i].tasks = queues[i]->tasksRun.load();
+			stats[i].steals = queues[i]->steals.load();
+			stats[i].busySeconds = queues[i]->busyMicroseconds.load() * 1e-6;
+			stats[i].utilization = seconds > 0 ? stats[i].busySeconds / seconds : 0;
+		}
+		return stats;
+	}
+
+	// returns once counter is 0; a worker of this pool runs queued tasks meanwhile (its own newest first, then
+	// stolen ones), any other thread blocks; whoever brings counter to 0 calls notifyProgress()
+	void helpUntil(const std::atomic<unsigned> &counter){
+		int worker = currentWorker();
+		while (counter.load() > 0){
+			std::function<void()> task;
+			bool stolen;
+			if (worker >= 0 && take((unsigned)worker, task, stolen)){
+				execute((unsigned)worker, task, stolen);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this, &counter, worker]{ return counter.load() == 0 || (worker >= 0 && queued > 0); });
+		}
+	}
+
+	void notifyProgress(){
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+		}
+		taskAvailable.notify_all();
+	}
+
+private:
+	friend class TaskGroup;
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void submit(std::function<void()> task){
+		int worker = currentWorker();
+		{
+			// counted before it is visible, so a worker that takes it at once cannot bring the counter below the tasks
+			// really queued; the pool mutex is always locked before a queue mutex
+			std::unique_lock<std::mutex> lock(mutex);
+			unsigned index = worker >= 0 ? (unsigned)worker : nextQueue++ % (unsigned)queues.size();
+			queued++;
+			std::unique_lock<std::mutex> queueLock(queues[index]->mutex);
+			queues[index]->tasks.push_back(task);
+		}
+		taskAvailable.notify_one();
+	}
+
+	struct Queue{
+		Queue() : tasksRun(0), steals(0), busyMicroseconds(0), depth(0){}
+
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+		std::atomic<unsigned long long> tasksRun, steals;
+		std::atomic<long long> busyMicroseconds;
+		int depth;		// tasks running on the worker, > 1 while it helps inside one; only the worker touches it
+	};
+
+	static void pin(std::thread &thread, int cpu){
+		if (cpu < 0)
+			return;
+#ifdef _WIN32
+		if (cpu < (int)(sizeof(DWORD_PTR) * 8))
+			SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu);
+#else
+		if (cpu < CPU_SETSIZE){
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+		}
+#endif
+	}
+
+	// newest task of the own deque, otherwise the oldest task of another one
+	bool take(unsigned index, std::function<void()> &task, bool &stolen){
+		{
+			Queue &own = *queues[index];
+			std::unique_lock<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()){
+				task = own.tasks.back();
+				own.tasks.pop_back();
+				stolen = false;
+				return true;
+			}
+		}
+		for (size_t k = 1; k < queues.size(); k++){
+			Queue &victim = *queues[(index + k) % queues.size()];
+			std::unique_lock<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()){
+				task = victim.tasks.front();
+				victim.tasks.pop_front();
+				stolen = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// a task nested in another one (helpUntil) counts towards the tasks, its time is already in the outer one
+	void execute(unsigned index, std::function<void()> &task, bool stolen){
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued--;
+		}
+
+		Queue &own = *queues[index];
+		own.tasksRun++;
+		if (stolen)
+			own.steals++;
+		if (own.depth++ == 0){
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			task();
+			own.busyMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+		else
+			task();
+		own.depth--;
+	}
+
+	void run(unsigned index){
+		for (;;){
+			std::function<void()> task;
+			bool stolen;
+			if (take(index, task, stolen)){
+				execute(index, task, stolen);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this]{ return stopping || queued > 0; });
+			if (stopping && queued == 0)
+				return;
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	unsigned queued;	// in the deques, counted before the push and uncounted after the take
+	unsigned nextQueue;
+	bool stopping;
+	std::chrono::steady_clock::time_point created;
+};
+
+// tasks on a pool that are waited for together: wait() returns when the tasks of the group are done, not the others
+// of the pool; a worker waiting runs tasks meanwhile, so a task may start a group and wait for it without
+// blocking its thread; the first exception thrown by a task is rethrown by wait()
+class TaskGroup{
+public:
+	explicit TaskGroup(ThreadPool &pool) : pool(pool), pending(0){}
+
+	// waits without rethrowing
+	~TaskGroup(){
+		pool.helpUntil(pending);
+	}
+
+	void run(std::function<void()> task){
+		pending++;
+		ThreadPool* owner = &pool;
+		std::atomic<unsigned>* counter = &pending;
+		std::mutex* errorMutex = &failureMutex;
+		std::exception_ptr* error = &failure;
+		pool.submit([task, owner, counter, errorMutex, error](){
+			try{
+				task();
+			}
+			catch (...){
+				std::unique_lock<std::mutex> lock(*errorMutex);
+				if (!*error)
+					*error = std::current_exception();
+			}
+			// the group may be gone as soon as the counter is 0, only the pool is touched afterwards
+			if (--*counter == 0)
+				owner->notifyProgress();
+		});
+	}
+
+	void wait(){
+		pool.helpUntil(pending);
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lock(failureMutex);
+			std::swap(error, failure);
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	TaskGroup(const TaskGroup&);
+	TaskGroup& operator=(const TaskGroup&);
+
+	ThreadPool &pool;
+	std::atomic<unsigned> pending;
+	std::mutex failureMutex;
+	std::exception_ptr failure;
+};
+
+// body(rangeBegin, rangeEnd) for consecutive ranges of at most grain of [begin, end[, in parallel on pool; the
+// calling thread runs the last range itself, short loops run on it entirely
+inline void parallelFor(ThreadPool &pool, int begin, int end, int grain, const std::function<void(int, int)> &body){
+	if (end <= begin)
+		return;
+	grain = std::max(1, grain);
+	if (end - begin <= grain || pool.size() <= 1){
+		body(begin, end);
+		return;
+	}
+
+	TaskGroup group(pool);
+	int rangeBegin = begin;
+	for (; end - rangeBegin > grain; rangeBegin += grain){
+		int b = rangeBegin, e = rangeBegin + grain;
+		group.run([&body, b, e](){ body(b, e); });
+	}
+	body(rangeBegin, end);
+	group.wait();
+}
+
+// the pool the processing stages, the batch runner and the exercises share, so parallel loops nested in parallel
+// tasks use the same threads instead of oversubscribing the processor; created by the first call, never destroyed
+inline std::atomic<ThreadPool*>& sharedThreadPoolInstance(){
+	// zero initialized, a constructor would not run thread safe in VS2013
+	static std::atomic<ThreadPool*> instance;
+	return instance;
+}
+
+// creates the shared pool with these settings (see ThreadPool); false if it exists already, its settings stay
+inline bool createSharedThreadPool(unsigned threadCount, const std::vector<int> &cpus = std::vector<int>()){
+	if (sharedThreadPoolInstance().load() != NULL)
+		return false;
+	ThreadPool* created = new ThreadPool(threadCount, cpus);
+	ThreadPool* expected = NULL;
+	if (!sharedThreadPoolInstance().compare_exchange_strong(expected, created)){
+		delete created;
+		return false;
+	}
+	return true;
+}
+
+// one thread per hardware thread unless createSharedThreadPool() came first
+inline ThreadPool& sharedThreadPool(){
+	ThreadPool* pool = sharedThreadPoolInstance().load();
+	if (pool == NULL){
+		createSharedThreadPool(0);
+		pool = sharedThreadPoolInstance().load();
+	}
+	return *pool;
+}
+
+// logical processors like "0-3,8,10": false for anything else
+inline bool parseCpuList(const std::string &text, std::vector<int> &cpus){
+	std::vector<int> parsed;
+	size_t pos = 0;
+	while (pos < text.size()){
+		size_t comma = text.find(',', pos);
+		if (comma == std::string::npos)
+			comma = text.size();
+		std::string item = text.substr(pos, comma - pos);
+		size_t dash = item.find('-');
+		std::string first = item.substr(0, dash), last = dash == std::string::npos ? first : item.substr(dash + 1);
+		if (first.empty() || last.empty() || first.find_first_not_of("0123456789") != std::string::npos
+			|| last.find_first_not_of("0123456789") != std::string::npos)
+			return false;
+		int from = atoi(first.c_str()), to = atoi(last.c_str());
+		if (to < from)
+			return false;
+		for (int cpu = from; cpu <= to; cpu++)
+			parsed.push_back(cpu);
+		pos = comma + 1;
+	}
+	if (parsed.empty())
+		return false;
+	cpus.swap(parsed);
+	return true;
+}
@@ -0,0 +1,602 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <opencv2\core\core.hpp>
+
+#include "..\Common\bufferPool.h"
+#include "..\Common\rawImage.h"
+#include "..\Batch Runner\stages.h"
+#include "..\Batch Runner\kernels.h"
+#include "..\Batch Runner\planner.h"
+#include "..\Batch Runner\gradientCache.h"
+#include "..\Batch Runner\strips.h"
+#include "..\4.1 Support Vector Machine\modelSelection.h"
+#include "..\4.1 Support Vector Machine\svmModel.h"
+
+using namespace std;
+using namespace cv;
+
+// checks of the shared components that need no image files; the file format checks write and remove their own
+// tests_* files in the working directory; every check prints its name and PASS or FAIL, the exit code is the number of
+// failed checks
+
+static int failures = 0;
+
+static void check(const string &name, bool passed){
+	cout << (passed ? "PASS  " : "FAIL  ") << name << endl;
+	if (!passed)
+		failures++;
+}
+
+static bool samePixels(const Mat &a, const Mat &b){
+	if (a.size() != b.size() || a.type() != b.type())
+		return false;
+	for (int y = 0; y < a.rows; y++){
+		if (memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), a.cols * a.elemSize()) != 0)
+			return false;
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// BufferPool
+
+// images of ever new sizes: with a budget the pool frees idle buffers of the old sizes, without one it keeps them all
+static void testBufferPoolBudget(){
+	const size_t budget = (size_t)1 << 20;
+	BufferPool bounded(budget);
+	BufferPool unbounded;
+
+	size_t maxBytes = 0;
+	for (int i = 0; i < 200; i++){
+		Mat a = bounded.acquire(200 + i, 300 + i, CV_8UC1);
+		Mat b = unbounded.acquire(200 + i, 300 + i, CV_8UC1);
+		maxBytes = max(maxBytes, bounded.bytes());
+	}
+	check("BufferPool: held bytes stay within the budget for mixed sizes", maxBytes <= budget);
+	check("BufferPool: without a budget every size is kept", unbounded.bytes() > 10 * budget);
+
+	// a buffer in use is never freed nor handed out twice, however far the pool is over its budget
+	Mat held = bounded.acquire(800, 800, CV_8UC1);
+	held.setTo(Scalar(7));
+	bool distinct = true;
+	for (int i = 0; i < 20; i++){
+		Mat other = bounded.acquire(100 + i, 100, CV_8UC1);
+		other.setTo(Scalar(0));
+		distinct = distinct && other.data != held.data;
+	}
+	check("BufferPool: a held buffer is not handed out again", distinct);
+	check("BufferPool: a held buffer keeps its contents", countNonZero(held) == (int)held.total());
+
+	// the same size again reuses the buffer
+	uint64_t allocations = bounded.allocations();
+	{
+		Mat again = bounded.acquire(100, 100, CV_8UC1);
+	}
+	Mat again = bounded.acquire(100, 100, CV_8UC1);
+	check("BufferPool: a free buffer of the size is reused", bounded.allocations() <= allocations + 1);
+
+	bounded.trim();
+	check("BufferPool: trim frees everything not in use", bounded.bytes() == held.total() + again.total());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// raw images
+
+// a loaded raw image is a mapping owned by rawImageAllocator(): the pixels and type of the written image in 64 byte
+// aligned rows, copy on write, and unmapped by the release of the last Mat on it or its reuse as dst of another size
+static void testRawImage(){
+	const string filename = "tests_image.rawimg";
+	Mat img(37, 51, CV_16SC1);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			img.at<short>(y, x) = (short)(x * 613 - y * 997);
+	}
+	check("rawimg: the image is written", writeRawImage(filename, img));
+
+	RawImageAllocator &allocator = rawImageAllocator();
+	const size_t mapped = allocator.mappedFiles();
+	{
+		Mat loaded = loadRawImage(filename);
+		check("rawimg: the image is read back with its type and pixels", samePixels(loaded, img));
+		check("rawimg: the rows are 64 byte aligned", loaded.step % 64 == 0 && (size_t)loaded.data % 64 == 0);
+		check("rawimg: the image holds a mapping", loaded.allocator == &allocator && allocator.mappedFiles() == mapped + 1);
+
+		Mat shared = loaded;
+		loaded.setTo(Scalar(0));
+		check("rawimg: writing to the image leaves the file unchanged", samePixels(loadRawImage(filename), img));
+		loaded.release();
+		check("rawimg: the mapping stays while a Mat refers to it", allocator.mappedFiles() == mapped + 1);
+
+		// a dst of another size gets ordinary memory from the allocator
+		shared.create(10, 20, CV_8UC1);
+		shared.setTo(Scalar(1));
+		check("rawimg: reused as dst of another size, the image gives up its mapping",
+			allocator.mappedFiles() == mapped && shared.isContinuous() && countNonZero(shared) == 200);
+	}
+	check("rawimg: released images leave no mapping", allocator.mappedFiles() == mapped);
+
+	// a file shorter than its rows is no raw image
+	{
+		ifstream file(filename, ios::binary);
+		vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+		file.close();
+		ofstream truncated(filename, ios::binary | ios::trunc);
+		truncated.write(&data[0], data.size() / 2);
+	}
+	check("rawimg: a truncated file is rejected", loadRawImage(filename).empty());
+	remove(filename.c_str());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CPU dispatch
+
+static bool sameValues(const void* a, const void* b, size_t bytes){
+	return memcmp(a, b, bytes) == 0;
+}
+
+// every tier up to the active one (CPU_TIER lowers it) gives the results of the scalar kernels bit for bit; the
+// counts are no multiples of the vector widths, so the scalar tails run as well; AVX-512 binds the AVX2 variants
+static void testKernelTiers(){
+	check(string("kernels: the variants of ") + cpuTierName(activeCpuTier()) + " are bound",
+		imageKernels().tier == activeCpuTier());
+
+	const int cols = 1037;
+	mt19937 random(5);
+	uniform_int_distribution<int> byte(0, 255), coefficient(-300, 300), derivative(-32768, 32767);
+	uniform_real_distribution<double> tap(-1., 1.);
+
+	Mat src(7, cols, CV_8UC1);
+	for (int y = 0; y < src.rows; y++){
+		for (int x = 0; x < src.cols; x++)
+			src.at<uchar>(y, x) = (uchar)byte(random);
+	}
+	Mat bgr(1, cols, CV_8UC3);
+	for (int x = 0; x < 3 * cols; x++)
+		bgr.ptr<uchar>(0)[x] = (uchar)byte(random);
+	vector<double> taps(5 * 7);
+	vector<short> coefficients(5 * 7);
+	for (size_t i = 0; i < taps.size(); i++){
+		taps[i] = tap(random);
+		coefficients[i] = (short)coefficient(random);
+	}
+	vector<short> X(cols), Y(cols);
+	for (int x = 0; x < cols; x++){
+		X[x] = (short)derivative(random);
+		Y[x] = (short)derivative(random);
+	}
+	uchar table[256];
+	for (int v = 0; v < 256; v++)
+		table[v] = (uchar)byte(random);
+
+	const ImageKernels scalar = imageKernels(CPU_TIER_SCALAR);
+	for (int t = CPU_TIER_SSE42; t <= min((int)activeCpuTier(), (int)CPU_TIER_AVX2); t++){
+		const ImageKernels kernels = imageKernels((CpuTier)t);
+		const string name = string("kernels: ") + cpuTierName((CpuTier)t) + " ";
+
+		vector<int> countsA(256, 0), countsB(256, 0);
+		scalar.histogram(src.data, src.step, src.rows, src.cols, &countsA[0]);
+		kernels.histogram(src.data, src.step, src.rows, src.cols, &countsB[0]);
+		check(name + "histogram is the scalar one", countsA == countsB);
+
+		bool same = true;
+		for (int kernelRows = 1; kernelRows <= 5; kernelRows += 2){
+			for (int kernelCols = 1; kernelCols <= 7; kernelCols += 2){
+				const int count = cols - kernelCols + 1;
+				vector<double> a(count), b(count);
+				scalar.convolve(src.data, src.step, &taps[0], kernelRows, kernelCols, count, &a[0]);
+				kernels.convolve(src.data, src.step, &taps[0], kernelRows, kernelCols, count, &b[0]);
+				same = same && sameValues(&a[0], &b[0], count * sizeof(double));
+			}
+		}
+		check(name + "convolve is the scalar one bit for bit", same);
+
+		same = true;
+		for (int kernelRows = 1; kernelRows <= 5; kernelRows += 2){
+			for (int kernelCols = 1; kernelCols <= 7; kernelCols += 2){
+				const int count = cols - kernelCols + 1;
+				vector<int> a(count), b(count);
+				scalar.convolveFixed(src.data, src.step, &coefficients[0], kernelRows, kernelCols, count, &a[0]);
+				kernels.convolveFixed(src.data, src.step, &coefficients[0], kernelRows, kernelCols, count, &b[0]);
+				same = same && a == b;
+			}
+		}
+		check(name + "convolveFixed is the scalar one", same);
+
+		vector<short> magnitudeA(cols), magnitudeB(cols);
+		scalar.magnitude(&X[0], &Y[0], cols, &magnitudeA[0]);
+		kernels.magnitude(&X[0], &Y[0], cols, &magnitudeB[0]);
+		check(name + "magnitude is the scalar one", magnitudeA == magnitudeB);
+
+		vector<uchar> lumaA(cols), lumaB(cols);
+		scalar.luma(bgr.data, cols, &lumaA[0]);
+		kernels.luma(bgr.data, cols, &lumaB[0]);
+		check(name + "luma is the scalar one", lumaA == lumaB);
+
+		vector<uchar> lookupA(cols), lookupB(src.data, src.data + cols);
+		scalar.lookup(src.data, cols, table, &lookupA[0]);
+		kernels.lookup(&lookupB[0], cols, table, &lookupB[0]);
+		check(name + "lookup is the scalar one, also in place", lookupA == lookupB);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Batch Runner steps
+
+// every step takes the result of the one before, the gradient fields are found by the image a step receives
+static void testGradientChain(){
+	Mat img(240, 320, CV_8UC1);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			img.at<uchar>(y, x) = (uchar)((x * x + 3 * y * y + 7 * x * y) / 64);
+	}
+
+	vector<Stage> chain, gradientsOnly, hogOnly;
+	string error;
+	check("steps: 'gradients+hog' is parsed", parseStages("gradients+hog", chain, error));
+	check("steps: 'gradients' is parsed", parseStages("gradients", gradientsOnly, error));
+	check("steps: 'hog' is parsed", parseStages("hog", hogOnly, error));
+
+	BufferPool pool;
+	const uint64_t misses = gradientCache().misses();
+	Mat chained = applyStages(chain, img, pool).clone();
+	check("steps: 'gradients+hog' computes the fields of the image and of the arrows",
+		gradientCache().misses() == misses + 2);
+
+	// the hog of the arrows, as if the steps ran one after the other
+	Mat arrows = applyStages(gradientsOnly, img, pool).clone();
+	const uint64_t hits = gradientCache().hits();
+	Mat alone = applyStages(hogOnly, arrows, pool);
+	check("steps: the hog of 'gradients+hog' is that of the arrows", samePixels(chained, alone));
+	check("steps: the images of a chain again reuse their fields",
+		gradientCache().misses() == misses + 2 && gradientCache().hits() == hits + 1);
+}
+
+static Mat noiseImage(int rows, int cols, unsigned seed){
+	Mat img(rows, cols, CV_8UC1);
+	mt19937 random(seed);
+	uniform_int_distribution<int> byte(0, 255);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			img.at<uchar>(y, x) = (uchar)byte(random);
+	}
+	return img;
+}
+
+static int maxDifference(const Mat &a, const Mat &b){
+	int difference = 0;
+	for (int y = 0; y < a.rows; y++){
+		for (int x = 0; x < a.cols; x++)
+			difference = max(difference, abs((int)a.at<uchar>(y, x) - (int)b.at<uchar>(y, x)));
+	}
+	return difference;
+}
+
+// the fixed point filters stay within maxDeviation of the double arithmetic, on noise, where every rounding differs
+static void testFixedPointFilter(const string &name, const Mat &kernel){
+	Mat img = noiseImage(90, 110, 6);
+	FixedPointKernel fixed;
+	bool quantized = quantizeKernel(kernel, true, fixed);
+	check("fixed point: the " + name + " kernel fits int16", quantized);
+	if (!quantized)
+		return;
+
+	Mat exact = filter(img, kernel, true);
+	Mat result;
+	filter(img, result, fixed);
+	const int difference = maxDifference(result, exact);
+	check("fixed point: the " + name + " filter is within maxDeviation (" + to_string(fixed.maxDeviation)
+		+ ") of the double arithmetic, off by " + to_string(difference), difference <= fixed.maxDeviation);
+}
+
+// the Sobel kernels are integers, so their fixed point sums are the exact derivatives
+static void testFixedPointSobel(){
+	Mat img = noiseImage(90, 110, 7);
+	Mat X = sobelX(img), Y = sobelY(img);
+	Mat expectedX(img.size(), CV_16SC1, Scalar(0)), expectedY(img.size(), CV_16SC1, Scalar(0));
+	for (int y = 1; y < img.rows - 1; y++){
+		for (int x = 1; x < img.cols - 1; x++){
+			int dx = 0, dy = 0;
+			for (int k = -1; k <= 1; k++){
+				const int weight = k == 0 ? 2 : 1;
+				dx += weight * (img.at<uchar>(y + k, x + 1) - img.at<uchar>(y + k, x - 1));
+				dy += weight * (img.at<uchar>(y + 1, x + k) - img.at<uchar>(y - 1, x + k));
+			}
+			expectedX.at<short>(y, x) = (short)dx;
+			expectedY.at<short>(y, x) = (short)dy;
+		}
+	}
+	check("fixed point: sobelX gives the exact derivatives", samePixels(X, expectedX));
+	check("fixed point: sobelY gives the exact derivatives", samePixels(Y, expectedY));
+
+	const double taps[9] = { 1., 2., 1., 2., 4., 2., 1., 2., 1. };
+	FixedPointKernel fixed;
+	check("fixed point: an integer kernel keeps shift 0 and maxDeviation 0",
+		quantizeKernel(Mat(3, 3, CV_64FC1, (void*)taps), false, fixed) && fixed.shift == 0 && fixed.maxDeviation == 0);
+
+	// the step after "fixed" carries the bound of its kernel and keeps to it
+	vector<Stage> fixedSteps, doubleSteps;
+	string error;
+	check("fixed point: 'fixed+gaussian:5:2' is parsed", parseStages("fixed+gaussian:5:2", fixedSteps, error)
+		&& parseStages("gaussian:5:2", doubleSteps, error));
+	BufferPool pool;
+	Mat fixedResult = applyStages(fixedSteps, img, pool).clone();
+	Mat doubleResult = applyStages(doubleSteps, img, pool);
+	check("fixed point: the 'fixed+gaussian:5:2' step keeps to its maxDeviation",
+		!fixedSteps.empty() && fixedSteps[0].maxDeviation > 0
+		&& maxDifference(fixedResult, doubleResult) <= fixedSteps[0].maxDeviation);
+}
+
+// the planner only chooses between strategies with the same results: the running sums of a box filter and the
+// histogram median give the pixels of the direct loops, on noise and on runs of equal values
+static void testPlannerStrategies(){
+	Mat noise = noiseImage(70, 133, 8);
+	Mat steps(70, 133, CV_8UC1);
+	for (int y = 0; y < steps.rows; y++){
+		for (int x = 0; x < steps.cols; x++)
+			steps.at<uchar>(y, x) = (uchar)((x / 9 + y / 5) % 4 * 80);
+	}
+
+	FilterPlanner &planner = filterPlanner();
+	const int forced = planner.forcedStrategy();
+	bool sameBox = true, sameMedian = true;
+	for (const Mat &img : { noise, steps }){
+		const int sizes[][2] = { { 3, 3 }, { 5, 5 }, { 3, 7 }, { 9, 9 } };
+		for (const auto &size : sizes){
+			const Mat kernel(size[0], size[1], CV_64FC1, Scalar(2.));
+			planner.force(STRATEGY_DIRECT);
+			Mat direct = filter(img, kernel, true);
+			Mat directMedian = median(img, size[0], size[1]);
+			planner.force(STRATEGY_RUNNING_SUM);
+			sameBox = sameBox && samePixels(filter(img, kernel, true), direct);
+			planner.force(STRATEGY_HISTOGRAM);
+			sameMedian = sameMedian && samePixels(median(img, size[0], size[1]), directMedian);
+		}
+	}
+	check("planner: the running sums of box filters give the direct pixels", sameBox);
+	check("planner: the histogram median gives the direct pixels", sameMedian);
+
+	// unforced, the first request of a key times the candidates, the next one reuses the plan
+	planner.force(-1);
+	const size_t plans = planner.plans();
+	Mat planned = median(noise, 11, 11);
+	const size_t plansAfterFirst = planner.plans();
+	Mat replanned = median(noise, 11, 11);
+	check("planner: a new key is planned once", plansAfterFirst == plans + 1 && planner.plans() == plans + 1
+		&& samePixels(planned, replanned));
+	planner.force(forced);
+}
+
+// box:5+sobelx in double arithmetic throughout: the box mean unrounded with the input as border, the Sobel sum with a
+// border of 0, scaled to 8 bit by a fourth of its absolute maximum
+static Mat blurSobelReference(const Mat &img){
+	Mat blurred(img.size(), CV_64FC1);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++){
+			if (y < 2 || y >= img.rows - 2 || x < 2 || x >= img.cols - 2){
+				blurred.at<double>(y, x) = img.at<uchar>(y, x);
+				continue;
+			}
+			double sum = 0.;
+			for (int ky = -2; ky <= 2; ky++){
+				for (int kx = -2; kx <= 2; kx++)
+					sum += img.at<uchar>(y + ky, x + kx);
+			}
+			blurred.at<double>(y, x) = sum / 25.;
+		}
+	}
+
+	Mat derivative(img.size(), CV_64FC1, Scalar(0.));
+	double absMax = 1.;
+	for (int y = 1; y < img.rows - 1; y++){
+		for (int x = 1; x < img.cols - 1; x++){
+			double value = 0.;
+			for (int ky = -1; ky <= 1; ky++){
+				double weight = ky == 0 ? 2. : 1.;
+				value += weight * (blurred.at<double>(y + ky, x + 1) - blurred.at<double>(y + ky, x - 1));
+			}
+			derivative.at<double>(y, x) = value;
+			absMax = max(absMax, abs(value));
+		}
+	}
+
+	Mat reference(img.size(), CV_8UC1);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			reference.at<uchar>(y, x) = (uchar)min(255., abs(derivative.at<double>(y, x) / (absMax / 4) * 255.));
+	}
+	return reference;
+}
+
+// the blurred image reaches the Sobel step unrounded, so the chain is off the double arithmetic only where the float
+// sums fall on the other side of a gray level
+static void testFloatChain(){
+	Mat img(120, 160, CV_8UC1);
+	mt19937 random(2);
+	uniform_int_distribution<int> noise(0, 40);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			img.at<uchar>(y, x) = (uchar)(x + y / 2 + noise(random));
+	}
+
+	vector<Stage> chain;
+	string error;
+	check("steps: 'box:5+sobelx' is parsed", parseStages("box:5+sobelx", chain, error));
+
+	BufferPool pool;
+	Mat result = applyStages(chain, img, pool);
+	Mat reference = blurSobelReference(img);
+	double maxDiff = 0.;
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			maxDiff = max(maxDiff, abs((double)result.at<uchar>(y, x) - reference.at<uchar>(y, x)));
+	}
+	check("steps: 'box:5+sobelx' returns 8 bit", result.type() == CV_8UC1);
+	check("steps: 'box:5+sobelx' is within a gray level of the double arithmetic", maxDiff <= 1.);
+}
+
+// the steps run strip by strip with their halo give the rows of the whole image; the strips of 23 rows do not line up
+// with the image height nor the cells of hog
+static void testStrips(const string &spec){
+	Mat img(301, 97, CV_8UC1);
+	mt19937 random(4);
+	uniform_int_distribution<int> noise(0, 60);
+	for (int y = 0; y < img.rows; y++){
+		for (int x = 0; x < img.cols; x++)
+			img.at<uchar>(y, x) = (uchar)((x * y) / 128 + noise(random));
+	}
+	const string input = "tests_strips_in.pgm", output = "tests_strips_out.pgm";
+	StripWriter writer;
+	check("strips: the input is written", writer.open(input) && writer.write(img) && writer.close());
+
+	vector<Stage> stages;
+	string error;
+	check("strips: '" + spec + "' is parsed", parseStages(spec, stages, error));
+	StripStats stats;
+	bool ran = runStrips(input, output, stages, 23, stats, error);
+	check("strips: '" + spec + "' runs in strips", ran && stats.strips > 1);
+
+	BufferPool pool;
+	Mat whole = applyStages(stages, img, pool);
+	Mat result;
+	{
+		StripReader reader;
+		if (ran && reader.open(output))
+			reader.read(0, reader.rows(), result);
+	}
+	check("strips: '" + spec + "' gives the rows of the whole image", samePixels(result, whole));
+
+	remove(input.c_str());
+	remove(output.c_str());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SVM model selection
+
+// the grid search keeps its shared distance rows within half of its cache size, far less than the n^2 values of all
+// sample pairs, and finds the same parameters as with room for the whole matrix
+static void testGridSearchCache(){
+	// two classes 1.5 apart in both features, within +-0.5 of their centers: separable
+	const int n = 400;
+	Mat data(n, 2, CV_32FC1), labels(n, 1, CV_32FC1);
+	mt19937 random(1);
+	uniform_real_distribution<float> offset(-0.5f, 0.5f);
+	for (int i = 0; i < n; i++){
+		float label = (float)(i % 2);
+		data.at<float>(i, 0) = 1.5f * label + offset(random);
+		data.at<float>(i, 1) = -1.5f * label + offset(random);
+		labels.at<float>(i) = label;
+	}
+
+	ThreadPool pool(4);
+	const double rowSize = (double)n * sizeof(float) / (1 << 20);
+	const double fullSize = n * rowSize;
+	const double smallSize = fullSize / 20;
+	GridSearchResult full = gridSearchSVM(data, labels, false, 5, 1e-3, 100000, 4 * fullSize, pool, nullptr);
+	GridSearchResult small = gridSearchSVM(data, labels, false, 5, 1e-3, 100000, smallSize, pool, nullptr);
+
+	check("gridSearchSVM: with room for all rows every distance row is computed once", full.pairwiseRows == (size_t)n);
+	check("gridSearchSVM: the shared rows stay within half of a cache of a twentieth of n^2 values",
+		small.peakPairwiseSize <= max(smallSize / 2, rowSize));
+	check("gridSearchSVM: a small cache drops and recomputes rows", small.pairwiseRows > (size_t)n);
+	check("gridSearchSVM: a cache of a twentieth of n^2 values finds the same C and gamma",
+		small.C == full.C && small.gamma == full.gamma);
+	check("gridSearchSVM: a cache of a twentieth of n^2 values gives the same error", small.error == full.error);
+	check("gridSearchSVM: separable classes are separated", full.error == 0.);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SVM models
+
+static SVMModel createModel(int kernelType, int svCount, int varCount){
+	SVMModel model;
+	model.kernelType = kernelType;
+	model.gamma = 0.25;
+	model.coef0 = 1.;
+	model.degree = 3.;
+	model.rho = -0.375;
+	model.labels[0] = 2.f;
+	model.labels[1] = -1.f;
+	model.supportVectors.create(svCount, varCount, CV_32FC1);
+	model.alpha.create(svCount, 1, CV_64FC1);
+	mt19937 random(3);
+	uniform_real_distribution<float> value(-2.f, 2.f);
+	for (int i = 0; i < svCount; i++){
+		for (int d = 0; d < varCount; d++)
+			model.supportVectors.at<float>(i, d) = value(random);
+		model.alpha.at<double>(i) = (i % 2 ? -1. : 1.) * (0.5 + i);
+	}
+	return model;
+}
+
+// a model written as .svmb is read back with every field, its support vector rows padded to 16 bytes
+static void testBinaryModel(int kernelType, const string &kernelName){
+	const char* filename = "tests_model.svmb";
+	SVMModel saved = createModel(kernelType, 7, 5);
+	check("svmb: the " + kernelName + " model is written", saveSVMModelBinary(filename, saved));
+
+	SVMModel loaded;
+	bool read = loadSVMModel(filename, loaded);
+	check("svmb: the " + kernelName + " model is read back", read);
+	if (read){
+		check("svmb: the " + kernelName + " parameters are kept", loaded.kernelType == saved.kernelType
+			&& loaded.gamma == saved.gamma && loaded.coef0 == saved.coef0 && loaded.degree == saved.degree
+			&& loaded.rho == saved.rho && loaded.labels[0] == saved.labels[0] && loaded.labels[1] == saved.labels[1]);
+		check("svmb: the " + kernelName + " support vectors and alphas are kept",
+			samePixels(loaded.supportVectors, saved.supportVectors) && samePixels(loaded.alpha, saved.alpha));
+		check("svmb: the " + kernelName + " support vectors are mapped, 16 byte aligned rows", loaded.mapping
+			&& loaded.supportVectors.step % 16 == 0 && (size_t)loaded.supportVectors.data % 16 == 0);
+
+		const float sample[5] = { 0.5f, -1.f, 1.5f, 0.f, -0.25f };
+		if (kernelType == CvSVM::LINEAR){
+			double expected = -saved.rho;
+			for (int i = 0; i < saved.supportVectors.rows; i++){
+				for (int d = 0; d < 5; d++)
+					expected += saved.alpha.at<double>(i) * saved.supportVectors.at<float>(i, d) * sample[d];
+			}
+			check("svmb: the linear weights are summed on loading", !loaded.w.empty()
+				&& abs(decisionValue(loaded, sample) - expected) < 1e-9);
+		}
+		else{
+			double expected = -saved.rho;
+			for (int i = 0; i < saved.supportVectors.rows; i++)
+				expected += saved.alpha.at<double>(i) * kernel(saved, saved.supportVectors.ptr<float>(i), sample);
+			check("svmb: the " + kernelName + " decision values are kept", decisionValue(loaded, sample) == expected);
+		}
+	}
+
+	// the mapping is closed before the file is removed
+	loaded = SVMModel();
+	remove(filename);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]){
+	testBufferPoolBudget();
+	testRawImage();
+	testKernelTiers();
+	testGradientChain();
+	testFloatChain();
+	testFixedPointFilter("box:3", Mat(3, 3, CV_64FC1, Scalar(1.)));
+	testFixedPointFilter("box:5", Mat(5, 5, CV_64FC1, Scalar(1.)));
+	testFixedPointFilter("gaussian:5:2", createGaussianKernel(5, 5, 2.));
+	testFixedPointFilter("gaussian:7:1", createGaussianKernel(7, 7, 1.));
+	testFixedPointSobel();
+	testPlannerStrategies();
+	testStrips("box:3+gaussian:5:2+median:3");
+	testStrips("quantize:4+hog:8");
+	testGridSearchCache();
+	testBinaryModel(CvSVM::LINEAR, "linear");
+	testBinaryModel(CvSVM::RBF, "RBF");
+
+	cout << failures << " checks failed" << endl;
+	return failures;
+}